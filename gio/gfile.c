@@ -23,14 +23,29 @@
  */
 
 #include "config.h"
-#ifdef HAVE_SPLICE
+#if defined (HAVE_SPLICE) || defined (HAVE_COPY_FILE_RANGE)
 #define _GNU_SOURCE
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #endif
+#if defined (HAVE_SENDFILE) && defined (HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#define USE_SENDFILE 1
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#if defined (HAVE_COPY_FILE_RANGE) || defined (USE_SENDFILE) || defined (FICLONE)
+#define HAVE_FAST_COPY 1
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 #include <string.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #ifdef HAVE_PWD_H
 #include <pwd.h>
@@ -38,9 +53,11 @@
 #include "gfile.h"
 #include "gvfs.h"
 #include "gioscheduler.h"
+#include "gioschedulerprivate.h"
 #include "gsimpleasyncresult.h"
 #include "gfileattribute-priv.h"
 #include "gfiledescriptorbased.h"
+#include "glocalfile.h"
 #include "gpollfilemonitor.h"
 #include "gappinfo.h"
 #include "gfileinputstream.h"
@@ -1184,6 +1201,313 @@ g_file_query_info_finish (GFile         *file,
   return (* iface->query_info_finish) (file, res, error);
 }
 
+/* Results are handed to the chunk callback this many at a time */
+#define QUERY_INFO_CHUNK_SIZE 256
+
+typedef struct {
+  GFile **files;
+  guint n_files;
+  char *attributes;
+  GFileAttributeMatcher *matcher;
+  GFileQueryInfoFlags flags;
+  GFileQueryInfoChunkCallback chunk_callback;
+  gpointer chunk_data;
+  GMainContext *context;
+} QueryInfoMultipleData;
+
+typedef struct {
+  GSimpleAsyncResult *res;
+  GFile **files;
+  GFileInfo **infos;
+  GError **errors;
+  guint n_files;
+  gboolean last;
+} QueryInfoChunk;
+
+static void
+query_info_multiple_data_free (QueryInfoMultipleData *data)
+{
+  guint i;
+
+  for (i = 0; i < data->n_files; i++)
+    g_object_unref (data->files[i]);
+  g_free (data->files);
+  g_free (data->attributes);
+  g_file_attribute_matcher_unref (data->matcher);
+  if (data->context)
+    g_main_context_unref (data->context);
+  g_free (data);
+}
+
+static QueryInfoChunk *
+query_info_chunk_new (GSimpleAsyncResult *res,
+                      guint               size)
+{
+  QueryInfoChunk *chunk;
+
+  chunk = g_new0 (QueryInfoChunk, 1);
+  chunk->res = g_object_ref (res);
+  chunk->files = g_new0 (GFile *, size);
+  chunk->infos = g_new0 (GFileInfo *, size);
+  chunk->errors = g_new0 (GError *, size);
+
+  return chunk;
+}
+
+static void
+query_info_chunk_free (QueryInfoChunk *chunk)
+{
+  guint i;
+
+  for (i = 0; i < chunk->n_files; i++)
+    {
+      if (chunk->infos[i])
+        g_object_unref (chunk->infos[i]);
+      if (chunk->errors[i])
+        g_error_free (chunk->errors[i]);
+    }
+  g_free (chunk->files);
+  g_free (chunk->infos);
+  g_free (chunk->errors);
+  g_object_unref (chunk->res);
+  g_free (chunk);
+}
+
+static gboolean
+query_info_chunk_dispatch (gpointer user_data)
+{
+  QueryInfoChunk *chunk = user_data;
+  QueryInfoMultipleData *data;
+
+  data = g_simple_async_result_get_op_res_gpointer (chunk->res);
+
+  if (chunk->n_files > 0 && data->chunk_callback)
+    data->chunk_callback (chunk->files, chunk->infos, chunk->errors,
+                          chunk->n_files, data->chunk_data);
+
+  if (chunk->last)
+    g_simple_async_result_complete (chunk->res);
+
+  return FALSE;
+}
+
+static void
+query_info_chunk_send (QueryInfoMultipleData *data,
+                       QueryInfoChunk        *chunk)
+{
+  GSource *source;
+
+  source = g_idle_source_new ();
+  g_source_set_priority (source, G_PRIORITY_DEFAULT);
+  g_source_set_callback (source, query_info_chunk_dispatch, chunk,
+                         (GDestroyNotify) query_info_chunk_free);
+  g_source_attach (source, data->context);
+  g_source_unref (source);
+}
+
+typedef struct {
+  guint index;
+  char *dirname;
+} QueryInfoItem;
+
+static int
+query_info_item_compare (gconstpointer a,
+                         gconstpointer b)
+{
+  const QueryInfoItem *item_a = a;
+  const QueryInfoItem *item_b = b;
+
+  /* Non-local files sort first, in their original order */
+  if (item_a->dirname == NULL || item_b->dirname == NULL)
+    {
+      if (item_a->dirname != item_b->dirname)
+        return item_a->dirname == NULL ? -1 : 1;
+      return item_a->index < item_b->index ? -1 : item_a->index > item_b->index;
+    }
+
+  return strcmp (item_a->dirname, item_b->dirname);
+}
+
+static gboolean
+query_info_multiple_job (GIOSchedulerJob *job,
+                         GCancellable    *cancellable,
+                         gpointer         user_data)
+{
+  GSimpleAsyncResult *res = user_data;
+  QueryInfoMultipleData *data;
+  QueryInfoItem *items;
+  QueryInfoChunk *chunk;
+  GError *error = NULL;
+  guint i, j;
+
+  data = g_simple_async_result_get_op_res_gpointer (res);
+
+  /* Local files are grouped by directory, so that each directory is
+   * only looked up once and its files can be stat'ed relative to it.
+   */
+  items = g_new (QueryInfoItem, data->n_files);
+  for (i = 0; i < data->n_files; i++)
+    {
+      items[i].index = i;
+      items[i].dirname = NULL;
+      if (G_IS_LOCAL_FILE (data->files[i]))
+        {
+          char *path = g_file_get_path (data->files[i]);
+          items[i].dirname = g_path_get_dirname (path);
+          g_free (path);
+        }
+    }
+  qsort (items, data->n_files, sizeof (QueryInfoItem), query_info_item_compare);
+
+  for (i = 0; i < data->n_files; i = j)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+        break;
+
+      chunk = query_info_chunk_new (res, QUERY_INFO_CHUNK_SIZE);
+
+      if (items[i].dirname == NULL)
+        {
+          for (j = i; j < data->n_files && j - i < QUERY_INFO_CHUNK_SIZE &&
+                 items[j].dirname == NULL; j++)
+            {
+              GFile *file = data->files[items[j].index];
+
+              chunk->files[j - i] = file;
+              chunk->infos[j - i] = g_file_query_info (file, data->attributes,
+                                                       data->flags, cancellable,
+                                                       &chunk->errors[j - i]);
+            }
+        }
+      else
+        {
+          for (j = i; j < data->n_files && j - i < QUERY_INFO_CHUNK_SIZE &&
+                 strcmp (items[j].dirname, items[i].dirname) == 0; j++)
+            chunk->files[j - i] = data->files[items[j].index];
+
+          _g_local_file_query_info_in_dir (items[i].dirname,
+                                           chunk->files, j - i,
+                                           data->matcher, data->flags,
+                                           chunk->infos, chunk->errors);
+        }
+
+      chunk->n_files = j - i;
+      query_info_chunk_send (data, chunk);
+    }
+
+  for (i = 0; i < data->n_files; i++)
+    g_free (items[i].dirname);
+  g_free (items);
+
+  if (error)
+    g_simple_async_result_take_error (res, error);
+
+  chunk = query_info_chunk_new (res, 0);
+  chunk->last = TRUE;
+  query_info_chunk_send (data, chunk);
+
+  return FALSE;
+}
+
+/**
+ * g_file_query_info_multiple_async:
+ * @files: (array length=n_files): the files to query
+ * @n_files: the number of files in @files
+ * @attributes: an attribute query string.
+ * @flags: a set of #GFileQueryInfoFlags.
+ * @io_priority: the <link linkend="io-priority">I/O priority</link>
+ *     of the request.
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @chunk_callback: (allow-none): function to call with each chunk
+ *     of results
+ * @chunk_data: user data for @chunk_callback
+ * @callback: (scope async): a #GAsyncReadyCallback to call when all
+ *     the files have been queried
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Asynchronously gets the requested information about all of @files,
+ * like calling g_file_query_info_async() on each of them, but with
+ * much less overhead per file.
+ *
+ * @attributes is only parsed once, and local files in the same
+ * directory are queried together. The results are passed to
+ * @chunk_callback a few hundred at a time, in the thread-default main
+ * context of the caller. They do not come in the order of @files.
+ *
+ * When all the files have been queried, or the operation was cancelled,
+ * @callback is called. You can then call
+ * g_file_query_info_multiple_finish() to get the result of the
+ * operation.
+ *
+ * Since: 2.30
+ **/
+void
+g_file_query_info_multiple_async (GFile                       **files,
+                                  guint                         n_files,
+                                  const char                   *attributes,
+                                  GFileQueryInfoFlags           flags,
+                                  int                           io_priority,
+                                  GCancellable                 *cancellable,
+                                  GFileQueryInfoChunkCallback   chunk_callback,
+                                  gpointer                      chunk_data,
+                                  GAsyncReadyCallback           callback,
+                                  gpointer                      user_data)
+{
+  GSimpleAsyncResult *res;
+  QueryInfoMultipleData *data;
+  guint i;
+
+  g_return_if_fail (files != NULL || n_files == 0);
+  for (i = 0; i < n_files; i++)
+    g_return_if_fail (G_IS_FILE (files[i]));
+
+  data = g_new0 (QueryInfoMultipleData, 1);
+  data->files = g_new (GFile *, n_files);
+  for (i = 0; i < n_files; i++)
+    data->files[i] = g_object_ref (files[i]);
+  data->n_files = n_files;
+  data->attributes = g_strdup (attributes);
+  data->matcher = g_file_attribute_matcher_new (attributes);
+  data->flags = flags;
+  data->chunk_callback = chunk_callback;
+  data->chunk_data = chunk_data;
+  data->context = g_main_context_get_thread_default ();
+  if (data->context)
+    g_main_context_ref (data->context);
+
+  res = g_simple_async_result_new (NULL, callback, user_data,
+                                   g_file_query_info_multiple_async);
+  g_simple_async_result_set_op_res_gpointer (res, data,
+                                             (GDestroyNotify) query_info_multiple_data_free);
+
+  g_io_scheduler_push_job (query_info_multiple_job, res, g_object_unref,
+                           io_priority, cancellable);
+}
+
+/**
+ * g_file_query_info_multiple_finish:
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Finishes an operation started with g_file_query_info_multiple_async().
+ * Errors for individual files are passed to the chunk callback; this
+ * only fails if the operation was cancelled.
+ *
+ * Returns: %TRUE if all the files were queried, %FALSE on error
+ *
+ * Since: 2.30
+ **/
+gboolean
+g_file_query_info_multiple_finish (GAsyncResult  *res,
+                                   GError       **error)
+{
+  g_return_val_if_fail (g_simple_async_result_is_valid (res, NULL,
+                                                        g_file_query_info_multiple_async),
+                        FALSE);
+
+  return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
+}
+
 /**
  * g_file_query_filesystem_info:
  * @file: input #GFile.
@@ -2854,6 +3178,160 @@ splice_stream_with_progress (GInputStream           *in,
 }
 #endif
 
+#ifdef HAVE_FAST_COPY
+
+/* Chunks start small so that progress is reported early, and grow
+ * while the kernel keeps up, so that a large copy takes few syscalls
+ * but still checks for cancellation a few times per second.
+ */
+#define FAST_COPY_MIN_CHUNK (1024 * 1024)
+#define FAST_COPY_MAX_CHUNK (64 * 1024 * 1024)
+#define FAST_COPY_SLICE_USEC (G_USEC_PER_SEC / 10)
+
+/* Copies between two regular files without going through userspace:
+ * by sharing the extents (FICLONE), with copy_file_range() or with
+ * sendfile(), whichever the kernel and filesystems support.  Fails
+ * with %G_IO_ERROR_NOT_SUPPORTED, having copied nothing, if none of
+ * them applies.
+ */
+static gboolean
+fast_copy_with_progress (GInputStream           *in,
+                         GOutputStream          *out,
+                         GCancellable           *cancellable,
+                         GFileProgressCallback   progress_callback,
+                         gpointer                progress_callback_data,
+                         GError                **error)
+{
+  struct stat sbuf;
+  goffset total_size;
+  goffset offset;
+  gsize chunk;
+  int fd_in, fd_out;
+#ifdef HAVE_COPY_FILE_RANGE
+  gboolean use_copy_file_range = TRUE;
+#endif
+
+  fd_in = g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (in));
+  fd_out = g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (out));
+
+  /* Files in /proc and /sys claim to be empty, let the read loops
+   * handle them along with empty files.
+   */
+  if (fstat (fd_in, &sbuf) != 0 || !S_ISREG (sbuf.st_mode) || sbuf.st_size == 0)
+    goto not_supported;
+  total_size = sbuf.st_size;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
+#ifdef FICLONE
+  if (ioctl (fd_out, FICLONE, fd_in) == 0)
+    {
+      if (progress_callback)
+        progress_callback (total_size, total_size, progress_callback_data);
+      return TRUE;
+    }
+#endif
+
+  offset = 0;
+  chunk = FAST_COPY_MIN_CHUNK;
+  while (TRUE)
+    {
+      gint64 start;
+      gssize n;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      start = g_get_monotonic_time ();
+
+#ifdef HAVE_COPY_FILE_RANGE
+      if (use_copy_file_range)
+        {
+          loff_t off_in = offset, off_out = offset;
+
+          n = copy_file_range (fd_in, &off_in, fd_out, &off_out, chunk, 0);
+          /* Some filesystems claim support but copy nothing */
+          if (n == 0 && offset == 0)
+            {
+              use_copy_file_range = FALSE;
+              continue;
+            }
+        }
+      else
+#endif
+        {
+#ifdef USE_SENDFILE
+          /* Only used from the start, so the output file position,
+           * which sendfile() writes at, matches @offset.
+           */
+          off_t off_in = offset;
+
+          n = sendfile (fd_out, fd_in, &off_in, chunk);
+          if (n == 0 && offset == 0)
+            goto not_supported;
+#else
+          goto not_supported;
+#endif
+        }
+
+      if (n == -1)
+        {
+          int errsv = errno;
+
+          if (errsv == EINTR)
+            continue;
+
+          if (offset == 0 &&
+              (errsv == ENOSYS || errsv == EINVAL || errsv == EXDEV ||
+               errsv == EOPNOTSUPP || errsv == ENOTTY || errsv == EBADF ||
+               errsv == ESPIPE || errsv == EPERM))
+            {
+#ifdef HAVE_COPY_FILE_RANGE
+              if (use_copy_file_range)
+                {
+                  use_copy_file_range = FALSE;
+                  continue;
+                }
+#endif
+              goto not_supported;
+            }
+
+          g_set_error (error, G_IO_ERROR,
+                       g_io_error_from_errno (errsv),
+                       _("Error copying file: %s"),
+                       g_strerror (errsv));
+          return FALSE;
+        }
+
+      if (n == 0)
+        break;
+
+      offset += n;
+
+      if (progress_callback)
+        progress_callback (offset, total_size, progress_callback_data);
+
+      /* Grow the chunk while a call stays well inside the slice */
+      if (g_get_monotonic_time () - start < FAST_COPY_SLICE_USEC / 2)
+        chunk = MIN (chunk * 2, FAST_COPY_MAX_CHUNK);
+      else if (chunk > FAST_COPY_MIN_CHUNK)
+        chunk /= 2;
+    }
+
+  /* Make sure we send full copied size */
+  if (progress_callback)
+    progress_callback (offset, total_size, progress_callback_data);
+
+  return TRUE;
+
+ not_supported:
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       _("Fast copy not supported"));
+  return FALSE;
+}
+#endif
+
 static gboolean
 file_copy_fallback (GFile                  *source,
 		    GFile                  *destination,
@@ -2868,7 +3346,7 @@ file_copy_fallback (GFile                  *source,
   GFileInfo *info;
   const char *target;
   gboolean result;
-#ifdef HAVE_SPLICE
+#if defined (HAVE_SPLICE) || defined (HAVE_FAST_COPY)
   gboolean fallback = TRUE;
 #endif
 
@@ -2938,8 +3416,29 @@ file_copy_fallback (GFile                  *source,
       return FALSE;
     }
 
-#ifdef HAVE_SPLICE
+#ifdef HAVE_FAST_COPY
   if (G_IS_FILE_DESCRIPTOR_BASED (in) && G_IS_FILE_DESCRIPTOR_BASED (out))
+    {
+      GError *copy_err = NULL;
+
+      result = fast_copy_with_progress (in, out, cancellable,
+                                        progress_callback, progress_callback_data,
+                                        &copy_err);
+
+      if (result || !g_error_matches (copy_err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+        {
+          fallback = FALSE;
+          if (!result)
+            g_propagate_error (error, copy_err);
+        }
+      else
+        g_clear_error (&copy_err);
+    }
+#endif
+
+#ifdef HAVE_SPLICE
+  if (fallback &&
+      G_IS_FILE_DESCRIPTOR_BASED (in) && G_IS_FILE_DESCRIPTOR_BASED (out))
     {
       GError *splice_err = NULL;
 
@@ -2956,7 +3455,9 @@ file_copy_fallback (GFile                  *source,
       else
         g_clear_error (&splice_err);
     }
+#endif
 
+#if defined (HAVE_SPLICE) || defined (HAVE_FAST_COPY)
   if (fallback)
 #endif
     result = copy_stream_with_progress (in, out, source, cancellable,
@@ -3031,6 +3532,10 @@ file_copy_fallback (GFile                  *source,
  * If you are interested in copying the #GFile object itself (not the on-disk
  * file), see g_file_dup().
  *
+ * Where the operating system supports it, copies between local files
+ * share the data of @source (reflink) or are done by the kernel without
+ * going through userspace.
+ *
  * Returns: %TRUE on success, %FALSE otherwise.
  **/
 gboolean
@@ -3189,6 +3694,604 @@ g_file_copy_finish (GFile        *file,
   return (* iface->copy_finish) (file, res, error);
 }
 
+/* Recursive copies.
+ *
+ * The tree is walked by a pool of workers sharing one queue of items,
+ * a file to copy or a directory to create and list.  Children are
+ * queued at the head so the walk stays depth-first and the queue stays
+ * short.  A directory gets its attributes once all of its children
+ * are done, so that its permissions and times are not disturbed by
+ * the copy.
+ */
+
+#define COPY_TREE_DEFAULT_WORKERS 4
+#define COPY_TREE_MAX_WORKERS 64
+#define COPY_TREE_PROGRESS_INTERVAL 100 /* ms */
+
+typedef struct _CopyTreeDir CopyTreeDir;
+
+struct _CopyTreeDir {
+  GFile *source;
+  GFile *destination;
+  CopyTreeDir *parent;
+  /* Children not done yet, plus one while the directory is listed */
+  gint outstanding;
+};
+
+typedef struct {
+  GFile *source;
+  GFile *destination;
+  GFileType type;
+  goffset size;
+  CopyTreeDir *parent;
+} CopyTreeItem;
+
+typedef struct {
+  GSimpleAsyncResult *result;
+  GMainContext *context;
+  GFile *source;
+  GFile *destination;
+  GFileCopyFlags flags;
+  GFileCopyTreeFlags tree_flags;
+  GCancellable *cancellable;
+  GFileProgressCallback progress_callback;
+  gpointer progress_callback_data;
+  GSource *progress_source;
+
+  GMutex *lock;
+  GCond *cond;
+  GQueue queue;
+  /* Items queued or being worked on */
+  guint pending;
+  guint running_workers;
+  GError *error;
+  goffset bytes_copied;
+  goffset bytes_total;
+
+  guint max_workers;
+  GThreadPool *pool;
+} CopyTreeData;
+
+typedef struct {
+  CopyTreeData *data;
+  goffset last;
+} CopyTreeFileProgress;
+
+static void
+copy_tree_item_free (CopyTreeItem *item)
+{
+  g_object_unref (item->source);
+  g_object_unref (item->destination);
+  g_slice_free (CopyTreeItem, item);
+}
+
+static void
+copy_tree_data_free (CopyTreeData *data)
+{
+  g_assert (g_queue_is_empty (&data->queue));
+
+  g_object_unref (data->source);
+  g_object_unref (data->destination);
+  if (data->cancellable)
+    g_object_unref (data->cancellable);
+  if (data->context)
+    g_main_context_unref (data->context);
+  if (data->error)
+    g_error_free (data->error);
+  if (data->lock)
+    g_mutex_free (data->lock);
+  if (data->cond)
+    g_cond_free (data->cond);
+  g_free (data);
+}
+
+/* Called with the lock held */
+static void
+copy_tree_push (CopyTreeData *data,
+                GFile        *source,
+                GFile        *destination,
+                GFileType     type,
+                goffset       size,
+                CopyTreeDir  *parent)
+{
+  CopyTreeItem *item;
+
+  item = g_slice_new (CopyTreeItem);
+  item->source = g_object_ref (source);
+  item->destination = g_object_ref (destination);
+  item->type = type;
+  item->size = size;
+  item->parent = parent;
+  if (parent)
+    parent->outstanding++;
+
+  g_queue_push_head (&data->queue, item);
+  data->pending++;
+  g_cond_signal (data->cond);
+}
+
+/* Called with the lock held, keeps the first error */
+static void
+copy_tree_take_error (CopyTreeData *data,
+                      GError       *error)
+{
+  if (data->error == NULL)
+    data->error = error;
+  else
+    g_error_free (error);
+}
+
+static gboolean
+copy_tree_failed (CopyTreeData *data)
+{
+  gboolean failed;
+
+  g_mutex_lock (data->lock);
+  failed = data->error != NULL;
+  g_mutex_unlock (data->lock);
+
+  return failed || g_cancellable_is_cancelled (data->cancellable);
+}
+
+static void
+copy_tree_file_progress (goffset  current_num_bytes,
+                         goffset  total_num_bytes,
+                         gpointer user_data)
+{
+  CopyTreeFileProgress *progress = user_data;
+  CopyTreeData *data = progress->data;
+
+  g_mutex_lock (data->lock);
+  data->bytes_copied += current_num_bytes - progress->last;
+  g_mutex_unlock (data->lock);
+  progress->last = current_num_bytes;
+}
+
+/* Drops one child of @dir, finishing the directories that it
+ * completes.  Called with the lock held, which is released while the
+ * attributes are copied.
+ */
+static void
+copy_tree_dir_release (CopyTreeData *data,
+                       CopyTreeDir  *dir)
+{
+  while (dir && --dir->outstanding == 0)
+    {
+      CopyTreeDir *parent = dir->parent;
+
+      if (data->error == NULL)
+        {
+          g_mutex_unlock (data->lock);
+          /* Failure to copy metadata is not a hard error */
+          g_file_copy_attributes (dir->source, dir->destination,
+                                  data->flags | G_FILE_COPY_NOFOLLOW_SYMLINKS,
+                                  data->cancellable, NULL);
+          g_mutex_lock (data->lock);
+        }
+
+      g_object_unref (dir->source);
+      g_object_unref (dir->destination);
+      g_slice_free (CopyTreeDir, dir);
+      dir = parent;
+    }
+}
+
+static void
+copy_tree_copy_dir (CopyTreeData *data,
+                    CopyTreeItem *item)
+{
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+  CopyTreeDir *dir;
+  GError *error = NULL;
+
+  if (!g_file_make_directory (item->destination, data->cancellable, &error))
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS) ||
+          !(data->tree_flags & G_FILE_COPY_TREE_MERGE) ||
+          g_file_query_file_type (item->destination, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                  data->cancellable) != G_FILE_TYPE_DIRECTORY)
+        goto error;
+      g_clear_error (&error);
+    }
+
+  enumerator = g_file_enumerate_children (item->source,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                          G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                          G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          data->cancellable, &error);
+  if (enumerator == NULL)
+    goto error;
+
+  dir = g_slice_new (CopyTreeDir);
+  dir->source = g_object_ref (item->source);
+  dir->destination = g_object_ref (item->destination);
+  dir->parent = item->parent;
+  dir->outstanding = 1;
+
+  /* The directory stands in for @item in its parent until it is done */
+  g_mutex_lock (data->lock);
+  if (dir->parent)
+    dir->parent->outstanding++;
+  g_mutex_unlock (data->lock);
+
+  while ((info = g_file_enumerator_next_file (enumerator, data->cancellable, &error)) != NULL)
+    {
+      const char *name = g_file_info_get_name (info);
+      GFile *source, *destination;
+
+      source = g_file_get_child (item->source, name);
+      destination = g_file_get_child (item->destination, name);
+
+      g_mutex_lock (data->lock);
+      if (g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY)
+        data->bytes_total += g_file_info_get_size (info);
+      copy_tree_push (data, source, destination,
+                      g_file_info_get_file_type (info),
+                      g_file_info_get_size (info), dir);
+      g_mutex_unlock (data->lock);
+
+      g_object_unref (source);
+      g_object_unref (destination);
+      g_object_unref (info);
+
+      if (copy_tree_failed (data))
+        break;
+    }
+
+  g_file_enumerator_close (enumerator, NULL, NULL);
+  g_object_unref (enumerator);
+
+  g_mutex_lock (data->lock);
+  if (error)
+    copy_tree_take_error (data, error);
+  copy_tree_dir_release (data, dir);
+  g_mutex_unlock (data->lock);
+  return;
+
+ error:
+  g_mutex_lock (data->lock);
+  copy_tree_take_error (data, error);
+  g_mutex_unlock (data->lock);
+}
+
+static void
+copy_tree_copy_file (CopyTreeData *data,
+                     CopyTreeItem *item)
+{
+  CopyTreeFileProgress progress;
+  GFileCopyFlags flags;
+  GError *error = NULL;
+
+  flags = data->flags | G_FILE_COPY_NOFOLLOW_SYMLINKS;
+  if (data->tree_flags & G_FILE_COPY_TREE_SKIP_EXISTING)
+    flags &= ~G_FILE_COPY_OVERWRITE;
+
+  progress.data = data;
+  progress.last = 0;
+
+  if (!g_file_copy (item->source, item->destination, flags, data->cancellable,
+                    copy_tree_file_progress, &progress, &error))
+    {
+      if (!(data->tree_flags & G_FILE_COPY_TREE_SKIP_EXISTING) ||
+          !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS))
+        {
+          g_mutex_lock (data->lock);
+          copy_tree_take_error (data, error);
+          g_mutex_unlock (data->lock);
+          return;
+        }
+      g_clear_error (&error);
+    }
+
+  /* Symlinks and skipped files report no progress of their own, and
+   * the size may have changed since the directory was listed.
+   */
+  if (progress.last != item->size)
+    copy_tree_file_progress (item->size, item->size, &progress);
+}
+
+static void
+copy_tree_report_progress (CopyTreeData *data)
+{
+  goffset copied, total;
+
+  g_mutex_lock (data->lock);
+  copied = data->bytes_copied;
+  total = data->bytes_total;
+  g_mutex_unlock (data->lock);
+
+  data->progress_callback (copied, total, data->progress_callback_data);
+}
+
+static gboolean
+copy_tree_progress_cb (gpointer user_data)
+{
+  copy_tree_report_progress (user_data);
+
+  return TRUE;
+}
+
+static gboolean
+copy_tree_complete_cb (gpointer user_data)
+{
+  CopyTreeData *data = user_data;
+  GSimpleAsyncResult *result = data->result;
+
+  if (data->progress_source)
+    {
+      g_source_destroy (data->progress_source);
+      g_source_unref (data->progress_source);
+    }
+
+  if (data->error)
+    g_simple_async_result_take_error (result, data->error);
+  else
+    {
+      /* Make sure we send full copied size */
+      if (data->progress_callback)
+        copy_tree_report_progress (data);
+      g_simple_async_result_set_op_res_gboolean (result, TRUE);
+    }
+  data->error = NULL;
+
+  if (data->pool)
+    g_thread_pool_free (data->pool, FALSE, FALSE);
+  copy_tree_data_free (data);
+
+  g_simple_async_result_complete (result);
+  g_object_unref (result);
+
+  return FALSE;
+}
+
+/* Works through the queue until the whole tree is done */
+static gboolean
+copy_tree_worker (GIOSchedulerJob *job,
+                  GCancellable    *cancellable,
+                  gpointer         user_data)
+{
+  CopyTreeData *data = user_data;
+  gboolean last;
+
+  g_mutex_lock (data->lock);
+  while (TRUE)
+    {
+      CopyTreeItem *item;
+
+      while (g_queue_is_empty (&data->queue) && data->pending > 0)
+        g_cond_wait (data->cond, data->lock);
+
+      if (data->pending == 0)
+        break;
+
+      item = g_queue_pop_head (&data->queue);
+      g_mutex_unlock (data->lock);
+
+      /* After an error, the rest of the queue is only drained */
+      if (!copy_tree_failed (data))
+        {
+          if (item->type == G_FILE_TYPE_DIRECTORY)
+            copy_tree_copy_dir (data, item);
+          else
+            copy_tree_copy_file (data, item);
+        }
+
+      g_mutex_lock (data->lock);
+      if (data->error == NULL && g_cancellable_is_cancelled (data->cancellable))
+        g_cancellable_set_error_if_cancelled (data->cancellable, &data->error);
+      if (item->parent)
+        copy_tree_dir_release (data, item->parent);
+      copy_tree_item_free (item);
+      if (--data->pending == 0)
+        g_cond_broadcast (data->cond);
+    }
+  last = --data->running_workers == 0;
+  g_mutex_unlock (data->lock);
+
+  if (last)
+    {
+      GSource *source = g_idle_source_new ();
+
+      g_source_set_priority (source, G_PRIORITY_DEFAULT);
+      g_source_set_callback (source, copy_tree_complete_cb, data, NULL);
+      g_source_attach (source, data->context);
+      g_source_unref (source);
+    }
+
+  return FALSE;
+}
+
+static void
+copy_tree_pool_func (gpointer worker_data,
+                     gpointer user_data)
+{
+  copy_tree_worker (NULL, NULL, user_data);
+}
+
+/* Queries the root and starts the walk, in a scheduler job so that
+ * the caller is not blocked by the query.
+ */
+static gboolean
+copy_tree_start_job (GIOSchedulerJob *job,
+                     GCancellable    *cancellable,
+                     gpointer         user_data)
+{
+  CopyTreeData *data = user_data;
+  GFileInfo *info;
+  GError *error = NULL;
+  guint i;
+
+  /* The root follows symlinks unless asked not to */
+  info = g_file_query_info (data->source,
+                            G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            (data->flags & G_FILE_COPY_NOFOLLOW_SYMLINKS) ?
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS : 0,
+                            data->cancellable, &error);
+
+  g_mutex_lock (data->lock);
+  if (info)
+    {
+      GFileType type = g_file_info_get_file_type (info);
+
+      if (type != G_FILE_TYPE_DIRECTORY)
+        data->bytes_total = g_file_info_get_size (info);
+      copy_tree_push (data, data->source, data->destination, type,
+                      g_file_info_get_size (info), NULL);
+      g_object_unref (info);
+    }
+  else
+    copy_tree_take_error (data, error);
+  g_mutex_unlock (data->lock);
+
+  /* Without threads, or with nothing to copy, this job does the walk */
+  if (info == NULL || !g_thread_supported ())
+    {
+      data->running_workers = 1;
+      return copy_tree_worker (job, cancellable, data);
+    }
+
+  data->pool = g_thread_pool_new (copy_tree_pool_func, data,
+                                  data->max_workers, FALSE, NULL);
+  data->running_workers = data->max_workers;
+  for (i = 0; i < data->max_workers; i++)
+    g_thread_pool_push (data->pool, GUINT_TO_POINTER (i + 1), NULL);
+
+  return FALSE;
+}
+
+/**
+ * g_file_copy_tree_async:
+ * @source: input #GFile
+ * @destination: destination #GFile
+ * @flags: set of #GFileCopyFlags
+ * @tree_flags: set of #GFileCopyTreeFlags
+ * @max_workers: the number of files to copy concurrently, or 0 for a
+ *     default
+ * @io_priority: the <link linkend="io-priority">I/O priority</link>
+ *     of the request
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore
+ * @progress_callback: (allow-none): function to callback with progress
+ *     information
+ * @progress_callback_data: (closure): user data to pass to @progress_callback
+ * @callback: a #GAsyncReadyCallback to call when the request is satisfied
+ * @user_data: the data to pass to callback function
+ *
+ * Copies the file or directory tree @source to @destination
+ * asynchronously. Directories are created and the other files are
+ * copied with g_file_copy(), up to @max_workers of them at a time,
+ * which hides the latency of copying many small files. Symbolic links
+ * below @source are copied as links.
+ *
+ * @flags apply to every file. With %G_FILE_COPY_ALL_METADATA, the
+ * directories get the metadata of their source as well, once their
+ * contents have been copied. @tree_flags decide what happens to the
+ * directories and files that already exist at @destination.
+ *
+ * If @progress_callback is not %NULL, it is called in the main loop a
+ * few times per second with the number of bytes copied so far and the
+ * size of the files found so far, and once more with the final counts
+ * before @callback runs.
+ *
+ * @io_priority orders the start of the copy, when @source is
+ * examined, among the other I/O jobs. The walk itself then runs on
+ * threads of its own, so it neither waits for nor delays other
+ * requests whatever their priority.
+ *
+ * The copy stops at the first error, which g_file_copy_tree_finish()
+ * returns. The files copied up to that point are left in place.
+ *
+ * When the operation is finished, @callback will be called. You can then
+ * call g_file_copy_tree_finish() to get the result of the operation.
+ *
+ * Since: 2.30
+ */
+void
+g_file_copy_tree_async (GFile                  *source,
+                        GFile                  *destination,
+                        GFileCopyFlags          flags,
+                        GFileCopyTreeFlags      tree_flags,
+                        guint                   max_workers,
+                        int                     io_priority,
+                        GCancellable           *cancellable,
+                        GFileProgressCallback   progress_callback,
+                        gpointer                progress_callback_data,
+                        GAsyncReadyCallback     callback,
+                        gpointer                user_data)
+{
+  CopyTreeData *data;
+
+  g_return_if_fail (G_IS_FILE (source));
+  g_return_if_fail (G_IS_FILE (destination));
+
+  if (max_workers == 0)
+    max_workers = COPY_TREE_DEFAULT_WORKERS;
+  max_workers = MIN (max_workers, COPY_TREE_MAX_WORKERS);
+
+  data = g_new0 (CopyTreeData, 1);
+  data->result = g_simple_async_result_new (G_OBJECT (source), callback, user_data,
+                                            g_file_copy_tree_async);
+  data->context = g_main_context_get_thread_default ();
+  if (data->context)
+    g_main_context_ref (data->context);
+  data->source = g_object_ref (source);
+  data->destination = g_object_ref (destination);
+  data->flags = flags;
+  data->tree_flags = tree_flags;
+  data->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  data->progress_callback = progress_callback;
+  data->progress_callback_data = progress_callback_data;
+  data->lock = g_mutex_new ();
+  data->cond = g_cond_new ();
+  g_queue_init (&data->queue);
+  data->max_workers = max_workers;
+
+  if (progress_callback)
+    {
+      data->progress_source = g_timeout_source_new (COPY_TREE_PROGRESS_INTERVAL);
+      g_source_set_callback (data->progress_source, copy_tree_progress_cb, data, NULL);
+      g_source_attach (data->progress_source,
+                       data->context);
+    }
+
+  _g_io_scheduler_push_job_to_pool (_g_io_scheduler_pool_for_object (G_OBJECT (source)),
+                                    copy_tree_start_job, data, NULL,
+                                    io_priority, NULL);
+}
+
+/**
+ * g_file_copy_tree_finish:
+ * @source: input #GFile
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Finishes a copy started with g_file_copy_tree_async().
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ *
+ * Since: 2.30
+ */
+gboolean
+g_file_copy_tree_finish (GFile         *source,
+                         GAsyncResult  *res,
+                         GError       **error)
+{
+  GSimpleAsyncResult *simple;
+
+  g_return_val_if_fail (G_IS_FILE (source), FALSE);
+  g_return_val_if_fail (g_simple_async_result_is_valid (res, G_OBJECT (source),
+                                                        g_file_copy_tree_async),
+                        FALSE);
+
+  simple = G_SIMPLE_ASYNC_RESULT (res);
+  if (g_simple_async_result_propagate_error (simple, error))
+    return FALSE;
+
+  return g_simple_async_result_get_op_res_gboolean (simple);
+}
+
 /**
  * g_file_move:
  * @source: #GFile pointing to the source location.
@@ -4798,6 +5901,65 @@ g_file_monitor (GFile             *file,
     return g_file_monitor_file (file, flags, cancellable, error);
 }
 
+/**
+ * g_file_monitor_tree:
+ * @file: input #GFile
+ * @flags: a set of #GFileMonitorFlags
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore
+ * @error: a #GError, or %NULL
+ *
+ * Obtains a monitor for the directory tree rooted at the given file.
+ * The monitor reports changes of the files in the directory and in all
+ * of its subdirectories, at any depth. Subdirectories created in the
+ * tree or moved into it are monitored automatically, and the ones
+ * removed from it are no longer monitored. The files of the events can
+ * be turned into paths relative to the root with
+ * g_file_get_relative_path().
+ *
+ * A single monitor object is used for the whole tree, and the backends
+ * keep their per-directory state to a minimum, so this is much cheaper
+ * than a #GFileMonitor for every directory of a large tree.
+ *
+ * Monitoring of a new subdirectory starts after it has been reported,
+ * so the files created in it before that are missed. Pass
+ * %G_FILE_MONITOR_SCAN_ON_ADD to have them reported as created.
+ *
+ * If @cancellable is not %NULL, then the operation can be cancelled by
+ * triggering the cancellable object from another thread. If the operation
+ * was cancelled, the error %G_IO_ERROR_CANCELLED will be returned.
+ *
+ * Virtual: monitor_tree
+ * Returns: (transfer full): a #GFileMonitor for the tree at @file, or
+ *     %NULL on error. Free the returned object with g_object_unref().
+ *
+ * Since: 2.30
+ */
+GFileMonitor*
+g_file_monitor_tree (GFile             *file,
+                     GFileMonitorFlags  flags,
+                     GCancellable      *cancellable,
+                     GError           **error)
+{
+  GFileIface *iface;
+
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  iface = G_FILE_GET_IFACE (file);
+
+  if (iface->monitor_tree == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR,
+                           G_IO_ERROR_NOT_SUPPORTED,
+                           _("Operation not supported"));
+      return NULL;
+    }
+
+  return (* iface->monitor_tree) (file, flags, cancellable, error);
+}
+
 /********************************************
  *   Default implementation of async ops    *
  ********************************************/
@@ -5816,6 +6978,7 @@ g_file_real_copy_async (GFile                  *source,
 {
   GSimpleAsyncResult *res;
   CopyAsyncData *data;
+  GIOSchedulerPool pool;
 
   data = g_new0 (CopyAsyncData, 1);
   data->source = g_object_ref (source);
@@ -5827,7 +6990,13 @@ g_file_real_copy_async (GFile                  *source,
   res = g_simple_async_result_new (G_OBJECT (source), callback, user_data, g_file_real_copy_async);
   g_simple_async_result_set_op_res_gpointer (res, data, (GDestroyNotify)copy_async_data_free);
 
-  g_io_scheduler_push_job (copy_async_thread, res, g_object_unref, io_priority, cancellable);
+  if (_g_io_scheduler_pool_for_object (G_OBJECT (source)) == G_IO_SCHEDULER_POOL_REMOTE)
+    pool = G_IO_SCHEDULER_POOL_REMOTE;
+  else
+    pool = _g_io_scheduler_pool_for_object (G_OBJECT (destination));
+
+  _g_io_scheduler_push_job_to_pool (pool, copy_async_thread, res, g_object_unref,
+                                    io_priority, cancellable);
 }
 
 static gboolean
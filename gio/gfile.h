@@ -152,6 +152,7 @@ typedef struct _GFileIface    		GFileIface;
  * @eject_mountable_with_operation_finish: Finishes an eject operation using a #GMountOperation. Since 2.22.
  * @poll_mountable: Polls a mountable object for media changes. Since 2.22.
  * @poll_mountable_finish: Finishes an poll operation for media changes. Since 2.22.
+ * @monitor_tree: Creates a #GFileMonitor for a directory tree. Since 2.30.
  *
  * An interface for writing VFS file handles.
  **/
@@ -543,6 +544,11 @@ struct _GFileIface
   gboolean            (* poll_mountable_finish)       (GFile                *file,
                                                        GAsyncResult         *result,
                                                        GError              **error);
+
+  GFileMonitor *      (* monitor_tree)                (GFile                *file,
+                                                       GFileMonitorFlags     flags,
+                                                       GCancellable         *cancellable,
+                                                       GError              **error);
 };
 
 GType                   g_file_get_type                   (void) G_GNUC_CONST;
@@ -692,6 +698,18 @@ void                    g_file_query_info_async           (GFile
 GFileInfo *             g_file_query_info_finish          (GFile                      *file,
 							   GAsyncResult               *res,
 							   GError                    **error);
+void                    g_file_query_info_multiple_async  (GFile                     **files,
+							   guint                       n_files,
+							   const char                 *attributes,
+							   GFileQueryInfoFlags         flags,
+							   int                         io_priority,
+							   GCancellable               *cancellable,
+							   GFileQueryInfoChunkCallback chunk_callback,
+							   gpointer                    chunk_data,
+							   GAsyncReadyCallback         callback,
+							   gpointer                    user_data);
+gboolean                g_file_query_info_multiple_finish (GAsyncResult               *res,
+							   GError                    **error);
 GFileInfo *             g_file_query_filesystem_info      (GFile                      *file,
 							   const char                 *attributes,
 							   GCancellable               *cancellable,
@@ -769,6 +787,20 @@ void                    g_file_copy_async                 (GFile
 gboolean                g_file_copy_finish                (GFile                      *file,
 							   GAsyncResult               *res,
 							   GError                    **error);
+void                    g_file_copy_tree_async            (GFile                      *source,
+							   GFile                      *destination,
+							   GFileCopyFlags              flags,
+							   GFileCopyTreeFlags          tree_flags,
+							   guint                       max_workers,
+							   int                         io_priority,
+							   GCancellable               *cancellable,
+							   GFileProgressCallback       progress_callback,
+							   gpointer                    progress_callback_data,
+							   GAsyncReadyCallback         callback,
+							   gpointer                    user_data);
+gboolean                g_file_copy_tree_finish           (GFile                      *source,
+							   GAsyncResult               *res,
+							   GError                    **error);
 gboolean                g_file_move                       (GFile                      *source,
 							   GFile                      *destination,
 							   GFileCopyFlags              flags,
@@ -927,6 +959,10 @@ GFileMonitor*           g_file_monitor                    (GFile
 							   GFileMonitorFlags       flags,
 							   GCancellable           *cancellable,
 							   GError                **error);
+GFileMonitor*           g_file_monitor_tree               (GFile                  *file,
+							   GFileMonitorFlags       flags,
+							   GCancellable           *cancellable,
+							   GError                **error);
 
 void                    g_file_start_mountable            (GFile                      *file,
 							   GDriveStartFlags            flags,
@@ -104,6 +104,9 @@
 
 gboolean           _g_file_attribute_matcher_matches_id         (GFileAttributeMatcher *matcher,
                                                                  guint32                id);
+gboolean           _g_file_attribute_matcher_matches_only_ids   (GFileAttributeMatcher *matcher,
+                                                                 const guint32         *ids,
+                                                                 guint                  n_ids);
 
 void               _g_file_info_set_attribute_by_id             (GFileInfo             *info,
                                                                  guint32                attribute,
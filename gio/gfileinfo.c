@@ -2353,6 +2353,53 @@ _g_file_attribute_matcher_matches_id (GFileAttributeMatcher *matcher,
   return matcher_matches_id (matcher, id);
 }
 
+/* Whether everything @matcher can match is in @ids.  Namespace
+ * wildcards are not expanded, so they never are.
+ */
+gboolean
+_g_file_attribute_matcher_matches_only_ids (GFileAttributeMatcher *matcher,
+                                            const guint32         *ids,
+                                            guint                  n_ids)
+{
+  SubMatcher *sub_matchers;
+  guint n_sub_matchers, i, j;
+
+  if (matcher == NULL)
+    return TRUE;
+
+  if (matcher->all)
+    return FALSE;
+
+  for (i = 0; i < ON_STACK_MATCHERS && matcher->sub_matchers[i].id != 0; i++)
+    {
+      if (matcher->sub_matchers[i].mask != 0xffffffff)
+        return FALSE;
+      for (j = 0; j < n_ids; j++)
+        if (ids[j] == matcher->sub_matchers[i].id)
+          break;
+      if (j == n_ids)
+        return FALSE;
+    }
+
+  if (matcher->more_sub_matchers == NULL)
+    return TRUE;
+
+  sub_matchers = (SubMatcher *)matcher->more_sub_matchers->data;
+  n_sub_matchers = matcher->more_sub_matchers->len;
+  for (i = 0; i < n_sub_matchers; i++)
+    {
+      if (sub_matchers[i].mask != 0xffffffff)
+        return FALSE;
+      for (j = 0; j < n_ids; j++)
+        if (ids[j] == sub_matchers[i].id)
+          break;
+      if (j == n_ids)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 /**
  * g_file_attribute_matcher_matches:
  * @matcher: a #GFileAttributeMatcher.
@@ -24,6 +24,7 @@
 #include <string.h>
 
 #include "gfilemonitor.h"
+#include "gfilemonitorprivate.h"
 #include "gio-marshal.h"
 #include "gioenumtypes.h"
 #include "gfile.h"
@@ -31,9 +32,7 @@
 #include "glibintl.h"
 
 
-struct _FileChange;
-typedef struct _FileChange FileChange;
-static void file_change_free (FileChange *change);
+static void file_changes_clear (GArray *changes);
 
 /**
  * SECTION:gfilemonitor
@@ -54,12 +53,18 @@ static void file_change_free (FileChange *change);
  * (though if the global default main context is blocked, this may
  * cause notifications to be blocked even if the thread-default
  * context is still running).
+ *
+ * g_file_monitor_get_statistics() reports what a monitor and the
+ * backend behind it are currently holding and how they have been
+ * coping, which helps diagnosing event storms and exhausted watch
+ * limits in a running process.
  **/
 
 G_LOCK_DEFINE_STATIC(cancelled);
 
 enum {
   CHANGED,
+  CHANGES,
   LAST_SIGNAL
 };
 
@@ -70,31 +75,56 @@ G_DEFINE_ABSTRACT_TYPE (GFileMonitor, g_file_monitor, G_TYPE_OBJECT);
 
 typedef struct {
   GFile *file;
-  guint32 last_sent_change_time; /* 0 == not sent */
-  guint32 send_delayed_change_at; /* 0 == never */
-  guint32 send_virtual_changes_done_at; /* 0 == never */
+  gint64 last_sent_change_time; /* 0 == not sent */
+  gint64 send_delayed_change_at; /* 0 == never */
+  gint64 send_virtual_changes_done_at; /* 0 == never */
+
+  gint64 deadline; /* the earliest of the above, 0 == not in the wheel */
+  guint slot;
+  gpointer prev;
+  gpointer next;
 } RateLimiter;
 
+/* A millisecond per slot, so a revolution covers the default virtual
+ * CHANGES_DONE_HINT delay */
+#define WHEEL_SLOTS 2048
+#define WHEEL_MASK  (WHEEL_SLOTS - 1)
+
 struct _GFileMonitorPrivate {
   gboolean cancelled;
   int rate_limit_msec;
+  gboolean batched;
 
   /* Rate limiting change events */
   GHashTable *rate_limiter;
+  RateLimiter **wheel;           /* lists of RateLimiter, by deadline */
+  guint32 *wheel_used;           /* bitmap of the non-empty slots */
+  gint64 wheel_time;             /* the slots up to this time are done */
+  guint wheel_size;
 
   GSource *pending_file_change_source;
-  GSList *pending_file_changes; /* FileChange */
+  GArray *pending_file_changes; /* GFileMonitorChange */
+  GArray *spare_file_changes;   /* emptied, to be reused */
 
   GSource *timeout;
-  guint32 timeout_fires_at;
+  gint64 timeout_fires_at;
 
   GMainContext *context;
+
+  /* Statistics */
+  guint64 n_emitted;
+  guint64 n_rate_limited;
+  guint64 n_delivered;
+  guint64 n_deliveries;
+  gint64 pending_since;          /* when the pending changes started */
+  GFileMonitorHistogram delivery_latency;
 };
 
 enum {
   PROP_0,
   PROP_RATE_LIMIT,
-  PROP_CANCELLED
+  PROP_CANCELLED,
+  PROP_BATCHED
 };
 
 static void
@@ -113,6 +143,10 @@ g_file_monitor_set_property (GObject      *object,
       g_file_monitor_set_rate_limit (monitor, g_value_get_int (value));
       break;
 
+    case PROP_BATCHED:
+      g_file_monitor_set_batched (monitor, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -143,6 +177,10 @@ g_file_monitor_get_property (GObject    *object,
       G_UNLOCK (cancelled);
       break;
 
+    case PROP_BATCHED:
+      g_value_set_boolean (value, priv->batched);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -175,6 +213,8 @@ g_file_monitor_finalize (GObject *object)
     }
 
   g_hash_table_destroy (monitor->priv->rate_limiter);
+  g_free (monitor->priv->wheel);
+  g_free (monitor->priv->wheel_used);
 
   if (monitor->priv->context)
     g_main_context_unref (monitor->priv->context);
@@ -197,9 +237,17 @@ g_file_monitor_dispose (GObject *object)
       g_source_unref (priv->pending_file_change_source);
       priv->pending_file_change_source = NULL;
     }
-  g_slist_foreach (priv->pending_file_changes, (GFunc) file_change_free, NULL);
-  g_slist_free (priv->pending_file_changes);
-  priv->pending_file_changes = NULL;
+  if (priv->pending_file_changes)
+    {
+      file_changes_clear (priv->pending_file_changes);
+      g_array_free (priv->pending_file_changes, TRUE);
+      priv->pending_file_changes = NULL;
+    }
+  if (priv->spare_file_changes)
+    {
+      g_array_free (priv->spare_file_changes, TRUE);
+      priv->spare_file_changes = NULL;
+    }
 
   /* Make sure we cancel on last unref */
   g_file_monitor_cancel (monitor);
@@ -207,6 +255,35 @@ g_file_monitor_dispose (GObject *object)
   G_OBJECT_CLASS (g_file_monitor_parent_class)->dispose (object);
 }
 
+static void
+g_file_monitor_real_get_statistics (GFileMonitor    *monitor,
+                                    GVariantBuilder *builder)
+{
+  GFileMonitorPrivate *priv = monitor->priv;
+
+  g_variant_builder_add (builder, "{sv}", "type",
+                         g_variant_new_string (G_OBJECT_TYPE_NAME (monitor)));
+  g_variant_builder_add (builder, "{sv}", "cancelled",
+                         g_variant_new_boolean (g_file_monitor_is_cancelled (monitor)));
+  g_variant_builder_add (builder, "{sv}", "rate-limit",
+                         g_variant_new_int32 (priv->rate_limit_msec));
+  g_variant_builder_add (builder, "{sv}", "events-emitted",
+                         g_variant_new_uint64 (priv->n_emitted));
+  g_variant_builder_add (builder, "{sv}", "events-rate-limited",
+                         g_variant_new_uint64 (priv->n_rate_limited));
+  g_variant_builder_add (builder, "{sv}", "events-delivered",
+                         g_variant_new_uint64 (priv->n_delivered));
+  g_variant_builder_add (builder, "{sv}", "deliveries",
+                         g_variant_new_uint64 (priv->n_deliveries));
+  g_variant_builder_add (builder, "{sv}", "events-pending",
+                         g_variant_new_uint32 (priv->pending_file_changes ?
+                                               priv->pending_file_changes->len : 0));
+  g_variant_builder_add (builder, "{sv}", "rate-limiters",
+                         g_variant_new_uint32 (g_hash_table_size (priv->rate_limiter)));
+  _g_file_monitor_statistics_add_histogram (builder, "delivery-latency-histogram",
+                                            &priv->delivery_latency);
+}
+
 static void
 g_file_monitor_class_init (GFileMonitorClass *klass)
 {
@@ -220,6 +297,8 @@ g_file_monitor_class_init (GFileMonitorClass *klass)
   object_class->get_property = g_file_monitor_get_property;
   object_class->set_property = g_file_monitor_set_property;
 
+  klass->get_statistics = g_file_monitor_real_get_statistics;
+
   /**
    * GFileMonitor::changed:
    * @monitor: a #GFileMonitor.
@@ -245,6 +324,32 @@ g_file_monitor_class_init (GFileMonitorClass *klass)
 		  G_TYPE_NONE, 3,
 		  G_TYPE_FILE, G_TYPE_FILE, G_TYPE_FILE_MONITOR_EVENT);
 
+  /**
+   * GFileMonitor::changes:
+   * @monitor: a #GFileMonitor.
+   * @changes: an array of #GFileMonitorChange.
+   * @n_changes: the number of elements in @changes.
+   *
+   * Emitted instead of #GFileMonitor::changed when the monitor is
+   * batched, with all the changes that were queued since the last
+   * emission, in order.
+   *
+   * The files are only valid for the duration of the emission, which
+   * avoids one signal emission and the marshalling of three values for
+   * every change.
+   *
+   * Since: 2.30
+   **/
+  signals[CHANGES] =
+    g_signal_new (I_("changes"),
+		  G_TYPE_FILE_MONITOR,
+		  G_SIGNAL_RUN_LAST,
+		  G_STRUCT_OFFSET (GFileMonitorClass, changes),
+		  NULL, NULL,
+		  _gio_marshal_VOID__POINTER_UINT,
+		  G_TYPE_NONE, 2,
+		  G_TYPE_POINTER, G_TYPE_UINT);
+
   g_object_class_install_property (object_class,
                                    PROP_RATE_LIMIT,
                                    g_param_spec_int ("rate-limit",
@@ -263,6 +368,23 @@ g_file_monitor_class_init (GFileMonitorClass *klass)
                                                          FALSE,
                                                          G_PARAM_READABLE|
                                                          G_PARAM_STATIC_NAME|G_PARAM_STATIC_NICK|G_PARAM_STATIC_BLURB));
+
+  /**
+   * GFileMonitor:batched:
+   *
+   * Whether the changes are delivered by #GFileMonitor::changes
+   * rather than #GFileMonitor::changed.
+   *
+   * Since: 2.30
+   **/
+  g_object_class_install_property (object_class,
+                                   PROP_BATCHED,
+                                   g_param_spec_boolean ("batched",
+                                                         P_("Batched"),
+                                                         P_("Whether the changes are delivered in batches"),
+                                                         FALSE,
+                                                         G_PARAM_READWRITE|
+                                                         G_PARAM_STATIC_NAME|G_PARAM_STATIC_NICK|G_PARAM_STATIC_BLURB));
 }
 
 static void
@@ -356,45 +478,154 @@ g_file_monitor_set_rate_limit (GFileMonitor *monitor,
     }
 }
 
-struct _FileChange {
-  GFile             *child;
-  GFile             *other_file;
-  GFileMonitorEvent  event_type;
-};
+/**
+ * g_file_monitor_set_batched:
+ * @monitor: a #GFileMonitor.
+ * @batched: whether to deliver the changes in batches
+ *
+ * Sets whether the changes queued by the @monitor are delivered by a
+ * single #GFileMonitor::changes emission per main loop dispatch, rather
+ * than by one #GFileMonitor::changed emission per change.
+ *
+ * Since: 2.30
+ */
+void
+g_file_monitor_set_batched (GFileMonitor *monitor,
+                            gboolean      batched)
+{
+  GFileMonitorPrivate *priv;
+
+  g_return_if_fail (G_IS_FILE_MONITOR (monitor));
+
+  priv = monitor->priv;
+  batched = !!batched;
+  if (priv->batched != batched)
+    {
+      priv->batched = batched;
+      g_object_notify (G_OBJECT (monitor), "batched");
+    }
+}
+
+/**
+ * g_file_monitor_get_statistics:
+ * @monitor: a #GFileMonitor.
+ *
+ * Gets statistics about @monitor and the backend implementing it, as
+ * a dictionary of type <literal>a{sv}</literal>. The statistics are
+ * gathered all the time and are cheap to query.
+ *
+ * The following keys are always present:
+ * <variablelist>
+ *   <varlistentry><term>type (s)</term>
+ *     <listitem><para>the type name of the monitor</para></listitem></varlistentry>
+ *   <varlistentry><term>cancelled (b)</term>
+ *     <listitem><para>whether the monitor is cancelled</para></listitem></varlistentry>
+ *   <varlistentry><term>rate-limit (i)</term>
+ *     <listitem><para>the rate limit in milliseconds</para></listitem></varlistentry>
+ *   <varlistentry><term>events-emitted (t)</term>
+ *     <listitem><para>events reported by the backend</para></listitem></varlistentry>
+ *   <varlistentry><term>events-rate-limited (t)</term>
+ *     <listitem><para>change events held back by the rate limit</para></listitem></varlistentry>
+ *   <varlistentry><term>events-delivered (t)</term>
+ *     <listitem><para>events delivered by the signals</para></listitem></varlistentry>
+ *   <varlistentry><term>deliveries (t)</term>
+ *     <listitem><para>the number of times queued events were delivered</para></listitem></varlistentry>
+ *   <varlistentry><term>events-pending (u)</term>
+ *     <listitem><para>events queued for delivery</para></listitem></varlistentry>
+ *   <varlistentry><term>rate-limiters (u)</term>
+ *     <listitem><para>files currently tracked by the rate limit</para></listitem></varlistentry>
+ *   <varlistentry><term>delivery-latency-histogram (at)</term>
+ *     <listitem><para>how long the oldest queued event waited for each
+ *     delivery; element n counts waits of less than 2<superscript>n</superscript>
+ *     microseconds that did not fit an earlier element</para></listitem></varlistentry>
+ * </variablelist>
+ *
+ * Backends add a <literal>backend</literal> string key naming them,
+ * followed by their own counters, such as the number of kernel watches,
+ * missing files, queue lengths, overflows and failed watches. Those
+ * are usually shared by all the monitors of the backend.
+ *
+ * Returns: (transfer full): a #GVariant dictionary, free with
+ *     g_variant_unref().
+ *
+ * Since: 2.30
+ **/
+GVariant *
+g_file_monitor_get_statistics (GFileMonitor *monitor)
+{
+  GFileMonitorClass *klass;
+  GVariantBuilder builder;
+
+  g_return_val_if_fail (G_IS_FILE_MONITOR (monitor), NULL);
+
+  klass = G_FILE_MONITOR_GET_CLASS (monitor);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  klass->get_statistics (monitor, &builder);
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
 
 static void
-file_change_free (FileChange *change)
+file_changes_clear (GArray *changes)
 {
-  g_object_unref (change->child);
-  if (change->other_file)
-    g_object_unref (change->other_file);
-  
-  g_slice_free (FileChange, change);
+  guint i;
+
+  for (i = 0; i < changes->len; i++)
+    {
+      GFileMonitorChange *change = &g_array_index (changes, GFileMonitorChange, i);
+
+      g_object_unref (change->file);
+      if (change->other_file)
+        g_object_unref (change->other_file);
+    }
+
+  g_array_set_size (changes, 0);
 }
 
 static gboolean
 emit_cb (gpointer data)
 {
   GFileMonitor *monitor = G_FILE_MONITOR (data);
-  GSList *pending, *iter;
+  GFileMonitorPrivate *priv = monitor->priv;
+  GArray *pending;
+  guint i;
   
-  pending = g_slist_reverse (monitor->priv->pending_file_changes);
-  monitor->priv->pending_file_changes = NULL;
-  if (monitor->priv->pending_file_change_source)
+  pending = priv->pending_file_changes;
+  priv->pending_file_changes = NULL;
+
+  priv->n_delivered += pending->len;
+  priv->n_deliveries++;
+  _g_file_monitor_histogram_add (&priv->delivery_latency,
+                                 g_get_monotonic_time () - priv->pending_since);
+  if (priv->pending_file_change_source)
     {
-      g_source_unref (monitor->priv->pending_file_change_source);
-      monitor->priv->pending_file_change_source = NULL;
+      g_source_unref (priv->pending_file_change_source);
+      priv->pending_file_change_source = NULL;
     }
 
   g_object_ref (monitor);
-  for (iter = pending; iter; iter = iter->next)
-    {
-       FileChange *change = iter->data;
-       g_signal_emit (monitor, signals[CHANGED], 0,
-	  	      change->child, change->other_file, change->event_type);
-       file_change_free (change);
-    }
-  g_slist_free (pending);
+
+  if (priv->batched)
+    g_signal_emit (monitor, signals[CHANGES], 0,
+                   pending->data, pending->len);
+  else
+    for (i = 0; i < pending->len; i++)
+      {
+        GFileMonitorChange *change = &g_array_index (pending, GFileMonitorChange, i);
+
+        g_signal_emit (monitor, signals[CHANGED], 0,
+                       change->file, change->other_file, change->event_type);
+      }
+
+  file_changes_clear (pending);
+
+  /* Keep the storage around, a busy monitor needs it again soon */
+  if (priv->spare_file_changes == NULL)
+    priv->spare_file_changes = pending;
+  else
+    g_array_free (pending, TRUE);
+
   g_object_unref (monitor);
 
   return FALSE;
@@ -407,19 +638,17 @@ emit_in_idle (GFileMonitor      *monitor,
 	      GFileMonitorEvent  event_type)
 {
   GSource *source;
-  FileChange *change;
+  GFileMonitorChange change;
   GFileMonitorPrivate *priv;
 
   priv = monitor->priv;
 
-  change = g_slice_new (FileChange);
-
-  change->child = g_object_ref (child);
+  change.file = g_object_ref (child);
   if (other_file)
-    change->other_file = g_object_ref (other_file);
+    change.other_file = g_object_ref (other_file);
   else
-    change->other_file = NULL;
-  change->event_type = event_type;
+    change.other_file = NULL;
+  change.event_type = event_type;
 
   if (!priv->pending_file_change_source)
     {
@@ -433,25 +662,193 @@ emit_in_idle (GFileMonitor      *monitor,
       g_source_set_callback (source, emit_cb, monitor, NULL);
       g_source_attach (source, monitor->priv->context);
     }
-  /* We reverse this in the processor */
-  priv->pending_file_changes = g_slist_prepend (priv->pending_file_changes, change);
+
+  if (priv->pending_file_changes == NULL)
+    {
+      if (priv->spare_file_changes != NULL)
+        {
+          priv->pending_file_changes = priv->spare_file_changes;
+          priv->spare_file_changes = NULL;
+        }
+      else
+        priv->pending_file_changes = g_array_new (FALSE, FALSE, sizeof (GFileMonitorChange));
+
+      priv->pending_since = g_get_monotonic_time ();
+    }
+  g_array_append_val (priv->pending_file_changes, change);
 }
 
-static guint32
+static gint64
 get_time_msecs (void)
 {
-  return g_thread_gettime() / (1000 * 1000);
+  return g_get_monotonic_time () / 1000;
 }
 
-static guint32
-time_difference (guint32 from, guint32 to)
+/* Change event rate limiting support.
+ *
+ * The limiters are kept in a hashed timer wheel, by the time they need
+ * attention next, and a single timeout is armed for the earliest
+ * non-empty slot. Rescheduling a limiter is O(1), and servicing the
+ * timeout only touches the slots that are due, no matter how many files
+ * are being rate limited. Deadlines further than a revolution away just
+ * stay in their slot until they are due.
+ */
+
+/* Returns 0 if the limiter has nothing left to do */
+static gint64
+limiter_deadline (GFileMonitor *monitor,
+                  RateLimiter  *limiter,
+                  gint64        time_now)
 {
-  if (from > to)
+  gint64 deadline = G_MAXINT64;
+  gint64 expire_at;
+
+  /* Keep the limiter for 2*rate limit so that a burst of changes is
+   * still rate limited, then clear it out */
+  if (limiter->last_sent_change_time != 0)
+    {
+      expire_at = limiter->last_sent_change_time + 2 * monitor->priv->rate_limit_msec;
+      if (expire_at > time_now)
+        deadline = expire_at;
+    }
+
+  if (limiter->send_delayed_change_at != 0)
+    deadline = MIN (deadline, limiter->send_delayed_change_at);
+
+  if (limiter->send_virtual_changes_done_at != 0)
+    deadline = MIN (deadline, limiter->send_virtual_changes_done_at);
+
+  return deadline != G_MAXINT64 ? deadline : 0;
+}
+
+static void
+wheel_link (GFileMonitorPrivate *priv,
+            RateLimiter         *limiter,
+            gint64               deadline)
+{
+  RateLimiter *head;
+
+  if (priv->wheel_size == 0)
+    {
+      if (priv->wheel == NULL)
+        {
+          priv->wheel = g_new0 (RateLimiter *, WHEEL_SLOTS);
+          priv->wheel_used = g_new0 (guint32, WHEEL_SLOTS / 32);
+        }
+      priv->wheel_time = get_time_msecs () - 1;
+    }
+
+  limiter->deadline = deadline;
+  limiter->slot = MAX (deadline, priv->wheel_time + 1) & WHEEL_MASK;
+
+  head = priv->wheel[limiter->slot];
+  limiter->prev = NULL;
+  limiter->next = head;
+  if (head != NULL)
+    head->prev = limiter;
+  priv->wheel[limiter->slot] = limiter;
+  priv->wheel_used[limiter->slot / 32] |= 1U << (limiter->slot % 32);
+  priv->wheel_size++;
+}
+
+static void
+wheel_unlink (GFileMonitorPrivate *priv,
+              RateLimiter         *limiter)
+{
+  RateLimiter *prev = limiter->prev;
+  RateLimiter *next = limiter->next;
+
+  if (limiter->deadline == 0)
+    return;
+
+  if (prev != NULL)
+    prev->next = next;
+  else
+    priv->wheel[limiter->slot] = next;
+  if (next != NULL)
+    next->prev = prev;
+
+  if (priv->wheel[limiter->slot] == NULL)
+    priv->wheel_used[limiter->slot / 32] &= ~(1U << (limiter->slot % 32));
+
+  limiter->deadline = 0;
+  priv->wheel_size--;
+}
+
+/* The time of the first non-empty slot after wheel_time, or 0 */
+static gint64
+wheel_next (GFileMonitorPrivate *priv)
+{
+  gint64 t = priv->wheel_time + 1;
+  gint64 end = t + WHEEL_SLOTS;
+
+  if (priv->wheel_size == 0)
     return 0;
-  return to - from;
+
+  while (t < end)
+    {
+      guint slot = t & WHEEL_MASK;
+      guint32 word = priv->wheel_used[slot / 32] >> (slot % 32);
+
+      if (word != 0)
+        return t + g_bit_nth_lsf (word, -1);
+
+      t += 32 - slot % 32;
+    }
+
+  return 0;
 }
 
-/* Change event rate limiting support: */
+static gboolean rate_limiter_timeout (gpointer timeout_data);
+
+/* Makes sure the timeout fires no later than the given time.
+ * A timeout firing too early is just rearmed. */
+static void
+update_rate_limiter_timeout (GFileMonitor *monitor,
+                             gint64        fire_at)
+{
+  GFileMonitorPrivate *priv = monitor->priv;
+  GSource *source;
+  gint64 time_now;
+
+  if (priv->timeout != NULL && priv->timeout_fires_at <= fire_at)
+    return; /* Nothing to do, we already fire earlier than that */
+
+  if (priv->timeout)
+    {
+      g_source_destroy (priv->timeout);
+      g_source_unref (priv->timeout);
+    }
+
+  time_now = get_time_msecs ();
+  source = g_timeout_source_new (MAX (fire_at - time_now, 0) + 1);  /* + 1 to make sure we've really passed the time */
+  g_source_set_callback (source, rate_limiter_timeout, monitor, NULL);
+  g_source_attach (source, priv->context);
+
+  priv->timeout = source;
+  priv->timeout_fires_at = fire_at;
+}
+
+/* Moves the limiter to its place in the wheel after its times changed */
+static void
+rate_limiter_reschedule (GFileMonitor *monitor,
+                         RateLimiter  *limiter)
+{
+  GFileMonitorPrivate *priv = monitor->priv;
+  gint64 time_now = get_time_msecs ();
+  gint64 deadline = limiter_deadline (monitor, limiter, time_now);
+
+  /* Cleared out on the next timeout */
+  if (deadline == 0)
+    deadline = time_now;
+
+  if (deadline == limiter->deadline)
+    return;
+
+  wheel_unlink (priv, limiter);
+  wheel_link (priv, limiter, deadline);
+  update_rate_limiter_timeout (monitor, MAX (deadline, priv->wheel_time + 1));
+}
 
 static RateLimiter *
 new_limiter (GFileMonitor *monitor,
@@ -481,7 +878,7 @@ rate_limiter_send_virtual_changes_done_now (GFileMonitor *monitor,
 static void
 rate_limiter_send_delayed_change_now (GFileMonitor *monitor, 
                                       RateLimiter *limiter, 
-                                      guint32 time_now)
+                                      gint64 time_now)
 {
   if (limiter->send_delayed_change_at != 0)
     {
@@ -493,157 +890,69 @@ rate_limiter_send_delayed_change_now (GFileMonitor *monitor,
     }
 }
 
-typedef struct {
-  guint32 min_time;
-  guint32 time_now;
-  GFileMonitor *monitor;
-} ForEachData;
-
-static gboolean
-calc_min_time (GFileMonitor *monitor, 
-               RateLimiter *limiter, 
-               guint32 time_now, 
-               guint32 *min_time)
+static void
+rate_limiter_service_slot (GFileMonitor *monitor,
+                           guint         slot,
+                           gint64        time_now)
 {
-  gboolean delete_me;
-  guint32 expire_at;
-
-  delete_me = TRUE;
-
-  if (limiter->last_sent_change_time != 0)
-    {
-      /* Set a timeout at 2*rate limit so that we can clear out the change from the hash eventualy */
-      expire_at = limiter->last_sent_change_time + 2 * monitor->priv->rate_limit_msec;
-
-      if (time_difference (time_now, expire_at) > 0)
-	{
-	  delete_me = FALSE;
-	  *min_time = MIN (*min_time,
-			   time_difference (time_now, expire_at));
-	}
-    }
-
-  if (limiter->send_delayed_change_at != 0)
-    {
-      delete_me = FALSE;
-      *min_time = MIN (*min_time,
-		       time_difference (time_now, limiter->send_delayed_change_at));
-    }
+  GFileMonitorPrivate *priv = monitor->priv;
+  RateLimiter *limiter, *next;
+  gint64 deadline;
 
-  if (limiter->send_virtual_changes_done_at != 0)
+  for (limiter = priv->wheel[slot]; limiter != NULL; limiter = next)
     {
-      delete_me = FALSE;
-      *min_time = MIN (*min_time,
-		       time_difference (time_now, limiter->send_virtual_changes_done_at));
+      next = limiter->next;
+
+      /* Due in a later revolution */
+      if (limiter->deadline > time_now)
+        continue;
+
+      wheel_unlink (priv, limiter);
+
+      if (limiter->send_delayed_change_at != 0 &&
+          limiter->send_delayed_change_at <= time_now)
+        rate_limiter_send_delayed_change_now (monitor, limiter, time_now);
+
+      if (limiter->send_virtual_changes_done_at != 0 &&
+          limiter->send_virtual_changes_done_at <= time_now)
+        rate_limiter_send_virtual_changes_done_now (monitor, limiter);
+
+      deadline = limiter_deadline (monitor, limiter, time_now);
+      if (deadline == 0)
+        {
+          /* Nothing pending and the change is old enough */
+          g_hash_table_remove (priv->rate_limiter, limiter->file);
+        }
+      else
+        wheel_link (priv, limiter, deadline);
     }
-
-  return delete_me;
-}
-
-static gboolean
-foreach_rate_limiter_fire (gpointer key,
-			   gpointer value,
-			   gpointer user_data)
-{
-  RateLimiter *limiter = value;
-  ForEachData *data = user_data;
-
-  if (limiter->send_delayed_change_at != 0 &&
-      time_difference (data->time_now, limiter->send_delayed_change_at) == 0)
-    rate_limiter_send_delayed_change_now (data->monitor, limiter, data->time_now);
-  
-  if (limiter->send_virtual_changes_done_at != 0 &&
-      time_difference (data->time_now, limiter->send_virtual_changes_done_at) == 0)
-    rate_limiter_send_virtual_changes_done_now (data->monitor, limiter);
-  
-  return calc_min_time (data->monitor, limiter, data->time_now, &data->min_time);
 }
 
 static gboolean 
 rate_limiter_timeout (gpointer timeout_data)
 {
   GFileMonitor *monitor = timeout_data;
-  ForEachData data;
-  GSource *source;
-  
-  data.min_time = G_MAXUINT32;
-  data.monitor = monitor;
-  data.time_now = get_time_msecs ();
-  g_hash_table_foreach_remove (monitor->priv->rate_limiter,
-			       foreach_rate_limiter_fire,
-			       &data);
-  
-  /* Remove old timeout */
-  if (monitor->priv->timeout)
-    {
-      g_source_destroy (monitor->priv->timeout);
-      g_source_unref (monitor->priv->timeout);
-      monitor->priv->timeout = NULL;
-      monitor->priv->timeout_fires_at = 0;
-    }
-  
-  /* Set up new timeout */
-  if (data.min_time != G_MAXUINT32)
-    {
-      source = g_timeout_source_new (data.min_time + 1); /* + 1 to make sure we've really passed the time */
-      g_source_set_callback (source, rate_limiter_timeout, monitor, NULL);
-      g_source_attach (source, monitor->priv->context);
-      
-      monitor->priv->timeout = source;
-      monitor->priv->timeout_fires_at = data.time_now + data.min_time; 
-    }
-  
-  return FALSE;
-}
+  GFileMonitorPrivate *priv = monitor->priv;
+  gint64 time_now, t;
 
-static gboolean
-foreach_rate_limiter_update (gpointer key,
-			     gpointer value,
-			     gpointer user_data)
-{
-  RateLimiter *limiter = value;
-  ForEachData *data = user_data;
-
-  return calc_min_time (data->monitor, limiter, data->time_now, &data->min_time);
-}
-
-static void
-update_rate_limiter_timeout (GFileMonitor *monitor, 
-                             guint new_time)
-{
-  ForEachData data;
-  GSource *source;
-  
-  if (monitor->priv->timeout_fires_at != 0 && new_time != 0 &&
-      time_difference (new_time, monitor->priv->timeout_fires_at) == 0)
-    return; /* Nothing to do, we already fire earlier than that */
+  g_source_unref (priv->timeout);
+  priv->timeout = NULL;
+  priv->timeout_fires_at = 0;
 
-  data.min_time = G_MAXUINT32;
-  data.monitor = monitor;
-  data.time_now = get_time_msecs ();
-  g_hash_table_foreach_remove (monitor->priv->rate_limiter,
-			       foreach_rate_limiter_update,
-			       &data);
+  time_now = get_time_msecs ();
 
-  /* Remove old timeout */
-  if (monitor->priv->timeout)
+  while ((t = wheel_next (priv)) != 0 && t <= time_now)
     {
-      g_source_destroy (monitor->priv->timeout);
-      g_source_unref (monitor->priv->timeout);
-      monitor->priv->timeout_fires_at = 0;
-      monitor->priv->timeout = NULL;
+      priv->wheel_time = t;
+      rate_limiter_service_slot (monitor, t & WHEEL_MASK, time_now);
     }
+  priv->wheel_time = time_now;
 
-  /* Set up new timeout */
-  if (data.min_time != G_MAXUINT32)
-    {
-      source = g_timeout_source_new (data.min_time + 1);  /* + 1 to make sure we've really passed the time */
-      g_source_set_callback (source, rate_limiter_timeout, monitor, NULL);
-      g_source_attach (source, monitor->priv->context);
-      
-      monitor->priv->timeout = source;
-      monitor->priv->timeout_fires_at = data.time_now + data.min_time; 
-    }
+  t = wheel_next (priv);
+  if (t != 0)
+    update_rate_limiter_timeout (monitor, t);
+
+  return FALSE;
 }
 
 /**
@@ -667,7 +976,7 @@ g_file_monitor_emit_event (GFileMonitor      *monitor,
 			   GFile             *other_file,
 			   GFileMonitorEvent  event_type)
 {
-  guint32 time_now, since_last;
+  gint64 time_now, since_last;
   gboolean emit_now;
   RateLimiter *limiter;
 
@@ -675,6 +984,7 @@ g_file_monitor_emit_event (GFileMonitor      *monitor,
   g_return_if_fail (G_IS_FILE (child));
 
   limiter = g_hash_table_lookup (monitor->priv->rate_limiter, child);
+  monitor->priv->n_emitted++;
 
   if (event_type != G_FILE_MONITOR_EVENT_CHANGED)
     {
@@ -685,7 +995,7 @@ g_file_monitor_emit_event (GFileMonitor      *monitor,
 	    limiter->send_virtual_changes_done_at = 0;
 	  else
 	    rate_limiter_send_virtual_changes_done_now (monitor, limiter);
-	  update_rate_limiter_timeout (monitor, 0);
+	  rate_limiter_reschedule (monitor, limiter);
 	}
       emit_in_idle (monitor, child, other_file, event_type);
     }
@@ -697,16 +1007,16 @@ g_file_monitor_emit_event (GFileMonitor      *monitor,
       
       if (limiter)
 	{
-	  since_last = time_difference (limiter->last_sent_change_time, time_now);
+	  since_last = time_now - limiter->last_sent_change_time;
 	  if (since_last < monitor->priv->rate_limit_msec)
 	    {
 	      /* We ignore this change, but arm a timer so that we can fire it later if we
 		 don't get any other events (that kill this timeout) */
 	      emit_now = FALSE;
+	      monitor->priv->n_rate_limited++;
 	      if (limiter->send_delayed_change_at == 0)
 		{
 		  limiter->send_delayed_change_at = time_now + monitor->priv->rate_limit_msec;
-		  update_rate_limiter_timeout (monitor, limiter->send_delayed_change_at);
 		}
 	    }
 	}
@@ -720,14 +1030,12 @@ g_file_monitor_emit_event (GFileMonitor      *monitor,
 	  
 	  limiter->last_sent_change_time = time_now;
 	  limiter->send_delayed_change_at = 0;
-	  /* Set a timeout of 2*rate limit so that we can clear out the change from the hash eventualy */
-	  update_rate_limiter_timeout (monitor, time_now + 2 * monitor->priv->rate_limit_msec);
 	}
       
       /* Schedule a virtual change done. This is removed if we get a real one, and
 	 postponed if we get more change events. */
       
       limiter->send_virtual_changes_done_at = time_now + DEFAULT_VIRTUAL_CHANGES_DONE_DELAY_SECS * 1000;
-      update_rate_limiter_timeout (monitor, limiter->send_virtual_changes_done_at);
+      rate_limiter_reschedule (monitor, limiter);
     }
 }
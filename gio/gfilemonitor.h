@@ -40,6 +40,7 @@ G_BEGIN_DECLS
 
 typedef struct _GFileMonitorClass       GFileMonitorClass;
 typedef struct _GFileMonitorPrivate	GFileMonitorPrivate;
+typedef struct _GFileMonitorChange      GFileMonitorChange;
 
 /**
  * GFileMonitor:
@@ -54,6 +55,25 @@ struct _GFileMonitor
   GFileMonitorPrivate *priv;
 };
 
+/**
+ * GFileMonitorChange:
+ * @file: the #GFile that changed
+ * @other_file: the other #GFile of a move, or %NULL
+ * @event_type: a #GFileMonitorEvent
+ *
+ * A change delivered by the #GFileMonitor::changes signal. The files
+ * are only valid for the duration of the signal emission, take a
+ * reference to keep them.
+ *
+ * Since: 2.30
+ **/
+struct _GFileMonitorChange
+{
+  GFile             *file;
+  GFile             *other_file;
+  GFileMonitorEvent  event_type;
+};
+
 struct _GFileMonitorClass
 {
   GObjectClass parent_class;
@@ -67,10 +87,17 @@ struct _GFileMonitorClass
   /* Virtual Table */
   gboolean (* cancel)  (GFileMonitor      *monitor);
 
+  /* Signals */
+  void     (* changes) (GFileMonitor             *monitor,
+                        const GFileMonitorChange *changes,
+                        guint                     n_changes);
+
+  /* Virtual Table */
+  void     (* get_statistics) (GFileMonitor    *monitor,
+                               GVariantBuilder *builder);
+
   /*< private >*/
   /* Padding for future expansion */
-  void (*_g_reserved1) (void);
-  void (*_g_reserved2) (void);
   void (*_g_reserved3) (void);
   void (*_g_reserved4) (void);
   void (*_g_reserved5) (void);
@@ -82,6 +109,9 @@ gboolean g_file_monitor_cancel         (GFileMonitor      *monitor);
 gboolean g_file_monitor_is_cancelled   (GFileMonitor      *monitor);
 void     g_file_monitor_set_rate_limit (GFileMonitor      *monitor,
                                         gint               limit_msecs);
+void     g_file_monitor_set_batched    (GFileMonitor      *monitor,
+                                        gboolean           batched);
+GVariant *g_file_monitor_get_statistics (GFileMonitor     *monitor);
 
 
 /* For implementations */
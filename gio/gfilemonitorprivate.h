@@ -0,0 +1,64 @@
+/* GIO - GLib Input, Output and Streaming Library
+ * 
+ * Copyright (C) 2006-2007 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_FILE_MONITOR_PRIVATE_H__
+#define __G_FILE_MONITOR_PRIVATE_H__
+
+#include <gio/gfilemonitor.h>
+
+G_BEGIN_DECLS
+
+/* Bucket n counts the samples of less than 2^n microseconds that
+ * did not fit an earlier bucket, the last one takes everything else
+ * (about 8 seconds and up).
+ */
+#define _G_FILE_MONITOR_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+  guint64 buckets[_G_FILE_MONITOR_HISTOGRAM_BUCKETS];
+} GFileMonitorHistogram;
+
+static inline void
+_g_file_monitor_histogram_add (GFileMonitorHistogram *histogram,
+                               guint64                usec)
+{
+  histogram->buckets[MIN (g_bit_storage (usec),
+                          _G_FILE_MONITOR_HISTOGRAM_BUCKETS - 1)]++;
+}
+
+static inline void
+_g_file_monitor_statistics_add_histogram (GVariantBuilder             *builder,
+                                          const char                  *key,
+                                          const GFileMonitorHistogram *histogram)
+{
+  GVariantBuilder buckets;
+  guint i;
+
+  g_variant_builder_init (&buckets, G_VARIANT_TYPE ("at"));
+  for (i = 0; i < _G_FILE_MONITOR_HISTOGRAM_BUCKETS; i++)
+    g_variant_builder_add (&buckets, "t", histogram->buckets[i]);
+
+  g_variant_builder_add (builder, "{sv}", key,
+                         g_variant_builder_end (&buckets));
+}
+
+G_END_DECLS
+
+#endif /* __G_FILE_MONITOR_PRIVATE_H__ */
@@ -298,6 +298,26 @@ typedef enum {
   G_FILE_COPY_TARGET_DEFAULT_PERMS = (1 << 5)
 } GFileCopyFlags;
 
+/**
+ * GFileCopyTreeFlags:
+ * @G_FILE_COPY_TREE_NONE: No flags set. A directory that already exists
+ *   at the destination is an error.
+ * @G_FILE_COPY_TREE_MERGE: Copy into directories that already exist at
+ *   the destination.
+ * @G_FILE_COPY_TREE_SKIP_EXISTING: Leave files that already exist at the
+ *   destination alone, instead of failing or (with
+ *   %G_FILE_COPY_OVERWRITE) overwriting them.
+ *
+ * Flags used to resolve conflicts in g_file_copy_tree_async().
+ *
+ * Since: 2.30
+ */
+typedef enum {
+  G_FILE_COPY_TREE_NONE          = 0,          /*< nick=none >*/
+  G_FILE_COPY_TREE_MERGE         = (1 << 0),
+  G_FILE_COPY_TREE_SKIP_EXISTING = (1 << 1)
+} GFileCopyTreeFlags;
+
 
 /**
  * GFileMonitorFlags:
@@ -308,13 +328,18 @@ typedef enum {
  *   event instead (NB: not supported on all backends; the default
  *   behaviour -without specifying this flag- is to send single DELETED
  *   and CREATED events).
+ * @G_FILE_MONITOR_SCAN_ON_ADD: When a directory appears in a tree
+ *   monitored with g_file_monitor_tree(), report the files already
+ *   found in it as created. This closes the race between the creation
+ *   of a directory and the start of its monitoring. Since 2.30
  *
  * Flags used to set what a #GFileMonitor will watch for.
  */
 typedef enum {
   G_FILE_MONITOR_NONE         = 0,
   G_FILE_MONITOR_WATCH_MOUNTS = (1 << 0),
-  G_FILE_MONITOR_SEND_MOVED   = (1 << 1)
+  G_FILE_MONITOR_SEND_MOVED   = (1 << 1),
+  G_FILE_MONITOR_SCAN_ON_ADD  = (1 << 2)
 } GFileMonitorFlags;
 
 
@@ -28,6 +28,7 @@
 #include "giomodule-priv.h"
 #include "glocalfilemonitor.h"
 #include "glocaldirectorymonitor.h"
+#include "glocaltreemonitor.h"
 #include "gnativevolumemonitor.h"
 #include "gproxyresolver.h"
 #include "gproxy.h"
@@ -473,8 +474,10 @@ extern GType _g_fen_directory_monitor_get_type (void);
 extern GType _g_fen_file_monitor_get_type (void);
 extern GType _g_inotify_directory_monitor_get_type (void);
 extern GType _g_inotify_file_monitor_get_type (void);
+extern GType _g_inotify_tree_monitor_get_type (void);
 extern GType _g_kqueue_directory_monitor_get_type (void);
 extern GType _g_kqueue_file_monitor_get_type (void);
+extern GType _g_kqueue_tree_monitor_get_type (void);
 extern GType _g_unix_volume_monitor_get_type (void);
 extern GType _g_local_vfs_get_type (void);
 
@@ -540,6 +543,9 @@ _g_io_modules_ensure_extension_points_registered (void)
       ep = g_io_extension_point_register (G_LOCAL_DIRECTORY_MONITOR_EXTENSION_POINT_NAME);
       g_io_extension_point_set_required_type (ep, G_TYPE_LOCAL_DIRECTORY_MONITOR);
       
+      ep = g_io_extension_point_register (G_LOCAL_TREE_MONITOR_EXTENSION_POINT_NAME);
+      g_io_extension_point_set_required_type (ep, G_TYPE_LOCAL_TREE_MONITOR);
+
       ep = g_io_extension_point_register (G_LOCAL_FILE_MONITOR_EXTENSION_POINT_NAME);
       g_io_extension_point_set_required_type (ep, G_TYPE_LOCAL_FILE_MONITOR);
       
@@ -605,10 +611,12 @@ _g_io_modules_ensure_loaded (void)
 #if defined(HAVE_SYS_INOTIFY_H) || defined(HAVE_LINUX_INOTIFY_H)
       _g_inotify_directory_monitor_get_type ();
       _g_inotify_file_monitor_get_type ();
+      _g_inotify_tree_monitor_get_type ();
 #endif
 #if defined(HAVE_KQUEUE)
       _g_kqueue_directory_monitor_get_type ();
       _g_kqueue_file_monitor_get_type ();
+      _g_kqueue_tree_monitor_get_type ();
 #endif
 #if defined(HAVE_FEN)
       _g_fen_directory_monitor_get_type ();
@@ -23,7 +23,10 @@
 #include "config.h"
 
 #include "gioscheduler.h"
+#include "gioschedulerprivate.h"
 #include "gcancellable.h"
+#include "gfile.h"
+#include "gfileenumerator.h"
 
 
 /**
@@ -45,10 +48,38 @@
  * </para>
  **/
 
+/* Jobs go to one of two pools, so that operations on slow remote
+ * mounts can't hold up local I/O.  A pool has a fixed number of slots,
+ * each with a queue of its own and at most one worker thread; workers
+ * are started when jobs are pushed and nobody is idle, and exit after
+ * being idle for a while.
+ *
+ * Jobs pushed from a worker go to the queue of its slot, others are
+ * spread over the slots round-robin.  Each queue is split in priority
+ * bands, sorted within a band.  A worker takes the first job of the
+ * most urgent non-empty band, looking at its own queue before stealing
+ * from the others, so priorities are respected across the pool up to
+ * the band granularity without a global queue lock.
+ */
+
+#define N_PRIORITY_BANDS 4
+#define MAX_THREADS_PER_POOL 10
+#define MAX_IDLE_TIME 15 /* seconds */
+
+/* Element n counts the samples of less than 2^n microseconds that
+ * did not fit an earlier element, the last one takes everything else.
+ */
+#define HISTOGRAM_BUCKETS 24
+
+typedef struct _WorkerSlot WorkerSlot;
+typedef struct _SchedulerPool SchedulerPool;
+
 struct _GIOSchedulerJob {
-  GSList *active_link;
+  GIOSchedulerJob *active_prev;
+  GIOSchedulerJob *active_next;
+  WorkerSlot *slot; /* whose active list we are in, NULL when idle-run */
+
   GIOSchedulerJobFunc job_func;
-  GSourceFunc cancel_func; /* Runs under job map lock */
   gpointer data;
   GDestroyNotify destroy_notify;
 
@@ -56,16 +87,56 @@ struct _GIOSchedulerJob {
   GCancellable *cancellable;
   GMainContext *context;
 
+  gint64 push_time;
   guint idle_tag;
 };
 
-G_LOCK_DEFINE_STATIC(active_jobs);
-static GSList *active_jobs = NULL;
+struct _WorkerSlot {
+  SchedulerPool *pool;
+
+  /* protects the queues and the active list */
+  GMutex *lock;
+  GQueue queues[N_PRIORITY_BANDS];
+  volatile gint n_queued[N_PRIORITY_BANDS];
+  GIOSchedulerJob *active_jobs;
+
+  /* only touched by the worker of the slot */
+  guint64 n_run;
+  guint64 n_stolen;
+  guint64 queue_wait[HISTOGRAM_BUCKETS];
+  guint64 run_time[HISTOGRAM_BUCKETS];
 
-static GThreadPool *job_thread_pool = NULL;
+  /* protected by the pool lock */
+  gboolean has_worker;
+};
+
+struct _SchedulerPool {
+  const char *name;
+  WorkerSlot slots[MAX_THREADS_PER_POOL];
+
+  volatile gint n_queued;
+  volatile gint n_workers;
+  volatile gint n_idle;
+  volatile gint next_slot;
+
+  /* idle workers wait on cond; protects n_wakeups and has_worker
+   * in the slots
+   */
+  GMutex *lock;
+  GCond *cond;
+  gint n_wakeups;
+};
 
-static void io_job_thread (gpointer data,
-			   gpointer user_data);
+static SchedulerPool pools[] = {
+  { "local" },
+  { "remote" }
+};
+
+static GStaticPrivate current_slot = G_STATIC_PRIVATE_INIT;
+
+/* Jobs run at idle when threads aren't available */
+G_LOCK_DEFINE_STATIC(active_jobs);
+static GIOSchedulerJob *active_jobs = NULL;
 
 static void
 g_io_job_free (GIOSchedulerJob *job)
@@ -74,84 +145,68 @@ g_io_job_free (GIOSchedulerJob *job)
     g_object_unref (job->cancellable);
   if (job->context)
     g_main_context_unref (job->context);
-  g_free (job);
+  g_slice_free (GIOSchedulerJob, job);
 }
 
 static gint
-g_io_job_compare (gconstpointer a,
-		  gconstpointer b,
-		  gpointer      user_data)
+priority_band (gint io_priority)
 {
-  const GIOSchedulerJob *aa = a;
-  const GIOSchedulerJob *bb = b;
-
-  /* Cancelled jobs are set prio == -1, so that
-     they are executed as quickly as possible */
-  
-  /* Lower value => higher priority */
-  if (aa->io_priority < bb->io_priority)
-    return -1;
-  if (aa->io_priority == bb->io_priority)
+  if (io_priority < G_PRIORITY_DEFAULT)
     return 0;
-  return 1;
+  if (io_priority < G_PRIORITY_DEFAULT_IDLE)
+    return 1;
+  if (io_priority < G_PRIORITY_LOW)
+    return 2;
+  return 3;
 }
 
-static gpointer
-init_scheduler (gpointer arg)
+static void
+histogram_add (guint64 *histogram,
+	       gint64   usec)
 {
-  if (job_thread_pool == NULL)
-    {
-      /* TODO: thread_pool_new can fail */
-      job_thread_pool = g_thread_pool_new (io_job_thread,
-					   NULL,
-					   10,
-					   FALSE,
-					   NULL);
-      if (job_thread_pool != NULL)
-	{
-	  g_thread_pool_set_sort_function (job_thread_pool,
-					   g_io_job_compare,
-					   NULL);
-	  /* It's kinda weird that this is a global setting
-	   * instead of per threadpool. However, we really
-	   * want to cache some threads, but not keep around
-	   * those threads forever. */
-	  g_thread_pool_set_max_idle_time (15 * 1000);
-	  g_thread_pool_set_max_unused_threads (2);
-	}
-    }
-  return NULL;
+  histogram[MIN (g_bit_storage (MAX (usec, 0)), HISTOGRAM_BUCKETS - 1)]++;
 }
 
 static void
-remove_active_job (GIOSchedulerJob *job)
+active_list_add (GIOSchedulerJob **list,
+		 GIOSchedulerJob  *job)
 {
-  GIOSchedulerJob *other_job;
-  GSList *l;
-  gboolean resort_jobs;
-  
-  G_LOCK (active_jobs);
-  active_jobs = g_slist_delete_link (active_jobs, job->active_link);
-  
-  resort_jobs = FALSE;
-  for (l = active_jobs; l != NULL; l = l->next)
+  job->active_prev = NULL;
+  job->active_next = *list;
+  if (*list)
+    (*list)->active_prev = job;
+  *list = job;
+}
+
+static void
+active_list_remove (GIOSchedulerJob **list,
+		    GIOSchedulerJob  *job)
+{
+  if (job->active_prev)
+    job->active_prev->active_next = job->active_next;
+  else
+    *list = job->active_next;
+  if (job->active_next)
+    job->active_next->active_prev = job->active_prev;
+}
+
+static gpointer
+init_scheduler (gpointer arg)
+{
+  gint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (pools); i++)
     {
-      other_job = l->data;
-      if (other_job->io_priority >= 0 &&
-	  g_cancellable_is_cancelled (other_job->cancellable))
+      pools[i].lock = g_mutex_new ();
+      pools[i].cond = g_cond_new ();
+      for (j = 0; j < MAX_THREADS_PER_POOL; j++)
 	{
-	  other_job->io_priority = -1;
-	  resort_jobs = TRUE;
+	  pools[i].slots[j].pool = &pools[i];
+	  pools[i].slots[j].lock = g_mutex_new ();
 	}
     }
-  G_UNLOCK (active_jobs);
-  
-  if (resort_jobs &&
-      job_thread_pool != NULL)
-    g_thread_pool_set_sort_function (job_thread_pool,
-				     g_io_job_compare,
-				     NULL);
 
+  return NULL;
 }
 
 static void
@@ -162,17 +217,82 @@ job_destroy (gpointer data)
   if (job->destroy_notify)
     job->destroy_notify (job->data);
 
-  remove_active_job (job);
+  if (job->slot)
+    {
+      g_mutex_lock (job->slot->lock);
+      active_list_remove (&job->slot->active_jobs, job);
+      g_mutex_unlock (job->slot->lock);
+    }
+  else
+    {
+      G_LOCK (active_jobs);
+      active_list_remove (&active_jobs, job);
+      G_UNLOCK (active_jobs);
+    }
+
   g_io_job_free (job);
 }
 
+static GIOSchedulerJob *
+slot_take_job (WorkerSlot *slot,
+	       gint        band)
+{
+  GIOSchedulerJob *job;
+
+  if (g_atomic_int_get (&slot->n_queued[band]) == 0)
+    return NULL;
+
+  g_mutex_lock (slot->lock);
+  job = g_queue_pop_head (&slot->queues[band]);
+  if (job)
+    g_atomic_int_add (&slot->n_queued[band], -1);
+  g_mutex_unlock (slot->lock);
+
+  if (job)
+    g_atomic_int_add (&slot->pool->n_queued, -1);
+
+  return job;
+}
+
+static GIOSchedulerJob *
+take_job (WorkerSlot *self)
+{
+  SchedulerPool *pool = self->pool;
+  GIOSchedulerJob *job;
+  gint index, band, i;
+
+  index = self - pool->slots;
+
+  for (band = 0; band < N_PRIORITY_BANDS; band++)
+    {
+      job = slot_take_job (self, band);
+      if (job)
+	return job;
+
+      for (i = 1; i < MAX_THREADS_PER_POOL; i++)
+	{
+	  job = slot_take_job (&pool->slots[(index + i) % MAX_THREADS_PER_POOL], band);
+	  if (job)
+	    {
+	      self->n_stolen++;
+	      return job;
+	    }
+	}
+    }
+
+  return NULL;
+}
+
 static void
-io_job_thread (gpointer data,
-	       gpointer user_data)
+run_job (WorkerSlot      *slot,
+	 GIOSchedulerJob *job)
 {
-  GIOSchedulerJob *job = data;
+  gint64 start;
   gboolean result;
 
+  start = g_get_monotonic_time ();
+  histogram_add (slot->queue_wait, start - job->push_time);
+
   if (job->cancellable)
     g_cancellable_push_current (job->cancellable);
 
@@ -186,6 +306,161 @@ io_job_thread (gpointer data,
     g_cancellable_pop_current (job->cancellable);
 
   job_destroy (job);
+
+  slot->n_run++;
+  histogram_add (slot->run_time, g_get_monotonic_time () - start);
+}
+
+static gpointer
+io_job_thread (gpointer data)
+{
+  WorkerSlot *slot = data;
+  SchedulerPool *pool = slot->pool;
+  GIOSchedulerJob *job;
+  GTimeVal end_time;
+  gboolean timed_out;
+
+  g_static_private_set (&current_slot, slot, NULL);
+
+  while (TRUE)
+    {
+      job = take_job (slot);
+      if (job)
+	{
+	  run_job (slot, job);
+	  continue;
+	}
+
+      /* Register as idle before looking at n_queued, and pushers
+       * bump n_queued before looking at n_idle, so one of us
+       * always notices the other.  A pusher waking us up takes us
+       * off n_idle itself, so that the next one doesn't count on
+       * us as well.
+       */
+      g_mutex_lock (pool->lock);
+      g_atomic_int_inc (&pool->n_idle);
+      timed_out = FALSE;
+      if (g_atomic_int_get (&pool->n_queued) == 0)
+	{
+	  g_get_current_time (&end_time);
+	  g_time_val_add (&end_time, MAX_IDLE_TIME * G_USEC_PER_SEC);
+	  while (pool->n_wakeups == 0 && !timed_out)
+	    timed_out = !g_cond_timed_wait (pool->cond, pool->lock, &end_time);
+
+	  if (pool->n_wakeups > 0)
+	    {
+	      pool->n_wakeups--;
+	      timed_out = FALSE;
+	    }
+	  else
+	    g_atomic_int_add (&pool->n_idle, -1);
+	}
+      else
+	g_atomic_int_add (&pool->n_idle, -1);
+
+      if (timed_out)
+	{
+	  /* Same dance for exiting: a pusher that doesn't see us
+	   * idle will start a new worker.
+	   */
+	  g_atomic_int_add (&pool->n_workers, -1);
+	  if (g_atomic_int_get (&pool->n_queued) == 0)
+	    {
+	      slot->has_worker = FALSE;
+	      g_mutex_unlock (pool->lock);
+	      break;
+	    }
+	  g_atomic_int_inc (&pool->n_workers);
+	}
+      g_mutex_unlock (pool->lock);
+    }
+
+  return NULL;
+}
+
+/* Must be called with the pool lock held */
+static void
+start_worker (SchedulerPool *pool)
+{
+  WorkerSlot *slot;
+  GError *error = NULL;
+  gint i;
+
+  slot = NULL;
+  for (i = 0; i < MAX_THREADS_PER_POOL; i++)
+    if (!pool->slots[i].has_worker)
+      {
+	slot = &pool->slots[i];
+	break;
+      }
+
+  if (slot == NULL)
+    return;
+
+  slot->has_worker = TRUE;
+  g_atomic_int_inc (&pool->n_workers);
+
+  if (!g_thread_create (io_job_thread, slot, FALSE, &error))
+    {
+      g_warning ("Unable to start an I/O thread: %s", error->message);
+      g_error_free (error);
+      slot->has_worker = FALSE;
+      g_atomic_int_add (&pool->n_workers, -1);
+    }
+}
+
+static void
+pool_push_job (SchedulerPool   *pool,
+	       GIOSchedulerJob *job)
+{
+  WorkerSlot *slot;
+  GQueue *queue;
+  GList *l;
+  gint band;
+
+  slot = g_static_private_get (&current_slot);
+  if (slot == NULL || slot->pool != pool)
+    slot = &pool->slots[(guint) g_atomic_int_exchange_and_add (&pool->next_slot, 1) %
+			MAX_THREADS_PER_POOL];
+
+  band = priority_band (job->io_priority);
+  queue = &slot->queues[band];
+
+  g_mutex_lock (slot->lock);
+  job->slot = slot;
+  active_list_add (&slot->active_jobs, job);
+
+  /* Keep the band sorted, FIFO among equal priorities; most jobs
+   * in a band share their priority, so this rarely walks at all.
+   */
+  for (l = queue->tail; l != NULL; l = l->prev)
+    if (((GIOSchedulerJob *) l->data)->io_priority <= job->io_priority)
+      break;
+  if (l == NULL)
+    g_queue_push_head (queue, job);
+  else if (l == queue->tail)
+    g_queue_push_tail (queue, job);
+  else
+    g_queue_insert_after (queue, l, job);
+  g_atomic_int_inc (&slot->n_queued[band]);
+  g_mutex_unlock (slot->lock);
+
+  g_atomic_int_inc (&pool->n_queued);
+
+  if (g_atomic_int_get (&pool->n_idle) > 0 ||
+      g_atomic_int_get (&pool->n_workers) < MAX_THREADS_PER_POOL)
+    {
+      g_mutex_lock (pool->lock);
+      if (g_atomic_int_get (&pool->n_idle) > 0)
+	{
+	  g_atomic_int_add (&pool->n_idle, -1);
+	  pool->n_wakeups++;
+	  g_cond_signal (pool->cond);
+	}
+      else
+	start_worker (pool);
+      g_mutex_unlock (pool->lock);
+    }
 }
 
 static gboolean
@@ -229,13 +504,34 @@ g_io_scheduler_push_job (GIOSchedulerJobFunc  job_func,
 			 GDestroyNotify       notify,
 			 gint                 io_priority,
 			 GCancellable        *cancellable)
+{
+  _g_io_scheduler_push_job_to_pool (G_IO_SCHEDULER_POOL_LOCAL,
+				    job_func, user_data, notify,
+				    io_priority, cancellable);
+}
+
+/*
+ * _g_io_scheduler_push_job_to_pool:
+ * @pool: the pool to run the job in
+ *
+ * Like g_io_scheduler_push_job(), but jobs pushed to different pools
+ * run on different threads, so that jobs that block for a long time
+ * (such as operations on remote mounts) don't delay the others.
+ */
+void
+_g_io_scheduler_push_job_to_pool (GIOSchedulerPool     pool,
+				  GIOSchedulerJobFunc  job_func,
+				  gpointer             user_data,
+				  GDestroyNotify       notify,
+				  gint                 io_priority,
+				  GCancellable        *cancellable)
 {
   static GOnce once_init = G_ONCE_INIT;
   GIOSchedulerJob *job;
 
   g_return_if_fail (job_func != NULL);
 
-  job = g_new0 (GIOSchedulerJob, 1);
+  job = g_slice_new0 (GIOSchedulerJob);
   job->job_func = job_func;
   job->data = user_data;
   job->destroy_notify = notify;
@@ -248,18 +544,18 @@ g_io_scheduler_push_job (GIOSchedulerJobFunc  job_func,
   if (job->context)
     g_main_context_ref (job->context);
 
-  G_LOCK (active_jobs);
-  active_jobs = g_slist_prepend (active_jobs, job);
-  job->active_link = active_jobs;
-  G_UNLOCK (active_jobs);
-
   if (g_thread_supported())
     {
       g_once (&once_init, init_scheduler, NULL);
-      g_thread_pool_push (job_thread_pool, job, NULL);
+      job->push_time = g_get_monotonic_time ();
+      pool_push_job (&pools[pool], job);
     }
   else
     {
+      G_LOCK (active_jobs);
+      active_list_add (&active_jobs, job);
+      G_UNLOCK (active_jobs);
+
       /* Threads not available, instead do the i/o sync inside a
        * low prio idle handler
        */
@@ -269,6 +565,35 @@ g_io_scheduler_push_job (GIOSchedulerJobFunc  job_func,
     }
 }
 
+/*
+ * _g_io_scheduler_pool_for_object:
+ * @object: (allow-none): the source object of an operation
+ *
+ * Returns: %G_IO_SCHEDULER_POOL_REMOTE if @object is a #GFile, or
+ *     a #GFileEnumerator of a #GFile, that isn't native,
+ *     %G_IO_SCHEDULER_POOL_LOCAL otherwise.
+ */
+GIOSchedulerPool
+_g_io_scheduler_pool_for_object (GObject *object)
+{
+  GFile *file;
+
+  if (object == NULL)
+    return G_IO_SCHEDULER_POOL_LOCAL;
+
+  if (G_IS_FILE (object))
+    file = G_FILE (object);
+  else if (G_IS_FILE_ENUMERATOR (object))
+    file = g_file_enumerator_get_container (G_FILE_ENUMERATOR (object));
+  else
+    file = NULL;
+
+  if (file != NULL && !g_file_is_native (file))
+    return G_IO_SCHEDULER_POOL_REMOTE;
+
+  return G_IO_SCHEDULER_POOL_LOCAL;
+}
+
 /**
  * g_io_scheduler_cancel_all_jobs:
  * 
@@ -281,17 +606,35 @@ void
 g_io_scheduler_cancel_all_jobs (void)
 {
   GSList *cancellable_list, *l;
+  GIOSchedulerJob *job;
+  gint i, j;
   
-  G_LOCK (active_jobs);
   cancellable_list = NULL;
-  for (l = active_jobs; l != NULL; l = l->next)
+
+  G_LOCK (active_jobs);
+  for (job = active_jobs; job != NULL; job = job->active_next)
+    if (job->cancellable)
+      cancellable_list = g_slist_prepend (cancellable_list,
+					  g_object_ref (job->cancellable));
+  G_UNLOCK (active_jobs);
+
+  for (i = 0; i < G_N_ELEMENTS (pools); i++)
     {
-      GIOSchedulerJob *job = l->data;
-      if (job->cancellable)
-	cancellable_list = g_slist_prepend (cancellable_list,
-					    g_object_ref (job->cancellable));
+      if (pools[i].lock == NULL)
+	continue;
+
+      for (j = 0; j < MAX_THREADS_PER_POOL; j++)
+	{
+	  WorkerSlot *slot = &pools[i].slots[j];
+
+	  g_mutex_lock (slot->lock);
+	  for (job = slot->active_jobs; job != NULL; job = job->active_next)
+	    if (job->cancellable)
+	      cancellable_list = g_slist_prepend (cancellable_list,
+						  g_object_ref (job->cancellable));
+	  g_mutex_unlock (slot->lock);
+	}
     }
-  G_UNLOCK (active_jobs);
 
   for (l = cancellable_list; l != NULL; l = l->next)
     {
@@ -302,6 +645,114 @@ g_io_scheduler_cancel_all_jobs (void)
   g_slist_free (cancellable_list);
 }
 
+static GVariant *
+histogram_to_variant (const guint64 *histogram)
+{
+  GVariantBuilder buckets;
+  gint i;
+
+  g_variant_builder_init (&buckets, G_VARIANT_TYPE ("at"));
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    g_variant_builder_add (&buckets, "t", histogram[i]);
+
+  return g_variant_builder_end (&buckets);
+}
+
+/**
+ * g_io_scheduler_get_statistics:
+ *
+ * Gets statistics about the threads running I/O jobs, as a dictionary
+ * of type <literal>a{sv}</literal>. Jobs are run by two separate pools
+ * of threads, one for local I/O and one for remote mounts; the
+ * dictionary has a <literal>local</literal> and a <literal>remote</literal>
+ * key, each holding an <literal>a{sv}</literal> dictionary with the
+ * following keys:
+ * <variablelist>
+ *   <varlistentry><term>threads (u)</term>
+ *     <listitem><para>the number of threads in the pool</para></listitem></varlistentry>
+ *   <varlistentry><term>max-threads (u)</term>
+ *     <listitem><para>the maximum number of threads in the pool</para></listitem></varlistentry>
+ *   <varlistentry><term>idle-threads (u)</term>
+ *     <listitem><para>threads waiting for a job</para></listitem></varlistentry>
+ *   <varlistentry><term>jobs-queued (u)</term>
+ *     <listitem><para>jobs waiting for a thread</para></listitem></varlistentry>
+ *   <varlistentry><term>jobs-run (t)</term>
+ *     <listitem><para>jobs that have completed</para></listitem></varlistentry>
+ *   <varlistentry><term>jobs-stolen (t)</term>
+ *     <listitem><para>jobs run by another thread than the one they
+ *     were queued for</para></listitem></varlistentry>
+ *   <varlistentry><term>queue-wait-histogram (at)</term>
+ *     <listitem><para>how long jobs waited before starting; element n
+ *     counts waits of less than 2<superscript>n</superscript> microseconds
+ *     that did not fit an earlier element</para></listitem></varlistentry>
+ *   <varlistentry><term>run-time-histogram (at)</term>
+ *     <listitem><para>how long jobs took to run, in the same
+ *     format</para></listitem></varlistentry>
+ * </variablelist>
+ *
+ * The counters are gathered all the time without any locking, so
+ * they are cheap but only approximate while jobs are running. Jobs run
+ * at idle because threads are not available aren't counted.
+ *
+ * Returns: (transfer full): a #GVariant dictionary, free with
+ *     g_variant_unref().
+ *
+ * Since: 2.30
+ **/
+GVariant *
+g_io_scheduler_get_statistics (void)
+{
+  GVariantBuilder builder;
+  gint i, j, k;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  for (i = 0; i < G_N_ELEMENTS (pools); i++)
+    {
+      SchedulerPool *pool = &pools[i];
+      GVariantBuilder pool_builder;
+      guint64 queue_wait[HISTOGRAM_BUCKETS] = { 0, };
+      guint64 run_time[HISTOGRAM_BUCKETS] = { 0, };
+      guint64 n_run = 0, n_stolen = 0;
+
+      for (j = 0; j < MAX_THREADS_PER_POOL; j++)
+	{
+	  WorkerSlot *slot = &pool->slots[j];
+
+	  n_run += slot->n_run;
+	  n_stolen += slot->n_stolen;
+	  for (k = 0; k < HISTOGRAM_BUCKETS; k++)
+	    {
+	      queue_wait[k] += slot->queue_wait[k];
+	      run_time[k] += slot->run_time[k];
+	    }
+	}
+
+      g_variant_builder_init (&pool_builder, G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (&pool_builder, "{sv}", "threads",
+			     g_variant_new_uint32 (g_atomic_int_get (&pool->n_workers)));
+      g_variant_builder_add (&pool_builder, "{sv}", "max-threads",
+			     g_variant_new_uint32 (MAX_THREADS_PER_POOL));
+      g_variant_builder_add (&pool_builder, "{sv}", "idle-threads",
+			     g_variant_new_uint32 (g_atomic_int_get (&pool->n_idle)));
+      g_variant_builder_add (&pool_builder, "{sv}", "jobs-queued",
+			     g_variant_new_uint32 (g_atomic_int_get (&pool->n_queued)));
+      g_variant_builder_add (&pool_builder, "{sv}", "jobs-run",
+			     g_variant_new_uint64 (n_run));
+      g_variant_builder_add (&pool_builder, "{sv}", "jobs-stolen",
+			     g_variant_new_uint64 (n_stolen));
+      g_variant_builder_add (&pool_builder, "{sv}", "queue-wait-histogram",
+			     histogram_to_variant (queue_wait));
+      g_variant_builder_add (&pool_builder, "{sv}", "run-time-histogram",
+			     histogram_to_variant (run_time));
+
+      g_variant_builder_add (&builder, "{sv}", pool->name,
+			     g_variant_builder_end (&pool_builder));
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 typedef struct {
   GSourceFunc func;
   gboolean ret_val;
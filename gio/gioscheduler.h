@@ -47,6 +47,8 @@ void     g_io_scheduler_job_send_to_mainloop_async (GIOSchedulerJob     *job,
 						    gpointer             user_data,
 						    GDestroyNotify       notify);
 
+GVariant *g_io_scheduler_get_statistics            (void);
+
 G_END_DECLS
 
 #endif /* __G_IO_SCHEDULER_H__ */
@@ -276,6 +276,28 @@ typedef gboolean (* GFileReadMoreCallback) (const char *file_contents,
                                             goffset file_size,
                                             gpointer callback_data);
 
+/**
+ * GFileQueryInfoChunkCallback:
+ * @files: (array length=n_files): the files in this chunk
+ * @infos: (array length=n_files): the #GFileInfo of each of @files, or
+ *     %NULL where it could not be queried
+ * @errors: (array length=n_files): the error for each of @files whose
+ *     info is %NULL
+ * @n_files: the number of files in this chunk
+ * @user_data: user data passed to g_file_query_info_multiple_async()
+ *
+ * Receives a chunk of results from g_file_query_info_multiple_async().
+ * The arrays and their contents are only valid during the call; take a
+ * reference to the infos you want to keep.
+ *
+ * Since: 2.30
+ **/
+typedef void (* GFileQueryInfoChunkCallback) (GFile      **files,
+                                              GFileInfo  **infos,
+                                              GError     **errors,
+                                              guint        n_files,
+                                              gpointer     user_data);
+
 
 /**
  * GIOSchedulerJobFunc:
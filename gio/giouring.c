@@ -0,0 +1,599 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "giouring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/* Asynchronous local file I/O through io_uring.
+ *
+ * Every GMainContext that issues requests gets its own ring, owned by
+ * a GSource attached to that context.  The ring file descriptor is
+ * polled by the main loop, so completions are dispatched in the same
+ * context (and thread) that issued the request, without any helper
+ * thread.  When the owner of the context is the one submitting, the
+ * io_uring_enter() call is postponed to the next prepare() so that all
+ * requests issued during one main loop iteration go to the kernel with
+ * a single system call.
+ *
+ * If the kernel doesn't support io_uring (or GIO_DISABLE_IO_URING is
+ * set) the request functions return %FALSE and the caller is expected
+ * to fall back to its thread based implementation.
+ *
+ * Requests can't be cancelled once queued, so they are only meant for
+ * regular files, see _g_io_uring_supports_fd().  If the context goes
+ * away with requests still in flight, the ring waits for them when it
+ * is finalized and calls their callbacks from there; those that could
+ * not be submitted get -ECANCELED.
+ */
+
+#define RING_ENTRIES 256
+
+typedef struct {
+  GIOUringCallback callback;
+  gpointer user_data;
+  struct iovec iov;
+  GList *link;        /* in ring->in_flight */
+} IOUringRequest;
+
+typedef struct {
+  GSource source;
+  GPollFD pollfd;
+  GMainContext *context;
+
+  /* protects everything below */
+  GMutex *lock;
+
+  int ring_fd;
+  guint n_unsubmitted;
+  GQueue in_flight;
+
+  gpointer sq_ptr;
+  gsize sq_size;
+  gpointer cq_ptr;
+  gsize cq_size;
+  struct io_uring_sqe *sqes;
+  gsize sqes_size;
+
+  guint sq_entries;
+  volatile guint *sq_head;
+  volatile guint *sq_tail;
+  guint sq_mask;
+  guint *sq_array;
+
+  guint cq_entries;
+  volatile guint *cq_head;
+  volatile guint *cq_tail;
+  guint cq_mask;
+  struct io_uring_cqe *cqes;
+} IOUringSource;
+
+G_LOCK_DEFINE_STATIC (rings);
+static GHashTable *rings = NULL;
+static gboolean io_uring_unsupported = FALSE;
+
+static int
+io_uring_setup (guint                   entries,
+                struct io_uring_params *params)
+{
+  return syscall (__NR_io_uring_setup, entries, params);
+}
+
+static int
+io_uring_enter (int   ring_fd,
+                guint to_submit,
+                guint min_complete,
+                guint flags)
+{
+  return syscall (__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                  flags, NULL, 0);
+}
+
+/* Must be called with the ring lock held */
+static void
+ring_flush (IOUringSource *ring)
+{
+  while (ring->n_unsubmitted > 0)
+    {
+      int res;
+
+      res = io_uring_enter (ring->ring_fd, ring->n_unsubmitted, 0, 0);
+      if (res < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          /* EAGAIN or EBUSY: the kernel is short on resources or the
+           * completion queue is full; retry from the next prepare().
+           */
+          break;
+        }
+
+      ring->n_unsubmitted -= MIN ((guint) res, ring->n_unsubmitted);
+      if (res == 0)
+        break;
+    }
+}
+
+static gboolean
+ring_has_completions (IOUringSource *ring)
+{
+  guint head, tail;
+
+  head = *ring->cq_head;
+  tail = *ring->cq_tail;
+  __sync_synchronize ();
+
+  return head != tail;
+}
+
+static gboolean
+ring_source_prepare (GSource *source,
+                     gint    *timeout)
+{
+  IOUringSource *ring = (IOUringSource *) source;
+  gboolean ready;
+
+  g_mutex_lock (ring->lock);
+  if (ring->n_unsubmitted > 0)
+    ring_flush (ring);
+  ready = ring_has_completions (ring);
+  g_mutex_unlock (ring->lock);
+
+  *timeout = -1;
+
+  return ready;
+}
+
+static gboolean
+ring_source_check (GSource *source)
+{
+  IOUringSource *ring = (IOUringSource *) source;
+  gboolean ready;
+
+  g_mutex_lock (ring->lock);
+  ready = ring_has_completions (ring);
+  g_mutex_unlock (ring->lock);
+
+  return ready;
+}
+
+static gboolean
+ring_source_dispatch (GSource     *source,
+                      GSourceFunc  callback,
+                      gpointer     user_data)
+{
+  IOUringSource *ring = (IOUringSource *) source;
+  guint head, tail;
+
+  g_mutex_lock (ring->lock);
+  head = *ring->cq_head;
+  tail = *ring->cq_tail;
+  __sync_synchronize ();
+  g_mutex_unlock (ring->lock);
+
+  /* Only reap what was there when we started, so that callbacks
+   * issuing new requests which complete inline can't starve the
+   * rest of the main loop.
+   */
+  while (head != tail)
+    {
+      IOUringRequest *request;
+      struct io_uring_cqe *cqe;
+      gssize result;
+
+      g_mutex_lock (ring->lock);
+      cqe = &ring->cqes[head & ring->cq_mask];
+      request = (IOUringRequest *) (gsize) cqe->user_data;
+      result = cqe->res;
+      head++;
+      __sync_synchronize ();
+      *ring->cq_head = head;
+      g_queue_delete_link (&ring->in_flight, request->link);
+      g_mutex_unlock (ring->lock);
+
+      request->callback (result, request->user_data);
+      g_slice_free (IOUringRequest, request);
+    }
+
+  return TRUE;
+}
+
+static void
+ring_source_finalize (GSource *source)
+{
+  IOUringSource *ring = (IOUringSource *) source;
+  IOUringRequest *request;
+  struct io_uring_cqe *cqe;
+  gssize result;
+
+  G_LOCK (rings);
+  if (rings != NULL &&
+      g_hash_table_lookup (rings, ring->context) == ring)
+    g_hash_table_remove (rings, ring->context);
+  G_UNLOCK (rings);
+
+  /* The callers of the requests still in flight are waiting for them,
+   * and the kernel may still be using their buffers, so wait for the
+   * submitted ones to complete; being on regular files, they don't
+   * take long.  Those the kernel never got are failed.
+   */
+  g_mutex_lock (ring->lock);
+  ring_flush (ring);
+  while (ring->in_flight.length > ring->n_unsubmitted)
+    {
+      if (!ring_has_completions (ring))
+        {
+          if (io_uring_enter (ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+              errno != EINTR)
+            break;
+          continue;
+        }
+
+      cqe = &ring->cqes[*ring->cq_head & ring->cq_mask];
+      request = (IOUringRequest *) (gsize) cqe->user_data;
+      result = cqe->res;
+      __sync_synchronize ();
+      *ring->cq_head = *ring->cq_head + 1;
+      g_queue_delete_link (&ring->in_flight, request->link);
+      g_mutex_unlock (ring->lock);
+
+      request->callback (result, request->user_data);
+      g_slice_free (IOUringRequest, request);
+
+      g_mutex_lock (ring->lock);
+    }
+
+  while ((request = g_queue_pop_head (&ring->in_flight)) != NULL)
+    {
+      g_mutex_unlock (ring->lock);
+
+      request->callback (-ECANCELED, request->user_data);
+      g_slice_free (IOUringRequest, request);
+
+      g_mutex_lock (ring->lock);
+    }
+  g_mutex_unlock (ring->lock);
+
+  munmap (ring->sqes, ring->sqes_size);
+  if (ring->cq_ptr != ring->sq_ptr)
+    munmap (ring->cq_ptr, ring->cq_size);
+  munmap (ring->sq_ptr, ring->sq_size);
+  close (ring->ring_fd);
+  g_mutex_free (ring->lock);
+}
+
+static GSourceFuncs ring_source_funcs = {
+  ring_source_prepare,
+  ring_source_check,
+  ring_source_dispatch,
+  ring_source_finalize
+};
+
+static IOUringSource *
+ring_new (GMainContext *context)
+{
+  struct io_uring_params params;
+  IOUringSource *ring;
+  gpointer sq_ptr, cq_ptr, sqes;
+  gsize sq_size, cq_size, sqes_size;
+  int fd;
+
+  memset (&params, 0, sizeof (params));
+  fd = io_uring_setup (RING_ENTRIES, &params);
+  if (fd < 0)
+    return NULL;
+
+  /* We rely on the kernel tracking the file position for us (offset -1),
+   * which is what makes these requests a drop-in for read() and write().
+   */
+  if ((params.features & IORING_FEAT_RW_CUR_POS) == 0)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof (guint);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    sq_size = cq_size = MAX (sq_size, cq_size);
+
+  sq_ptr = mmap (NULL, sq_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    cq_ptr = sq_ptr;
+  else
+    {
+      cq_ptr = mmap (NULL, cq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq_ptr == MAP_FAILED)
+        {
+          munmap (sq_ptr, sq_size);
+          close (fd);
+          return NULL;
+        }
+    }
+
+  sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+  sqes = mmap (NULL, sqes_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    {
+      if (cq_ptr != sq_ptr)
+        munmap (cq_ptr, cq_size);
+      munmap (sq_ptr, sq_size);
+      close (fd);
+      return NULL;
+    }
+
+  ring = (IOUringSource *) g_source_new (&ring_source_funcs, sizeof (IOUringSource));
+  ring->context = context;
+  ring->lock = g_mutex_new ();
+  ring->ring_fd = fd;
+  g_queue_init (&ring->in_flight);
+
+  ring->sq_ptr = sq_ptr;
+  ring->sq_size = sq_size;
+  ring->cq_ptr = cq_ptr;
+  ring->cq_size = cq_size;
+  ring->sqes = sqes;
+  ring->sqes_size = sqes_size;
+
+  ring->sq_entries = params.sq_entries;
+  ring->sq_head = (guint *) ((char *) sq_ptr + params.sq_off.head);
+  ring->sq_tail = (guint *) ((char *) sq_ptr + params.sq_off.tail);
+  ring->sq_mask = *(guint *) ((char *) sq_ptr + params.sq_off.ring_mask);
+  ring->sq_array = (guint *) ((char *) sq_ptr + params.sq_off.array);
+
+  ring->cq_entries = params.cq_entries;
+  ring->cq_head = (guint *) ((char *) cq_ptr + params.cq_off.head);
+  ring->cq_tail = (guint *) ((char *) cq_ptr + params.cq_off.tail);
+  ring->cq_mask = *(guint *) ((char *) cq_ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((char *) cq_ptr + params.cq_off.cqes);
+
+  ring->pollfd.fd = fd;
+  ring->pollfd.events = G_IO_IN;
+  g_source_add_poll ((GSource *) ring, &ring->pollfd);
+  g_source_set_priority ((GSource *) ring, G_PRIORITY_DEFAULT);
+  g_source_set_can_recurse ((GSource *) ring, TRUE);
+
+  return ring;
+}
+
+/* Returns the ring of the current thread-default context, creating it if
+ * needed.  The context holds the only reference to the ring; the returned
+ * pointer is valid as long as the caller keeps the context alive.
+ */
+static IOUringSource *
+get_ring (GMainContext **context_out)
+{
+  GMainContext *context;
+  IOUringSource *ring;
+
+  if (!g_thread_supported ())
+    return NULL;
+
+  context = g_main_context_get_thread_default ();
+  if (context == NULL)
+    context = g_main_context_default ();
+  *context_out = context;
+
+  G_LOCK (rings);
+
+  if (io_uring_unsupported)
+    {
+      G_UNLOCK (rings);
+      return NULL;
+    }
+
+  if (rings == NULL)
+    rings = g_hash_table_new (NULL, NULL);
+
+  ring = g_hash_table_lookup (rings, context);
+  if (ring == NULL)
+    {
+      /* Checked per context rather than once, so that it's possible to
+       * compare both code paths in the same process.
+       */
+      if (g_getenv ("GIO_DISABLE_IO_URING") != NULL)
+        {
+          G_UNLOCK (rings);
+          return NULL;
+        }
+
+      ring = ring_new (context);
+      if (ring == NULL)
+        {
+          /* No io_uring in this kernel (or we're not allowed to use
+           * it); don't try again.
+           */
+          io_uring_unsupported = TRUE;
+          G_UNLOCK (rings);
+          return NULL;
+        }
+
+      g_hash_table_insert (rings, context, ring);
+      g_source_attach ((GSource *) ring, context);
+      g_source_unref ((GSource *) ring);
+    }
+
+  G_UNLOCK (rings);
+
+  return ring;
+}
+
+static gboolean
+queue_request (int               opcode,
+               int               fd,
+               gpointer          buffer,
+               gsize             count,
+               GIOUringCallback  callback,
+               gpointer          user_data)
+{
+  GMainContext *context;
+  IOUringSource *ring;
+  IOUringRequest *request;
+  struct io_uring_sqe *sqe;
+  guint head, tail, index;
+
+  ring = get_ring (&context);
+  if (ring == NULL)
+    return FALSE;
+
+  g_mutex_lock (ring->lock);
+
+  /* Never have more requests in flight than the completion queue can
+   * hold; the caller falls back to a thread in that case.
+   */
+  if (ring->in_flight.length >= ring->cq_entries)
+    {
+      g_mutex_unlock (ring->lock);
+      return FALSE;
+    }
+
+  head = *ring->sq_head;
+  tail = *ring->sq_tail;
+  __sync_synchronize ();
+  if (tail - head >= ring->sq_entries)
+    {
+      ring_flush (ring);
+      head = *ring->sq_head;
+      __sync_synchronize ();
+      if (tail - head >= ring->sq_entries)
+        {
+          g_mutex_unlock (ring->lock);
+          return FALSE;
+        }
+    }
+
+  request = g_slice_new (IOUringRequest);
+  request->callback = callback;
+  request->user_data = user_data;
+  request->iov.iov_base = buffer;
+  request->iov.iov_len = MIN (count, G_MAXINT);
+  g_queue_push_tail (&ring->in_flight, request);
+  request->link = g_queue_peek_tail_link (&ring->in_flight);
+
+  index = tail & ring->sq_mask;
+  sqe = &ring->sqes[index];
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = (guint64) -1;
+  sqe->addr = (guint64) (gsize) &request->iov;
+  sqe->len = 1;
+  sqe->user_data = (guint64) (gsize) request;
+
+  ring->sq_array[index] = index;
+  __sync_synchronize ();
+  *ring->sq_tail = tail + 1;
+
+  ring->n_unsubmitted++;
+
+  /* If the context is being iterated by someone else (or not at all)
+   * there's no prepare() we can rely on coming soon, so submit now.
+   */
+  if (!g_main_context_is_owner (context))
+    ring_flush (ring);
+
+  g_mutex_unlock (ring->lock);
+
+  return TRUE;
+}
+
+/* Whether @fd is a regular file.  Reads and writes on pipes, sockets
+ * or devices can block indefinitely, and a queued request would then
+ * outlive any cancellation of the operation.
+ */
+gboolean
+_g_io_uring_supports_fd (int fd)
+{
+  struct stat buf;
+
+  return fstat (fd, &buf) == 0 && S_ISREG (buf.st_mode);
+}
+
+gboolean
+_g_io_uring_read (int               fd,
+                  void             *buffer,
+                  gsize             count,
+                  GIOUringCallback  callback,
+                  gpointer          user_data)
+{
+  return queue_request (IORING_OP_READV, fd, buffer, count,
+                        callback, user_data);
+}
+
+gboolean
+_g_io_uring_write (int               fd,
+                   const void       *buffer,
+                   gsize             count,
+                   GIOUringCallback  callback,
+                   gpointer          user_data)
+{
+  return queue_request (IORING_OP_WRITEV, fd, (gpointer) buffer, count,
+                        callback, user_data);
+}
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+gboolean
+_g_io_uring_supports_fd (int fd)
+{
+  return FALSE;
+}
+
+gboolean
+_g_io_uring_read (int               fd,
+                  void             *buffer,
+                  gsize             count,
+                  GIOUringCallback  callback,
+                  gpointer          user_data)
+{
+  return FALSE;
+}
+
+gboolean
+_g_io_uring_write (int               fd,
+                   const void       *buffer,
+                   gsize             count,
+                   GIOUringCallback  callback,
+                   gpointer          user_data)
+{
+  return FALSE;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
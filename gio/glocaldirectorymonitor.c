@@ -24,6 +24,7 @@
 
 #include "glocaldirectorymonitor.h"
 #include "gunixmounts.h"
+#include "gunixmountsprivate.h"
 #include "giomodule-priv.h"
 #include "gfile.h"
 #include "gioerror.h"
@@ -128,18 +129,13 @@ g_local_directory_monitor_constructor (GType                  type,
       /*claim everything was mounted */
       local_monitor->was_mounted = TRUE;
 #else
-      GUnixMountEntry *mount;
-      
       /* Emulate unmount detection */
       
-      mount = g_unix_mount_at (local_monitor->dirname, NULL);
-      
-      local_monitor->was_mounted = mount != NULL;
-      
-      if (mount)
-        g_unix_mount_free (mount);
-
       local_monitor->mount_monitor = g_unix_mount_monitor_new ();
+      local_monitor->was_mounted =
+        _g_unix_mount_monitor_lookup (local_monitor->mount_monitor,
+                                      local_monitor->dirname) != NULL;
+
       g_signal_connect_object (local_monitor->mount_monitor, "mounts-changed",
 			       G_CALLBACK (mounts_changed), local_monitor, 0);
 #endif
@@ -193,22 +189,19 @@ mounts_changed (GUnixMountMonitor *mount_monitor,
                 gpointer           user_data)
 {
   GLocalDirectoryMonitor *local_monitor = user_data;
-  GUnixMountEntry *mount;
   gboolean is_mounted;
   GFile *file;
   
   /* Emulate unmount detection */
 #ifdef G_OS_WIN32
-  mount = NULL;
   /*claim everything was mounted */
   is_mounted = TRUE;
 #else  
-  mount = g_unix_mount_at (local_monitor->dirname, NULL);
-  
-  is_mounted = mount != NULL;
-  
-  if (mount)
-    g_unix_mount_free (mount);
+  /* The mount monitor has already read the new table, no need to
+   * parse it again for every directory being watched.
+   */
+  is_mounted = _g_unix_mount_monitor_lookup (mount_monitor,
+                                             local_monitor->dirname) != NULL;
 #endif
 
   if (local_monitor->was_mounted != is_mounted)
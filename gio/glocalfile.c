@@ -80,6 +80,7 @@
 #include "glocalfileoutputstream.h"
 #include "glocalfileiostream.h"
 #include "glocaldirectorymonitor.h"
+#include "glocaltreemonitor.h"
 #include "glocalfilemonitor.h"
 #include "gmountprivate.h"
 #include "gunixmounts.h"
@@ -1198,6 +1199,56 @@ g_local_file_query_info (GFile                *file,
   return info;
 }
 
+/* Gets the info of @n_files local files that all live in @dirname,
+ * looking up the directory only once. Used by
+ * g_file_query_info_multiple_async().
+ */
+void
+_g_local_file_query_info_in_dir (const char             *dirname,
+                                 GFile                 **files,
+                                 guint                   n_files,
+                                 GFileAttributeMatcher  *matcher,
+                                 GFileQueryInfoFlags     flags,
+                                 GFileInfo             **infos,
+                                 GError                **errors)
+{
+  GLocalParentFileInfo parent_info;
+  int dir_fd;
+  guint i;
+
+  dir_fd = -1;
+#ifdef HAVE_FSTATAT
+  if (_g_local_file_info_get_needs (matcher) != G_LOCAL_FILE_INFO_NEEDS_PATH)
+    dir_fd = g_open (dirname, O_RDONLY, 0);
+#endif
+  if (dir_fd == -1)
+    _g_local_file_info_get_parent_info (dirname, matcher, &parent_info);
+
+  for (i = 0; i < n_files; i++)
+    {
+      GLocalFile *local = G_LOCAL_FILE (files[i]);
+      char *basename;
+
+      basename = g_path_get_basename (local->filename);
+#ifdef HAVE_FSTATAT
+      if (dir_fd != -1)
+        infos[i] = _g_local_file_info_get_at (dir_fd, dirname, basename,
+                                              G_FILE_TYPE_UNKNOWN,
+                                              matcher, flags, &errors[i]);
+      else
+#endif
+        infos[i] = _g_local_file_info_get (basename, local->filename,
+                                           matcher, flags, &parent_info,
+                                           &errors[i]);
+      g_free (basename);
+    }
+
+  if (dir_fd != -1)
+    close (dir_fd);
+  else
+    _g_local_file_info_free_parent_info (&parent_info);
+}
+
 static GFileAttributeInfoList *
 g_local_file_query_settable_attributes (GFile         *file,
 					GCancellable  *cancellable,
@@ -2360,6 +2411,16 @@ g_local_file_monitor_file (GFile             *file,
   return _g_local_file_monitor_new (local_file->filename, flags, error);
 }
 
+static GFileMonitor*
+g_local_file_monitor_tree (GFile             *file,
+			   GFileMonitorFlags  flags,
+			   GCancellable      *cancellable,
+			   GError           **error)
+{
+  GLocalFile* local_file = G_LOCAL_FILE(file);
+  return _g_local_tree_monitor_new (local_file->filename, flags, error);
+}
+
 static void
 g_local_file_file_iface_init (GFileIface *iface)
 {
@@ -2402,6 +2463,7 @@ g_local_file_file_iface_init (GFileIface *iface)
   iface->move = g_local_file_move;
   iface->monitor_dir = g_local_file_monitor_dir;
   iface->monitor_file = g_local_file_monitor_file;
+  iface->monitor_tree = g_local_file_monitor_tree;
 
   iface->supports_thread_contexts = TRUE;
 }
@@ -46,6 +46,14 @@ GType   _g_local_file_get_type (void) G_GNUC_CONST;
 
 GFile * _g_local_file_new      (const char *filename);
 
+void    _g_local_file_query_info_in_dir (const char             *dirname,
+                                         GFile                 **files,
+                                         guint                   n_files,
+                                         GFileAttributeMatcher  *matcher,
+                                         GFileQueryInfoFlags     flags,
+                                         GFileInfo             **infos,
+                                         GError                **errors);
+
 G_END_DECLS
 
 #endif /* __G_LOCAL_FILE_H__ */
@@ -27,6 +27,8 @@
 #include <glocalfileinfo.h>
 #include <glocalfile.h>
 #include <gioerror.h>
+#include <gsimpleasyncresult.h>
+#include <gcancellable.h>
 #include <string.h>
 #include <stdlib.h>
 #include "glibintl.h"
@@ -34,12 +36,6 @@
 
 #define CHUNK_SIZE 1000
 
-  /* TODO:
-   *  It would be nice to use the dirent->d_type to check file type without
-   *  needing to stat each files on linux and other systems that support it.
-   *  (question: does that following symlink or not?)
-   */
-
 #ifdef G_OS_WIN32
 #define USE_GDIR
 #endif
@@ -50,13 +46,76 @@
 #include <dirent.h>
 #include <errno.h>
 
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef SYS_getdents64
+#define USE_GETDENTS64
+#endif
+#endif
+
 typedef struct {
   char *name;
   long inode;
+  GFileType type;
 } DirEntry;
 
+#ifdef USE_GETDENTS64
+/* Read the directory in batches this large; a single getdents64()
+ * call then returns a few thousand entries, and the names are used
+ * straight from the buffer.
+ */
+#define DIRENT_BUFFER_SIZE (128 * 1024)
+
+/* The smallest record getdents64() returns: the fixed header plus a
+ * one-byte name and its nul, padded to 8 bytes.
+ */
+#define DIRENT_MIN_RECLEN 24
+
+struct linux_dirent64
+{
+  guint64        d_ino;
+  gint64         d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char           d_name[];
+};
+#endif
+
 #endif
 
+/* Default number of threads a single enumerator uses to get file
+ * info for next_files_async(), see GIO_ENUMERATOR_THREADS.
+ */
+#define DEFAULT_MAX_THREADS 4
+#define MAX_MAX_THREADS 64
+
+typedef struct {
+  char *name;
+  GFileType type;
+  GFileInfo *info;
+  GError *error;
+} BatchEntry;
+
+typedef struct _Batch Batch;
+
+typedef struct {
+  Batch *batch;
+  int start;
+  int end;
+} BatchSlice;
+
+/* A chunk of directory entries whose info is being filled in by the
+ * worker threads. n_pending is protected by the enumerator lock.
+ */
+struct _Batch {
+  BatchEntry *entries;
+  int n_entries;
+  int pos;
+  BatchSlice *slices;
+  int n_pending;
+};
+
 struct _GLocalFileEnumerator
 {
   GFileEnumerator parent;
@@ -76,7 +135,21 @@ struct _GLocalFileEnumerator
   DirEntry *entries;
   int entries_pos;
   gboolean at_end;
+#ifdef USE_GETDENTS64
+  char *dirent_buffer;
+#endif
+#ifdef HAVE_FSTATAT
+  GLocalFileInfoNeeds needs;
+#endif
 #endif
+
+  /* Pipelined next_files_async() */
+  guint max_threads;
+  GThreadPool *pool;
+  GMutex *lock;
+  GCond *cond;
+  Batch *batch;
+  GError *pending_error;
   
   gboolean follow_symlinks;
 };
@@ -90,21 +163,38 @@ static GFileInfo *g_local_file_enumerator_next_file (GFileEnumerator  *enumerato
 static gboolean   g_local_file_enumerator_close     (GFileEnumerator  *enumerator,
 						     GCancellable     *cancellable,
 						     GError          **error);
+static void       g_local_file_enumerator_next_files_async  (GFileEnumerator     *enumerator,
+                                                             int                  num_files,
+                                                             int                  io_priority,
+                                                             GCancellable        *cancellable,
+                                                             GAsyncReadyCallback  callback,
+                                                             gpointer             user_data);
+static GList *    g_local_file_enumerator_next_files_finish (GFileEnumerator     *enumerator,
+                                                             GAsyncResult        *result,
+                                                             GError             **error);
+static void       batch_drop                                (GLocalFileEnumerator *local);
 
 
 static void
 free_entries (GLocalFileEnumerator *local)
 {
 #ifndef USE_GDIR
+#ifndef USE_GETDENTS64
   int i;
+#endif
 
   if (local->entries != NULL)
     {
+#ifndef USE_GETDENTS64
       for (i = 0; local->entries[i].name != NULL; i++)
 	g_free (local->entries[i].name);
+#endif
       
       g_free (local->entries);
     }
+#ifdef USE_GETDENTS64
+  g_free (local->dirent_buffer);
+#endif
 #endif
 }
 
@@ -115,6 +205,17 @@ g_local_file_enumerator_finalize (GObject *object)
 
   local = G_LOCAL_FILE_ENUMERATOR (object);
 
+  batch_drop (local);
+  if (local->pool)
+    g_thread_pool_free (local->pool, FALSE, TRUE);
+  if (local->lock)
+    {
+      g_mutex_free (local->lock);
+      g_cond_free (local->cond);
+    }
+  if (local->pending_error)
+    g_error_free (local->pending_error);
+
   if (local->got_parent_info)
     _g_local_file_info_free_parent_info (&local->parent_info);
   g_free (local->filename);
@@ -145,6 +246,8 @@ g_local_file_enumerator_class_init (GLocalFileEnumeratorClass *klass)
 
   enumerator_class->next_file = g_local_file_enumerator_next_file;
   enumerator_class->close_fn = g_local_file_enumerator_close;
+  enumerator_class->next_files_async = g_local_file_enumerator_next_files_async;
+  enumerator_class->next_files_finish = g_local_file_enumerator_next_files_finish;
 }
 
 static void
@@ -200,6 +303,7 @@ _g_local_file_enumerator_new (GLocalFile *file,
 {
   GLocalFileEnumerator *local;
   char *filename = g_file_get_path (G_FILE (file));
+  const char *threads;
 
 #ifdef USE_GDIR
   GError *dir_error;
@@ -243,6 +347,15 @@ _g_local_file_enumerator_new (GLocalFile *file,
   local->filename = filename;
   local->matcher = g_file_attribute_matcher_new (attributes);
   local->flags = flags;
+#if defined (HAVE_FSTATAT) && !defined (USE_GDIR)
+  local->needs = _g_local_file_info_get_needs (local->matcher);
+#endif
+
+  threads = g_getenv ("GIO_ENUMERATOR_THREADS");
+  if (threads != NULL)
+    local->max_threads = CLAMP (atoi (threads), 1, MAX_MAX_THREADS);
+  else
+    local->max_threads = DEFAULT_MAX_THREADS;
   
   return G_FILE_ENUMERATOR (local);
 }
@@ -258,59 +371,296 @@ sort_by_inode (const void *_a, const void *_b)
   return a->inode - b->inode;
 }
 
-static const char *
-next_file_helper (GLocalFileEnumerator *local)
+static GFileType
+file_type_from_dirent (unsigned char d_type)
+{
+#ifdef DT_UNKNOWN
+  switch (d_type)
+    {
+    case DT_REG:
+      return G_FILE_TYPE_REGULAR;
+    case DT_DIR:
+      return G_FILE_TYPE_DIRECTORY;
+    case DT_LNK:
+      return G_FILE_TYPE_SYMBOLIC_LINK;
+    case DT_FIFO:
+    case DT_CHR:
+    case DT_BLK:
+    case DT_SOCK:
+      return G_FILE_TYPE_SPECIAL;
+    default:
+      return G_FILE_TYPE_UNKNOWN;
+    }
+#else
+  return G_FILE_TYPE_UNKNOWN;
+#endif
+}
+
+#ifdef USE_GETDENTS64
+
+/* Fills local->entries from one getdents64() batch. The names point
+ * into local->dirent_buffer and stay valid until the next batch.
+ */
+static int
+read_entries (GLocalFileEnumerator *local)
+{
+  int n_entries;
+  long n_read;
+  long pos;
+
+  if (local->dirent_buffer == NULL)
+    {
+      local->dirent_buffer = g_malloc (DIRENT_BUFFER_SIZE);
+      local->entries = g_new (DirEntry, DIRENT_BUFFER_SIZE / DIRENT_MIN_RECLEN + 1);
+    }
+
+  n_entries = 0;
+  while (n_entries == 0)
+    {
+      n_read = syscall (SYS_getdents64, dirfd (local->dir),
+                        local->dirent_buffer, DIRENT_BUFFER_SIZE);
+      if (n_read <= 0)
+        break;
+
+      for (pos = 0; pos < n_read; )
+        {
+          struct linux_dirent64 *entry;
+
+          entry = (struct linux_dirent64 *) (local->dirent_buffer + pos);
+          pos += entry->d_reclen;
+
+          if (0 == strcmp (entry->d_name, ".") ||
+              0 == strcmp (entry->d_name, ".."))
+            continue;
+
+          local->entries[n_entries].name = entry->d_name;
+          local->entries[n_entries].inode = entry->d_ino;
+          local->entries[n_entries].type = file_type_from_dirent (entry->d_type);
+          n_entries++;
+        }
+    }
+
+  return n_entries;
+}
+
+#else
+
+static int
+read_entries (GLocalFileEnumerator *local)
 {
   struct dirent *entry;
-  const char *filename;
   int i;
 
+  if (local->entries == NULL)
+    local->entries = g_new (DirEntry, CHUNK_SIZE + 1);
+  else
+    {
+      /* Restart by clearing old names */
+      for (i = 0; local->entries[i].name != NULL; i++)
+        g_free (local->entries[i].name);
+    }
+
+  for (i = 0; i < CHUNK_SIZE; i++)
+    {
+      entry = readdir (local->dir);
+      while (entry
+             && (0 == strcmp (entry->d_name, ".") ||
+                 0 == strcmp (entry->d_name, "..")))
+        entry = readdir (local->dir);
+
+      if (entry)
+        {
+          local->entries[i].name = g_strdup (entry->d_name);
+          local->entries[i].inode = entry->d_ino;
+#ifdef DT_UNKNOWN
+          local->entries[i].type = file_type_from_dirent (entry->d_type);
+#else
+          local->entries[i].type = G_FILE_TYPE_UNKNOWN;
+#endif
+        }
+      else
+        break;
+    }
+
+  return i;
+}
+
+#endif
+
+static DirEntry *
+next_file_helper (GLocalFileEnumerator *local)
+{
+  DirEntry *entry;
+  int n_entries;
+
   if (local->at_end)
     return NULL;
   
   if (local->entries == NULL ||
       (local->entries[local->entries_pos].name == NULL))
     {
-      if (local->entries == NULL)
-	local->entries = g_new (DirEntry, CHUNK_SIZE + 1);
-      else
-	{
-	  /* Restart by clearing old names */
-	  for (i = 0; local->entries[i].name != NULL; i++)
-	    g_free (local->entries[i].name);
-	}
-      
-      for (i = 0; i < CHUNK_SIZE; i++)
-	{
-	  entry = readdir (local->dir);
-	  while (entry 
-		 && (0 == strcmp (entry->d_name, ".") ||
-		     0 == strcmp (entry->d_name, "..")))
-	    entry = readdir (local->dir);
-
-	  if (entry)
-	    {
-	      local->entries[i].name = g_strdup (entry->d_name);
-	      local->entries[i].inode = entry->d_ino;
-	    }
-	  else
-	    break;
-	}
-      local->entries[i].name = NULL;
+      n_entries = read_entries (local);
+      local->entries[n_entries].name = NULL;
       local->entries_pos = 0;
-      
-      qsort (local->entries, i, sizeof (DirEntry), sort_by_inode);
+
+      /* Stat'ing in inode order is a lot faster on some filesystems,
+       * but there is no point sorting if we never stat.
+       */
+#ifdef HAVE_FSTATAT
+      if (local->needs != G_LOCAL_FILE_INFO_NEEDS_DIRENT)
+#endif
+        qsort (local->entries, n_entries, sizeof (DirEntry), sort_by_inode);
     }
 
-  filename = local->entries[local->entries_pos++].name;
-  if (filename == NULL)
-    local->at_end = TRUE;
+  entry = &local->entries[local->entries_pos++];
+  if (entry->name == NULL)
+    {
+      local->at_end = TRUE;
+      return NULL;
+    }
     
-  return filename;
+  return entry;
 }
 
 #endif
 
+static const char *
+next_entry (GLocalFileEnumerator *local,
+            GFileType            *type)
+{
+#ifdef USE_GDIR
+  *type = G_FILE_TYPE_UNKNOWN;
+  return g_dir_read_name (local->dir);
+#else
+  DirEntry *entry;
+
+  entry = next_file_helper (local);
+  if (entry == NULL)
+    return NULL;
+
+  *type = entry->type;
+  return entry->name;
+#endif
+}
+
+static void
+ensure_parent_info (GLocalFileEnumerator *local)
+{
+  if (!local->got_parent_info
+#if defined (HAVE_FSTATAT) && !defined (USE_GDIR)
+      && local->needs == G_LOCAL_FILE_INFO_NEEDS_PATH
+#endif
+      )
+    {
+      _g_local_file_info_get_parent_info (local->filename, local->matcher, &local->parent_info);
+      local->got_parent_info = TRUE;
+    }
+}
+
+/* Safe to call from several threads at once, as long as
+ * ensure_parent_info() was called first.
+ */
+static GFileInfo *
+get_entry_info (GLocalFileEnumerator  *local,
+                const char            *filename,
+                GFileType              type,
+                GError               **error)
+{
+  GFileInfo *info;
+  char *path;
+
+#if defined (HAVE_FSTATAT) && !defined (USE_GDIR)
+  if (local->needs != G_LOCAL_FILE_INFO_NEEDS_PATH)
+    return _g_local_file_info_get_at (dirfd (local->dir), local->filename,
+                                      filename, type,
+                                      local->matcher,
+                                      local->flags,
+                                      error);
+#endif
+
+  path = g_build_filename (local->filename, filename, NULL);
+  info = _g_local_file_info_get (filename, path,
+                                 local->matcher,
+                                 local->flags,
+                                 &local->parent_info,
+                                 error);
+  g_free (path);
+
+  return info;
+}
+
+static void
+batch_free (Batch *batch)
+{
+  int i;
+
+  for (i = 0; i < batch->n_entries; i++)
+    {
+      g_free (batch->entries[i].name);
+      if (batch->entries[i].info)
+        g_object_unref (batch->entries[i].info);
+      if (batch->entries[i].error)
+        g_error_free (batch->entries[i].error);
+    }
+  g_free (batch->entries);
+  g_free (batch->slices);
+  g_free (batch);
+}
+
+/* Waits until the workers are done with local->batch */
+static void
+batch_wait (GLocalFileEnumerator *local)
+{
+  if (local->lock == NULL)
+    return;
+
+  g_mutex_lock (local->lock);
+  while (local->batch != NULL && local->batch->n_pending > 0)
+    g_cond_wait (local->cond, local->lock);
+  g_mutex_unlock (local->lock);
+}
+
+/* Hands out the next result of the prefetched batch, waiting for
+ * the workers if needed. Returns FALSE, and frees the batch, once it
+ * is used up.
+ */
+static gboolean
+batch_next (GLocalFileEnumerator  *local,
+            GFileInfo            **info,
+            GError               **error)
+{
+  Batch *batch = local->batch;
+
+  batch_wait (local);
+
+  while (batch->pos < batch->n_entries)
+    {
+      BatchEntry *entry = &batch->entries[batch->pos++];
+
+      if (entry->info != NULL)
+        {
+          *info = entry->info;
+          entry->info = NULL;
+          return TRUE;
+        }
+
+      /* Same as in next_file(): a file removed since the readdir
+       * is skipped */
+      if (!g_error_matches (entry->error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          *info = NULL;
+          g_propagate_error (error, entry->error);
+          entry->error = NULL;
+          return TRUE;
+        }
+    }
+
+  batch_free (batch);
+  local->batch = NULL;
+
+  return FALSE;
+}
+
 static GFileInfo *
 g_local_file_enumerator_next_file (GFileEnumerator  *enumerator,
 				   GCancellable     *cancellable,
@@ -318,35 +668,33 @@ g_local_file_enumerator_next_file (GFileEnumerator  *enumerator,
 {
   GLocalFileEnumerator *local = G_LOCAL_FILE_ENUMERATOR (enumerator);
   const char *filename;
-  char *path;
+  GFileType type;
   GFileInfo *info;
   GError *my_error;
 
-  if (!local->got_parent_info)
+  /* An error that ended an earlier next_files_async() comes before
+   * the files that follow it */
+  if (local->pending_error != NULL)
     {
-      _g_local_file_info_get_parent_info (local->filename, local->matcher, &local->parent_info);
-      local->got_parent_info = TRUE;
+      g_propagate_error (error, local->pending_error);
+      local->pending_error = NULL;
+      return NULL;
     }
 
- next_file:
+  /* Use up whatever next_files_async() prefetched first */
+  if (local->batch != NULL && batch_next (local, &info, error))
+    return info;
 
-#ifdef USE_GDIR
-  filename = g_dir_read_name (local->dir);
-#else
-  filename = next_file_helper (local);
-#endif
+  ensure_parent_info (local);
+
+ next_file:
 
+  filename = next_entry (local, &type);
   if (filename == NULL)
     return NULL;
 
   my_error = NULL;
-  path = g_build_filename (local->filename, filename, NULL);
-  info = _g_local_file_info_get (filename, path,
-				 local->matcher,
-				 local->flags,
-				 &local->parent_info,
-				 &my_error); 
-  g_free (path);
+  info = get_entry_info (local, filename, type, &my_error);
 
   if (info == NULL)
     {
@@ -366,6 +714,240 @@ g_local_file_enumerator_next_file (GFileEnumerator  *enumerator,
   return info;
 }
 
+static void
+batch_slice_work (gpointer data,
+                  gpointer user_data)
+{
+  BatchSlice *slice = data;
+  GLocalFileEnumerator *local = user_data;
+  Batch *batch = slice->batch;
+  int i;
+
+  for (i = slice->start; i < slice->end; i++)
+    {
+      BatchEntry *entry = &batch->entries[i];
+
+      entry->info = get_entry_info (local, entry->name, entry->type, &entry->error);
+    }
+
+  g_mutex_lock (local->lock);
+  if (--batch->n_pending == 0)
+    g_cond_broadcast (local->cond);
+  g_mutex_unlock (local->lock);
+}
+
+/* Reads up to @num_files names, but no more than CHUNK_SIZE, and
+ * hands them to the workers in slices. Sets local->batch, unless the
+ * directory is exhausted.
+ */
+static void
+batch_start (GLocalFileEnumerator *local,
+             int                   num_files)
+{
+  Batch *batch;
+  const char *filename;
+  GFileType type;
+  int slice_size, n_slices, i;
+
+  num_files = MIN (num_files, CHUNK_SIZE);
+
+  batch = g_new0 (Batch, 1);
+  batch->entries = g_new (BatchEntry, num_files);
+
+  while (batch->n_entries < num_files &&
+         (filename = next_entry (local, &type)) != NULL)
+    {
+      BatchEntry *entry = &batch->entries[batch->n_entries++];
+
+      entry->name = g_strdup (filename);
+      entry->type = type;
+      entry->info = NULL;
+      entry->error = NULL;
+    }
+
+  if (batch->n_entries == 0)
+    {
+      batch_free (batch);
+      return;
+    }
+
+  ensure_parent_info (local);
+
+  /* A few slices per worker, so that a slow file does not hold
+   * up the others for long */
+  slice_size = MAX (1, batch->n_entries / (local->max_threads * 4));
+  n_slices = (batch->n_entries + slice_size - 1) / slice_size;
+
+  batch->slices = g_new (BatchSlice, n_slices);
+  batch->n_pending = n_slices;
+  local->batch = batch;
+
+  for (i = 0; i < n_slices; i++)
+    {
+      batch->slices[i].batch = batch;
+      batch->slices[i].start = i * slice_size;
+      batch->slices[i].end = MIN (batch->n_entries, (i + 1) * slice_size);
+      g_thread_pool_push (local->pool, &batch->slices[i], NULL);
+    }
+}
+
+static void
+batch_drop (GLocalFileEnumerator *local)
+{
+  if (local->batch == NULL)
+    return;
+
+  batch_wait (local);
+  batch_free (local->batch);
+  local->batch = NULL;
+}
+
+typedef struct {
+  int                num_files;
+  GList             *files;
+} NextFilesOp;
+
+static void
+next_files_op_free (NextFilesOp *op)
+{
+  /* Free the list, if finish wasn't called */
+  g_list_foreach (op->files, (GFunc)g_object_unref, NULL);
+  g_list_free (op->files);
+
+  g_free (op);
+}
+
+/* Gathers the results of the current batches in directory order, and
+ * queues up the next batch for the workers before returning, so it is
+ * being worked on while the caller looks at this one. Without a pool
+ * this just calls next_file() like the default implementation, but
+ * keeps the files in order.
+ */
+static void
+next_files_thread (GSimpleAsyncResult *res,
+                   GObject            *object,
+                   GCancellable       *cancellable)
+{
+  GLocalFileEnumerator *local = G_LOCAL_FILE_ENUMERATOR (object);
+  NextFilesOp *op;
+  GFileInfo *info;
+  GError *error = NULL;
+  int n_files;
+
+  op = g_simple_async_result_get_op_res_gpointer (res);
+
+  if (local->pending_error != NULL)
+    {
+      g_simple_async_result_take_error (res, local->pending_error);
+      local->pending_error = NULL;
+      return;
+    }
+
+  n_files = 0;
+  while (n_files < op->num_files)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+        break;
+
+      if (local->pool == NULL)
+        info = g_local_file_enumerator_next_file (G_FILE_ENUMERATOR (local),
+                                                  cancellable, &error);
+      else
+        {
+          if (local->batch == NULL)
+            {
+              batch_start (local, op->num_files - n_files);
+              if (local->batch == NULL)
+                break;
+            }
+
+          if (!batch_next (local, &info, &error))
+            continue;
+        }
+
+      if (info == NULL)
+        break;
+
+      op->files = g_list_prepend (op->files, info);
+      n_files++;
+    }
+
+  if (error != NULL)
+    {
+      /* If we get an error after the first file, return that on the
+       * next operation */
+      if (n_files == 0)
+        g_simple_async_result_take_error (res, error);
+      else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_error_free (error); /* Never propagate cancel errors to other call */
+      else
+        local->pending_error = error;
+    }
+  else if (local->pool != NULL && local->batch == NULL &&
+           n_files == op->num_files)
+    batch_start (local, MIN (op->num_files, CHUNK_SIZE));
+
+  op->files = g_list_reverse (op->files);
+}
+
+static void
+g_local_file_enumerator_next_files_async (GFileEnumerator     *enumerator,
+                                          int                  num_files,
+                                          int                  io_priority,
+                                          GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
+{
+  GLocalFileEnumerator *local = G_LOCAL_FILE_ENUMERATOR (enumerator);
+  GSimpleAsyncResult *res;
+  NextFilesOp *op;
+
+  /* If names and types come straight from the directory entries
+   * there is nothing worth spreading over several threads */
+  if (local->pool == NULL && local->max_threads > 1 && g_thread_supported ()
+#if defined (HAVE_FSTATAT) && !defined (USE_GDIR)
+      && local->needs != G_LOCAL_FILE_INFO_NEEDS_DIRENT
+#endif
+      )
+    {
+      local->lock = g_mutex_new ();
+      local->cond = g_cond_new ();
+      local->pool = g_thread_pool_new (batch_slice_work, local,
+                                       local->max_threads, FALSE, NULL);
+    }
+
+  op = g_new0 (NextFilesOp, 1);
+  op->num_files = num_files;
+
+  res = g_simple_async_result_new (G_OBJECT (enumerator), callback, user_data,
+                                   g_local_file_enumerator_next_files_async);
+  g_simple_async_result_set_op_res_gpointer (res, op, (GDestroyNotify) next_files_op_free);
+
+  g_simple_async_result_run_in_thread (res, next_files_thread, io_priority, cancellable);
+  g_object_unref (res);
+}
+
+static GList *
+g_local_file_enumerator_next_files_finish (GFileEnumerator  *enumerator,
+                                           GAsyncResult     *result,
+                                           GError          **error)
+{
+  GSimpleAsyncResult *simple;
+  NextFilesOp *op;
+  GList *files;
+
+  simple = G_SIMPLE_ASYNC_RESULT (result);
+  g_warn_if_fail (g_simple_async_result_get_source_tag (simple) ==
+                  g_local_file_enumerator_next_files_async);
+
+  op = g_simple_async_result_get_op_res_gpointer (simple);
+
+  files = op->files;
+  op->files = NULL;
+
+  return files;
+}
+
 static gboolean
 g_local_file_enumerator_close (GFileEnumerator  *enumerator,
 			       GCancellable     *cancellable,
@@ -373,6 +955,9 @@ g_local_file_enumerator_close (GFileEnumerator  *enumerator,
 {
   GLocalFileEnumerator *local = G_LOCAL_FILE_ENUMERATOR (enumerator);
 
+  /* The workers use the directory fd */
+  batch_drop (local);
+
   if (local->dir)
     {
 #ifdef USE_GDIR
@@ -116,6 +116,11 @@ static GHashTable *gid_cache = NULL;
 
 #endif  /* !G_OS_WIN32 */
 
+/* The enumerator may get the info of several files in the same
+ * directory at once, and they share the parent info.
+ */
+G_LOCK_DEFINE_STATIC (local_file_add_info);
+
 char *
 _g_local_file_info_create_etag (GLocalFileStat *statbuf)
 {
@@ -1407,6 +1412,47 @@ win32_get_file_user_info (const gchar  *filename,
 }
 #endif /* G_OS_WIN32 */
 
+static void
+set_info_from_name (GFileInfo             *info,
+                    const char            *basename,
+                    const char            *path,
+                    GFileAttributeMatcher *attribute_matcher)
+{
+  if (_g_file_attribute_matcher_matches_id (attribute_matcher,
+					    G_FILE_ATTRIBUTE_ID_STANDARD_DISPLAY_NAME))
+    {
+      char *display_name = g_filename_display_basename (path);
+     
+      /* look for U+FFFD REPLACEMENT CHARACTER */ 
+      if (strstr (display_name, "\357\277\275") != NULL)
+	{
+	  char *p = display_name;
+	  display_name = g_strconcat (display_name, _(" (invalid encoding)"), NULL);
+	  g_free (p);
+	}
+      g_file_info_set_display_name (info, display_name);
+      g_free (display_name);
+    }
+  
+  if (_g_file_attribute_matcher_matches_id (attribute_matcher,
+					    G_FILE_ATTRIBUTE_ID_STANDARD_EDIT_NAME))
+    {
+      char *edit_name = g_filename_display_basename (path);
+      g_file_info_set_edit_name (info, edit_name);
+      g_free (edit_name);
+    }
+
+  
+  if (_g_file_attribute_matcher_matches_id (attribute_matcher,
+					    G_FILE_ATTRIBUTE_ID_STANDARD_COPY_NAME))
+    {
+      char *copy_name = g_filename_to_utf8 (basename, -1, NULL, NULL, NULL);
+      if (copy_name)
+	_g_file_info_set_attribute_string_by_id (info, G_FILE_ATTRIBUTE_ID_STANDARD_COPY_NAME, copy_name);
+      g_free (copy_name);
+    }
+}
+
 GFileInfo *
 _g_local_file_info_get (const char             *basename,
 			const char             *path,
@@ -1555,39 +1601,7 @@ _g_local_file_info_get (const char             *basename,
         g_file_info_set_symlink_target (info, symlink_target);
     }
 #endif
-  if (_g_file_attribute_matcher_matches_id (attribute_matcher,
-					    G_FILE_ATTRIBUTE_ID_STANDARD_DISPLAY_NAME))
-    {
-      char *display_name = g_filename_display_basename (path);
-     
-      /* look for U+FFFD REPLACEMENT CHARACTER */ 
-      if (strstr (display_name, "\357\277\275") != NULL)
-	{
-	  char *p = display_name;
-	  display_name = g_strconcat (display_name, _(" (invalid encoding)"), NULL);
-	  g_free (p);
-	}
-      g_file_info_set_display_name (info, display_name);
-      g_free (display_name);
-    }
-  
-  if (_g_file_attribute_matcher_matches_id (attribute_matcher,
-					    G_FILE_ATTRIBUTE_ID_STANDARD_EDIT_NAME))
-    {
-      char *edit_name = g_filename_display_basename (path);
-      g_file_info_set_edit_name (info, edit_name);
-      g_free (edit_name);
-    }
-
-  
-  if (_g_file_attribute_matcher_matches_id (attribute_matcher,
-					    G_FILE_ATTRIBUTE_ID_STANDARD_COPY_NAME))
-    {
-      char *copy_name = g_filename_to_utf8 (basename, -1, NULL, NULL, NULL);
-      if (copy_name)
-	_g_file_info_set_attribute_string_by_id (info, G_FILE_ATTRIBUTE_ID_STANDARD_COPY_NAME, copy_name);
-      g_free (copy_name);
-    }
+  set_info_from_name (info, basename, path, attribute_matcher);
 
   if (_g_file_attribute_matcher_matches_id (attribute_matcher,
 					    G_FILE_ATTRIBUTE_ID_STANDARD_CONTENT_TYPE) ||
@@ -1728,6 +1742,7 @@ _g_local_file_info_get (const char             *basename,
   class = G_VFS_GET_CLASS (vfs);
   if (class->local_file_add_info)
     {
+      G_LOCK (local_file_add_info);
       class->local_file_add_info (vfs,
                                   path,
                                   device,
@@ -1736,6 +1751,7 @@ _g_local_file_info_get (const char             *basename,
                                   NULL,
                                   &parent_info->extra_data,
                                   &parent_info->free_extra_data);
+      G_UNLOCK (local_file_add_info);
     }
 
   g_file_info_unset_attribute_mask (info);
@@ -1745,6 +1761,246 @@ _g_local_file_info_get (const char             *basename,
   return info;
 }
 
+#ifdef HAVE_FSTATAT
+
+/* Attributes that can be filled in from the directory entry alone,
+ * as long as the entry carries a file type.
+ */
+static const guint32 dirent_attribute_ids[] = {
+  G_FILE_ATTRIBUTE_ID_STANDARD_NAME,
+  G_FILE_ATTRIBUTE_ID_STANDARD_TYPE,
+  G_FILE_ATTRIBUTE_ID_STANDARD_IS_HIDDEN,
+  G_FILE_ATTRIBUTE_ID_STANDARD_IS_BACKUP,
+  G_FILE_ATTRIBUTE_ID_STANDARD_IS_SYMLINK,
+  G_FILE_ATTRIBUTE_ID_STANDARD_DISPLAY_NAME,
+  G_FILE_ATTRIBUTE_ID_STANDARD_EDIT_NAME,
+  G_FILE_ATTRIBUTE_ID_STANDARD_COPY_NAME
+};
+
+/* Attributes that need at most an fstatat() and a readlinkat()
+ * relative to the parent directory.
+ */
+static const guint32 stat_attribute_ids[] = {
+  G_FILE_ATTRIBUTE_ID_STANDARD_NAME,
+  G_FILE_ATTRIBUTE_ID_STANDARD_TYPE,
+  G_FILE_ATTRIBUTE_ID_STANDARD_IS_HIDDEN,
+  G_FILE_ATTRIBUTE_ID_STANDARD_IS_BACKUP,
+  G_FILE_ATTRIBUTE_ID_STANDARD_IS_SYMLINK,
+  G_FILE_ATTRIBUTE_ID_STANDARD_DISPLAY_NAME,
+  G_FILE_ATTRIBUTE_ID_STANDARD_EDIT_NAME,
+  G_FILE_ATTRIBUTE_ID_STANDARD_COPY_NAME,
+  G_FILE_ATTRIBUTE_ID_STANDARD_SIZE,
+  G_FILE_ATTRIBUTE_ID_STANDARD_ALLOCATED_SIZE,
+  G_FILE_ATTRIBUTE_ID_STANDARD_SYMLINK_TARGET,
+  G_FILE_ATTRIBUTE_ID_ETAG_VALUE,
+  G_FILE_ATTRIBUTE_ID_ID_FILE,
+  G_FILE_ATTRIBUTE_ID_ID_FILESYSTEM,
+  G_FILE_ATTRIBUTE_ID_TIME_MODIFIED,
+  G_FILE_ATTRIBUTE_ID_TIME_MODIFIED_USEC,
+  G_FILE_ATTRIBUTE_ID_TIME_ACCESS,
+  G_FILE_ATTRIBUTE_ID_TIME_ACCESS_USEC,
+  G_FILE_ATTRIBUTE_ID_TIME_CHANGED,
+  G_FILE_ATTRIBUTE_ID_TIME_CHANGED_USEC,
+  G_FILE_ATTRIBUTE_ID_UNIX_DEVICE,
+  G_FILE_ATTRIBUTE_ID_UNIX_INODE,
+  G_FILE_ATTRIBUTE_ID_UNIX_MODE,
+  G_FILE_ATTRIBUTE_ID_UNIX_NLINK,
+  G_FILE_ATTRIBUTE_ID_UNIX_UID,
+  G_FILE_ATTRIBUTE_ID_UNIX_GID,
+  G_FILE_ATTRIBUTE_ID_UNIX_RDEV,
+  G_FILE_ATTRIBUTE_ID_UNIX_BLOCK_SIZE,
+  G_FILE_ATTRIBUTE_ID_UNIX_BLOCKS
+};
+
+/**
+ * _g_local_file_info_get_needs:
+ * @attribute_matcher: the attributes that will be queried
+ *
+ * Works out how much work _g_local_file_info_get_at() has to do
+ * for @attribute_matcher. Anything beyond a stat of the file
+ * (content types, access rights, xattrs, owner names, ...) needs
+ * the full path and is handled by _g_local_file_info_get().
+ *
+ * Returns: the cheapest way to satisfy @attribute_matcher
+ */
+GLocalFileInfoNeeds
+_g_local_file_info_get_needs (GFileAttributeMatcher *attribute_matcher)
+{
+  if (_g_file_attribute_matcher_matches_only_ids (attribute_matcher,
+                                                  dirent_attribute_ids,
+                                                  G_N_ELEMENTS (dirent_attribute_ids)))
+    return G_LOCAL_FILE_INFO_NEEDS_DIRENT;
+
+  if (_g_file_attribute_matcher_matches_only_ids (attribute_matcher,
+                                                  stat_attribute_ids,
+                                                  G_N_ELEMENTS (stat_attribute_ids)))
+    return G_LOCAL_FILE_INFO_NEEDS_STAT;
+
+  return G_LOCAL_FILE_INFO_NEEDS_PATH;
+}
+
+static gchar *
+read_link_at (int          dir_fd,
+              const gchar *basename)
+{
+  gchar *buffer;
+  guint size;
+
+  size = 256;
+  buffer = g_malloc (size);
+
+  while (1)
+    {
+      int read_size;
+
+      read_size = readlinkat (dir_fd, basename, buffer, size);
+      if (read_size < 0)
+        {
+          g_free (buffer);
+          return NULL;
+        }
+      if (read_size < size)
+        {
+          buffer[read_size] = 0;
+          return buffer;
+        }
+      size *= 2;
+      buffer = g_realloc (buffer, size);
+    }
+}
+
+/**
+ * _g_local_file_info_get_at:
+ * @dir_fd: an open file descriptor for the parent directory
+ * @dirname: the path of the parent directory, used in error messages
+ * @basename: the name of the file inside @dir_fd
+ * @dirent_type: the file type reported by the directory entry, or
+ *     %G_FILE_TYPE_UNKNOWN
+ * @attribute_matcher: the attributes to get
+ * @flags: #GFileQueryInfoFlags
+ * @error: a #GError
+ *
+ * Like _g_local_file_info_get(), but relative to an open directory
+ * and without building the full path. Only valid if
+ * _g_local_file_info_get_needs() does not return
+ * %G_LOCAL_FILE_INFO_NEEDS_PATH for @attribute_matcher.
+ *
+ * The file is not stat()ed at all if @dirent_type is enough to
+ * answer the query.
+ *
+ * Returns: a new #GFileInfo, or %NULL on error
+ */
+GFileInfo *
+_g_local_file_info_get_at (int                     dir_fd,
+                           const char             *dirname,
+                           const char             *basename,
+                           GFileType               dirent_type,
+                           GFileAttributeMatcher  *attribute_matcher,
+                           GFileQueryInfoFlags     flags,
+                           GError                **error)
+{
+  GFileInfo *info;
+  GLocalFileStat statbuf;
+  GLocalFileStat statbuf2;
+  gboolean need_stat;
+  gboolean stat_ok;
+  gboolean is_symlink;
+  gboolean is_regular;
+  int res;
+
+  info = g_file_info_new ();
+
+  /* Make sure we don't set any unwanted attributes */
+  g_file_info_set_attribute_mask (info, attribute_matcher);
+
+  g_file_info_set_name (info, basename);
+
+  if (attribute_matcher == NULL)
+    return info;
+
+  need_stat = dirent_type == G_FILE_TYPE_UNKNOWN ||
+    (dirent_type == G_FILE_TYPE_SYMBOLIC_LINK &&
+     !(flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS)) ||
+    !_g_file_attribute_matcher_matches_only_ids (attribute_matcher,
+                                                 dirent_attribute_ids,
+                                                 G_N_ELEMENTS (dirent_attribute_ids));
+
+  if (!need_stat)
+    {
+      g_file_info_set_file_type (info, dirent_type);
+      if (dirent_type == G_FILE_TYPE_SYMBOLIC_LINK)
+        g_file_info_set_is_symlink (info, TRUE);
+      is_symlink = FALSE;
+      is_regular = dirent_type == G_FILE_TYPE_REGULAR;
+    }
+  else
+    {
+      res = fstatat (dir_fd, basename, &statbuf, AT_SYMLINK_NOFOLLOW);
+      if (res == -1)
+        {
+          int errsv = errno;
+
+          /* Don't bail out if we get Permission denied (SELinux?) */
+          if (errsv != EACCES)
+            {
+              char *path = g_build_filename (dirname, basename, NULL);
+              char *display_name = g_filename_display_name (path);
+              g_object_unref (info);
+              g_set_error (error, G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           _("Error stating file '%s': %s"),
+                           display_name, g_strerror (errsv));
+              g_free (display_name);
+              g_free (path);
+              return NULL;
+            }
+        }
+
+      stat_ok = res != -1;
+      is_symlink = stat_ok && S_ISLNK (statbuf.st_mode);
+
+      if (is_symlink)
+        {
+          g_file_info_set_is_symlink (info, TRUE);
+
+          /* Report broken links as symlinks */
+          if (!(flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS) &&
+              fstatat (dir_fd, basename, &statbuf2, 0) != -1)
+            statbuf = statbuf2;
+        }
+
+      if (stat_ok)
+        set_info_from_stat (info, &statbuf, attribute_matcher);
+
+      is_regular = stat_ok && S_ISREG (statbuf.st_mode);
+    }
+
+  if (basename[0] == '.')
+    g_file_info_set_is_hidden (info, TRUE);
+
+  if (basename[strlen (basename) - 1] == '~' && is_regular)
+    _g_file_info_set_attribute_boolean_by_id (info, G_FILE_ATTRIBUTE_ID_STANDARD_IS_BACKUP, TRUE);
+
+  if (is_symlink &&
+      _g_file_attribute_matcher_matches_id (attribute_matcher,
+                                            G_FILE_ATTRIBUTE_ID_STANDARD_SYMLINK_TARGET))
+    {
+      char *symlink_target = read_link_at (dir_fd, basename);
+
+      if (symlink_target)
+        g_file_info_set_symlink_target (info, symlink_target);
+      g_free (symlink_target);
+    }
+
+  set_info_from_name (info, basename, basename, attribute_matcher);
+
+  g_file_info_unset_attribute_mask (info);
+
+  return info;
+}
+
+#endif /* HAVE_FSTATAT */
+
 GFileInfo *
 _g_local_file_info_get_from_fd (int         fd,
 				const char *attributes,
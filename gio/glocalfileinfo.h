@@ -43,6 +43,13 @@ typedef struct
   GDestroyNotify free_extra_data;
 } GLocalParentFileInfo;
 
+typedef enum
+{
+  G_LOCAL_FILE_INFO_NEEDS_DIRENT,
+  G_LOCAL_FILE_INFO_NEEDS_STAT,
+  G_LOCAL_FILE_INFO_NEEDS_PATH
+} GLocalFileInfoNeeds;
+
 #ifdef G_OS_WIN32
 /* We want 64-bit file size support */
 #define GLocalFileStat struct _stati64
@@ -62,6 +69,16 @@ GFileInfo *_g_local_file_info_get             (const char             *basename,
                                                GFileQueryInfoFlags     flags,
                                                GLocalParentFileInfo   *parent_info,
                                                GError                **error);
+#ifdef HAVE_FSTATAT
+GLocalFileInfoNeeds _g_local_file_info_get_needs (GFileAttributeMatcher *attribute_matcher);
+GFileInfo *_g_local_file_info_get_at          (int                     dir_fd,
+                                               const char             *dirname,
+                                               const char             *basename,
+                                               GFileType               dirent_type,
+                                               GFileAttributeMatcher  *attribute_matcher,
+                                               GFileQueryInfoFlags     flags,
+                                               GError                **error);
+#endif
 GFileInfo *_g_local_file_info_get_from_fd     (int                     fd,
                                                const char             *attributes,
                                                GError                **error);
@@ -34,12 +34,14 @@
 #include <glib/gstdio.h>
 #include "gcancellable.h"
 #include "gioerror.h"
+#include "gsimpleasyncresult.h"
 #include "glocalfileinputstream.h"
 #include "glocalfileinfo.h"
 #include "glibintl.h"
 
 #ifdef G_OS_UNIX
 #include "gfiledescriptorbased.h"
+#include "giouring.h"
 #endif
 
 #ifdef G_OS_WIN32
@@ -65,6 +67,10 @@ G_DEFINE_TYPE_WITH_CODE (GLocalFileInputStream, g_local_file_input_stream, G_TYP
 struct _GLocalFileInputStreamPrivate {
   int fd;
   guint do_close : 1;
+#ifdef HAVE_LINUX_IO_URING_H
+  guint checked_io_uring : 1;
+  guint use_io_uring : 1;
+#endif
 };
 
 static gssize     g_local_file_input_stream_read       (GInputStream      *stream,
@@ -72,6 +78,18 @@ static gssize     g_local_file_input_stream_read       (GInputStream      *strea
 							gsize              count,
 							GCancellable      *cancellable,
 							GError           **error);
+#ifdef HAVE_LINUX_IO_URING_H
+static void       g_local_file_input_stream_read_async (GInputStream      *stream,
+							void              *buffer,
+							gsize              count,
+							int                io_priority,
+							GCancellable      *cancellable,
+							GAsyncReadyCallback callback,
+							gpointer           user_data);
+static gssize     g_local_file_input_stream_read_finish (GInputStream     *stream,
+							 GAsyncResult     *result,
+							 GError          **error);
+#endif
 static gssize     g_local_file_input_stream_skip       (GInputStream      *stream,
 							gsize              count,
 							GCancellable      *cancellable,
@@ -119,6 +137,10 @@ g_local_file_input_stream_class_init (GLocalFileInputStreamClass *klass)
   gobject_class->finalize = g_local_file_input_stream_finalize;
 
   stream_class->read_fn = g_local_file_input_stream_read;
+#ifdef HAVE_LINUX_IO_URING_H
+  stream_class->read_async = g_local_file_input_stream_read_async;
+  stream_class->read_finish = g_local_file_input_stream_read_finish;
+#endif
   stream_class->skip = g_local_file_input_stream_skip;
   stream_class->close_fn = g_local_file_input_stream_close;
   file_stream_class->tell = g_local_file_input_stream_tell;
@@ -192,6 +214,95 @@ g_local_file_input_stream_read (GInputStream  *stream,
   return res;
 }
 
+#ifdef HAVE_LINUX_IO_URING_H
+static void
+read_async_done (gssize   result,
+		 gpointer user_data)
+{
+  GSimpleAsyncResult *simple = user_data;
+
+  if (result < 0)
+    {
+      int errsv = -result;
+
+      g_simple_async_result_set_error (simple, G_IO_ERROR,
+				       g_io_error_from_errno (errsv),
+				       _("Error reading from file: %s"),
+				       g_strerror (errsv));
+    }
+  else
+    g_simple_async_result_set_op_res_gssize (simple, result);
+
+  g_simple_async_result_complete (simple);
+  g_object_unref (simple);
+}
+
+static void
+g_local_file_input_stream_read_async (GInputStream        *stream,
+				      void                *buffer,
+				      gsize                count,
+				      int                  io_priority,
+				      GCancellable        *cancellable,
+				      GAsyncReadyCallback  callback,
+				      gpointer             user_data)
+{
+  GLocalFileInputStream *file;
+  GSimpleAsyncResult *simple;
+  GError *error = NULL;
+
+  file = G_LOCAL_FILE_INPUT_STREAM (stream);
+
+  /* The request can't be cancelled once queued, so only regular files,
+   * on which a read completes quickly anyway, go through io_uring.
+   */
+  if (!file->priv->checked_io_uring)
+    {
+      file->priv->use_io_uring = _g_io_uring_supports_fd (file->priv->fd);
+      file->priv->checked_io_uring = TRUE;
+    }
+
+  if (file->priv->use_io_uring)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+	{
+	  g_simple_async_report_gerror_in_idle (G_OBJECT (stream),
+						callback, user_data,
+						error);
+	  g_error_free (error);
+	  return;
+	}
+
+      simple = g_simple_async_result_new (G_OBJECT (stream),
+					  callback, user_data,
+					  g_local_file_input_stream_read_async);
+
+      if (_g_io_uring_read (file->priv->fd, buffer, count,
+			    read_async_done, simple))
+	return;
+
+      g_object_unref (simple);
+    }
+
+  G_INPUT_STREAM_CLASS (g_local_file_input_stream_parent_class)->read_async (stream, buffer, count,
+									      io_priority, cancellable,
+									      callback, user_data);
+}
+
+static gssize
+g_local_file_input_stream_read_finish (GInputStream  *stream,
+				       GAsyncResult  *result,
+				       GError       **error)
+{
+  GSimpleAsyncResult *simple;
+
+  simple = G_SIMPLE_ASYNC_RESULT (result);
+  if (g_simple_async_result_get_source_tag (simple) != g_local_file_input_stream_read_async)
+    return G_INPUT_STREAM_CLASS (g_local_file_input_stream_parent_class)->read_finish (stream, result, error);
+
+  return g_simple_async_result_get_op_res_gssize (simple);
+}
+#endif
+
 static gssize
 g_local_file_input_stream_skip (GInputStream  *stream,
 				gsize          count,
@@ -36,11 +36,13 @@
 #include "glibintl.h"
 #include "gioerror.h"
 #include "gcancellable.h"
+#include "gsimpleasyncresult.h"
 #include "glocalfileoutputstream.h"
 #include "glocalfileinfo.h"
 
 #ifdef G_OS_UNIX
 #include "gfiledescriptorbased.h"
+#include "giouring.h"
 #endif
 
 #ifdef G_OS_WIN32
@@ -86,6 +88,10 @@ struct _GLocalFileOutputStreamPrivate {
   char *etag;
   guint sync_on_close : 1;
   guint do_close : 1;
+#ifdef HAVE_LINUX_IO_URING_H
+  guint checked_io_uring : 1;
+  guint use_io_uring : 1;
+#endif
   int fd;
 };
 
@@ -94,6 +100,18 @@ static gssize     g_local_file_output_stream_write        (GOutputStream      *s
 							   gsize               count,
 							   GCancellable       *cancellable,
 							   GError            **error);
+#ifdef HAVE_LINUX_IO_URING_H
+static void       g_local_file_output_stream_write_async  (GOutputStream      *stream,
+							   const void         *buffer,
+							   gsize               count,
+							   int                 io_priority,
+							   GCancellable       *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer            user_data);
+static gssize     g_local_file_output_stream_write_finish (GOutputStream      *stream,
+							   GAsyncResult       *result,
+							   GError            **error);
+#endif
 static gboolean   g_local_file_output_stream_close        (GOutputStream      *stream,
 							   GCancellable       *cancellable,
 							   GError            **error);
@@ -146,6 +164,10 @@ g_local_file_output_stream_class_init (GLocalFileOutputStreamClass *klass)
   gobject_class->finalize = g_local_file_output_stream_finalize;
 
   stream_class->write_fn = g_local_file_output_stream_write;
+#ifdef HAVE_LINUX_IO_URING_H
+  stream_class->write_async = g_local_file_output_stream_write_async;
+  stream_class->write_finish = g_local_file_output_stream_write_finish;
+#endif
   stream_class->close_fn = g_local_file_output_stream_close;
   file_stream_class->query_info = g_local_file_output_stream_query_info;
   file_stream_class->get_etag = g_local_file_output_stream_get_etag;
@@ -209,6 +231,94 @@ g_local_file_output_stream_write (GOutputStream  *stream,
   return res;
 }
 
+#ifdef HAVE_LINUX_IO_URING_H
+static void
+write_async_done (gssize   result,
+		  gpointer user_data)
+{
+  GSimpleAsyncResult *simple = user_data;
+
+  if (result < 0)
+    {
+      int errsv = -result;
+
+      g_simple_async_result_set_error (simple, G_IO_ERROR,
+				       g_io_error_from_errno (errsv),
+				       _("Error writing to file: %s"),
+				       g_strerror (errsv));
+    }
+  else
+    g_simple_async_result_set_op_res_gssize (simple, result);
+
+  g_simple_async_result_complete (simple);
+  g_object_unref (simple);
+}
+
+static void
+g_local_file_output_stream_write_async (GOutputStream       *stream,
+					const void          *buffer,
+					gsize                count,
+					int                  io_priority,
+					GCancellable        *cancellable,
+					GAsyncReadyCallback  callback,
+					gpointer             user_data)
+{
+  GLocalFileOutputStream *file;
+  GSimpleAsyncResult *simple;
+  GError *error = NULL;
+
+  file = G_LOCAL_FILE_OUTPUT_STREAM (stream);
+
+  /* As for reads, only regular files go through io_uring, since the
+   * request can't be cancelled once queued */
+  if (!file->priv->checked_io_uring)
+    {
+      file->priv->use_io_uring = _g_io_uring_supports_fd (file->priv->fd);
+      file->priv->checked_io_uring = TRUE;
+    }
+
+  if (file->priv->use_io_uring)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+	{
+	  g_simple_async_report_gerror_in_idle (G_OBJECT (stream),
+						callback, user_data,
+						error);
+	  g_error_free (error);
+	  return;
+	}
+
+      simple = g_simple_async_result_new (G_OBJECT (stream),
+					  callback, user_data,
+					  g_local_file_output_stream_write_async);
+
+      if (_g_io_uring_write (file->priv->fd, buffer, count,
+			     write_async_done, simple))
+	return;
+
+      g_object_unref (simple);
+    }
+
+  G_OUTPUT_STREAM_CLASS (g_local_file_output_stream_parent_class)->write_async (stream, buffer, count,
+										 io_priority, cancellable,
+										 callback, user_data);
+}
+
+static gssize
+g_local_file_output_stream_write_finish (GOutputStream  *stream,
+					 GAsyncResult   *result,
+					 GError        **error)
+{
+  GSimpleAsyncResult *simple;
+
+  simple = G_SIMPLE_ASYNC_RESULT (result);
+  if (g_simple_async_result_get_source_tag (simple) != g_local_file_output_stream_write_async)
+    return G_OUTPUT_STREAM_CLASS (g_local_file_output_stream_parent_class)->write_finish (stream, result, error);
+
+  return g_simple_async_result_get_op_res_gssize (simple);
+}
+#endif
+
 void
 _g_local_file_output_stream_set_do_close (GLocalFileOutputStream *out,
 					  gboolean do_close)
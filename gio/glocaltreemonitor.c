@@ -0,0 +1,577 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "glocaltreemonitor.h"
+#include "glocaldirectorymonitor.h"
+#include "giomodule-priv.h"
+#include "gfile.h"
+#include "gioerror.h"
+#include "glibintl.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+
+enum
+{
+  PROP_0,
+  PROP_DIRNAME,
+  PROP_FLAGS
+};
+
+static gboolean g_local_tree_monitor_cancel (GFileMonitor      *monitor);
+static void     tree_changed                (GFileMonitor      *monitor,
+                                             GFile             *file,
+                                             GFile             *other_file,
+                                             GFileMonitorEvent  event_type,
+                                             gpointer           user_data);
+static void     tree_changes                (GFileMonitor             *monitor,
+                                             const GFileMonitorChange *changes,
+                                             guint                     n_changes,
+                                             gpointer                  user_data);
+
+G_DEFINE_TYPE (GLocalTreeMonitor, g_local_tree_monitor, G_TYPE_FILE_MONITOR)
+
+/* A watched directory. Each one is linked into the list of its parent,
+ * so dropping a subtree only visits the directories in it. */
+typedef struct _TreeDir TreeDir;
+
+struct _TreeDir {
+  gchar *path;
+  gpointer watch;
+  TreeDir *parent;
+  GList *link;       /* in parent->children */
+  GQueue children;
+};
+
+/* Whether the path is below the root */
+static gboolean
+is_in_tree (GLocalTreeMonitor *tree,
+            const gchar       *path)
+{
+  gsize len = strlen (tree->dirname);
+
+  if (strncmp (path, tree->dirname, len) != 0 || path[len] == '\0')
+    return FALSE;
+
+  return path[len] == G_DIR_SEPARATOR || tree->dirname[len - 1] == G_DIR_SEPARATOR;
+}
+
+static gboolean
+is_directory (const gchar *path)
+{
+  struct stat buf;
+
+  return g_lstat (path, &buf) == 0 && S_ISDIR (buf.st_mode);
+}
+
+static void
+watch_tree (GLocalTreeMonitor *tree,
+            const gchar       *dirname,
+            gboolean           report);
+
+/* Starts watching the subdirectories of a watched directory, and
+ * reports the files found there if requested */
+static void
+scan_dir (GLocalTreeMonitor *tree,
+          const gchar       *dirname,
+          gboolean           report)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *path = g_build_filename (dirname, name, NULL);
+
+      if (report)
+        {
+          GFile *file = g_file_new_for_path (path);
+          g_file_monitor_emit_event (G_FILE_MONITOR (tree), file, NULL,
+                                     G_FILE_MONITOR_EVENT_CREATED);
+          g_object_unref (file);
+        }
+
+      if (is_directory (path))
+        watch_tree (tree, path, report);
+
+      g_free (path);
+    }
+
+  g_dir_close (dir);
+}
+
+static void
+watch_tree (GLocalTreeMonitor *tree,
+            const gchar       *dirname,
+            gboolean           report)
+{
+  GLocalTreeMonitorClass *klass = G_LOCAL_TREE_MONITOR_GET_CLASS (tree);
+  gboolean is_root = strcmp (dirname, tree->dirname) == 0;
+  gpointer watch;
+  TreeDir *dir;
+
+  if (g_hash_table_lookup (tree->watches, dirname) != NULL)
+    return;
+
+  /* The directory is watched before it is scanned, so nothing created
+   * in the meantime is missed */
+  watch = klass->watch_dir (tree, dirname, is_root);
+  if (watch == NULL)
+    return;
+
+  dir = g_slice_new0 (TreeDir);
+  dir->path = g_strdup (dirname);
+  dir->watch = watch;
+  g_queue_init (&dir->children);
+
+  if (!is_root)
+    {
+      gchar *parent_path = g_path_get_dirname (dirname);
+
+      dir->parent = g_hash_table_lookup (tree->watches, parent_path);
+      if (dir->parent != NULL)
+        {
+          g_queue_push_tail (&dir->parent->children, dir);
+          dir->link = g_queue_peek_tail_link (&dir->parent->children);
+        }
+      g_free (parent_path);
+    }
+
+  g_hash_table_insert (tree->watches, dir->path, dir);
+  scan_dir (tree, dirname, report);
+}
+
+static void
+unwatch_dir (GLocalTreeMonitor *tree,
+             TreeDir           *dir)
+{
+  GLocalTreeMonitorClass *klass = G_LOCAL_TREE_MONITOR_GET_CLASS (tree);
+  TreeDir *child;
+
+  while ((child = g_queue_peek_head (&dir->children)) != NULL)
+    unwatch_dir (tree, child);
+
+  klass->unwatch_dir (tree, dir->watch);
+  if (dir->parent != NULL)
+    g_queue_delete_link (&dir->parent->children, dir->link);
+  g_hash_table_remove (tree->watches, dir->path);
+
+  g_free (dir->path);
+  g_slice_free (TreeDir, dir);
+}
+
+/* Stops watching a directory and all its subdirectories. The root
+ * itself is kept, as the backends track its reappearance. */
+static void
+unwatch_tree (GLocalTreeMonitor *tree,
+              const gchar       *dirname)
+{
+  TreeDir *dir, *child;
+
+  dir = g_hash_table_lookup (tree->watches, dirname);
+  if (dir == NULL)
+    return;
+
+  if (strcmp (dirname, tree->dirname) != 0)
+    unwatch_dir (tree, dir);
+  else
+    while ((child = g_queue_peek_head (&dir->children)) != NULL)
+      unwatch_dir (tree, child);
+}
+
+static void
+unwatch_all (GLocalTreeMonitor *tree)
+{
+  GLocalTreeMonitorClass *klass = G_LOCAL_TREE_MONITOR_GET_CLASS (tree);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, tree->watches);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      TreeDir *dir = value;
+
+      klass->unwatch_dir (tree, dir->watch);
+      g_hash_table_iter_remove (&iter);
+      g_queue_clear (&dir->children);
+      g_free (dir->path);
+      g_slice_free (TreeDir, dir);
+    }
+}
+
+static void
+g_local_tree_monitor_finalize (GObject *object)
+{
+  GLocalTreeMonitor *tree = G_LOCAL_TREE_MONITOR (object);
+
+  unwatch_all (tree);
+  g_hash_table_destroy (tree->watches);
+  g_free (tree->dirname);
+
+  G_OBJECT_CLASS (g_local_tree_monitor_parent_class)->finalize (object);
+}
+
+static void
+g_local_tree_monitor_set_property (GObject      *object,
+                                   guint         property_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+  switch (property_id)
+  {
+    case PROP_DIRNAME:
+      /* Do nothing */
+      break;
+    case PROP_FLAGS:
+      /* Do nothing */
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static GObject *
+g_local_tree_monitor_constructor (GType                  type,
+                                  guint                  n_construct_properties,
+                                  GObjectConstructParam *construct_properties)
+{
+  GObject *obj;
+  GObjectClass *parent_class;
+  GLocalTreeMonitor *tree;
+  GFileMonitorFlags flags = 0;
+  const gchar *dirname = NULL;
+  gint i;
+
+  parent_class = G_OBJECT_CLASS (g_local_tree_monitor_parent_class);
+  obj = parent_class->constructor (type,
+                                   n_construct_properties,
+                                   construct_properties);
+
+  tree = G_LOCAL_TREE_MONITOR (obj);
+
+  for (i = 0; i < n_construct_properties; i++)
+    {
+      if (strcmp ("dirname", g_param_spec_get_name (construct_properties[i].pspec)) == 0)
+        {
+          g_warn_if_fail (G_VALUE_HOLDS_STRING (construct_properties[i].value));
+          dirname = g_value_get_string (construct_properties[i].value);
+        }
+      if (strcmp ("flags", g_param_spec_get_name (construct_properties[i].pspec)) == 0)
+        {
+          g_warn_if_fail (G_VALUE_HOLDS_FLAGS (construct_properties[i].value));
+          flags = g_value_get_flags (construct_properties[i].value);
+        }
+    }
+
+  tree->dirname = g_strdup (dirname);
+  tree->flags = flags;
+
+  /* Runs before the handlers of the users, so the watches are already
+   * updated when they see an event */
+  g_signal_connect (tree, "changed", G_CALLBACK (tree_changed), NULL);
+  g_signal_connect (tree, "changes", G_CALLBACK (tree_changes), NULL);
+
+  watch_tree (tree, tree->dirname, FALSE);
+
+  return obj;
+}
+
+/* The default implementation, used when no backend can watch trees */
+
+typedef struct {
+  GLocalTreeMonitor *tree;
+  GFileMonitor *monitor;
+  GFile *dir;
+  gboolean is_root;
+} GenericWatch;
+
+static void
+generic_changed (GFileMonitor      *monitor,
+                 GFile             *file,
+                 GFile             *other_file,
+                 GFileMonitorEvent  event_type,
+                 gpointer           user_data)
+{
+  GenericWatch *watch = user_data;
+
+  if (!watch->is_root && g_file_equal (file, watch->dir))
+    return;
+
+  g_file_monitor_emit_event (G_FILE_MONITOR (watch->tree),
+                             file, other_file, event_type);
+}
+
+static gpointer
+g_local_tree_monitor_watch_dir (GLocalTreeMonitor *tree,
+                                const gchar       *dirname,
+                                gboolean           is_root)
+{
+  GenericWatch *watch;
+  GFileMonitor *monitor;
+
+  monitor = _g_local_directory_monitor_new (dirname,
+                                            tree->flags & ~G_FILE_MONITOR_SCAN_ON_ADD,
+                                            NULL);
+  if (monitor == NULL)
+    return NULL;
+
+  watch = g_slice_new (GenericWatch);
+  watch->tree = tree;
+  watch->monitor = monitor;
+  watch->dir = g_file_new_for_path (dirname);
+  watch->is_root = is_root;
+  g_signal_connect (monitor, "changed", G_CALLBACK (generic_changed), watch);
+
+  return watch;
+}
+
+static void
+g_local_tree_monitor_unwatch_dir (GLocalTreeMonitor *tree,
+                                  gpointer           data)
+{
+  GenericWatch *watch = data;
+
+  g_signal_handlers_disconnect_by_func (watch->monitor, generic_changed, watch);
+  g_file_monitor_cancel (watch->monitor);
+  g_object_unref (watch->monitor);
+  g_object_unref (watch->dir);
+  g_slice_free (GenericWatch, watch);
+}
+
+static gboolean
+g_local_tree_monitor_is_supported (void)
+{
+  return TRUE;
+}
+
+static void
+g_local_tree_monitor_get_statistics (GFileMonitor    *monitor,
+                                     GVariantBuilder *builder)
+{
+  GLocalTreeMonitor *tree = G_LOCAL_TREE_MONITOR (monitor);
+
+  G_FILE_MONITOR_CLASS (g_local_tree_monitor_parent_class)->get_statistics (monitor, builder);
+
+  g_variant_builder_add (builder, "{sv}", "tree-directories",
+                         g_variant_new_uint32 (tree->watches ?
+                                               g_hash_table_size (tree->watches) : 0));
+}
+
+static void
+g_local_tree_monitor_class_init (GLocalTreeMonitorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GFileMonitorClass *file_monitor_class = G_FILE_MONITOR_CLASS (klass);
+
+  gobject_class->finalize = g_local_tree_monitor_finalize;
+  gobject_class->set_property = g_local_tree_monitor_set_property;
+  gobject_class->constructor = g_local_tree_monitor_constructor;
+  file_monitor_class->cancel = g_local_tree_monitor_cancel;
+  file_monitor_class->get_statistics = g_local_tree_monitor_get_statistics;
+
+  klass->is_supported = g_local_tree_monitor_is_supported;
+  klass->watch_dir = g_local_tree_monitor_watch_dir;
+  klass->unwatch_dir = g_local_tree_monitor_unwatch_dir;
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_DIRNAME,
+                                   g_param_spec_string ("dirname",
+                                                        P_("Directory name"),
+                                                        P_("Root of the directory tree to monitor"),
+                                                        NULL,
+                                                        G_PARAM_CONSTRUCT_ONLY|
+                                                        G_PARAM_WRITABLE|
+                                                        G_PARAM_STATIC_NAME|G_PARAM_STATIC_NICK|G_PARAM_STATIC_BLURB));
+  g_object_class_install_property (gobject_class,
+                                   PROP_FLAGS,
+                                   g_param_spec_flags ("flags",
+                                                       P_("Monitor flags"),
+                                                       P_("Monitor flags"),
+                                                       G_TYPE_FILE_MONITOR_FLAGS,
+                                                       0,
+                                                       G_PARAM_CONSTRUCT_ONLY|
+                                                       G_PARAM_WRITABLE|
+                                                       G_PARAM_STATIC_NAME|G_PARAM_STATIC_NICK|G_PARAM_STATIC_BLURB));
+}
+
+static void
+g_local_tree_monitor_init (GLocalTreeMonitor *tree)
+{
+  tree->watches = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+/* Keeps the set of watched directories in sync with the tree */
+static void
+tree_changed (GFileMonitor      *monitor,
+              GFile             *file,
+              GFile             *other_file,
+              GFileMonitorEvent  event_type,
+              gpointer           user_data)
+{
+  GLocalTreeMonitor *tree = G_LOCAL_TREE_MONITOR (monitor);
+  gboolean report = (tree->flags & G_FILE_MONITOR_SCAN_ON_ADD) != 0;
+  gchar *path;
+  gchar *other_path = NULL;
+
+  if (g_file_monitor_is_cancelled (monitor))
+    return;
+
+  path = g_file_get_path (file);
+  if (path == NULL)
+    return;
+
+  switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_CREATED:
+      if (strcmp (path, tree->dirname) == 0)
+        scan_dir (tree, path, report);
+      else if (is_in_tree (tree, path) && is_directory (path))
+        watch_tree (tree, path, report);
+      break;
+
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_UNMOUNTED:
+      unwatch_tree (tree, path);
+      break;
+
+    case G_FILE_MONITOR_EVENT_MOVED:
+      unwatch_tree (tree, path);
+      if (other_file != NULL)
+        other_path = g_file_get_path (other_file);
+      if (other_path != NULL &&
+          is_in_tree (tree, other_path) &&
+          is_directory (other_path))
+        watch_tree (tree, other_path, report);
+      break;
+
+    default:
+      break;
+    }
+
+  g_free (path);
+  g_free (other_path);
+}
+
+static void
+tree_changes (GFileMonitor             *monitor,
+              const GFileMonitorChange *changes,
+              guint                     n_changes,
+              gpointer                  user_data)
+{
+  guint i;
+
+  for (i = 0; i < n_changes; i++)
+    tree_changed (monitor, changes[i].file, changes[i].other_file,
+                  changes[i].event_type, user_data);
+}
+
+static gpointer
+get_default_local_tree_monitor (gpointer data)
+{
+  GLocalTreeMonitorClass *chosen_class;
+  GLocalTreeMonitorClass **ret = data;
+  GIOExtensionPoint *ep;
+  GList *extensions, *l;
+
+  _g_io_modules_ensure_loaded ();
+
+  ep = g_io_extension_point_lookup (G_LOCAL_TREE_MONITOR_EXTENSION_POINT_NAME);
+
+  extensions = g_io_extension_point_get_extensions (ep);
+
+  chosen_class = NULL;
+  for (l = extensions; l != NULL; l = l->next)
+    {
+      GIOExtension *extension = l->data;
+      GLocalTreeMonitorClass *klass;
+
+      klass = G_LOCAL_TREE_MONITOR_CLASS (g_io_extension_ref_class (extension));
+
+      if (klass->is_supported ())
+	{
+	  chosen_class = klass;
+	  break;
+	}
+      else
+	g_type_class_unref (klass);
+    }
+
+  if (chosen_class)
+    {
+      *ret = chosen_class;
+      return (gpointer)G_TYPE_FROM_CLASS (chosen_class);
+    }
+  else
+    return (gpointer)G_TYPE_LOCAL_TREE_MONITOR;
+}
+
+GFileMonitor*
+_g_local_tree_monitor_new (const char         *dirname,
+                           GFileMonitorFlags   flags,
+                           GError            **error)
+{
+  static GOnce once_init = G_ONCE_INIT;
+  GTypeClass *type_class;
+  GFileMonitor *monitor;
+  GType type;
+
+  type_class = NULL;
+  g_once (&once_init, get_default_local_tree_monitor, &type_class);
+  type = (GType)once_init.retval;
+
+  monitor = G_FILE_MONITOR (g_object_new (type, "dirname", dirname, "flags", flags, NULL));
+
+  /* This is non-null on first pass here. Unref the class now.
+   * This is to avoid unloading the module and then loading it
+   * again which would happen if we unrefed the class
+   * before creating the monitor.
+   */
+  if (type_class)
+    g_type_class_unref (type_class);
+
+  if (g_hash_table_size (G_LOCAL_TREE_MONITOR (monitor)->watches) == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Unable to monitor the directory tree"));
+      g_object_unref (monitor);
+      return NULL;
+    }
+
+  return monitor;
+}
+
+static gboolean
+g_local_tree_monitor_cancel (GFileMonitor *monitor)
+{
+  GLocalTreeMonitor *tree = G_LOCAL_TREE_MONITOR (monitor);
+
+  g_signal_handlers_disconnect_by_func (tree, tree_changed, NULL);
+  g_signal_handlers_disconnect_by_func (tree, tree_changes, NULL);
+  unwatch_all (tree);
+
+  return TRUE;
+}
@@ -0,0 +1,77 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_LOCAL_TREE_MONITOR_H__
+#define __G_LOCAL_TREE_MONITOR_H__
+
+#include <gio/gfilemonitor.h>
+
+G_BEGIN_DECLS
+
+#define G_TYPE_LOCAL_TREE_MONITOR		(g_local_tree_monitor_get_type ())
+#define G_LOCAL_TREE_MONITOR(o)			(G_TYPE_CHECK_INSTANCE_CAST ((o), G_TYPE_LOCAL_TREE_MONITOR, GLocalTreeMonitor))
+#define G_LOCAL_TREE_MONITOR_CLASS(k)		(G_TYPE_CHECK_CLASS_CAST ((k), G_TYPE_LOCAL_TREE_MONITOR, GLocalTreeMonitorClass))
+#define G_LOCAL_TREE_MONITOR_GET_CLASS(o)	(G_TYPE_INSTANCE_GET_CLASS ((o), G_TYPE_LOCAL_TREE_MONITOR, GLocalTreeMonitorClass))
+#define G_IS_LOCAL_TREE_MONITOR(o)		(G_TYPE_CHECK_INSTANCE_TYPE ((o), G_TYPE_LOCAL_TREE_MONITOR))
+#define G_IS_LOCAL_TREE_MONITOR_CLASS(k)	(G_TYPE_CHECK_CLASS_TYPE ((k), G_TYPE_LOCAL_TREE_MONITOR))
+
+#define G_LOCAL_TREE_MONITOR_EXTENSION_POINT_NAME "gio-local-tree-monitor"
+
+typedef struct _GLocalTreeMonitor      GLocalTreeMonitor;
+typedef struct _GLocalTreeMonitorClass GLocalTreeMonitorClass;
+
+struct _GLocalTreeMonitor
+{
+  GFileMonitor parent_instance;
+
+  gchar             *dirname;
+  GFileMonitorFlags  flags;
+  /* directory path -> watched directory */
+  GHashTable        *watches;
+};
+
+/*
+ * The backends only have to watch a single directory at a time and
+ * emit the events on the tree monitor. @watch_dir is never called twice
+ * for the same directory without @unwatch_dir in between. For all the
+ * directories but the root, the events about the directory itself must
+ * not be emitted, as they are reported by its parent.
+ *
+ * The default implementation uses a directory monitor per directory.
+ */
+struct _GLocalTreeMonitorClass
+{
+  GFileMonitorClass parent_class;
+
+  gboolean (* is_supported) (void);
+  gpointer (* watch_dir)    (GLocalTreeMonitor *monitor,
+                             const gchar       *dirname,
+                             gboolean           is_root);
+  void     (* unwatch_dir)  (GLocalTreeMonitor *monitor,
+                             gpointer           watch);
+};
+
+GType           g_local_tree_monitor_get_type (void) G_GNUC_CONST;
+
+GFileMonitor * _g_local_tree_monitor_new      (const char         *dirname,
+                                               GFileMonitorFlags   flags,
+                                               GError            **error);
+
+G_END_DECLS
+
+#endif /* __G_LOCAL_TREE_MONITOR_H__ */
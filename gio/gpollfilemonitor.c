@@ -27,105 +27,226 @@
 #include "gfile.h"
 #include "gfilemonitor.h"
 #include "gfileinfo.h"
+#include "gioscheduler.h"
+#include "gfilemonitorprivate.h"
+#include "glibintl.h"
 
 
+/* All the poll monitors share a scheduler, which ticks once a second
+ * and stats all the files that are due in a single I/O job. The files
+ * are spread over the seconds of their interval, so the batches are
+ * about the same size, and only the etag and the size of each file
+ * are kept to compare with the next poll.
+ */
+
 static gboolean g_poll_file_monitor_cancel (GFileMonitor* monitor);
-static void schedule_poll_timeout (GPollFileMonitor* poll_monitor);
 
 struct _GPollFileMonitor
 {
   GFileMonitor parent_instance;
   GFile *file;
-  GFileInfo *last_info;
-  guint timeout;
+  guint interval;       /* seconds */
+
+  gboolean registered;  /* counted by the scheduler */
+  gint64 next_poll;     /* seconds, 0 == not scheduled */
+
+  gboolean have_info;   /* the below are from a finished poll */
+  gboolean exists;
+  gchar *etag;
+  goffset size;
+};
+
+enum {
+  PROP_0,
+  PROP_POLL_INTERVAL
 };
 
 #define POLL_TIME_SECS 5
+#define POLL_ATTRIBUTES G_FILE_ATTRIBUTE_ETAG_VALUE "," G_FILE_ATTRIBUTE_STANDARD_SIZE
+
+/* Spread new monitors over at most that many seconds */
+#define POLL_SPREAD_SECS 60
+
+typedef struct {
+  GHashTable *slots;    /* second -> GQueue of GPollFileMonitor */
+  guint n_monitors;
+  gint64 time;          /* the slots up to this second are done */
+  guint timeout;
+  gboolean in_flight;   /* a batch is being stat'ed */
+
+  /* Statistics */
+  guint64 n_batches;
+  guint64 n_polls;
+  guint64 n_late_ticks; /* ticks skipped because of a slow batch */
+  guint max_batch;
+  GFileMonitorHistogram batch_times;
+} PollScheduler;
+
+typedef struct {
+  GPollFileMonitor *monitor;
+  gboolean exists;
+  gchar *etag;
+  goffset size;
+} PollResult;
+
+typedef struct {
+  gint64 time;
+  gint64 started;       /* microseconds */
+  GArray *results;      /* PollResult */
+} PollBatch;
+
+G_LOCK_DEFINE_STATIC (poll_scheduler);
+static PollScheduler scheduler;
 
 #define g_poll_file_monitor_get_type _g_poll_file_monitor_get_type
 G_DEFINE_TYPE (GPollFileMonitor, g_poll_file_monitor, G_TYPE_FILE_MONITOR)
 
+static gint64
+get_time_secs (void)
+{
+  return g_get_monotonic_time () / G_USEC_PER_SEC;
+}
+
+/* Must be called with the scheduler lock held */
 static void
-g_poll_file_monitor_finalize (GObject* object)
+scheduler_insert (GPollFileMonitor *poll_monitor,
+                  gint64            when)
 {
-  GPollFileMonitor* poll_monitor;
-  
-  poll_monitor = G_POLL_FILE_MONITOR (object);
+  GQueue *queue;
 
-  g_object_unref (poll_monitor->file);
+  queue = g_hash_table_lookup (scheduler.slots, &when);
+  if (queue == NULL)
+    {
+      gint64 *key = g_new (gint64, 1);
 
-  G_OBJECT_CLASS (g_poll_file_monitor_parent_class)->finalize (object);
-}
+      *key = when;
+      queue = g_queue_new ();
+      g_hash_table_insert (scheduler.slots, key, queue);
+    }
 
+  g_queue_push_tail (queue, poll_monitor);
+  poll_monitor->next_poll = when;
+}
 
+/* Picks the least loaded second of the next interval */
 static void
-g_poll_file_monitor_class_init (GPollFileMonitorClass* klass)
+scheduler_insert_spread (GPollFileMonitor *poll_monitor)
 {
-  GObjectClass* gobject_class = G_OBJECT_CLASS (klass);
-  GFileMonitorClass *file_monitor_class = G_FILE_MONITOR_CLASS (klass);
-  
-  gobject_class->finalize = g_poll_file_monitor_finalize;
+  gint64 first = scheduler.time + 1;
+  gint64 best = first;
+  guint best_len = G_MAXUINT;
+  guint i;
 
-  file_monitor_class->cancel = g_poll_file_monitor_cancel;
+  for (i = 0; i < MIN (poll_monitor->interval, POLL_SPREAD_SECS); i++)
+    {
+      gint64 when = first + i;
+      GQueue *queue = g_hash_table_lookup (scheduler.slots, &when);
+      guint len = queue ? g_queue_get_length (queue) : 0;
+
+      if (len < best_len)
+        {
+          best = when;
+          best_len = len;
+          if (len == 0)
+            break;
+        }
+    }
+
+  scheduler_insert (poll_monitor, best);
 }
 
 static void
-g_poll_file_monitor_init (GPollFileMonitor* poll_monitor)
+scheduler_remove (GPollFileMonitor *poll_monitor)
 {
+  GQueue *queue;
+
+  if (poll_monitor->next_poll == 0)
+    return;
+
+  queue = g_hash_table_lookup (scheduler.slots, &poll_monitor->next_poll);
+  g_queue_remove (queue, poll_monitor);
+  if (g_queue_is_empty (queue))
+    g_hash_table_remove (scheduler.slots, &poll_monitor->next_poll);
+
+  poll_monitor->next_poll = 0;
 }
 
-static int 
-safe_strcmp (const char *a, 
-             const char *b)
+static void
+poll_batch_done_free (gpointer data)
 {
-  if (a == NULL && b == NULL)
-    return 0;
-  if (a == NULL)
-    return -1;
-  if (b == NULL)
-    return 1;
-  
-  return strcmp (a, b);
+  PollBatch *batch = data;
+  gint64 batch_time;
+  guint i;
+
+  batch_time = g_get_monotonic_time () - batch->started;
+
+  for (i = 0; i < batch->results->len; i++)
+    {
+      PollResult *result = &g_array_index (batch->results, PollResult, i);
+
+      g_free (result->etag);
+      g_object_unref (result->monitor);
+    }
+
+  g_array_free (batch->results, TRUE);
+  g_slice_free (PollBatch, batch);
+
+  G_LOCK (poll_scheduler);
+  scheduler.in_flight = FALSE;
+  _g_file_monitor_histogram_add (&scheduler.batch_times, batch_time);
+  G_UNLOCK (poll_scheduler);
 }
 
 static int
-calc_event_type (GFileInfo *last,
-		 GFileInfo *new)
+calc_event_type (GPollFileMonitor *poll_monitor,
+                 PollResult       *result)
 {
-  if (last == NULL && new == NULL)
+  if (!poll_monitor->exists && !result->exists)
     return -1;
 
-  if (last == NULL && new != NULL)
+  if (!poll_monitor->exists && result->exists)
     return G_FILE_MONITOR_EVENT_CREATED;
-  
-  if (last != NULL && new == NULL)
+
+  if (poll_monitor->exists && !result->exists)
     return G_FILE_MONITOR_EVENT_DELETED;
 
-  if (safe_strcmp (g_file_info_get_etag (last),
-		   g_file_info_get_etag (new)))
+  if (g_strcmp0 (poll_monitor->etag, result->etag) != 0)
     return G_FILE_MONITOR_EVENT_CHANGED;
-  
-  if (g_file_info_get_size (last) !=
-      g_file_info_get_size (new))
+
+  if (poll_monitor->size != result->size)
     return G_FILE_MONITOR_EVENT_CHANGED;
 
   return -1;
 }
 
-static void
-got_new_info (GObject      *source_object,
-              GAsyncResult *res,
-              gpointer      user_data)
+static gboolean
+poll_batch_done (gpointer data)
 {
-  GPollFileMonitor* poll_monitor = user_data;
-  GFileInfo *info;
-  int event;
+  PollBatch *batch = data;
+  gint64 batch_time;
+  guint i;
 
-  info = g_file_query_info_finish (poll_monitor->file, res, NULL);
+  batch_time = g_get_monotonic_time () - batch->started;
 
-  if (!g_file_monitor_is_cancelled (G_FILE_MONITOR (poll_monitor)))
+  for (i = 0; i < batch->results->len; i++)
     {
-      event = calc_event_type (poll_monitor->last_info, info);
+      PollResult *result = &g_array_index (batch->results, PollResult, i);
+      GPollFileMonitor *poll_monitor = result->monitor;
+      gboolean first = !poll_monitor->have_info;
+      int event = -1;
+
+      if (g_file_monitor_is_cancelled (G_FILE_MONITOR (poll_monitor)))
+        continue;
+
+      if (!first)
+        event = calc_event_type (poll_monitor, result);
+
+      poll_monitor->have_info = TRUE;
+      poll_monitor->exists = result->exists;
+      poll_monitor->size = result->size;
+      g_free (poll_monitor->etag);
+      poll_monitor->etag = result->etag;
+      result->etag = NULL;
 
       if (event != -1)
 	{
@@ -138,67 +259,275 @@ got_new_info (GObject      *source_object,
 				       poll_monitor->file,
 				       NULL, G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT);
 	}
-      
-      if (poll_monitor->last_info)
-	{
-	  g_object_unref (poll_monitor->last_info);
-	  poll_monitor->last_info = NULL;
-	}
-      
-      if (info)
-	poll_monitor->last_info = g_object_ref (info);
-      
-      schedule_poll_timeout (poll_monitor);
+
+      G_LOCK (poll_scheduler);
+      if (poll_monitor->registered && poll_monitor->next_poll == 0)
+        {
+          if (first)
+            scheduler_insert_spread (poll_monitor);
+          else
+            scheduler_insert (poll_monitor,
+                              MAX (batch->time + poll_monitor->interval, scheduler.time + 1));
+        }
+      G_UNLOCK (poll_scheduler);
     }
 
-  if (info)
-    g_object_unref (info);
-  
-  g_object_unref (poll_monitor);
+  return FALSE;
 }
 
 static gboolean
-poll_file_timeout (gpointer data)
+poll_batch_job (GIOSchedulerJob *job,
+                GCancellable    *cancellable,
+                gpointer         user_data)
 {
-  GPollFileMonitor* poll_monitor = data;
+  PollBatch *batch = user_data;
+  guint i;
 
-  poll_monitor->timeout = FALSE;
+  for (i = 0; i < batch->results->len; i++)
+    {
+      PollResult *result = &g_array_index (batch->results, PollResult, i);
+      GFileInfo *info;
+
+      info = g_file_query_info (result->monitor->file, POLL_ATTRIBUTES,
+                                0, NULL, NULL);
+      if (info == NULL)
+        continue;
+
+      result->exists = TRUE;
+      result->etag = g_strdup (g_file_info_get_etag (info));
+      result->size = g_file_info_get_size (info);
+      g_object_unref (info);
+    }
+
+  g_io_scheduler_job_send_to_mainloop_async (job, poll_batch_done,
+                                             batch, poll_batch_done_free);
 
-  g_file_query_info_async (poll_monitor->file, G_FILE_ATTRIBUTE_ETAG_VALUE "," G_FILE_ATTRIBUTE_STANDARD_SIZE,
-			 0, 0, NULL, got_new_info, g_object_ref (poll_monitor));
-  
   return FALSE;
 }
 
+static gboolean
+poll_scheduler_tick (gpointer data)
+{
+  PollBatch *batch;
+  gint64 now, t;
+
+  G_LOCK (poll_scheduler);
+
+  if (scheduler.n_monitors == 0)
+    {
+      scheduler.timeout = 0;
+      G_UNLOCK (poll_scheduler);
+      return FALSE;
+    }
+
+  /* The previous batch is still running on a slow filesystem, the
+   * files due in the meantime go into the next one */
+  if (scheduler.in_flight)
+    {
+      scheduler.n_late_ticks++;
+      G_UNLOCK (poll_scheduler);
+      return TRUE;
+    }
+
+  now = get_time_secs ();
+  batch = g_slice_new (PollBatch);
+  batch->time = now;
+  batch->results = g_array_new (FALSE, TRUE, sizeof (PollResult));
+
+  for (t = scheduler.time + 1; t <= now; t++)
+    {
+      GQueue *queue = g_hash_table_lookup (scheduler.slots, &t);
+      GList *l;
+
+      if (queue == NULL)
+        continue;
+
+      for (l = queue->head; l != NULL; l = l->next)
+        {
+          GPollFileMonitor *poll_monitor = l->data;
+          PollResult result = { NULL, };
+
+          result.monitor = g_object_ref (poll_monitor);
+          poll_monitor->next_poll = 0;
+          g_array_append_val (batch->results, result);
+        }
+
+      g_hash_table_remove (scheduler.slots, &t);
+    }
+  scheduler.time = now;
+
+  if (batch->results->len > 0)
+    {
+      scheduler.in_flight = TRUE;
+      scheduler.n_batches++;
+      scheduler.n_polls += batch->results->len;
+      scheduler.max_batch = MAX (scheduler.max_batch, batch->results->len);
+      batch->started = g_get_monotonic_time ();
+      g_io_scheduler_push_job (poll_batch_job, batch, NULL,
+                               G_PRIORITY_DEFAULT, NULL);
+    }
+  else
+    {
+      g_array_free (batch->results, TRUE);
+      g_slice_free (PollBatch, batch);
+    }
+
+  G_UNLOCK (poll_scheduler);
+
+  return TRUE;
+}
+
+static void
+scheduler_add (GPollFileMonitor *poll_monitor)
+{
+  G_LOCK (poll_scheduler);
+
+  if (scheduler.slots == NULL)
+    scheduler.slots = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                             g_free, (GDestroyNotify) g_queue_free);
+
+  if (scheduler.timeout == 0)
+    {
+      scheduler.time = get_time_secs ();
+      scheduler.timeout = g_timeout_add_seconds (1, poll_scheduler_tick, NULL);
+    }
+
+  poll_monitor->registered = TRUE;
+  scheduler.n_monitors++;
+
+  /* The first poll only fills the cache */
+  scheduler_insert (poll_monitor, scheduler.time + 1);
+
+  G_UNLOCK (poll_scheduler);
+}
+
+static void
+g_poll_file_monitor_finalize (GObject* object)
+{
+  GPollFileMonitor* poll_monitor;
+  
+  poll_monitor = G_POLL_FILE_MONITOR (object);
+
+  g_object_unref (poll_monitor->file);
+  g_free (poll_monitor->etag);
+
+  G_OBJECT_CLASS (g_poll_file_monitor_parent_class)->finalize (object);
+}
+
 static void
-schedule_poll_timeout (GPollFileMonitor* poll_monitor)
+g_poll_file_monitor_set_property (GObject      *object,
+                                  guint         prop_id,
+                                  const GValue *value,
+                                  GParamSpec   *pspec)
 {
-  poll_monitor->timeout = g_timeout_add_seconds (POLL_TIME_SECS, poll_file_timeout, poll_monitor);
- }
+  GPollFileMonitor *poll_monitor = G_POLL_FILE_MONITOR (object);
+
+  switch (prop_id)
+    {
+    case PROP_POLL_INTERVAL:
+      G_LOCK (poll_scheduler);
+      poll_monitor->interval = g_value_get_uint (value);
+      if (poll_monitor->have_info && poll_monitor->next_poll != 0)
+        {
+          scheduler_remove (poll_monitor);
+          scheduler_insert_spread (poll_monitor);
+        }
+      G_UNLOCK (poll_scheduler);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
 
 static void
-got_initial_info (GObject      *source_object,
-                  GAsyncResult *res,
-                  gpointer      user_data)
+g_poll_file_monitor_get_property (GObject    *object,
+                                  guint       prop_id,
+                                  GValue     *value,
+                                  GParamSpec *pspec)
 {
-  GPollFileMonitor* poll_monitor = user_data;
-  GFileInfo *info;
+  GPollFileMonitor *poll_monitor = G_POLL_FILE_MONITOR (object);
 
-  info = g_file_query_info_finish (poll_monitor->file, res, NULL);
+  switch (prop_id)
+    {
+    case PROP_POLL_INTERVAL:
+      g_value_set_uint (value, poll_monitor->interval);
+      break;
 
-  poll_monitor->last_info = info;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
 
-  if (!g_file_monitor_is_cancelled (G_FILE_MONITOR (poll_monitor)))
-    schedule_poll_timeout (poll_monitor);
+static void
+g_poll_file_monitor_get_statistics (GFileMonitor    *monitor,
+                                    GVariantBuilder *builder)
+{
+  GPollFileMonitor *poll_monitor = G_POLL_FILE_MONITOR (monitor);
+  PollScheduler copy;
+
+  G_FILE_MONITOR_CLASS (g_poll_file_monitor_parent_class)->get_statistics (monitor, builder);
+
+  G_LOCK (poll_scheduler);
+  copy = scheduler;
+  G_UNLOCK (poll_scheduler);
+
+  g_variant_builder_add (builder, "{sv}", "backend",
+                         g_variant_new_string ("poll"));
+  g_variant_builder_add (builder, "{sv}", "poll-interval",
+                         g_variant_new_uint32 (poll_monitor->interval));
+  g_variant_builder_add (builder, "{sv}", "watches",
+                         g_variant_new_uint32 (copy.n_monitors));
+  g_variant_builder_add (builder, "{sv}", "polls",
+                         g_variant_new_uint64 (copy.n_polls));
+  g_variant_builder_add (builder, "{sv}", "poll-batches",
+                         g_variant_new_uint64 (copy.n_batches));
+  g_variant_builder_add (builder, "{sv}", "poll-batch-max",
+                         g_variant_new_uint32 (copy.max_batch));
+  g_variant_builder_add (builder, "{sv}", "poll-late-ticks",
+                         g_variant_new_uint64 (copy.n_late_ticks));
+  _g_file_monitor_statistics_add_histogram (builder, "poll-batch-time-histogram",
+                                            &copy.batch_times);
+}
+
+static void
+g_poll_file_monitor_class_init (GPollFileMonitorClass* klass)
+{
+  GObjectClass* gobject_class = G_OBJECT_CLASS (klass);
+  GFileMonitorClass *file_monitor_class = G_FILE_MONITOR_CLASS (klass);
   
-  g_object_unref (poll_monitor);
+  gobject_class->finalize = g_poll_file_monitor_finalize;
+  gobject_class->set_property = g_poll_file_monitor_set_property;
+  gobject_class->get_property = g_poll_file_monitor_get_property;
+
+  file_monitor_class->cancel = g_poll_file_monitor_cancel;
+  file_monitor_class->get_statistics = g_poll_file_monitor_get_statistics;
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_POLL_INTERVAL,
+                                   g_param_spec_uint ("poll-interval",
+                                                      P_("Poll interval"),
+                                                      P_("The time between two polls of the file, in seconds"),
+                                                      1, G_MAXUINT,
+                                                      POLL_TIME_SECS,
+                                                      G_PARAM_READWRITE|
+                                                      G_PARAM_STATIC_NAME|G_PARAM_STATIC_NICK|G_PARAM_STATIC_BLURB));
+}
+
+static void
+g_poll_file_monitor_init (GPollFileMonitor* poll_monitor)
+{
+  poll_monitor->interval = POLL_TIME_SECS;
 }
 
 /**
  * g_poll_file_monitor_new:
  * @file: a #GFile.
  * 
- * Polls @file for changes.
+ * Polls @file for changes, every 5 seconds by default. The interval
+ * can be changed with the "poll-interval" property of the monitor.
  * 
  * Returns: a new #GFileMonitor for the given #GFile. 
  **/
@@ -210,9 +539,7 @@ _g_poll_file_monitor_new (GFile *file)
   poll_monitor = g_object_new (G_TYPE_POLL_FILE_MONITOR, NULL);
 
   poll_monitor->file = g_object_ref (file);
-
-  g_file_query_info_async (file, G_FILE_ATTRIBUTE_ETAG_VALUE "," G_FILE_ATTRIBUTE_STANDARD_SIZE,
-			   0, 0, NULL, got_initial_info, g_object_ref (poll_monitor));
+  scheduler_add (poll_monitor);
   
   return G_FILE_MONITOR (poll_monitor);
 }
@@ -222,11 +549,14 @@ g_poll_file_monitor_cancel (GFileMonitor* monitor)
 {
   GPollFileMonitor *poll_monitor = G_POLL_FILE_MONITOR (monitor);
   
-  if (poll_monitor->timeout)
+  G_LOCK (poll_scheduler);
+  if (poll_monitor->registered)
     {
-      g_source_remove (poll_monitor->timeout);
-      poll_monitor->timeout = 0;
+      scheduler_remove (poll_monitor);
+      poll_monitor->registered = FALSE;
+      scheduler.n_monitors--;
     }
+  G_UNLOCK (poll_scheduler);
   
   return TRUE;
 }
@@ -35,6 +35,7 @@
 #include "gasyncresult.h"
 #include "gcancellable.h"
 #include "gioscheduler.h"
+#include "gioschedulerprivate.h"
 #include <gio/gioerror.h>
 #include "glibintl.h"
 
@@ -880,7 +881,8 @@ g_simple_async_result_run_in_thread (GSimpleAsyncResult     *simple,
   data->cancellable = cancellable;
   if (cancellable)
     g_object_ref (cancellable);
-  g_io_scheduler_push_job (run_in_thread, data, NULL, io_priority, cancellable);
+  _g_io_scheduler_push_job_to_pool (_g_io_scheduler_pool_for_object (simple->source_object),
+                                    run_in_thread, data, NULL, io_priority, cancellable);
 }
 
 /**
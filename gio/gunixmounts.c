@@ -43,6 +43,7 @@
 #endif
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/time.h>
 #include <errno.h>
 #include <string.h>
@@ -51,8 +52,10 @@
 #include <dirent.h>
 
 #include "gunixmounts.h"
+#include "gunixmountsprivate.h"
 #include "gfile.h"
 #include "gfilemonitor.h"
+#include "gio-marshal.h"
 #include "glibintl.h"
 #include "gthemedicon.h"
 
@@ -125,6 +128,7 @@ struct _GUnixMountPoint {
 enum {
   MOUNTS_CHANGED,
   MOUNTPOINTS_CHANGED,
+  MOUNT_ENTRIES_CHANGED,
   LAST_SIGNAL
 };
 
@@ -135,6 +139,10 @@ struct _GUnixMountMonitor {
 
   GFileMonitor *fstab_monitor;
   GFileMonitor *mtab_monitor;
+  GSource *mountinfo_source;
+
+  /* Last read mount table, sorted with g_unix_mount_compare() */
+  GList *mounts;
 };
 
 struct _GUnixMountMonitorClass {
@@ -148,8 +156,6 @@ static GList *_g_get_unix_mount_points (void);
 
 G_DEFINE_TYPE (GUnixMountMonitor, g_unix_mount_monitor, G_TYPE_OBJECT);
 
-#define MOUNT_POLL_INTERVAL 4000
-
 #ifdef HAVE_SYS_MNTTAB_H
 #define MNTOPT_RO	"ro"
 #endif
@@ -334,6 +340,137 @@ get_mtab_monitor_file (void)
 #endif
 }
 
+#ifdef __linux__
+
+#define MOUNTINFO_FILE "/proc/self/mountinfo"
+
+/* The kernel escapes space, tab, newline and backslash in
+ * mountinfo fields as three digit octal sequences.
+ */
+static char *
+unescape_mountinfo_field (const char *field)
+{
+  char *result, *out;
+
+  result = out = g_malloc (strlen (field) + 1);
+  while (*field != 0)
+    {
+      if (field[0] == '\\' &&
+          field[1] >= '0' && field[1] <= '3' &&
+          field[2] >= '0' && field[2] <= '7' &&
+          field[3] >= '0' && field[3] <= '7')
+        {
+          *out++ = ((field[1] - '0') << 6) |
+                   ((field[2] - '0') << 3) |
+                    (field[3] - '0');
+          field += 4;
+        }
+      else
+        *out++ = *field++;
+    }
+  *out = 0;
+
+  return result;
+}
+
+static gboolean
+mount_options_have_ro (const char *options)
+{
+  const char *p;
+
+  for (p = options; p != NULL; p = strchr (p, ','))
+    {
+      if (*p == ',')
+        p++;
+      if (p[0] == 'r' && p[1] == 'o' && (p[2] == ',' || p[2] == 0))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Parses the contents of /proc/self/mountinfo.  Unlike /proc/mounts
+ * this has one well defined line format on every kernel that has it,
+ * so we don't need the getmntent() machinery or its lock.
+ */
+static GList *
+_g_get_unix_mounts_from_mountinfo (char *contents)
+{
+  GUnixMountEntry *mount_entry;
+  GHashTable *mounts_hash;
+  GList *return_list;
+  char *line, *next;
+  char **fields;
+  char *device_path;
+  int n_fields, sep;
+
+  return_list = NULL;
+  mounts_hash = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (line = contents; line != NULL && *line != 0; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next != NULL)
+        *next++ = 0;
+
+      /* id parent major:minor root mount-point options [optional...] - type source super-options */
+      fields = g_strsplit (line, " ", -1);
+      n_fields = g_strv_length (fields);
+
+      for (sep = 6; sep < n_fields; sep++)
+        if (strcmp (fields[sep], "-") == 0)
+          break;
+
+      if (sep + 2 >= n_fields)
+        {
+          g_strfreev (fields);
+          continue;
+        }
+
+      device_path = unescape_mountinfo_field (fields[sep + 2]);
+
+      /* See _g_get_unix_mounts() below for why repeated device
+       * paths are skipped.
+       */
+      if (device_path[0] == '/' &&
+          g_hash_table_lookup (mounts_hash, device_path))
+        {
+          g_free (device_path);
+          g_strfreev (fields);
+          continue;
+        }
+
+      mount_entry = g_new0 (GUnixMountEntry, 1);
+      mount_entry->mount_path = unescape_mountinfo_field (fields[4]);
+      if (strcmp (device_path, "/dev/root") == 0)
+        {
+          g_free (device_path);
+          device_path = g_strdup (_resolve_dev_root ());
+        }
+      mount_entry->device_path = device_path;
+      mount_entry->filesystem_type = unescape_mountinfo_field (fields[sep + 1]);
+      mount_entry->is_read_only =
+        mount_options_have_ro (fields[5]) ||
+        (sep + 3 < n_fields && mount_options_have_ro (fields[sep + 3]));
+      mount_entry->is_system_internal =
+	guess_system_internal (mount_entry->mount_path,
+			       mount_entry->filesystem_type,
+			       mount_entry->device_path);
+
+      g_hash_table_insert (mounts_hash,
+			   mount_entry->device_path,
+			   mount_entry->device_path);
+
+      return_list = g_list_prepend (return_list, mount_entry);
+      g_strfreev (fields);
+    }
+  g_hash_table_destroy (mounts_hash);
+
+  return g_list_reverse (return_list);
+}
+
+#endif /* __linux__ */
+
 #ifndef HAVE_GETMNTENT_R
 G_LOCK_DEFINE_STATIC(getmntent);
 #endif
@@ -351,6 +488,16 @@ _g_get_unix_mounts (void)
   GUnixMountEntry *mount_entry;
   GHashTable *mounts_hash;
   GList *return_list;
+#ifdef __linux__
+  char *contents;
+
+  if (g_file_get_contents (MOUNTINFO_FILE, &contents, NULL, NULL))
+    {
+      return_list = _g_get_unix_mounts_from_mountinfo (contents);
+      g_free (contents);
+      return return_list;
+    }
+#endif
   
   read_file = get_mtab_read_file ();
 
@@ -1198,6 +1345,15 @@ g_unix_mount_monitor_finalize (GObject *object)
       g_object_unref (monitor->mtab_monitor);
     }
 
+  if (monitor->mountinfo_source)
+    {
+      g_source_destroy (monitor->mountinfo_source);
+      g_source_unref (monitor->mountinfo_source);
+    }
+
+  g_list_foreach (monitor->mounts, (GFunc)g_unix_mount_free, NULL);
+  g_list_free (monitor->mounts);
+
   the_mount_monitor = NULL;
 
   G_OBJECT_CLASS (g_unix_mount_monitor_parent_class)->finalize (object);
@@ -1216,6 +1372,11 @@ g_unix_mount_monitor_class_init (GUnixMountMonitorClass *klass)
    * @monitor: the object on which the signal is emitted
    * 
    * Emitted when the unix mounts have changed.
+   *
+   * This is only emitted when the mount table actually differs from
+   * the last time it was read; connect to
+   * #GUnixMountMonitor::mount-entries-changed to find out what changed
+   * without rereading the mount table.
    */ 
   signals[MOUNTS_CHANGED] =
     g_signal_new ("mounts-changed",
@@ -1226,6 +1387,33 @@ g_unix_mount_monitor_class_init (GUnixMountMonitorClass *klass)
 		  g_cclosure_marshal_VOID__VOID,
 		  G_TYPE_NONE, 0);
 
+  /**
+   * GUnixMountMonitor::mount-entries-changed:
+   * @monitor: the object on which the signal is emitted
+   * @added: (element-type GUnixMountEntry): the #GUnixMountEntry<!-- -->s
+   *     that appeared, sorted with g_unix_mount_compare()
+   * @removed: (element-type GUnixMountEntry): the #GUnixMountEntry<!-- -->s
+   *     that went away, sorted with g_unix_mount_compare()
+   *
+   * Emitted just before #GUnixMountMonitor::mounts-changed with the
+   * difference between the previous and the current mount table.
+   * A mount whose options changed shows up in both lists.
+   *
+   * The lists and entries are owned by @monitor and are only valid
+   * for the duration of the signal emission.
+   *
+   * Since: 2.30
+   */
+  signals[MOUNT_ENTRIES_CHANGED] =
+    g_signal_new ("mount-entries-changed",
+		  G_TYPE_FROM_CLASS (klass),
+		  G_SIGNAL_RUN_LAST,
+		  0,
+		  NULL, NULL,
+		  _gio_marshal_VOID__POINTER_POINTER,
+		  G_TYPE_NONE, 2,
+		  G_TYPE_POINTER, G_TYPE_POINTER);
+
   /**
    * GUnixMountMonitor::mountpoints-changed:
    * @monitor: the object on which the signal is emitted
@@ -1260,6 +1448,73 @@ fstab_file_changed (GFileMonitor      *monitor,
   g_signal_emit (mount_monitor, signals[MOUNTPOINTS_CHANGED], 0);
 }
 
+static void
+diff_sorted_mounts (GList  *old_mounts,
+                    GList  *new_mounts,
+                    GList **added,
+                    GList **removed)
+{
+  int order;
+
+  *added = *removed = NULL;
+
+  while (old_mounts != NULL && new_mounts != NULL)
+    {
+      order = g_unix_mount_compare (old_mounts->data, new_mounts->data);
+      if (order < 0)
+        {
+          *removed = g_list_prepend (*removed, old_mounts->data);
+          old_mounts = old_mounts->next;
+        }
+      else if (order > 0)
+        {
+          *added = g_list_prepend (*added, new_mounts->data);
+          new_mounts = new_mounts->next;
+        }
+      else
+        {
+          old_mounts = old_mounts->next;
+          new_mounts = new_mounts->next;
+        }
+    }
+
+  for (; old_mounts != NULL; old_mounts = old_mounts->next)
+    *removed = g_list_prepend (*removed, old_mounts->data);
+  for (; new_mounts != NULL; new_mounts = new_mounts->next)
+    *added = g_list_prepend (*added, new_mounts->data);
+
+  *added = g_list_reverse (*added);
+  *removed = g_list_reverse (*removed);
+}
+
+static void
+update_mounts (GUnixMountMonitor *mount_monitor)
+{
+  GList *new_mounts, *old_mounts;
+  GList *added, *removed;
+
+  new_mounts = g_list_sort (_g_get_unix_mounts (),
+                            (GCompareFunc) g_unix_mount_compare);
+  diff_sorted_mounts (mount_monitor->mounts, new_mounts, &added, &removed);
+
+  old_mounts = mount_monitor->mounts;
+  mount_monitor->mounts = new_mounts;
+
+  if (added != NULL || removed != NULL)
+    {
+      g_object_ref (mount_monitor);
+      g_signal_emit (mount_monitor, signals[MOUNT_ENTRIES_CHANGED], 0,
+                     added, removed);
+      g_signal_emit (mount_monitor, signals[MOUNTS_CHANGED], 0);
+      g_object_unref (mount_monitor);
+    }
+
+  g_list_free (added);
+  g_list_free (removed);
+  g_list_foreach (old_mounts, (GFunc)g_unix_mount_free, NULL);
+  g_list_free (old_mounts);
+}
+
 static void
 mtab_file_changed (GFileMonitor      *monitor,
 		   GFile             *file,
@@ -1275,13 +1530,61 @@ mtab_file_changed (GFileMonitor      *monitor,
     return;
   
   mount_monitor = user_data;
-  g_signal_emit (mount_monitor, signals[MOUNTS_CHANGED], 0);
+  update_mounts (mount_monitor);
 }
 
+#ifdef __linux__
+/* The kernel flags /proc/self/mountinfo with POLLPRI | POLLERR
+ * whenever the mount namespace changes, so there is no need to
+ * watch (or poll) /etc/mtab.
+ */
+static gboolean
+mountinfo_changed (GIOChannel   *channel,
+                   GIOCondition  cond,
+                   gpointer      user_data)
+{
+  GUnixMountMonitor *mount_monitor = user_data;
+
+  update_mounts (mount_monitor);
+
+  return TRUE;
+}
+
+static GSource *
+mountinfo_source_new (GUnixMountMonitor *mount_monitor)
+{
+  GIOChannel *channel;
+  GSource *source;
+  int fd;
+
+  fd = g_open (MOUNTINFO_FILE, O_RDONLY, 0);
+  if (fd < 0)
+    return NULL;
+
+  channel = g_io_channel_unix_new (fd);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+
+  source = g_io_create_watch (channel, G_IO_PRI | G_IO_ERR);
+  g_source_set_callback (source, (GSourceFunc) mountinfo_changed,
+                         mount_monitor, NULL);
+  g_source_attach (source, g_main_context_get_thread_default ());
+  g_io_channel_unref (channel);
+
+  return source;
+}
+#endif
+
 static void
 g_unix_mount_monitor_init (GUnixMountMonitor *monitor)
 {
   GFile *file;
+
+  monitor->mounts = g_list_sort (_g_get_unix_mounts (),
+                                 (GCompareFunc) g_unix_mount_compare);
+
+#ifdef __linux__
+  monitor->mountinfo_source = mountinfo_source_new (monitor);
+#endif
     
   if (get_fstab_file () != NULL)
     {
@@ -1292,7 +1595,8 @@ g_unix_mount_monitor_init (GUnixMountMonitor *monitor)
       g_signal_connect (monitor->fstab_monitor, "changed", (GCallback)fstab_file_changed, monitor);
     }
   
-  if (get_mtab_monitor_file () != NULL)
+  if (monitor->mountinfo_source == NULL &&
+      get_mtab_monitor_file () != NULL)
     {
       file = g_file_new_for_path (get_mtab_monitor_file ());
       monitor->mtab_monitor = g_file_monitor_file (file, 0, NULL, NULL);
@@ -1311,6 +1615,10 @@ g_unix_mount_monitor_init (GUnixMountMonitor *monitor)
  * Sets the rate limit to which the @mount_monitor will report
  * consecutive change events to the mount and mount point entry files.
  *
+ * On Linux, changes to the mount table are picked up from
+ * <filename>/proc/self/mountinfo</filename> as they happen and the
+ * limit only applies to the mount point entry file.
+ *
  * Since: 2.18
  */
 void
@@ -1348,6 +1656,42 @@ g_unix_mount_monitor_new (void)
   return g_object_ref (the_mount_monitor);
 }
 
+/* Returns the monitor's copy of the mount table, sorted with
+ * g_unix_mount_compare().  It is kept in step with the
+ * ::mount-entries-changed deltas, so listeners can combine the two
+ * without ever rereading the table themselves.  The list is owned
+ * by @mount_monitor.
+ */
+GList *
+_g_unix_mount_monitor_get_mounts (GUnixMountMonitor *mount_monitor)
+{
+  g_return_val_if_fail (G_IS_UNIX_MOUNT_MONITOR (mount_monitor), NULL);
+
+  return mount_monitor->mounts;
+}
+
+/* Like g_unix_mount_at(), but looks in the cached mount table.
+ * The returned entry is owned by @mount_monitor.
+ */
+GUnixMountEntry *
+_g_unix_mount_monitor_lookup (GUnixMountMonitor *mount_monitor,
+                              const char        *mount_path)
+{
+  GList *l;
+
+  g_return_val_if_fail (G_IS_UNIX_MOUNT_MONITOR (mount_monitor), NULL);
+
+  for (l = mount_monitor->mounts; l != NULL; l = l->next)
+    {
+      GUnixMountEntry *mount_entry = l->data;
+
+      if (strcmp (mount_path, mount_entry->mount_path) == 0)
+        return mount_entry;
+    }
+
+  return NULL;
+}
+
 /**
  * g_unix_mount_free:
  * @mount_entry: a #GUnixMount.
@@ -30,6 +30,7 @@
 #include <glib.h>
 #include "gunixvolumemonitor.h"
 #include "gunixmounts.h"
+#include "gunixmountsprivate.h"
 #include "gunixmount.h"
 #include "gunixvolume.h"
 #include "gmount.h"
@@ -44,7 +45,6 @@ struct _GUnixVolumeMonitor {
   GUnixMountMonitor *mount_monitor;
 
   GList *last_mountpoints;
-  GList *last_mounts;
 
   GList *volumes;
   GList *mounts;
@@ -52,10 +52,14 @@ struct _GUnixVolumeMonitor {
 
 static void mountpoints_changed      (GUnixMountMonitor  *mount_monitor,
                                       gpointer            user_data);
-static void mounts_changed           (GUnixMountMonitor  *mount_monitor,
+static void mount_entries_changed    (GUnixMountMonitor  *mount_monitor,
+                                      GList              *added,
+                                      GList              *removed,
                                       gpointer            user_data);
 static void update_volumes           (GUnixVolumeMonitor *monitor);
-static void update_mounts            (GUnixVolumeMonitor *monitor);
+static void update_mounts            (GUnixVolumeMonitor *monitor,
+                                      GList              *added,
+                                      GList              *removed);
 
 #define g_unix_volume_monitor_get_type _g_unix_volume_monitor_get_type
 G_DEFINE_TYPE_WITH_CODE (GUnixVolumeMonitor, g_unix_volume_monitor, G_TYPE_NATIVE_VOLUME_MONITOR,
@@ -72,14 +76,12 @@ g_unix_volume_monitor_finalize (GObject *object)
   monitor = G_UNIX_VOLUME_MONITOR (object);
 
   g_signal_handlers_disconnect_by_func (monitor->mount_monitor, mountpoints_changed, monitor);
-  g_signal_handlers_disconnect_by_func (monitor->mount_monitor, mounts_changed, monitor);
+  g_signal_handlers_disconnect_by_func (monitor->mount_monitor, mount_entries_changed, monitor);
 					
   g_object_unref (monitor->mount_monitor);
 
   g_list_foreach (monitor->last_mountpoints, (GFunc)g_unix_mount_point_free, NULL);
   g_list_free (monitor->last_mountpoints);
-  g_list_foreach (monitor->last_mounts, (GFunc)g_unix_mount_free, NULL);
-  g_list_free (monitor->last_mounts);
 
   g_list_foreach (monitor->volumes, (GFunc)g_object_unref, NULL);
   g_list_free (monitor->volumes);
@@ -204,38 +206,47 @@ mountpoints_changed (GUnixMountMonitor *mount_monitor,
 {
   GUnixVolumeMonitor *unix_monitor = user_data;
 
-  /* Update both to make sure volumes are created before mounts */
   update_volumes (unix_monitor);
-  update_mounts (unix_monitor);
 }
 
 static void
-mounts_changed (GUnixMountMonitor *mount_monitor,
-		gpointer           user_data)
+mount_entries_changed (GUnixMountMonitor *mount_monitor,
+                       GList             *added,
+                       GList             *removed,
+                       gpointer           user_data)
 {
   GUnixVolumeMonitor *unix_monitor = user_data;
 
-  /* Update both to make sure volumes are created before mounts */
-  update_volumes (unix_monitor);
-  update_mounts (unix_monitor);
+  /* Volumes only depend on the mount points, which
+   * mountpoints_changed() takes care of, so the delta is
+   * all that is needed here.
+   */
+  update_mounts (unix_monitor, added, removed);
 }
 
 static void
 g_unix_volume_monitor_init (GUnixVolumeMonitor *unix_monitor)
 {
+  GList *mounts;
 
   unix_monitor->mount_monitor = g_unix_mount_monitor_new ();
 
   g_signal_connect (unix_monitor->mount_monitor,
-		    "mounts-changed", G_CALLBACK (mounts_changed),
+		    "mount-entries-changed", G_CALLBACK (mount_entries_changed),
 		    unix_monitor);
   
   g_signal_connect (unix_monitor->mount_monitor,
 		    "mountpoints-changed", G_CALLBACK (mountpoints_changed),
 		    unix_monitor);
 		    
+  /* Create volumes before mounts so the mounts can find theirs */
   update_volumes (unix_monitor);
-  update_mounts (unix_monitor);
+
+  /* Start from the mount monitor's table so that the deltas it
+   * reports later apply on top of exactly what we have seen.
+   */
+  mounts = _g_unix_mount_monitor_get_mounts (unix_monitor->mount_monitor);
+  update_mounts (unix_monitor, mounts, NULL);
 }
 
 GVolumeMonitor *
@@ -379,23 +390,15 @@ update_volumes (GUnixVolumeMonitor *monitor)
 }
 
 static void
-update_mounts (GUnixVolumeMonitor *monitor)
+update_mounts (GUnixVolumeMonitor *monitor,
+               GList              *added,
+               GList              *removed)
 {
-  GList *new_mounts;
-  GList *removed, *added;
   GList *l;
   GUnixMount *mount;
   GUnixVolume *volume;
   const char *mount_path;
   
-  new_mounts = g_unix_mounts_get (NULL);
-  
-  new_mounts = g_list_sort (new_mounts, (GCompareFunc) g_unix_mount_compare);
-  
-  diff_sorted_lists (monitor->last_mounts,
-		     new_mounts, (GCompareFunc) g_unix_mount_compare,
-		     &added, &removed);
-  
   for (l = removed; l != NULL; l = l->next)
     {
       GUnixMountEntry *mount_entry = l->data;
@@ -425,11 +428,4 @@ update_mounts (GUnixVolumeMonitor *monitor)
 	  g_signal_emit_by_name (monitor, "mount-added", mount);
 	}
     }
-  
-  g_list_free (added);
-  g_list_free (removed);
-  g_list_foreach (monitor->last_mounts,
-		  (GFunc)g_unix_mount_free, NULL);
-  g_list_free (monitor->last_mounts);
-  monitor->last_mounts = new_mounts;
 }
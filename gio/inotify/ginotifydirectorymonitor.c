@@ -116,6 +116,14 @@ g_inotify_directory_monitor_is_supported (void)
   return _ih_startup ();
 }
 
+static void
+g_inotify_directory_monitor_get_statistics (GFileMonitor    *monitor,
+                                             GVariantBuilder *builder)
+{
+  G_FILE_MONITOR_CLASS (g_inotify_directory_monitor_parent_class)->get_statistics (monitor, builder);
+  _ih_get_statistics (builder);
+}
+
 static void
 g_inotify_directory_monitor_class_init (GInotifyDirectoryMonitorClass* klass)
 {
@@ -126,6 +134,7 @@ g_inotify_directory_monitor_class_init (GInotifyDirectoryMonitorClass* klass)
   gobject_class->finalize = g_inotify_directory_monitor_finalize;
   gobject_class->constructor = g_inotify_directory_monitor_constructor;
   directory_monitor_class->cancel = g_inotify_directory_monitor_cancel;
+  directory_monitor_class->get_statistics = g_inotify_directory_monitor_get_statistics;
 
   local_directory_monitor_class->mount_notify = TRUE;
   local_directory_monitor_class->is_supported = g_inotify_directory_monitor_is_supported;
@@ -139,6 +139,14 @@ g_inotify_file_monitor_is_supported (void)
   return _ih_startup ();
 }
 
+static void
+g_inotify_file_monitor_get_statistics (GFileMonitor    *monitor,
+                                        GVariantBuilder *builder)
+{
+  G_FILE_MONITOR_CLASS (g_inotify_file_monitor_parent_class)->get_statistics (monitor, builder);
+  _ih_get_statistics (builder);
+}
+
 static void
 g_inotify_file_monitor_class_init (GInotifyFileMonitorClass* klass)
 {
@@ -149,6 +157,7 @@ g_inotify_file_monitor_class_init (GInotifyFileMonitorClass* klass)
   gobject_class->finalize = g_inotify_file_monitor_finalize;
   gobject_class->constructor = g_inotify_file_monitor_constructor;
   file_monitor_class->cancel = g_inotify_file_monitor_cancel;
+  file_monitor_class->get_statistics = g_inotify_file_monitor_get_statistics;
 
   local_file_monitor_class->is_supported = g_inotify_file_monitor_is_supported;
 }
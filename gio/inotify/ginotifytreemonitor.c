@@ -0,0 +1,102 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ginotifytreemonitor.h"
+#include <gio/giomodule.h>
+
+#define USE_INOTIFY 1
+#include "inotify-helper.h"
+
+/* A tree is watched with a bare inotify_sub per directory, which all
+ * share the tree monitor as their user data. */
+
+struct _GInotifyTreeMonitor
+{
+  GLocalTreeMonitor parent_instance;
+};
+
+#define g_inotify_tree_monitor_get_type _g_inotify_tree_monitor_get_type
+G_DEFINE_TYPE_WITH_CODE (GInotifyTreeMonitor, g_inotify_tree_monitor, G_TYPE_LOCAL_TREE_MONITOR,
+			 g_io_extension_point_implement (G_LOCAL_TREE_MONITOR_EXTENSION_POINT_NAME,
+							 g_define_type_id,
+							 "inotify",
+							 20))
+
+static gpointer
+g_inotify_tree_monitor_watch_dir (GLocalTreeMonitor *tree,
+                                  const gchar       *dirname,
+                                  gboolean           is_root)
+{
+  inotify_sub *sub;
+  gboolean pair_moves;
+
+  pair_moves = tree->flags & G_FILE_MONITOR_SEND_MOVED;
+
+  sub = _ih_sub_new (dirname, NULL, pair_moves, tree);
+  g_assert (sub != NULL);
+  sub->children_only = !is_root;
+
+  /* _ih_sub_add allways returns TRUE, a missing root is waited for */
+  _ih_sub_add (sub);
+
+  return sub;
+}
+
+static void
+g_inotify_tree_monitor_unwatch_dir (GLocalTreeMonitor *tree,
+                                    gpointer           watch)
+{
+  inotify_sub *sub = watch;
+
+  _ih_sub_cancel (sub);
+  _ih_sub_free (sub);
+}
+
+static gboolean
+g_inotify_tree_monitor_is_supported (void)
+{
+  return _ih_startup ();
+}
+
+static void
+g_inotify_tree_monitor_get_statistics (GFileMonitor    *monitor,
+                                       GVariantBuilder *builder)
+{
+  G_FILE_MONITOR_CLASS (g_inotify_tree_monitor_parent_class)->get_statistics (monitor, builder);
+  _ih_get_statistics (builder);
+}
+
+static void
+g_inotify_tree_monitor_class_init (GInotifyTreeMonitorClass* klass)
+{
+  GFileMonitorClass *file_monitor_class = G_FILE_MONITOR_CLASS (klass);
+  GLocalTreeMonitorClass *local_tree_monitor_class = G_LOCAL_TREE_MONITOR_CLASS (klass);
+
+  file_monitor_class->get_statistics = g_inotify_tree_monitor_get_statistics;
+
+  local_tree_monitor_class->is_supported = g_inotify_tree_monitor_is_supported;
+  local_tree_monitor_class->watch_dir = g_inotify_tree_monitor_watch_dir;
+  local_tree_monitor_class->unwatch_dir = g_inotify_tree_monitor_unwatch_dir;
+}
+
+static void
+g_inotify_tree_monitor_init (GInotifyTreeMonitor* monitor)
+{
+}
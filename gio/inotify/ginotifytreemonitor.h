@@ -0,0 +1,46 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_INOTIFY_TREE_MONITOR_H__
+#define __G_INOTIFY_TREE_MONITOR_H__
+
+#include <glib-object.h>
+#include <string.h>
+#include <gio/glocaltreemonitor.h>
+#include <gio/giomodule.h>
+
+G_BEGIN_DECLS
+
+#define G_TYPE_INOTIFY_TREE_MONITOR		(_g_inotify_tree_monitor_get_type ())
+#define G_INOTIFY_TREE_MONITOR(o)		(G_TYPE_CHECK_INSTANCE_CAST ((o), G_TYPE_INOTIFY_TREE_MONITOR, GInotifyTreeMonitor))
+#define G_INOTIFY_TREE_MONITOR_CLASS(k)		(G_TYPE_CHECK_CLASS_CAST ((k), G_TYPE_INOTIFY_TREE_MONITOR, GInotifyTreeMonitorClass))
+#define G_IS_INOTIFY_TREE_MONITOR(o)		(G_TYPE_CHECK_INSTANCE_TYPE ((o), G_TYPE_INOTIFY_TREE_MONITOR))
+#define G_IS_INOTIFY_TREE_MONITOR_CLASS(k)	(G_TYPE_CHECK_CLASS_TYPE ((k), G_TYPE_INOTIFY_TREE_MONITOR))
+
+typedef struct _GInotifyTreeMonitor      GInotifyTreeMonitor;
+typedef struct _GInotifyTreeMonitorClass GInotifyTreeMonitorClass;
+
+struct _GInotifyTreeMonitorClass {
+  GLocalTreeMonitorClass parent_class;
+};
+
+GType _g_inotify_tree_monitor_get_type (void);
+
+G_END_DECLS
+
+#endif /* __G_INOTIFY_TREE_MONITOR_H__ */
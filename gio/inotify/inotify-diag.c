@@ -27,6 +27,7 @@
 #include <glib.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "inotify-kernel.h"
 #include "inotify-missing.h"
 #include "inotify-path.h"
 #include "inotify-diag.h"
@@ -55,6 +56,7 @@ id_dump (gpointer userdata)
       return TRUE;
     }
 
+  _ik_diag_dump (ioc);
   _im_diag_dump (ioc);
   
   g_io_channel_shutdown (ioc, TRUE, NULL);
@@ -134,6 +134,85 @@ _ih_sub_cancel (inotify_sub *sub)
   return TRUE;
 }
 
+/*
+ * Adds the state and the counters of the backend to the statistics
+ * of a monitor, see g_file_monitor_get_statistics().
+ */
+void
+_ih_get_statistics (GVariantBuilder *builder)
+{
+  ik_queue_stats_t queue;
+  guint n_watches, n_dirs, n_subs;
+  guint n_missing, n_ancestors, n_backoff;
+  guint32 move_matches, move_misses;
+  guint budget, n_polled;
+  gboolean limit_reached;
+  guint64 n_polls, n_promoted, n_demoted;
+
+  _ik_queue_stats (&queue);
+
+  G_LOCK (inotify_lock);
+  _ip_get_stats (&n_watches, &n_dirs, &n_subs);
+  _ip_get_budget_stats (&budget, &limit_reached, &n_polled,
+                        &n_polls, &n_promoted, &n_demoted);
+  _im_get_stats (&n_missing, &n_ancestors, &n_backoff);
+  _ik_move_stats (&move_matches, &move_misses);
+  G_UNLOCK (inotify_lock);
+
+  g_variant_builder_add (builder, "{sv}", "backend",
+                         g_variant_new_string ("inotify"));
+  g_variant_builder_add (builder, "{sv}", "watches",
+                         g_variant_new_uint32 (n_watches));
+  g_variant_builder_add (builder, "{sv}", "watched-directories",
+                         g_variant_new_uint32 (n_dirs));
+  g_variant_builder_add (builder, "{sv}", "subscriptions",
+                         g_variant_new_uint32 (n_subs));
+  g_variant_builder_add (builder, "{sv}", "watch-budget",
+                         g_variant_new_uint32 (budget));
+  g_variant_builder_add (builder, "{sv}", "watch-limit-reached",
+                         g_variant_new_boolean (limit_reached));
+  g_variant_builder_add (builder, "{sv}", "polled-directories",
+                         g_variant_new_uint32 (n_polled));
+  g_variant_builder_add (builder, "{sv}", "directory-polls",
+                         g_variant_new_uint64 (n_polls));
+  g_variant_builder_add (builder, "{sv}", "watch-promotions",
+                         g_variant_new_uint64 (n_promoted));
+  g_variant_builder_add (builder, "{sv}", "watch-demotions",
+                         g_variant_new_uint64 (n_demoted));
+  g_variant_builder_add (builder, "{sv}", "missing",
+                         g_variant_new_uint32 (n_missing));
+  g_variant_builder_add (builder, "{sv}", "missing-polled",
+                         g_variant_new_uint32 (n_backoff));
+  g_variant_builder_add (builder, "{sv}", "ancestor-watches",
+                         g_variant_new_uint32 (n_ancestors));
+  g_variant_builder_add (builder, "{sv}", "watch-failures",
+                         g_variant_new_uint64 (queue.n_watch_failures));
+  g_variant_builder_add (builder, "{sv}", "watch-limit-failures",
+                         g_variant_new_uint64 (queue.n_watch_limit_failures));
+  g_variant_builder_add (builder, "{sv}", "queue-length",
+                         g_variant_new_uint32 (queue.queue_length));
+  g_variant_builder_add (builder, "{sv}", "queue-max-length",
+                         g_variant_new_uint32 (queue.max_queue_length));
+  g_variant_builder_add (builder, "{sv}", "queue-overflows",
+                         g_variant_new_uint64 (queue.n_overflows));
+  g_variant_builder_add (builder, "{sv}", "kernel-events",
+                         g_variant_new_uint64 (queue.n_read));
+  g_variant_builder_add (builder, "{sv}", "kernel-events-processed",
+                         g_variant_new_uint64 (queue.n_delivered));
+  g_variant_builder_add (builder, "{sv}", "kernel-batches",
+                         g_variant_new_uint64 (queue.n_batches));
+  g_variant_builder_add (builder, "{sv}", "process-delay",
+                         g_variant_new_uint32 (queue.process_delay));
+  g_variant_builder_add (builder, "{sv}", "queue-latency-max",
+                         g_variant_new_uint64 (queue.max_latency));
+  _g_file_monitor_statistics_add_histogram (builder, "queue-latency-histogram",
+                                            &queue.latency);
+  g_variant_builder_add (builder, "{sv}", "moves-matched",
+                         g_variant_new_uint32 (move_matches));
+  g_variant_builder_add (builder, "{sv}", "moves-missed",
+                         g_variant_new_uint32 (move_misses));
+}
+
 static char *
 _ih_fullpath_from_event (ik_event_t *event, const char *dirname)
 {
@@ -206,7 +285,7 @@ ih_not_missing_callback (inotify_sub *sub)
   if (sub->filename)
     {
       fullpath = g_strdup_printf ("%s/%s", sub->dirname, sub->filename);
-      g_warning ("Missing callback called fullpath = %s\n", fullpath);
+      IH_W ("Missing callback called fullpath = %s\n", fullpath);
       if (!g_file_test (fullpath, G_FILE_TEST_EXISTS))
 	{
 	  g_free (fullpath);
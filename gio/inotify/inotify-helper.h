@@ -30,4 +30,6 @@ gboolean _ih_startup    (void);
 gboolean _ih_sub_add    (inotify_sub *sub);
 gboolean _ih_sub_cancel (inotify_sub *sub);
 
+void     _ih_get_statistics (GVariantBuilder *builder);
+
 #endif /* __INOTIFY_HELPER_H */
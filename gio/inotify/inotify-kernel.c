@@ -32,10 +32,15 @@
 #include <sys/inotify.h>
 
 /* Timings for pairing MOVED_TO / MOVED_FROM events */
-#define PROCESS_EVENTS_TIME 1000 /* 1000 milliseconds (1 hz) */
-#define DEFAULT_HOLD_UNTIL_TIME 0 /* 0 millisecond */
 #define MOVE_HOLD_UNTIL_TIME 500 /* 500 microseconds or 0.5 milliseconds */
 
+/* The event queue is processed as soon as possible while the events
+ * come one by one. When the batches grow, processing is delayed more
+ * and more (up to PROCESS_DELAY_MAX) to collect larger batches, and
+ * the delay shrinks back when the load goes away. */
+#define PROCESS_DELAY_MAX 250 /* milliseconds */
+#define PROCESS_BATCH_LARGE 64 /* events delivered at once */
+
 static int inotify_instance_fd = -1;
 static GQueue *events_to_process = NULL;
 static GQueue *event_queue = NULL;
@@ -51,7 +56,10 @@ static gboolean ik_process_eq_callback (gpointer user_data);
 static guint32 ik_move_matches = 0;
 static guint32 ik_move_misses = 0;
 
-static gboolean process_eq_running = FALSE;
+static guint process_eq_source = 0;
+static guint process_delay = 0;
+
+static ik_queue_stats_t queue_stats;
 
 /* We use the lock from inotify-helper.c
  *
@@ -68,9 +76,9 @@ G_LOCK_EXTERN (inotify_lock);
 
 typedef struct ik_event_internal {
   ik_event_t *event;
-  gboolean seen;
   gboolean sent;
-  GTimeVal hold_until;
+  gint64 read_time;
+  gint64 hold_until;
   struct ik_event_internal *pair;
 } ik_event_internal_t;
 
@@ -123,6 +131,10 @@ ik_source_check (GSource *source)
       
       pending /= AVERAGE_EVENT_SIZE;
       
+      /* A lone event is delivered right away */
+      if (pending <= 1 && pending_count == 0)
+	goto do_read;
+      
       /* Don't wait if the number of pending events is too close
        * to the maximum queue size.
        */
@@ -222,17 +234,16 @@ gboolean _ik_startup (void (*cb)(ik_event_t *event))
 }
 
 static ik_event_internal_t *
-ik_event_internal_new (ik_event_t *event)
+ik_event_internal_new (ik_event_t *event,
+                       gint64      now)
 {
   ik_event_internal_t *internal_event = g_new0 (ik_event_internal_t, 1);
-  GTimeVal tv;
   
   g_assert (event);
   
-  g_get_current_time (&tv);
-  g_time_val_add (&tv, DEFAULT_HOLD_UNTIL_TIME);
   internal_event->event = event;
-  internal_event->hold_until = tv;
+  internal_event->read_time = now;
+  internal_event->hold_until = now;
   
   return internal_event;
 }
@@ -301,6 +312,9 @@ _ik_watch (const char *path,
     {
       int e = errno;
       /* FIXME: debug msg failed to add watch */
+      queue_stats.n_watch_failures++;
+      if (e == ENOSPC)
+        queue_stats.n_watch_limit_failures++;
       if (err)
 	*err = e;
       return wd;
@@ -338,6 +352,42 @@ _ik_move_stats (guint32 *matches,
     *misses = ik_move_misses;
 }
 
+void
+_ik_queue_stats (ik_queue_stats_t *stats)
+{
+  g_assert (stats != NULL);
+
+  G_LOCK (inotify_lock);
+  *stats = queue_stats;
+  stats->queue_length = events_to_process ? g_queue_get_length (events_to_process) : 0;
+  stats->process_delay = process_delay;
+  G_UNLOCK (inotify_lock);
+}
+
+void
+_ik_diag_dump (GIOChannel *ioc)
+{
+  gchar *str;
+
+  str = g_strdup_printf ("event queue: %u queued (%u max), "
+                         "%" G_GUINT64_FORMAT " delivered in %u batches, "
+                         "latency %" G_GUINT64_FORMAT " us mean, "
+                         "%" G_GUINT64_FORMAT " us max, delay %u ms\n"
+                         "moves: %u matched, %u missed\n",
+                         g_queue_get_length (events_to_process),
+                         queue_stats.max_queue_length,
+                         queue_stats.n_delivered,
+                         queue_stats.n_batches,
+                         queue_stats.n_delivered
+                           ? queue_stats.total_latency / queue_stats.n_delivered : 0,
+                         queue_stats.max_latency,
+                         process_delay,
+                         ik_move_matches,
+                         ik_move_misses);
+  g_io_channel_write_chars (ioc, str, -1, NULL, NULL);
+  g_free (str);
+}
+
 const char *
 _ik_mask_to_string (guint32 mask)
 {
@@ -445,64 +495,48 @@ ik_read_events (gsize  *buffer_size_out,
   *buffer_out = buffer;
 }
 
+static void ik_pair_moves (ik_event_internal_t *event);
+static void ik_schedule_processing (gint64 now);
+
 static gboolean
 ik_read_callback (gpointer user_data)
 {
   gchar *buffer;
-  gsize buffer_size, buffer_i, events;
+  gsize buffer_size, buffer_i;
+  gint64 now;
+  guint length;
   
   G_LOCK (inotify_lock);
   ik_read_events (&buffer_size, &buffer);
+  now = g_get_monotonic_time ();
   
   buffer_i = 0;
-  events = 0;
   while (buffer_i < buffer_size)
     {
       struct inotify_event *event;
+      ik_event_internal_t *internal_event;
       gsize event_size;
       event = (struct inotify_event *)&buffer[buffer_i];
       event_size = sizeof(struct inotify_event) + event->len;
-      g_queue_push_tail (events_to_process, ik_event_internal_new (ik_event_new (&buffer[buffer_i])));
+      queue_stats.n_read++;
+      if (event->mask & IN_Q_OVERFLOW)
+        queue_stats.n_overflows++;
+      internal_event = ik_event_internal_new (ik_event_new (&buffer[buffer_i]), now);
+      ik_pair_moves (internal_event);
+      g_queue_push_tail (events_to_process, internal_event);
       buffer_i += event_size;
-      events++;
     }
+
+  length = g_queue_get_length (events_to_process);
+  queue_stats.max_queue_length = MAX (queue_stats.max_queue_length, length);
   
-  /* If the event process callback is off, turn it back on */
-  if (!process_eq_running && events)
-    {
-      process_eq_running = TRUE;
-      g_timeout_add (PROCESS_EVENTS_TIME, ik_process_eq_callback, NULL);
-    }
+  ik_schedule_processing (now);
   
   G_UNLOCK (inotify_lock);
   
   return TRUE;
 }
 
-static gboolean
-g_timeval_lt (GTimeVal *val1, 
-              GTimeVal *val2)
-{
-  if (val1->tv_sec < val2->tv_sec)
-    return TRUE;
-  
-  if (val1->tv_sec > val2->tv_sec)
-    return FALSE;
-  
-  /* val1->tv_sec == val2->tv_sec */
-  if (val1->tv_usec < val2->tv_usec)
-    return TRUE;
-  
-  return FALSE;
-}
-
-static gboolean
-g_timeval_eq (GTimeVal *val1, 
-              GTimeVal *val2)
-{
-  return (val1->tv_sec == val2->tv_sec) && (val1->tv_usec == val2->tv_usec);
-}
-
 static void
 ik_pair_events (ik_event_internal_t *event1, 
                 ik_event_internal_t *event2)
@@ -517,28 +551,16 @@ ik_pair_events (ik_event_internal_t *event1,
   event1->pair = event2;
   event1->event->pair = event2->event;
   
-  if (g_timeval_lt (&event1->hold_until, &event2->hold_until))
-    event1->hold_until = event2->hold_until;
-  
+  event1->hold_until = MAX (event1->hold_until, event2->hold_until);
   event2->hold_until = event1->hold_until;
 }
 
-static void
-ik_event_add_microseconds (ik_event_internal_t *event, 
-                           glong                ms)
-{
-  g_assert (event);
-  g_time_val_add (&event->hold_until, ms);
-}
-
 static gboolean
-ik_event_ready (ik_event_internal_t *event)
+ik_event_ready (ik_event_internal_t *event,
+                gint64               now)
 {
-  GTimeVal tv;
   g_assert (event);
   
-  g_get_current_time (&tv);
-  
   /* An event is ready if,
    *
    * it has no cookie -- there is nothing to be gained by holding it
@@ -548,19 +570,14 @@ ik_event_ready (ik_event_internal_t *event)
   return
     event->event->cookie == 0 ||
     event->pair != NULL ||
-    g_timeval_lt (&event->hold_until, &tv) ||
-    g_timeval_eq (&event->hold_until, &tv);
+    event->hold_until <= now;
 }
 
+/* Pairs the moves by cookie as the events are read, so the queue
+ * is never walked for that */
 static void
-ik_pair_moves (gpointer data, 
-               gpointer user_data)
+ik_pair_moves (ik_event_internal_t *event)
 {
-  ik_event_internal_t *event = (ik_event_internal_t *)data;
-  
-  if (event->seen == TRUE || event->sent == TRUE)
-    return;
-  
   if (event->event->cookie != 0)
     {
       /* When we get a MOVED_FROM event we delay sending the event by
@@ -570,7 +587,7 @@ ik_pair_moves (gpointer data,
 	{
 	  g_hash_table_insert (cookie_hash, GINT_TO_POINTER (event->event->cookie), event);
 	  /* because we don't deliver move events there is no point in waiting for the match right now. */
-	  ik_event_add_microseconds (event, MOVE_HOLD_UNTIL_TIME);
+	  event->hold_until += MOVE_HOLD_UNTIL_TIME;
 	}
       else if (event->event->mask & IN_MOVED_TO)
 	{
@@ -585,14 +602,11 @@ ik_pair_moves (gpointer data,
 	    }
 	}
     }
-  event->seen = TRUE;
 }
 
 static void
-ik_process_events (void)
+ik_process_events (gint64 now)
 {
-  g_queue_foreach (events_to_process, ik_pair_moves, NULL);
-
   while (!g_queue_is_empty (events_to_process))
     {
       ik_event_internal_t *event = g_queue_peek_head (events_to_process);
@@ -608,7 +622,7 @@ ik_process_events (void)
 	}
       
       /* The event isn't ready yet */
-      if (!ik_event_ready (event))
+      if (!ik_event_ready (event, now))
 	break;
       
       /* Pop it */
@@ -644,6 +658,12 @@ ik_process_events (void)
 	    event->event->mask = IN_CREATE|(event->event->mask & IN_ISDIR);
 	}
       
+      queue_stats.total_latency += now - event->read_time;
+      queue_stats.max_latency = MAX (queue_stats.max_latency,
+                                     (guint64) (now - event->read_time));
+      _g_file_monitor_histogram_add (&queue_stats.latency,
+                                     now - event->read_time);
+
       /* Push the ik_event_t onto the event queue */
       g_queue_push_tail (event_queue, event->event);
       /* Free the internal event structure */
@@ -651,31 +671,60 @@ ik_process_events (void)
     }
 }
 
+/* Called with the lock held */
+static void
+ik_schedule_processing (gint64 now)
+{
+  ik_event_internal_t *head;
+  guint delay = process_delay;
+
+  if (process_eq_source != 0 || g_queue_is_empty (events_to_process))
+    return;
+
+  /* Do not wake up before the first event may be delivered */
+  head = g_queue_peek_head (events_to_process);
+  if (!ik_event_ready (head, now))
+    delay = MAX (delay, (guint) ((head->hold_until - now + 999) / 1000));
+
+  process_eq_source = g_timeout_add (delay, ik_process_eq_callback, NULL);
+}
+
 static gboolean
 ik_process_eq_callback (gpointer user_data)
 {
-  gboolean res;
+  gint64 now;
+  guint delivered = 0;
   
   /* Try and move as many events to the event queue */
   G_LOCK (inotify_lock);
-  ik_process_events ();
+  now = g_get_monotonic_time ();
+  ik_process_events (now);
   
   while (!g_queue_is_empty (event_queue))
     {
       ik_event_t *event = g_queue_pop_head (event_queue);
       
       user_cb (event);
+      delivered++;
     }
 
-  res = TRUE;
-  
-  if (g_queue_get_length (events_to_process) == 0)
+  if (delivered > 0)
     {
-      process_eq_running = FALSE;
-      res = FALSE;
+      queue_stats.n_delivered += delivered;
+      queue_stats.n_batches++;
     }
+
+  /* Adapt the delay to the load */
+  if (delivered >= PROCESS_BATCH_LARGE)
+    process_delay = MIN (MAX (process_delay * 2, 1), PROCESS_DELAY_MAX);
+  else
+    process_delay /= 2;
+
+  /* Held moves may still be waiting for their pairs */
+  process_eq_source = 0;
+  ik_schedule_processing (now);
   
   G_UNLOCK (inotify_lock);
   
-  return res;
+  return FALSE;
 }
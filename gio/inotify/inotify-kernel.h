@@ -23,6 +23,8 @@
 #ifndef __INOTIFY_KERNEL_H
 #define __INOTIFY_KERNEL_H
 
+#include <gio/gfilemonitorprivate.h>
+
 typedef struct ik_event_s {
   gint32 wd;
   guint32 mask;
@@ -46,6 +48,24 @@ int         _ik_ignore          (const char *path,
 				 gint32      wd);
 
 
+typedef struct {
+  guint   queue_length;     /* events read but not delivered yet */
+  guint   max_queue_length;
+  guint64 n_delivered;
+  guint   n_batches;        /* times the queue was processed */
+  guint64 total_latency;    /* from read to delivery, microseconds */
+  guint64 max_latency;
+  guint   process_delay;    /* current processing delay, milliseconds */
+  guint64 n_read;           /* events read from the kernel */
+  guint64 n_overflows;      /* IN_Q_OVERFLOW, events were lost */
+  guint64 n_watch_failures;
+  guint64 n_watch_limit_failures; /* ENOSPC, out of max_user_watches */
+  GFileMonitorHistogram latency;
+} ik_queue_stats_t;
+
+void        _ik_queue_stats    (ik_queue_stats_t *stats);
+void        _ik_diag_dump      (GIOChannel       *ioc);
+
 /* The miss count will probably be enflated */
 void        _ik_move_stats     (guint32 *matches,
 				guint32 *misses);
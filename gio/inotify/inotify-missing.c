@@ -24,21 +24,77 @@
 */
 
 #include "config.h"
+
+/* Don't put conflicting kernel types in the global namespace: */
+#define __KERNEL_STRICT_NAMES
+
+#include <sys/inotify.h>
+#include <errno.h>
+#include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "inotify-missing.h"
 #include "inotify-path.h"
 
-#define SCAN_MISSING_TIME 4 /* 1/4 Hz */
+/* Missing subscriptions are grouped by the nearest ancestor directory
+ * that exists. Only that directory is watched, and a subscription is
+ * only rechecked when the next component of its path appears there or
+ * when the ancestor itself goes away.
+ *
+ * Subscriptions that can't be grouped (no ancestor can be watched, or
+ * the path exists but can't be watched yet) are rechecked with an
+ * exponential backoff instead.
+ */
+#define IM_INOTIFY_MASK (IN_CREATE|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)
+
+#define IM_BACKOFF_MIN 1  /* seconds */
+#define IM_BACKOFF_MAX 32
+
+/* Older libcs don't have this */
+#ifndef IN_ONLYDIR
+#define IN_ONLYDIR 0  
+#endif
 
 static gboolean im_debug_enabled = FALSE;
 #define IM_W if (im_debug_enabled) g_warning
 
-/* We put inotify_sub's that are missing on this list */
-static GList *missing_sub_list = NULL;
-static gboolean im_scan_missing (gpointer user_data);
-static gboolean scan_missing_running = FALSE;
+typedef struct {
+  char *path;
+  gint32 wd;
+
+  /* Next path component -> GList of inotify_sub's waiting for it */
+  GHashTable *children;
+
+  /* Components that have appeared since the last recheck */
+  GSList *appeared;
+  /* The directory went away or events were lost, recheck everything */
+  gboolean rescan;
+  gboolean dirty;
+} im_ancestor_t;
+
+/* path -> im_ancestor_t */
+static GHashTable *path_ancestor_hash = NULL;
+/* wd -> GList of im_ancestor_t's, symbolic links can share the same wd */
+static GHashTable *wd_ancestor_hash = NULL;
+/* inotify_sub * -> im_ancestor_t *
+ *
+ * A missing subscription is either attached to an ancestor or it is
+ * on the backoff list
+ */
+static GHashTable *sub_ancestor_hash = NULL;
+
+/* Ancestors waiting for a recheck */
+static GList *dirty_ancestors = NULL;
+static guint recheck_id = 0;
+
+static GList *backoff_sub_list = NULL;
+static guint backoff_id = 0;
+static guint backoff_secs = IM_BACKOFF_MIN;
+
 static void (*missing_cb)(inotify_sub *sub) = NULL;
 
+static gboolean im_scan_backoff (gpointer user_data);
+
 G_LOCK_EXTERN (inotify_lock);
 
 /* inotify_lock must be held before calling */
@@ -50,39 +106,281 @@ _im_startup (void (*callback)(inotify_sub *sub))
   if (!initialized)
     {
       missing_cb = callback;
+      path_ancestor_hash = g_hash_table_new (g_str_hash, g_str_equal);
+      wd_ancestor_hash = g_hash_table_new (g_direct_hash, g_direct_equal);
+      sub_ancestor_hash = g_hash_table_new (g_direct_hash, g_direct_equal);
       initialized = TRUE;
     }
 }
 
+/* Returns the first component of @dirname below @ancestor */
+static char *
+im_next_component (const char *ancestor, 
+                   const char *dirname)
+{
+  const char *start = dirname + strlen (ancestor);
+  const char *end;
+
+  while (*start == '/')
+    start++;
+  end = strchr (start, '/');
+
+  return end ? g_strndup (start, end - start) : g_strdup (start);
+}
+
+static im_ancestor_t *
+im_ancestor_new (const char *path, 
+                 gint32      wd)
+{
+  im_ancestor_t *anc = g_new0 (im_ancestor_t, 1);
+  GList *wd_list;
+
+  anc->path = g_strdup (path);
+  anc->wd = wd;
+  anc->children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  g_hash_table_insert (path_ancestor_hash, anc->path, anc);
+  wd_list = g_hash_table_lookup (wd_ancestor_hash, GINT_TO_POINTER (wd));
+  wd_list = g_list_prepend (wd_list, anc);
+  g_hash_table_replace (wd_ancestor_hash, GINT_TO_POINTER (wd), wd_list);
+
+  return anc;
+}
+
+static void
+im_ancestor_clear_appeared (im_ancestor_t *anc)
+{
+  GSList *l;
+
+  for (l = anc->appeared; l; l = l->next)
+    g_free (l->data);
+  g_slist_free (anc->appeared);
+  anc->appeared = NULL;
+}
+
+/* Stops watching an ancestor if nobody is waiting on it */
+static void
+im_ancestor_release (im_ancestor_t *anc)
+{
+  GList *wd_list;
+
+  if (g_hash_table_size (anc->children) > 0)
+    return;
+
+  IM_W ("no longer watching ancestor %s\n", anc->path);
+
+  wd_list = g_hash_table_lookup (wd_ancestor_hash, GINT_TO_POINTER (anc->wd));
+  wd_list = g_list_remove (wd_list, anc);
+  if (wd_list == NULL)
+    {
+      g_hash_table_remove (wd_ancestor_hash, GINT_TO_POINTER (anc->wd));
+
+      /* The watch may be shared with a watched directory */
+      if (_ip_get_path_for_wd (anc->wd) == NULL)
+        _ik_ignore (anc->path, anc->wd);
+    }
+  else
+    g_hash_table_replace (wd_ancestor_hash, GINT_TO_POINTER (anc->wd), wd_list);
+
+  g_hash_table_remove (path_ancestor_hash, anc->path);
+  if (anc->dirty)
+    dirty_ancestors = g_list_remove (dirty_ancestors, anc);
+
+  im_ancestor_clear_appeared (anc);
+  g_hash_table_destroy (anc->children);
+  g_free (anc->path);
+  g_free (anc);
+}
+
+/* Detaches the subscriptions that have to be rechecked */
+static GList *
+im_ancestor_take (im_ancestor_t *anc)
+{
+  GList *subs = NULL;
+  GList *l;
+
+  if (anc->rescan)
+    {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init (&iter, anc->children);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+	subs = g_list_concat (subs, value);
+      g_hash_table_remove_all (anc->children);
+    }
+  else
+    {
+      GSList *sl;
+
+      for (sl = anc->appeared; sl; sl = sl->next)
+	{
+	  GList *waiting = g_hash_table_lookup (anc->children, sl->data);
+
+	  if (waiting)
+	    {
+	      subs = g_list_concat (subs, waiting);
+	      g_hash_table_remove (anc->children, sl->data);
+	    }
+	}
+    }
+
+  im_ancestor_clear_appeared (anc);
+  anc->rescan = FALSE;
+  anc->dirty = FALSE;
+
+  for (l = subs; l; l = l->next)
+    g_hash_table_remove (sub_ancestor_hash, l->data);
+
+  return subs;
+}
+
+static void
+im_ancestor_mark_dirty (im_ancestor_t *anc)
+{
+  if (!anc->dirty)
+    {
+      anc->dirty = TRUE;
+      dirty_ancestors = g_list_prepend (dirty_ancestors, anc);
+    }
+}
+
+/* Attaches a subscription to the nearest existing ancestor of its
+ * directory. Returns FALSE if the subscription has to be polled.
+ */
+static gboolean
+im_group (inotify_sub *sub)
+{
+  im_ancestor_t *anc = NULL;
+  char *path;
+  char *component;
+  char *child;
+  GList *waiting;
+  struct stat buf;
+
+  path = g_path_get_dirname (sub->dirname);
+
+  while (!anc)
+    {
+      gint32 wd;
+      int err = 0;
+      char *parent;
+
+      anc = g_hash_table_lookup (path_ancestor_hash, path);
+      if (anc)
+	break;
+
+      wd = _ik_watch (path, IM_INOTIFY_MASK|IN_ONLYDIR|IN_MASK_ADD, &err);
+      if (wd >= 0)
+	{
+	  IM_W ("watching ancestor %s\n", path);
+	  anc = im_ancestor_new (path, wd);
+	  break;
+	}
+
+      parent = g_path_get_dirname (path);
+      if ((err != ENOENT && err != ENOTDIR) || strcmp (parent, path) == 0)
+	{
+	  IM_W ("can't watch an ancestor of %s (error %d)\n", sub->dirname, err);
+	  g_free (parent);
+	  g_free (path);
+	  return FALSE;
+	}
+
+      g_free (path);
+      path = parent;
+    }
+  g_free (path);
+
+  /* If the next component exists already, it has either appeared
+   * before the ancestor was watched or it can't be watched for
+   * some other reason. Either way, an event may never come.
+   */
+  component = im_next_component (anc->path, sub->dirname);
+  child = g_build_filename (anc->path, component, NULL);
+  if (g_lstat (child, &buf) == 0)
+    {
+      g_free (child);
+      g_free (component);
+      im_ancestor_release (anc);
+      return FALSE;
+    }
+  g_free (child);
+
+  waiting = g_hash_table_lookup (anc->children, component);
+  g_hash_table_insert (anc->children, component, g_list_prepend (waiting, sub));
+  g_hash_table_insert (sub_ancestor_hash, sub, anc);
+
+  return TRUE;
+}
+
+static void
+im_backoff_add (inotify_sub *sub)
+{
+  backoff_sub_list = g_list_prepend (backoff_sub_list, sub);
+
+  /* Start over with the shortest delay */
+  backoff_secs = IM_BACKOFF_MIN;
+  if (backoff_id)
+    g_source_remove (backoff_id);
+  backoff_id = g_timeout_add_seconds (backoff_secs, im_scan_backoff, NULL);
+}
+
+static void
+im_place (inotify_sub *sub)
+{
+  if (!im_group (sub))
+    {
+      IM_W ("polling for %s\n", sub->dirname);
+      im_backoff_add (sub);
+    }
+}
+
 /* inotify_lock must be held before calling */
 void
 _im_add (inotify_sub *sub)
 {
-  if (g_list_find (missing_sub_list, sub))
+  if (g_hash_table_lookup (sub_ancestor_hash, sub) ||
+      g_list_find (backoff_sub_list, sub))
     {
       IM_W ("asked to add %s to missing list but it's already on the list!\n", sub->dirname);
       return;
     }
 
   IM_W ("adding %s to missing list\n", sub->dirname);
-  missing_sub_list = g_list_prepend (missing_sub_list, sub);
-
-  /* If the timeout is turned off, we turn it back on */
-  if (!scan_missing_running)
-    {
-      scan_missing_running = TRUE;
-      g_timeout_add_seconds (SCAN_MISSING_TIME, im_scan_missing, NULL);
-    }
+  im_place (sub);
 }
 
 /* inotify_lock must be held before calling */
 void
 _im_rm (inotify_sub *sub)
 {
+  im_ancestor_t *anc;
   GList *link;
   
-  link = g_list_find (missing_sub_list, sub);
+  anc = g_hash_table_lookup (sub_ancestor_hash, sub);
+  if (anc)
+    {
+      char *component = im_next_component (anc->path, sub->dirname);
+      GList *waiting = g_hash_table_lookup (anc->children, component);
 
+      IM_W ("removing %s from missing list\n", sub->dirname);
+
+      waiting = g_list_remove (waiting, sub);
+      if (waiting)
+	g_hash_table_insert (anc->children, component, waiting);
+      else
+	{
+	  g_hash_table_remove (anc->children, component);
+	  g_free (component);
+	}
+      g_hash_table_remove (sub_ancestor_hash, sub);
+
+      im_ancestor_release (anc);
+      return;
+    }
+
+  link = g_list_find (backoff_sub_list, sub);
   if (!link)
     {
       IM_W ("asked to remove %s from missing list but it isn't on the list!\n", sub->dirname);
@@ -91,77 +389,203 @@ _im_rm (inotify_sub *sub)
 
   IM_W ("removing %s from missing list\n", sub->dirname);
 
-  missing_sub_list = g_list_remove_link (missing_sub_list, link);
-  g_list_free_1 (link);
+  backoff_sub_list = g_list_delete_link (backoff_sub_list, link);
 }
 
-/* Scans the list of missing subscriptions checking if they
- * are available yet.
+/* Rechecks the subscriptions whose ancestors have changed.
  */
 static gboolean
-im_scan_missing (gpointer user_data)
+im_recheck (gpointer user_data)
 {
-  GList *nolonger_missing = NULL;
+  GList *dirty;
+  GList *subs = NULL;
+  GList *l;
+
+  G_LOCK (inotify_lock);
+
+  recheck_id = 0;
+  dirty = dirty_ancestors;
+  dirty_ancestors = NULL;
+
+  for (l = dirty; l; l = l->next)
+    subs = g_list_concat (subs, im_ancestor_take (l->data));
+
+  /* Unused ancestors go away before anything is regrouped, so a path
+   * which has been moved away is never reused */
+  for (l = dirty; l; l = l->next)
+    im_ancestor_release (l->data);
+  g_list_free (dirty);
+
+  IM_W ("rechecking %d missing subscriptions\n", g_list_length (subs));
+  for (l = subs; l; l = l->next)
+    {
+      inotify_sub *sub = l->data;
+
+      if (_ip_start_watching (sub))
+	{
+	  IM_W ("%s is no longer missing\n", sub->dirname);
+	  missing_cb (sub);
+	}
+      else
+	im_place (sub);
+    }
+  g_list_free (subs);
+
+  G_UNLOCK (inotify_lock);
+  return FALSE;
+}
+
+static void
+im_handle_event_on_wd (ik_event_t *event)
+{
+  GList *l;
+
+  for (l = g_hash_table_lookup (wd_ancestor_hash, GINT_TO_POINTER (event->wd)); l; l = l->next)
+    {
+      im_ancestor_t *anc = l->data;
+
+      if (event->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT|IN_IGNORED))
+	{
+	  anc->rescan = TRUE;
+	  im_ancestor_mark_dirty (anc);
+	}
+      else if (event->mask & (IN_CREATE|IN_MOVED_TO) &&
+	       event->name &&
+	       g_hash_table_lookup (anc->children, event->name))
+	{
+	  anc->appeared = g_slist_prepend (anc->appeared, g_strdup (event->name));
+	  im_ancestor_mark_dirty (anc);
+	}
+    }
+}
+
+static void
+im_rescan_ancestor (gpointer key, 
+                    gpointer value, 
+                    gpointer user_data)
+{
+  im_ancestor_t *anc = value;
+
+  anc->rescan = TRUE;
+  im_ancestor_mark_dirty (anc);
+}
+
+/* inotify_lock must be held before calling
+ *
+ * Looks for events on the watched ancestors. The affected subscriptions
+ * are rechecked from an idle handler, once the event queue has been
+ * processed.
+ */
+void
+_im_handle_event (ik_event_t *event)
+{
+  if (event->mask & IN_Q_OVERFLOW)
+    {
+      /* Events were lost, so anything could have appeared */
+      g_hash_table_foreach (path_ancestor_hash, im_rescan_ancestor, NULL);
+    }
+  else
+    {
+      im_handle_event_on_wd (event);
+      if (event->pair)
+	im_handle_event_on_wd (event->pair);
+    }
+
+  if (dirty_ancestors && recheck_id == 0)
+    recheck_id = g_idle_add (im_recheck, NULL);
+}
+
+/* inotify_lock must be held before calling */
+gboolean
+_im_watches_wd (gint32 wd)
+{
+  return g_hash_table_lookup (wd_ancestor_hash, GINT_TO_POINTER (wd)) != NULL;
+}
+
+/* Rechecks the subscriptions which could not be grouped, doubling
+ * the delay each time.
+ */
+static gboolean
+im_scan_backoff (gpointer user_data)
+{
+  GList *subs;
   GList *l;
   
   G_LOCK (inotify_lock);
+
+  backoff_id = 0;
+  subs = backoff_sub_list;
+  backoff_sub_list = NULL;
   
-  IM_W ("scanning missing list with %d items\n", g_list_length (missing_sub_list));
-  for (l = missing_sub_list; l; l = l->next)
+  IM_W ("scanning backoff list with %d items\n", g_list_length (subs));
+  for (l = subs; l; l = l->next)
     {
       inotify_sub *sub = l->data;
-      gboolean not_m = FALSE;
       
       IM_W ("checking %p\n", sub);
       g_assert (sub);
       g_assert (sub->dirname);
-      not_m = _ip_start_watching (sub);
 
-      if (not_m)
+      if (_ip_start_watching (sub))
 	{
 	  missing_cb (sub);
 	  IM_W ("removed %s from missing list\n", sub->dirname);
-	  /* We have to build a list of list nodes to remove from the
-	   * missing_sub_list. We do the removal outside of this loop.
-	   */
-	  nolonger_missing = g_list_prepend (nolonger_missing, l);
-	} 
+	}
+      else if (!im_group (sub))
+	backoff_sub_list = g_list_prepend (backoff_sub_list, sub);
     }
+  g_list_free (subs);
 
-  for (l = nolonger_missing; l ; l = l->next)
+  if (backoff_sub_list)
     {
-      GList *llink = l->data;
-      missing_sub_list = g_list_remove_link (missing_sub_list, llink);
-      g_list_free_1 (llink);
+      backoff_secs = MIN (backoff_secs * 2, IM_BACKOFF_MAX);
+      backoff_id = g_timeout_add_seconds (backoff_secs, im_scan_backoff, NULL);
     }
-
-  g_list_free (nolonger_missing);
   
-  /* If the missing list is now empty, we disable the timeout */
-  if (missing_sub_list == NULL)
-    {
-      scan_missing_running = FALSE;
-      G_UNLOCK (inotify_lock);
-      return FALSE;
-    }
-  else
-    {
-      G_UNLOCK (inotify_lock);
-      return TRUE;
-    }
+  G_UNLOCK (inotify_lock);
+  return FALSE;
 }
 
 
+/* inotify_lock must be held */
+void
+_im_get_stats (guint *n_missing,
+	       guint *n_ancestors,
+	       guint *n_backoff)
+{
+  guint n_backoff_subs = g_list_length (backoff_sub_list);
+
+  *n_missing = (sub_ancestor_hash ? g_hash_table_size (sub_ancestor_hash) : 0) +
+	       n_backoff_subs;
+  *n_ancestors = wd_ancestor_hash ? g_hash_table_size (wd_ancestor_hash) : 0;
+  *n_backoff = n_backoff_subs;
+}
+
 /* inotify_lock must be held */
 void
 _im_diag_dump (GIOChannel *ioc)
 {
+  GHashTableIter iter;
+  gpointer key, value;
   GList *l;
+
   g_io_channel_write_chars (ioc, "missing list:\n", -1, NULL, NULL);
-  for (l = missing_sub_list; l; l = l->next)
+
+  g_hash_table_iter_init (&iter, sub_ancestor_hash);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      inotify_sub *sub = key;
+      im_ancestor_t *anc = value;
+      g_io_channel_write_chars (ioc, sub->dirname, -1, NULL, NULL);
+      g_io_channel_write_chars (ioc, " (waiting in ", -1, NULL, NULL);
+      g_io_channel_write_chars (ioc, anc->path, -1, NULL, NULL);
+      g_io_channel_write_chars (ioc, ")\n", -1, NULL, NULL);
+    }
+
+  for (l = backoff_sub_list; l; l = l->next)
     {
       inotify_sub *sub = l->data;
       g_io_channel_write_chars (ioc, sub->dirname, -1, NULL, NULL);
-      g_io_channel_write_chars (ioc, "\n", -1, NULL, NULL);
+      g_io_channel_write_chars (ioc, " (polled)\n", -1, NULL, NULL);
     }
 }
@@ -25,11 +25,17 @@
 #define __INOTIFY_MISSING_H
 
 #include "inotify-sub.h"
-
-void _im_startup   (void (*missing_cb)(inotify_sub *sub));
-void _im_add       (inotify_sub *sub);
-void _im_rm        (inotify_sub *sub);
-void _im_diag_dump (GIOChannel  *ioc);
+#include "inotify-kernel.h"
+
+void     _im_startup      (void (*missing_cb)(inotify_sub *sub));
+void     _im_add          (inotify_sub *sub);
+void     _im_rm           (inotify_sub *sub);
+void     _im_handle_event (ik_event_t  *event);
+gboolean _im_watches_wd   (gint32       wd);
+void     _im_diag_dump    (GIOChannel  *ioc);
+void     _im_get_stats    (guint       *n_missing,
+			   guint       *n_ancestors,
+			   guint       *n_backoff);
 
 
 #endif /* __INOTIFY_MISSING_H */
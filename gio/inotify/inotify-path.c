@@ -29,6 +29,12 @@
 #define __KERNEL_STRICT_NAMES
 
 #include <sys/inotify.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 #include "inotify-kernel.h"
@@ -42,6 +48,32 @@
 #define IN_ONLYDIR 0  
 #endif
 
+/* Budgeted mode.  When the kernel runs out of watches (ENOSPC, see
+ * max_user_watches) or GIO_INOTIFY_WATCH_BUDGET caps the number we may
+ * use, directories that have been quiet for IP_COLD_USEC give their
+ * watch to the directory that needs it, and fall back to a shared,
+ * low-frequency snapshot poll.  A polled directory that changes gets
+ * its watch back as soon as one is available.
+ */
+#define IP_COLD_USEC       (60 * G_USEC_PER_SEC)
+#define IP_POLL_INTERVAL   2      /* seconds between poll ticks */
+#define IP_POLL_SLICE_USEC 20000  /* time spent polling per tick */
+
+typedef struct {
+  char   *name;
+  guint64 ino;
+  gint64  mtime;
+  gint64  ctime;
+  gint64  size;
+  gboolean is_dir;
+} ip_snapshot_entry_t;
+
+/* Listing of a polled directory, sorted by name */
+typedef struct {
+  guint64 ino;
+  GArray *entries;
+} ip_snapshot_t;
+
 typedef struct ip_watched_dir_s {
   char *path;
   /* TODO: We need to maintain a tree of watched directories
@@ -51,11 +83,19 @@ typedef struct ip_watched_dir_s {
   struct ip_watched_dir_s* parent;
   GList*	 children;
 
-  /* Inotify state */
+  /* Inotify state, wd is -1 while the directory is polled */
   gint32 wd;
   
   /* List of inotify subscriptions */
   GList *subs;
+
+  /* Budgeted mode: last time the directory saw an event, its link in
+   * watched_lru (watched) or polled_dirs (polled), and the listing the
+   * next poll is compared against.
+   */
+  gint64         last_active;
+  GList         *link;
+  ip_snapshot_t *snapshot;
 } ip_watched_dir_t;
 
 static gboolean     ip_debug_enabled = FALSE;
@@ -75,10 +115,31 @@ static GHashTable * sub_dir_hash = NULL;
  */
 static GHashTable * wd_dir_hash = NULL;
 
+/* Watched directories, least recently active first */
+static GQueue watched_lru = G_QUEUE_INIT;
+/* Polled directories, in round-robin order */
+static GQueue polled_dirs = G_QUEUE_INIT;
+static guint  poll_source_id = 0;
+/* 0 means no limit other than the kernel's */
+static guint  watch_budget = 0;
+static gboolean watch_limit_reached = FALSE;
+static guint64 n_dir_polls = 0;
+static guint64 n_promotions = 0;
+static guint64 n_demotions = 0;
+
+G_LOCK_EXTERN (inotify_lock);
+
 static ip_watched_dir_t *ip_watched_dir_new  (const char       *path,
 					      int               wd);
 static void              ip_watched_dir_free (ip_watched_dir_t *dir);
 static void              ip_event_callback   (ik_event_t       *event);
+static void              ip_event_dispatch   (GList            *dir_list,
+					      GList            *pair_dir_list,
+					      ik_event_t       *event);
+static void              ip_wd_delete        (gpointer          data,
+					      gpointer          user_data);
+static void              ip_unmap_wd_dir     (gint32            wd,
+					      ip_watched_dir_t *dir);
 
 
 static void (*event_callback)(ik_event_t *event, inotify_sub *sub);
@@ -88,6 +149,7 @@ _ip_startup (void (*cb)(ik_event_t *event, inotify_sub *sub))
 {
   static gboolean initialized = FALSE;
   static gboolean result = FALSE;
+  const char *budget;
   
   if (initialized == TRUE)
     return result;
@@ -101,6 +163,10 @@ _ip_startup (void (*cb)(ik_event_t *event, inotify_sub *sub))
   path_dir_hash = g_hash_table_new (g_str_hash, g_str_equal);
   sub_dir_hash = g_hash_table_new (g_direct_hash, g_direct_equal);
   wd_dir_hash = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  budget = g_getenv ("GIO_INOTIFY_WATCH_BUDGET");
+  if (budget)
+    watch_budget = strtoul (budget, NULL, 10);
   
   initialized = TRUE;
   return TRUE;
@@ -136,12 +202,421 @@ ip_map_wd_dir (gint32            wd,
   g_hash_table_replace (wd_dir_hash, GINT_TO_POINTER (dir->wd), dir_list);
 }
 
+static int
+ip_snapshot_entry_compare (gconstpointer a,
+			   gconstpointer b)
+{
+  const ip_snapshot_entry_t *ea = a;
+  const ip_snapshot_entry_t *eb = b;
+
+  return strcmp (ea->name, eb->name);
+}
+
+static void
+ip_snapshot_free (ip_snapshot_t *snapshot)
+{
+  guint i;
+
+  if (!snapshot)
+    return;
+
+  for (i = 0; i < snapshot->entries->len; i++)
+    g_free (g_array_index (snapshot->entries, ip_snapshot_entry_t, i).name);
+  g_array_free (snapshot->entries, TRUE);
+  g_slice_free (ip_snapshot_t, snapshot);
+}
+
+/* Lists @path, returns NULL and sets errno on failure */
+static ip_snapshot_t *
+ip_snapshot_new (const char *path)
+{
+  ip_snapshot_t *snapshot;
+  struct dirent *de;
+  struct stat st;
+  DIR *d;
+  int fd;
+
+  d = opendir (path);
+  if (!d)
+    return NULL;
+
+  fd = dirfd (d);
+  if (fstat (fd, &st) != 0)
+    {
+      int e = errno;
+      closedir (d);
+      errno = e;
+      return NULL;
+    }
+
+  snapshot = g_slice_new (ip_snapshot_t);
+  snapshot->ino = st.st_ino;
+  snapshot->entries = g_array_new (FALSE, FALSE, sizeof (ip_snapshot_entry_t));
+
+  while ((de = readdir (d)) != NULL)
+    {
+      ip_snapshot_entry_t entry;
+
+      if (de->d_name[0] == '.' &&
+	  (de->d_name[1] == '\0' ||
+	   (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+	continue;
+
+      /* Gone since readdir() saw it; the next poll will notice */
+      if (fstatat (fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+	continue;
+
+      entry.name = g_strdup (de->d_name);
+      entry.ino = st.st_ino;
+      entry.mtime = (gint64) st.st_mtime * G_GINT64_CONSTANT (1000000000);
+      entry.ctime = (gint64) st.st_ctime * G_GINT64_CONSTANT (1000000000);
+#if defined (HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+      entry.mtime += st.st_mtim.tv_nsec;
+#endif
+#if defined (HAVE_STRUCT_STAT_ST_CTIM_TV_NSEC)
+      entry.ctime += st.st_ctim.tv_nsec;
+#endif
+      entry.size = st.st_size;
+      entry.is_dir = S_ISDIR (st.st_mode);
+      g_array_append_val (snapshot->entries, entry);
+    }
+  closedir (d);
+
+  g_array_sort (snapshot->entries, ip_snapshot_entry_compare);
+
+  return snapshot;
+}
+
+static void
+ip_emit_synthetic (ip_watched_dir_t *dir,
+		   const char       *name,
+		   guint32           mask)
+{
+  GList dir_list = { dir, NULL, NULL };
+  ik_event_t *event;
+
+  event = _ik_event_new_dummy (name, -1, mask);
+  ip_event_dispatch (&dir_list, NULL, event);
+  _ik_event_free (event);
+}
+
+/* Reports the differences between two listings of @dir as the events
+ * a watch would have seen.  Returns TRUE if there were any.
+ */
+static gboolean
+ip_snapshot_diff (ip_watched_dir_t *dir,
+		  ip_snapshot_t    *old,
+		  ip_snapshot_t    *new)
+{
+  gboolean changed = FALSE;
+  guint i = 0, j = 0;
+
+  while (i < old->entries->len || j < new->entries->len)
+    {
+      ip_snapshot_entry_t *o = NULL, *n = NULL;
+      int cmp;
+
+      if (i < old->entries->len)
+	o = &g_array_index (old->entries, ip_snapshot_entry_t, i);
+      if (j < new->entries->len)
+	n = &g_array_index (new->entries, ip_snapshot_entry_t, j);
+
+      if (!o)
+	cmp = 1;
+      else if (!n)
+	cmp = -1;
+      else
+	cmp = strcmp (o->name, n->name);
+
+      if (cmp < 0)
+	{
+	  ip_emit_synthetic (dir, o->name, IN_DELETE | (o->is_dir ? IN_ISDIR : 0));
+	  changed = TRUE;
+	  i++;
+	  continue;
+	}
+      if (cmp > 0)
+	{
+	  ip_emit_synthetic (dir, n->name, IN_CREATE | (n->is_dir ? IN_ISDIR : 0));
+	  changed = TRUE;
+	  j++;
+	  continue;
+	}
+
+      if (o->ino != n->ino)
+	{
+	  ip_emit_synthetic (dir, o->name, IN_DELETE | (o->is_dir ? IN_ISDIR : 0));
+	  ip_emit_synthetic (dir, n->name, IN_CREATE | (n->is_dir ? IN_ISDIR : 0));
+	  changed = TRUE;
+	}
+      /* A subdirectory's times change with its contents, which a
+       * watch on this directory would not report.
+       */
+      else if (!n->is_dir &&
+	       (o->mtime != n->mtime || o->size != n->size))
+	{
+	  ip_emit_synthetic (dir, n->name, IN_MODIFY);
+	  ip_emit_synthetic (dir, n->name, IN_CLOSE_WRITE);
+	  changed = TRUE;
+	}
+      else if (!n->is_dir && o->ctime != n->ctime)
+	{
+	  ip_emit_synthetic (dir, n->name, IN_ATTRIB);
+	  changed = TRUE;
+	}
+      i++;
+      j++;
+    }
+
+  return changed;
+}
+
+/* Re-lists a polled directory and reports what changed.  Returns -1
+ * if the directory is gone (or was replaced), 1 if it changed and 0
+ * otherwise.
+ */
+static int
+ip_poll_dir (ip_watched_dir_t *dir)
+{
+  ip_snapshot_t *snapshot;
+  gboolean changed;
+
+  n_dir_polls++;
+  snapshot = ip_snapshot_new (dir->path);
+  if (!snapshot)
+    return (errno == ENOENT || errno == ENOTDIR) ? -1 : 0;
+
+  if (snapshot->ino != dir->snapshot->ino)
+    {
+      ip_snapshot_free (snapshot);
+      return -1;
+    }
+
+  changed = ip_snapshot_diff (dir, dir->snapshot, snapshot);
+  ip_snapshot_free (dir->snapshot);
+  dir->snapshot = snapshot;
+
+  return changed ? 1 : 0;
+}
+
+static void
+ip_dir_unlink (ip_watched_dir_t *dir)
+{
+  if (!dir->link)
+    return;
+
+  if (dir->wd < 0)
+    g_queue_delete_link (&polled_dirs, dir->link);
+  else
+    g_queue_delete_link (&watched_lru, dir->link);
+  dir->link = NULL;
+}
+
+static void
+ip_dir_touch (ip_watched_dir_t *dir,
+	      gint64            now)
+{
+  dir->last_active = now;
+  if (dir->link && dir->wd >= 0 && dir->link != watched_lru.tail)
+    {
+      g_queue_unlink (&watched_lru, dir->link);
+      g_queue_push_tail_link (&watched_lru, dir->link);
+    }
+}
+
+static gboolean ip_poll_tick (gpointer user_data);
+
+static void
+ip_dir_set_polled (ip_watched_dir_t *dir,
+		   ip_snapshot_t    *snapshot)
+{
+  g_assert (dir->link == NULL);
+
+  dir->wd = -1;
+  dir->snapshot = snapshot;
+  dir->link = g_list_alloc ();
+  dir->link->data = dir;
+  g_queue_push_tail_link (&polled_dirs, dir->link);
+
+  if (!poll_source_id)
+    poll_source_id = g_timeout_add_seconds (IP_POLL_INTERVAL, ip_poll_tick, NULL);
+}
+
+static void
+ip_dir_set_watched (ip_watched_dir_t *dir,
+		    gint32            wd,
+		    gint64            now)
+{
+  g_assert (dir->link == NULL);
+
+  dir->wd = wd;
+  dir->last_active = now;
+  dir->link = g_list_alloc ();
+  dir->link->data = dir;
+  g_queue_push_tail_link (&watched_lru, dir->link);
+  ip_map_wd_dir (wd, dir);
+}
+
+/* Hands the watch of the least recently active directory over to
+ * polling, if that directory has been quiet for long enough. Watches
+ * that would stay in the kernel anyway are passed over.
+ */
+static gboolean
+ip_demote_coldest (gint64 now)
+{
+  ip_watched_dir_t *dir;
+  ip_snapshot_t *snapshot;
+  GList *dir_list;
+  GList *l, *next;
+
+  for (l = watched_lru.head; l; l = next)
+    {
+      dir = l->data;
+      next = l->next;
+
+      if (now - dir->last_active < IP_COLD_USEC)
+	return FALSE;
+
+      /* Symbolic links share the wd, and the watch may be used to
+       * wait for a missing file, so dropping it would not free it */
+      dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER (dir->wd));
+      if ((dir_list && dir_list->next) || _im_watches_wd (dir->wd))
+	{
+	  ip_dir_touch (dir, now);
+	  continue;
+	}
+
+      snapshot = ip_snapshot_new (dir->path);
+      if (!snapshot)
+	{
+	  ip_dir_touch (dir, now);
+	  continue;
+	}
+
+      IP_W ("Demoting %s to polling\n", dir->path);
+      ip_dir_unlink (dir);
+      _ik_ignore (dir->path, dir->wd);
+      ip_unmap_wd_dir (dir->wd, dir);
+      ip_dir_set_polled (dir, snapshot);
+      n_demotions++;
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Adds a watch on @path, making room within the budget if needed */
+static gint32
+ip_watch_path (const char *path,
+	       gint64      now,
+	       int        *err)
+{
+  gint32 wd;
+
+  if (watch_budget > 0 &&
+      g_hash_table_size (wd_dir_hash) >= watch_budget &&
+      !ip_demote_coldest (now))
+    {
+      *err = ENOSPC;
+      return -1;
+    }
+
+  wd = _ik_watch (path, IP_INOTIFY_MASK|IN_ONLYDIR, err);
+  if (wd < 0 && *err == ENOSPC)
+    {
+      if (!watch_limit_reached)
+	{
+	  IP_W ("Out of inotify watches, falling back to polling\n");
+	  watch_limit_reached = TRUE;
+	}
+      if (ip_demote_coldest (now))
+	wd = _ik_watch (path, IP_INOTIFY_MASK|IN_ONLYDIR, err);
+    }
+
+  return wd;
+}
+
+/* Gives a polled directory that just changed a watch again */
+static void
+ip_promote (ip_watched_dir_t *dir,
+	    gint64            now)
+{
+  gint32 wd;
+  int err;
+
+  wd = ip_watch_path (dir->path, now, &err);
+  if (wd < 0)
+    return;
+
+  IP_W ("Promoting %s to a watch\n", dir->path);
+  ip_dir_unlink (dir);
+  ip_dir_set_watched (dir, wd, now);
+  n_promotions++;
+
+  /* Catch up with changes made since the last poll */
+  if (ip_poll_dir (dir) < 0)
+    {
+      /* The watch will report the deletion */
+      IP_W ("%s vanished while being promoted\n", dir->path);
+    }
+  ip_snapshot_free (dir->snapshot);
+  dir->snapshot = NULL;
+}
+
+static gboolean
+ip_poll_tick (gpointer user_data)
+{
+  gint64 start, now;
+  guint i, n;
+
+  G_LOCK (inotify_lock);
+
+  start = now = g_get_monotonic_time ();
+  n = g_queue_get_length (&polled_dirs);
+  for (i = 0; i < n && (i == 0 || now - start < IP_POLL_SLICE_USEC); i++)
+    {
+      ip_watched_dir_t *dir;
+      GList *link;
+      int changed;
+
+      link = g_queue_pop_head_link (&polled_dirs);
+      g_queue_push_tail_link (&polled_dirs, link);
+      dir = link->data;
+
+      changed = ip_poll_dir (dir);
+      now = g_get_monotonic_time ();
+
+      if (changed < 0)
+	{
+	  ip_emit_synthetic (dir, NULL, IN_DELETE_SELF);
+	  ip_wd_delete (dir, NULL);
+	}
+      else if (changed > 0)
+	{
+	  dir->last_active = now;
+	  ip_promote (dir, now);
+	}
+    }
+
+  if (g_queue_is_empty (&polled_dirs))
+    {
+      poll_source_id = 0;
+      G_UNLOCK (inotify_lock);
+      return FALSE;
+    }
+
+  G_UNLOCK (inotify_lock);
+  return TRUE;
+}
+
 gboolean
 _ip_start_watching (inotify_sub *sub)
 {
   gint32 wd;
   int err;
   ip_watched_dir_t *dir;
+  ip_snapshot_t *snapshot;
   
   g_assert (sub);
   g_assert (!sub->cancelled);
@@ -156,22 +631,30 @@ _ip_start_watching (inotify_sub *sub)
     }
 	
   IP_W ("Trying to add inotify watch ");
-  wd = _ik_watch (sub->dirname, IP_INOTIFY_MASK|IN_ONLYDIR, &err);
-  if (wd < 0) 
-    {
-      IP_W ("Failed\n");
-      return FALSE;
-    }
-  else
+  wd = ip_watch_path (sub->dirname, g_get_monotonic_time (), &err);
+  if (wd >= 0)
     {
       /* Create new watched directory and associate it with the 
        * wd hash and path hash
        */
       IP_W ("Success\n");
       dir = ip_watched_dir_new (sub->dirname, wd);
-      ip_map_wd_dir (wd, dir);
+      ip_dir_set_watched (dir, wd, g_get_monotonic_time ());
+      ip_map_path_dir (sub->dirname, dir);
+    }
+  else if (err == ENOSPC && (snapshot = ip_snapshot_new (sub->dirname)))
+    {
+      /* Out of watches, poll the directory until it earns one */
+      IP_W ("Polling\n");
+      dir = ip_watched_dir_new (sub->dirname, -1);
+      ip_dir_set_polled (dir, snapshot);
       ip_map_path_dir (sub->dirname, dir);
     }
+  else
+    {
+      IP_W ("Failed\n");
+      return FALSE;
+    }
   
  out:
   ip_map_sub_dir (sub, dir);
@@ -252,8 +735,14 @@ _ip_stop_watching (inotify_sub *sub)
   /* No one is subscribing to this directory any more */
   if (dir->subs == NULL)
     {
-      _ik_ignore (dir->path, dir->wd);
-      ip_unmap_wd_dir (dir->wd, dir);
+      ip_dir_unlink (dir);
+      if (dir->wd >= 0)
+	{
+	  /* The watch may still be used to wait for a missing file */
+	  if (!_im_watches_wd (dir->wd))
+	    _ik_ignore (dir->path, dir->wd);
+	  ip_unmap_wd_dir (dir->wd, dir);
+	}
       ip_unmap_path_dir (dir->path, dir);
       ip_watched_dir_free (dir);
     }
@@ -278,6 +767,8 @@ static void
 ip_watched_dir_free (ip_watched_dir_t *dir)
 {
   g_assert (dir->subs == NULL);
+  g_assert (dir->link == NULL);
+  ip_snapshot_free (dir->snapshot);
   g_free (dir->path);
   g_free (dir);
 }
@@ -296,6 +787,7 @@ ip_wd_delete (gpointer data,
       _im_add (sub);
     }
   ip_unmap_all_subs (dir);
+  ip_dir_unlink (dir);
   /* Unassociate the path and the directory */
   ip_unmap_path_dir (dir->path, dir);
   ip_watched_dir_free (dir);
@@ -336,6 +828,13 @@ ip_event_dispatch (GList      *dir_list,
 	  if (sub->filename && !event->name)
 	    continue;
 	  
+	  /* Subdirectories of a watched tree leave the
+	   * events about themselves to their parents.
+	   */
+	  if (sub->children_only &&
+	      (!event->name || !event->name[0]))
+	    continue;
+	  
 	  /* FIXME: We might need to synthesize
 	   * DELETE/UNMOUNT events when
 	   * the filename doesn't match
@@ -389,6 +888,9 @@ ip_event_callback (ik_event_t *event)
   GList* dir_list = NULL;
   GList* pair_dir_list = NULL;
   
+  /* Watched ancestors of missing files share the same inotify instance */
+  _im_handle_event (event);
+
   dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER (event->wd));
   
   /* We can ignore the IGNORED events */
@@ -401,6 +903,17 @@ ip_event_callback (ik_event_t *event)
   if (event->pair)
     pair_dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER (event->pair->wd));
 
+  if (dir_list || pair_dir_list)
+    {
+      gint64 now = g_get_monotonic_time ();
+      GList *l;
+
+      for (l = dir_list; l; l = l->next)
+	ip_dir_touch (l->data, now);
+      for (l = pair_dir_list; l; l = l->next)
+	ip_dir_touch (l->data, now);
+    }
+
   if (event->mask & IP_INOTIFY_MASK)
     ip_event_dispatch (dir_list, pair_dir_list, event);
   
@@ -421,6 +934,34 @@ ip_event_callback (ik_event_t *event)
   _ik_event_free (event);
 }
 
+/* inotify_lock must be held */
+void
+_ip_get_stats (guint *n_watches,
+	       guint *n_dirs,
+	       guint *n_subs)
+{
+  *n_watches = wd_dir_hash ? g_hash_table_size (wd_dir_hash) : 0;
+  *n_dirs = path_dir_hash ? g_hash_table_size (path_dir_hash) : 0;
+  *n_subs = sub_dir_hash ? g_hash_table_size (sub_dir_hash) : 0;
+}
+
+/* inotify_lock must be held */
+void
+_ip_get_budget_stats (guint    *budget,
+		      gboolean *limit_reached,
+		      guint    *n_polled,
+		      guint64  *n_polls,
+		      guint64  *n_promoted,
+		      guint64  *n_demoted)
+{
+  *budget = watch_budget;
+  *limit_reached = watch_limit_reached;
+  *n_polled = g_queue_get_length (&polled_dirs);
+  *n_polls = n_dir_polls;
+  *n_promoted = n_promotions;
+  *n_demoted = n_demotions;
+}
+
 const char *
 _ip_get_path_for_wd (gint32 wd)
 {
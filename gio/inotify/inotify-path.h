@@ -30,4 +30,13 @@ gboolean     _ip_startup (void (*event_cb)(ik_event_t *event, inotify_sub *sub))
 gboolean     _ip_start_watching (inotify_sub *sub);
 gboolean     _ip_stop_watching  (inotify_sub *sub);
 const char * _ip_get_path_for_wd (gint32 wd);
+void         _ip_get_stats       (guint *n_watches,
+				  guint *n_dirs,
+				  guint *n_subs);
+void         _ip_get_budget_stats (guint    *budget,
+				   gboolean *limit_reached,
+				   guint    *n_polled,
+				   guint64  *n_polls,
+				   guint64  *n_promoted,
+				   guint64  *n_demoted);
 #endif
@@ -31,6 +31,7 @@ typedef struct
 	gboolean cancelled;
 	gpointer user_data;
         gboolean pair_moves;
+	gboolean children_only; /* no events about the directory itself */
 } inotify_sub;
 
 inotify_sub* _ih_sub_new (const gchar* dirname, const gchar* filename, gboolean pair_moves, gpointer user_data);
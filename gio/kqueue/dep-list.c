@@ -20,12 +20,15 @@
   THE SOFTWARE.
 *******************************************************************************/
 
+#include "config.h"
 #include <glib.h>
 
 #include <stdlib.h>  /* calloc */
 #include <stdio.h>   /* printf */
 #include <dirent.h>  /* opendir, readdir, closedir */
 #include <string.h>  /* strcmp */
+#include <fcntl.h>   /* AT_SYMLINK_NOFOLLOW */
+#include <sys/stat.h>
 #include <assert.h>
 
 #include "dep-list.h"
@@ -50,25 +53,211 @@ dl_print (const dep_list *dl)
 }
 
 /**
- * Create a new list item.
+ * A pool of interned file names.
  *
- * Create a new list item and initialize its fields.
+ * The pool is shared between successive listings of the same directory,
+ * so the names which did not change between rescans are stored only once
+ * and do not cost any allocation.
+ **/
+typedef struct {
+    GStringChunk *chunk;
+    GHashTable *table;
+    int ref_count;
+} dl_names;
+
+/**
+ * A directory snapshot.
+ *
+ * All the list items of a snapshot live in a single contiguous block,
+ * right after this header. The head of the list is always items[0].
+ **/
+typedef struct {
+    dl_names *names;
+    size_t n_items;
+    size_t n_allocated;
+    dep_list items[1];
+} dl_snapshot;
+
+#define DL_SNAPSHOT(dl) \
+    ((dl_snapshot *) ((char *) (dl) - G_STRUCT_OFFSET (dl_snapshot, items)))
+
+/* The initial snapshot capacity */
+#define DL_EXTEND_COUNT 16
+
+/* The pool is not reused if it has more than 2*n+DL_NAMES_SLACK names
+ * for a listing of n items, so the stale names do not accumulate */
+#define DL_NAMES_SLACK 64
+
+
+static dl_names*
+dl_names_new ()
+{
+    dl_names *names = g_slice_new (dl_names);
+    names->chunk = g_string_chunk_new (4096);
+    names->table = g_hash_table_new (g_str_hash, g_str_equal);
+    names->ref_count = 1;
+    return names;
+}
+
+static dl_names*
+dl_names_ref (dl_names *names)
+{
+    ++names->ref_count;
+    return names;
+}
+
+static void
+dl_names_unref (dl_names *names)
+{
+    if (--names->ref_count == 0) {
+        g_hash_table_destroy (names->table);
+        g_string_chunk_free (names->chunk);
+        g_slice_free (dl_names, names);
+    }
+}
+
+/**
+ * Get an interned copy of a file name.
+ *
+ * @param[in] names A pointer to a names pool.
+ * @param[in] name  A file name.
+ * @return A copy of the name, owned by the pool.
+ **/
+static char*
+dl_names_intern (dl_names *names, const char *name)
+{
+    char *interned = g_hash_table_lookup (names->table, name);
+    if (interned == NULL) {
+        interned = g_string_chunk_insert (names->chunk, name);
+        g_hash_table_insert (names->table, interned, interned);
+    }
+    return interned;
+}
+
+/**
+ * Create a new empty snapshot.
+ *
+ * @param[in] names      A pool to intern the names in. May be NULL, a new
+ *     pool will be created in this case.
+ * @param[in] n_reserved A number of items to preallocate.
+ * @return A pointer to a new snapshot or NULL in the case of error.
+ **/
+static dl_snapshot*
+dl_snapshot_new (dl_names *names, size_t n_reserved)
+{
+    if (n_reserved < DL_EXTEND_COUNT) {
+        n_reserved = DL_EXTEND_COUNT;
+    }
+
+    dl_snapshot *snap = malloc (sizeof (dl_snapshot)
+                                + (n_reserved - 1) * sizeof (dep_list));
+    if (snap == NULL) {
+        perror_msg ("Failed to allocate a snapshot");
+        return NULL;
+    }
+
+    snap->names = (names != NULL) ? dl_names_ref (names) : dl_names_new ();
+    snap->n_items = 0;
+    snap->n_allocated = n_reserved;
+    return snap;
+}
+
+/**
+ * Add an item to the end of a snapshot.
+ *
+ * The snapshot memory is reallocated when needed, so all the pointers
+ * into it should be considered invalid after the call.
  *
- * @param[in] path  A name of a file (the string is not copied!).
+ * @param[in,out] psnap A pointer to a pointer to a snapshot.
+ * @param[in]     path  A name of a file (will be interned).
+ * @param[in]     inode A file's inode number.
+ * @param[in]     meta  A file's metadata. May be NULL.
+ * @return 0 in the case of error, non-zero otherwise.
+ **/
+static int
+dl_snapshot_add (dl_snapshot  **psnap,
+                 const char    *path,
+                 ino_t          inode,
+                 const dl_meta *meta)
+{
+    dl_snapshot *snap = *psnap;
+    size_t i;
+
+    if (snap->n_items == snap->n_allocated) {
+        size_t n_allocated = snap->n_allocated * 2;
+        dl_snapshot *grown = realloc (snap,
+                                      sizeof (dl_snapshot)
+                                      + (n_allocated - 1) * sizeof (dep_list));
+        if (grown == NULL) {
+            perror_msg ("Failed to extend a snapshot");
+            return 0;
+        }
+
+        /* The block could move, relink the items */
+        snap = *psnap = grown;
+        snap->n_allocated = n_allocated;
+        for (i = 1; i < snap->n_items; i++) {
+            snap->items[i - 1].next = &snap->items[i];
+        }
+    }
+
+    dep_list *item = &snap->items[snap->n_items];
+    item->path = dl_names_intern (snap->names, path);
+    item->inode = inode;
+    item->next = NULL;
+    if (meta != NULL) {
+        item->meta = *meta;
+    } else {
+        memset (&item->meta, 0, sizeof (dl_meta));
+    }
+
+    if (snap->n_items > 0) {
+        snap->items[snap->n_items - 1].next = item;
+    }
+    ++snap->n_items;
+    return 1;
+}
+
+/**
+ * Free a snapshot.
+ *
+ * @param[in] snap A pointer to a snapshot.
+ **/
+static void
+dl_snapshot_free (dl_snapshot *snap)
+{
+    dl_names_unref (snap->names);
+    free (snap);
+}
+
+
+/**
+ * Append an item to a list.
+ *
+ * The list is stored in a contiguous memory block, so the head of the
+ * list may change after this call (like with g_list_append()).
+ *
+ * @param[in] dl    A pointer to a list (as returned by dl_append() or
+ *     dl_listing()). May be NULL.
+ * @param[in] path  A name of a file (the string is copied).
  * @param[in] inode A file's inode number.
- * @return A pointer to a new item or NULL in the case of error.
+ * @return A new head of the list or NULL in the case of error. The
+ *     original list is not changed on error.
  **/
-dep_list* dl_create (char *path, ino_t inode)
+dep_list*
+dl_append (dep_list *dl, const char *path, ino_t inode)
 {
-    dep_list *dl = calloc (1, sizeof (dep_list));
-    if (dl == NULL) {
-        perror_msg ("Failed to create a new dep-list item");
+    assert (path != NULL);
+
+    dl_snapshot *snap = (dl != NULL) ? DL_SNAPSHOT (dl) : dl_snapshot_new (NULL, 0);
+    if (snap == NULL || !dl_snapshot_add (&snap, path, inode, NULL)) {
+        if (dl == NULL && snap != NULL) {
+            dl_snapshot_free (snap);
+        }
         return NULL;
     }
 
-    dl->path = path;
-    dl->inode = inode;
-    return dl;
+    return &snap->items[0];
 }
 
 /**
@@ -78,6 +267,9 @@ dep_list* dl_create (char *path, ino_t inode)
  * contents. All data pointers (`path' in our case) of a list and its
  * shallow copy will point to the same memory.
  *
+ * The copy is allocated in a single memory block, so it should be freed
+ * with dl_shallow_free().
+ *
  * @param[in] dl A pointer to list to make a copy. May be NULL.
  * @return A shallow copy of the list.
  **/ 
@@ -88,28 +280,24 @@ dl_shallow_copy (const dep_list *dl)
         return NULL;
     }
 
-    dep_list *head = calloc (1, sizeof (dep_list));
+    const dep_list *it;
+    size_t i, n = 0;
+
+    for (it = dl; it != NULL; it = it->next) {
+        ++n;
+    }
+
+    dep_list *head = calloc (n, sizeof (dep_list));
     if (head == NULL) {
-        perror_msg ("Failed to allocate head during shallow copy");
+        perror_msg ("Failed to allocate a shallow copy");
         return NULL;
     }
 
-    dep_list *cp = head;
-    const dep_list *it = dl;
-
-    while (it != NULL) {
-        cp->path = it->path;
-        cp->inode = it->inode;
-        if (it->next) {
-            cp->next = calloc (1, sizeof (dep_list));
-            if (cp->next == NULL) {
-                perror_msg ("Failed to allocate a new element during shallow copy");
-                dl_shallow_free (head);
-                return NULL;
-            }
-            cp = cp->next;
-        }
-        it = it->next;
+    for (it = dl, i = 0; it != NULL; it = it->next, i++) {
+        head[i].path = it->path;
+        head[i].inode = it->inode;
+        head[i].meta = it->meta;
+        head[i].next = (i + 1 < n) ? &head[i + 1] : NULL;
     }
 
     return head;
@@ -121,211 +309,369 @@ dl_shallow_copy (const dep_list *dl)
  * This function will free the memory used by a list structure, but
  * the list data will remain in the heap.
  *
- * @param[in] dl A pointer to a list. May be NULL.
+ * @param[in] dl A pointer to a list returned by dl_shallow_copy().
+ *     May be NULL.
  **/
 void
 dl_shallow_free (dep_list *dl)
 {
-    while (dl != NULL) {
-        dep_list *ptr = dl;
-        dl = dl->next;
-        free (ptr);
-    }
+    free (dl);
 }
 
 /**
  * Free the memory allocated for a list.
  *
  * This function will free all the memory used by a list: both
- * list structure and the list data.
+ * list structure and the list data. The names are released in
+ * the shared pool, which is freed with its last user.
  *
- * @param[in] dl A pointer to a list. May be NULL.
+ * @param[in] dl A pointer to a list (as returned by dl_append() or
+ *     dl_listing()). May be NULL.
  **/
 void
 dl_free (dep_list *dl)
 {
-    while (dl != NULL) {
-        dep_list *ptr = dl;
-        dl = dl->next;
+    if (dl != NULL) {
+        dl_snapshot_free (DL_SNAPSHOT (dl));
+    }
+}
 
-        free (ptr->path);
-        free (ptr);
+/**
+ * Fill the metadata of a directory entry.
+ *
+ * The entry is examined relative to the directory descriptor, so no
+ * descriptor is kept open for the entry itself. Symbolic links are not
+ * followed.
+ *
+ * @param[in]  dir  An open directory.
+ * @param[in]  path A path to the directory.
+ * @param[in]  name A name of the entry.
+ * @param[out] meta A pointer to the metadata to fill.
+ **/
+static void
+dl_meta_fill (DIR *dir, const char *path, const char *name, dl_meta *meta)
+{
+    struct stat st;
+    int rc;
+
+    memset (meta, 0, sizeof (dl_meta));
+
+#ifdef HAVE_FSTATAT
+    (void) path;
+    rc = fstatat (dirfd (dir), name, &st, AT_SYMLINK_NOFOLLOW);
+#else
+    (void) dir;
+    char *full_path = g_build_filename (path, name, NULL);
+    rc = lstat (full_path, &st);
+    g_free (full_path);
+#endif
+
+    if (rc == -1) {
+        /* The entry could vanish after readdir(), it will be noticed
+         * by the next listing */
+        return;
     }
+
+    meta->size = st.st_size;
+    meta->is_dir = S_ISDIR (st.st_mode);
+    meta->mtime = st.st_mtime;
+    meta->ctime = st.st_ctime;
+#if defined (HAVE_STRUCT_STAT_ST_MTIMENSEC)
+    meta->mtime_nsec = st.st_mtimensec;
+#elif defined (HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+    meta->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+#if defined (HAVE_STRUCT_STAT_ST_CTIMENSEC)
+    meta->ctime_nsec = st.st_ctimensec;
+#elif defined (HAVE_STRUCT_STAT_ST_CTIM_TV_NSEC)
+    meta->ctime_nsec = st.st_ctim.tv_nsec;
+#endif
+    meta->valid = 1;
 }
 
 /**
  * Create a directory listing and return it as a list.
  *
- * @param[in] path A path to a directory.
+ * If a previous listing of the same directory is passed, its names
+ * pool is reused for the new listing, so the names of the files which
+ * are still in the directory are not copied again.
+ *
+ * @param[in] path     A path to a directory.
+ * @param[in] previous A previous listing of the directory. May be NULL.
  * @return A pointer to a list. May return NULL, check errno in this case.
  **/
 dep_list*
-dl_listing (const char *path)
+dl_listing (const char *path, const dep_list *previous)
+{
+    return dl_listing_full (path, previous, 0);
+}
+
+/**
+ * Create a directory listing with the specified options.
+ *
+ * With DL_LISTING_META, the size and the modification and change times
+ * of every entry are recorded, so dl_calculate() can report changes of
+ * the entries without watching them individually.
+ *
+ * @param[in] path     A path to a directory.
+ * @param[in] previous A previous listing of the directory. May be NULL.
+ * @param[in] flags    A combination of DL_LISTING_* flags.
+ * @return A pointer to a list. May return NULL, check errno in this case.
+ **/
+dep_list*
+dl_listing_full (const char *path, const dep_list *previous, int flags)
 {
     assert (path != NULL);
 
-    dep_list *head = NULL;
-    dep_list *prev = NULL;
+    dl_names *names = NULL;
+    size_t n_reserved = 0;
+
+    if (previous != NULL) {
+        dl_snapshot *prev_snap = DL_SNAPSHOT (previous);
+        n_reserved = prev_snap->n_items + DL_EXTEND_COUNT;
+        if (g_hash_table_size (prev_snap->names->table)
+            <= 2 * prev_snap->n_items + DL_NAMES_SLACK) {
+            names = prev_snap->names;
+        }
+    }
+
+    dl_snapshot *snap = NULL;
     DIR *dir = opendir (path);
     if (dir != NULL) {
         struct dirent *ent;
+        dl_meta meta;
+
+        snap = dl_snapshot_new (names, n_reserved);
+        if (snap == NULL) {
+            goto error;
+        }
 
         while ((ent = readdir (dir)) != NULL) {
             if (!strcmp (ent->d_name, ".") || !strcmp (ent->d_name, "..")) {
                 continue;
             }
 
-            if (head == NULL) {
-                head = calloc (1, sizeof (dep_list));
-                if (head == NULL) {
-                    perror_msg ("Failed to allocate head during listing");
-                    goto error;
-                }
-            }
-
-            dep_list *iter = (prev == NULL) ? head : calloc (1, sizeof (dep_list));
-            if (iter == NULL) {
-                perror_msg ("Failed to allocate a new element during listing");
-                goto error;
+            if (flags & DL_LISTING_META) {
+                dl_meta_fill (dir, path, ent->d_name, &meta);
             }
 
-            iter->path = strdup (ent->d_name);
-            if (iter->path == NULL) {
-                perror_msg ("Failed to copy a string during listing");
+            if (!dl_snapshot_add (&snap,
+                                  ent->d_name,
+                                  ent->d_ino,
+                                  (flags & DL_LISTING_META) ? &meta : NULL)) {
+                perror_msg ("Failed to add a new element during listing");
                 goto error;
             }
-
-            iter->inode = ent->d_ino;
-            iter->next = NULL;
-            if (prev) {
-                prev->next = iter;
-            }
-            prev = iter;
         }
 
         closedir (dir);
+
+        if (snap->n_items == 0) {
+            dl_snapshot_free (snap);
+            return NULL;
+        }
+        return &snap->items[0];
     }
-    return head;
+    return NULL;
 
 error:
     if (dir != NULL) {
         closedir (dir);
     }
-    dl_free (head);
+    if (snap != NULL) {
+        dl_snapshot_free (snap);
+    }
     return NULL;
 }
 
+/* Per-entry state bits used by the diff engine. */
+enum {
+    DL_COMMON      = 1 << 0, /* present in both listings under the same name */
+    DL_MOVED       = 1 << 1, /* matched as a move */
+    DL_REPLACED    = 1 << 2, /* matched as a replacement */
+    DL_OVERWRITTEN = 1 << 3, /* matched as an overwrite */
+};
+
 /**
- * Perform a diff on lists.
+ * A flat view on a list, used by the diff engine.
  *
- * This function performs something like a set intersection. The same items
- * will be removed from the both lists. Items are comapred by a filename.
- * 
- * @param[in,out] before A pointer to a pointer to a list. Will contain items
- *     which were not found in the `after' list.
- * @param[in,out] after  A pointer to a pointer to a list. Will containt items
- *     which were not found in the `before' list.
+ * The entries are stored in the list order, every entry has a set of
+ * state bits (see DL_COMMON and friends).
  **/
-void
-dl_diff (dep_list **before, dep_list **after)
+typedef struct {
+    const dep_list **items;
+    guint8 *state;
+    gsize n;
+} dl_array;
+
+/**
+ * A hash index over a #dl_array.
+ *
+ * Maps a key (file name or inode number) to the first entry with this
+ * key. Entries sharing the same key are chained in the list order
+ * through the `next' array, so a lookup always returns the earliest
+ * suitable entry, as the linear scan did.
+ **/
+typedef struct {
+    GHashTable *heads;
+    gssize *next;
+} dl_index;
+
+typedef enum {
+    DL_KEY_NAME,
+    DL_KEY_INODE
+} dl_key;
+
+
+static guint
+dl_inode_hash (gconstpointer key)
 {
-    assert (before != NULL);
-    assert (after != NULL);
+    guint64 ino = (guint64) *(const ino_t *) key;
+    return (guint) (ino ^ (ino >> 32));
+}
 
-    if (*before == NULL || *after == NULL) {
-        return;
+static gboolean
+dl_inode_equal (gconstpointer a, gconstpointer b)
+{
+    return *(const ino_t *) a == *(const ino_t *) b;
+}
+
+static gconstpointer
+dl_key_of (const dep_list *item, dl_key kind)
+{
+    return (kind == DL_KEY_NAME) ? (gconstpointer) item->path
+                                 : (gconstpointer) &item->inode;
+}
+
+/**
+ * Convert a list into a #dl_array.
+ *
+ * @param[out] arr A pointer to an array to fill.
+ * @param[in]  dl  A pointer to a list. May be NULL.
+ **/
+static void
+dl_array_init (dl_array *arr, const dep_list *dl)
+{
+    const dep_list *it;
+    gsize i = 0;
+
+    arr->n = 0;
+    for (it = dl; it != NULL; it = it->next) {
+        ++arr->n;
     }
 
-    dep_list *before_iter = *before;
-    dep_list *before_prev = NULL;
+    arr->items = g_new (const dep_list *, arr->n);
+    arr->state = g_new0 (guint8, arr->n);
 
-    while (before_iter != NULL) {
-        dep_list *after_iter = *after;
-        dep_list *after_prev = NULL;
+    for (it = dl; it != NULL; it = it->next) {
+        arr->items[i++] = it;
+    }
+}
 
-        int matched = 0;
-        while (after_iter != NULL) {
-            if (strcmp (before_iter->path, after_iter->path) == 0) {
-                matched = 1;
-                /* removing the entry from the both lists */
-                if (before_prev) {
-                    before_prev->next = before_iter->next;
-                } else {
-                    *before = before_iter->next;
-                }
+static void
+dl_array_free (dl_array *arr)
+{
+    g_free (arr->items);
+    g_free (arr->state);
+}
 
-                if (after_prev) {
-                    after_prev->next = after_iter->next;
-                } else {
-                    *after = after_iter->next;
-                }
-                free (after_iter);
-                break;
-            }
-            after_prev = after_iter;
-            after_iter = after_iter->next;
-        }
+/**
+ * Build a hash index over an array.
+ *
+ * @param[out] idx  A pointer to an index to initialize.
+ * @param[in]  arr  A pointer to an array to index.
+ * @param[in]  kind Which field to use as a key.
+ * @param[in]  skip Entries with any of these state bits set are not indexed.
+ **/
+static void
+dl_index_init (dl_index *idx, const dl_array *arr, dl_key kind, guint8 skip)
+{
+    gsize i;
+
+    if (kind == DL_KEY_NAME) {
+        idx->heads = g_hash_table_new (g_str_hash, g_str_equal);
+    } else {
+        idx->heads = g_hash_table_new (dl_inode_hash, dl_inode_equal);
+    }
+    idx->next = g_new (gssize, arr->n);
+
+    /* Walk backwards, so the chains will follow the list order */
+    for (i = arr->n; i-- > 0; ) {
+        gconstpointer key = dl_key_of (arr->items[i], kind);
 
-        dep_list *oldptr = before_iter;
-        before_iter = before_iter->next;
-        if (matched == 0) {
-            before_prev = oldptr;
-        } else {
-            free (oldptr);
+        if (arr->state[i] & skip) {
+            idx->next[i] = -1;
+            continue;
         }
+
+        idx->next[i] = (gssize) GPOINTER_TO_SIZE (g_hash_table_lookup (idx->heads, key)) - 1;
+        g_hash_table_insert (idx->heads, (gpointer) key, GSIZE_TO_POINTER (i + 1));
     }
 }
 
+static void
+dl_index_free (dl_index *idx)
+{
+    g_hash_table_destroy (idx->heads);
+    g_free (idx->next);
+}
 
 /**
- * Traverses two lists. Compares items with a supplied expression
- * and performs the passed code on a match. Removes the matched entries
- * from the both lists.
+ * Find the first available entry with the given key.
+ *
+ * Entries with any of the `busy' state bits set are skipped. If `consume'
+ * is set, the busy state is considered permanent for this index and the
+ * chain head is advanced past such entries, so the consumed items are
+ * never visited twice.
+ *
+ * @param[in] idx        A pointer to an index.
+ * @param[in] arr        A pointer to the indexed array.
+ * @param[in] key        A key to look up.
+ * @param[in] busy       State bits marking unavailable entries.
+ * @param[in] consume    Drop the busy entries from the index.
+ * @param[in] not_inode  If not NULL, entries with this inode number are
+ *     not matched (but not skipped permanently either).
+ * @return An index of the entry in the array or -1 if nothing was found.
  **/
-#define EXCLUDE_SIMILAR(removed_list, added_list, match_expr, matched_code) \
-    assert (removed_list != NULL);                                      \
-    assert (added_list != NULL);                                        \
-                                                                        \
-    dep_list *removed_list##_iter = *removed_list;                      \
-    dep_list *removed_list##_prev = NULL;                               \
-                                                                        \
-    int productive = 0;                                                 \
-                                                                        \
-    while (removed_list##_iter != NULL) {                               \
-        dep_list *added_list##_iter = *added_list;                      \
-        dep_list *added_list##_prev = NULL;                             \
-                                                                        \
-        int matched = 0;                                                \
-        while (added_list##_iter != NULL) {                             \
-            if (match_expr) {                                           \
-                matched = 1;                                            \
-                ++productive;                                           \
-                matched_code;                                           \
-                                                                        \
-                if (removed_list##_prev) {                              \
-                    removed_list##_prev->next = removed_list##_iter->next; \
-                } else {                                                \
-                    *removed_list = removed_list##_iter->next;          \
-                }                                                       \
-                if (added_list##_prev) {                                \
-                    added_list##_prev->next = added_list##_iter->next;  \
-                } else {                                                \
-                    *added_list = added_list##_iter->next;              \
-                }                                                       \
-                free (added_list##_iter);                               \
-                break;                                                  \
-            }                                                           \
-            added_list##_iter = added_list##_iter->next;                \
-        }                                                               \
-        dep_list *oldptr = removed_list##_iter;                         \
-        removed_list##_iter = removed_list##_iter->next;                \
-        if (matched == 0) {                                             \
-            removed_list##_prev = oldptr;                               \
-        } else {                                                        \
-            free (oldptr);                                              \
-        }                                                               \
-    }                                                                   \
-    return (productive > 0);
+static gssize
+dl_index_lookup (dl_index       *idx,
+                 const dl_array *arr,
+                 gconstpointer   key,
+                 guint8          busy,
+                 gboolean        consume,
+                 const ino_t    *not_inode)
+{
+    gpointer orig_key = NULL;
+    gpointer value = NULL;
+    gboolean at_head = consume;
+    gssize i;
+
+    if (!g_hash_table_lookup_extended (idx->heads, key, &orig_key, &value)) {
+        return -1;
+    }
+
+    for (i = (gssize) GPOINTER_TO_SIZE (value) - 1; i != -1; i = idx->next[i]) {
+        if (arr->state[i] & busy) {
+            if (at_head) {
+                if (idx->next[i] == -1) {
+                    g_hash_table_remove (idx->heads, key);
+                } else {
+                    g_hash_table_insert (idx->heads,
+                                         orig_key,
+                                         GSIZE_TO_POINTER (idx->next[i] + 1));
+                }
+            }
+            continue;
+        }
+
+        if (not_inode == NULL || arr->items[i]->inode != *not_inode) {
+            return i;
+        }
+        at_head = FALSE;
+    }
+
+    return -1;
+}
 
 
 #define cb_invoke(cbs, name, udata, ...) \
@@ -335,6 +681,47 @@ dl_diff (dep_list **before, dep_list **after)
         } \
     } while (0)
 
+/**
+ * Match the entries of two listings by their file names.
+ *
+ * This is the first step of the diff calculation. It performs something
+ * like a set intersection: all the entries which are present in both
+ * listings under the same name are marked with DL_COMMON.
+ *
+ * The name index is reused later for overwrites detection, so the
+ * matched entries are not dropped from it.
+ *
+ * @param[in,out] before The previous contents of the directory.
+ * @param[in,out] after  The current contents of the directory.
+ * @param[in]     names  A name index over `after'.
+ * @param[out]    pairs  If not NULL, receives the index of the matching
+ *     entry in `after' for every entry of `before', or -1.
+ **/
+static void
+dl_detect_common (dl_array *before,
+                  dl_array *after,
+                  dl_index *names,
+                  gssize   *pairs)
+{
+    gsize i;
+
+    for (i = 0; i < before->n; i++) {
+        gssize j = dl_index_lookup (names,
+                                    after,
+                                    before->items[i]->path,
+                                    DL_COMMON,
+                                    FALSE,
+                                    NULL);
+        if (j != -1) {
+            before->state[i] |= DL_COMMON;
+            after->state[j] |= DL_COMMON;
+        }
+        if (pairs != NULL) {
+            pairs[i] = j;
+        }
+    }
+}
+
 /**
  * Detect and notify about moves in the watched directory.
  *
@@ -342,29 +729,55 @@ dl_diff (dep_list **before, dep_list **after)
  * a new name is unique, i.e. you didnt overwrite any existing files
  * with this one.
  *
- * @param[in,out] removed  A list of the removed files in the directory.
- * @param[in,out] added    A list of the added files of the directory.
+ * Removed files (not marked with DL_COMMON in `before') are matched with
+ * the added files (not marked with DL_COMMON in `after') by the inode
+ * number.
+ *
+ * @param[in,out] before   The previous contents of the directory.
+ * @param[in,out] after    The current contents of the directory.
  * @param[in]     cbs      A pointer to #traverse_cbs, an user-defined set of 
  *     traverse callbacks.
  * @param[in]     udata    A pointer to the user-defined data.
  * @return 0 if no files were renamed, >0 otherwise.
 **/
 static int
-dl_detect_moves (dep_list           **removed, 
-                 dep_list           **added, 
-                 const traverse_cbs  *cbs, 
-                 void                *udata)
+dl_detect_moves (dl_array           *before,
+                 dl_array           *after,
+                 const traverse_cbs *cbs,
+                 void               *udata)
 {
     assert (cbs != NULL);
 
-     EXCLUDE_SIMILAR
-        (removed, added,
-         (removed_iter->inode == added_iter->inode),
-         {
-             cb_invoke (cbs, moved, udata,
-                        removed_iter->path, removed_iter->inode,
-                        added_iter->path, added_iter->inode);
-         });
+    const guint8 busy = DL_COMMON | DL_MOVED;
+    int productive = 0;
+    dl_index inodes;
+    gsize i;
+
+    dl_index_init (&inodes, after, DL_KEY_INODE, busy);
+
+    for (i = 0; i < before->n; i++) {
+        const dep_list *removed = before->items[i];
+        gssize j;
+
+        if (before->state[i] & busy) {
+            continue;
+        }
+
+        j = dl_index_lookup (&inodes, after, &removed->inode, busy, TRUE, NULL);
+        if (j != -1) {
+            const dep_list *added = after->items[j];
+
+            ++productive;
+            before->state[i] |= DL_MOVED;
+            after->state[j] |= DL_MOVED;
+            cb_invoke (cbs, moved, udata,
+                       removed->path, removed->inode,
+                       added->path, added->inode);
+        }
+    }
+
+    dl_index_free (&inodes);
+    return productive;
 }
 
 /**
@@ -383,29 +796,63 @@ dl_detect_moves (dep_list           **removed,
  * i.e. when you replace a file in a watched directory with another file
  * from the same directory.
  *
- * @param[in,out] removed  A list of the removed files in the directory.
- * @param[in,out] current  A list with the current contents of the directory.
+ * Removed files which were not moved are matched by the inode number with
+ * the whole current contents of the directory.
+ *
+ * @param[in,out] before   The previous contents of the directory.
+ * @param[in,out] after    The current contents of the directory.
  * @param[in]     cbs      A pointer to #traverse_cbs, an user-defined set of 
  *     traverse callbacks.
  * @param[in]     udata    A pointer to the user-defined data.
  * @return 0 if no files were renamed, >0 otherwise.
  **/
 static int
-dl_detect_replacements (dep_list           **removed,
-                        dep_list           **current,
-                        const traverse_cbs  *cbs,
-                        void                *udata)
+dl_detect_replacements (dl_array           *before,
+                        dl_array           *after,
+                        const traverse_cbs *cbs,
+                        void               *udata)
 {
     assert (cbs != NULL);
 
-    EXCLUDE_SIMILAR
-        (removed, current,
-         (removed_iter->inode == current_iter->inode),
-         {
+    const guint8 removed_mask = DL_COMMON | DL_MOVED;
+    int productive = 0;
+    gboolean have_removed = FALSE;
+    dl_index inodes;
+    gsize i;
+
+    for (i = 0; i < before->n && !have_removed; i++) {
+        have_removed = !(before->state[i] & removed_mask);
+    }
+
+    if (!have_removed) {
+        return 0;
+    }
+
+    dl_index_init (&inodes, after, DL_KEY_INODE, DL_REPLACED);
+
+    for (i = 0; i < before->n; i++) {
+        const dep_list *removed = before->items[i];
+        gssize j;
+
+        if (before->state[i] & removed_mask) {
+            continue;
+        }
+
+        j = dl_index_lookup (&inodes, after, &removed->inode, DL_REPLACED, TRUE, NULL);
+        if (j != -1) {
+            const dep_list *current = after->items[j];
+
+            ++productive;
+            before->state[i] |= DL_REPLACED;
+            after->state[j] |= DL_REPLACED;
             cb_invoke (cbs, replaced, udata,
-                        removed_iter->path, removed_iter->inode,
-                        current_iter->path, current_iter->inode);
-         });
+                       removed->path, removed->inode,
+                       current->path, current->inode);
+        }
+    }
+
+    dl_index_free (&inodes);
+    return productive;
 }
 
 /**
@@ -428,47 +875,186 @@ dl_detect_replacements (dep_list           **removed,
  * i.e. when you overwrite a file in a watched directory with another file
  * from the another directory.
  *
- * @param[in,out] previous A list with the previous contents of the directory.
- * @param[in,out] current  A list with the current contents of the directory.
+ * The whole previous contents of the directory is matched by the file name
+ * with the current contents, except the files already used as replacements.
+ *
+ * @param[in]     before   The previous contents of the directory.
+ * @param[in,out] after    The current contents of the directory.
+ * @param[in]     names    A name index over `after'.
  * @param[in]     cbs      A pointer to #traverse_cbs, an user-defined set of 
  *     traverse callbacks.
  * @param[in]     udata    A pointer to the user-defined data.
  * @return 0 if no files were renamed, >0 otherwise.
  **/
 static int
-dl_detect_overwrites (dep_list           **previous,
-                      dep_list           **current,
-                      const traverse_cbs  *cbs,
-                      void                *udata)
+dl_detect_overwrites (const dl_array     *before,
+                      dl_array           *after,
+                      dl_index           *names,
+                      const traverse_cbs *cbs,
+                      void               *udata)
 {
     assert (cbs != NULL);
 
-    EXCLUDE_SIMILAR
-        (previous, current,
-         (strcmp (previous_iter->path, current_iter->path) == 0
-          && previous_iter->inode != current_iter->inode),
-         {
-             cb_invoke (cbs, overwritten, udata, current_iter->path, current_iter->inode);
-         });
+    const guint8 busy = DL_REPLACED | DL_OVERWRITTEN;
+    int productive = 0;
+    gsize i;
+
+    for (i = 0; i < before->n; i++) {
+        const dep_list *previous = before->items[i];
+        gssize j = dl_index_lookup (names,
+                                    after,
+                                    previous->path,
+                                    busy,
+                                    TRUE,
+                                    &previous->inode);
+        if (j != -1) {
+            const dep_list *current = after->items[j];
+
+            ++productive;
+            after->state[j] |= DL_OVERWRITTEN;
+            cb_invoke (cbs, overwritten, udata, current->path, current->inode);
+        }
+    }
+
+    return productive;
 }
 
+/**
+ * Compare the metadata of two snapshots of the same entry.
+ *
+ * The times of a subdirectory move whenever its own entries change,
+ * which is not a change of the subdirectory as seen from here, so
+ * subdirectories are never reported.
+ *
+ * @return Non-zero if both have metadata and it differs.
+ **/
+static int
+dl_meta_changed (const dl_meta *was, const dl_meta *now)
+{
+    return was->valid && now->valid
+        && !was->is_dir && !now->is_dir
+        && (was->size != now->size
+            || was->mtime != now->mtime
+            || was->mtime_nsec != now->mtime_nsec
+            || was->ctime != now->ctime
+            || was->ctime_nsec != now->ctime_nsec);
+}
 
 /**
- * Traverse a list and invoke a callback for each item.
+ * Detect and notify about changes of the files in the watched directory.
+ *
+ * An entry is changed if it is present in both listings under the same
+ * name and with the same inode number, but its size, modification or
+ * change time differ. Subdirectories are skipped. Works only for the
+ * listings made with DL_LISTING_META.
+ *
+ * @param[in] before The previous contents of the directory.
+ * @param[in] after  The current contents of the directory.
+ * @param[in] pairs  Matching entries, as found by dl_detect_common().
+ * @param[in] cbs    A pointer to #traverse_cbs, an user-defined set of 
+ *     traverse callbacks.
+ * @param[in] udata  A pointer to the user-defined data.
+ * @return 0 if no files were changed, >0 otherwise.
+ **/
+static int
+dl_detect_changes (const dl_array     *before,
+                   const dl_array     *after,
+                   const gssize       *pairs,
+                   const traverse_cbs *cbs,
+                   void               *udata)
+{
+    assert (cbs != NULL);
+
+    int productive = 0;
+    gsize i;
+
+    for (i = 0; i < before->n; i++) {
+        const dep_list *was = before->items[i];
+        const dep_list *now = NULL;
+
+        if (pairs[i] == -1
+            || (after->state[pairs[i]] & (DL_OVERWRITTEN | DL_REPLACED))) {
+            continue;
+        }
+
+        now = after->items[pairs[i]];
+        if (was->inode == now->inode && dl_meta_changed (&was->meta, &now->meta)) {
+            ++productive;
+            cb_invoke (cbs, changed, udata, now->path, now->inode);
+        }
+    }
+
+    return productive;
+}
+
+
+/**
+ * Traverse an array and invoke a callback for each item without
+ * any of the specified state bits.
  * 
- * @param[in] list  A #dep_list.
+ * @param[in] arr   A pointer to #dl_array.
+ * @param[in] mask  State bits of the entries to skip.
  * @param[in] cb    A #single_entry_cb callback function.
  * @param[in] udata A pointer to the user-defined data.
  **/
 static void 
-dl_emit_single_cb_on (dep_list        *list,
+dl_emit_single_cb_on (const dl_array  *arr,
+                      guint8           mask,
                       single_entry_cb  cb,
                       void            *udata)
 {
-    while (cb && list != NULL) {
-        (cb) (udata, list->path, list->inode);
-        list = list->next;
+    gsize i;
+
+    for (i = 0; cb && i < arr->n; i++) {
+        if (!(arr->state[i] & mask)) {
+            (cb) (udata, arr->items[i]->path, arr->items[i]->inode);
+        }
+    }
+}
+
+/**
+ * Invoke a #list_cb callback on the items without any of the specified
+ * state bits.
+ *
+ * A temporary shallow list is built for the callback.
+ *
+ * @param[in] arr   A pointer to #dl_array.
+ * @param[in] mask  State bits of the entries to skip.
+ * @param[in] cb    A #list_cb callback function. May be NULL.
+ * @param[in] udata A pointer to the user-defined data.
+ **/
+static void
+dl_emit_list_cb_on (const dl_array *arr,
+                    guint8          mask,
+                    list_cb         cb,
+                    void           *udata)
+{
+    if (cb == NULL) {
+        return;
+    }
+
+    dep_list *nodes = g_new0 (dep_list, arr->n > 0 ? arr->n : 1);
+    dep_list *head = NULL;
+    dep_list *prev = NULL;
+    gsize i, n = 0;
+
+    for (i = 0; i < arr->n; i++) {
+        if (!(arr->state[i] & mask)) {
+            dep_list *node = &nodes[n++];
+            node->path = arr->items[i]->path;
+            node->inode = arr->items[i]->inode;
+            node->meta = arr->items[i]->meta;
+            if (prev) {
+                prev->next = node;
+            } else {
+                head = node;
+            }
+            prev = node;
+        }
     }
+
+    (cb) (udata, head);
+    g_free (nodes);
 }
 
 
@@ -477,6 +1063,11 @@ dl_emit_single_cb_on (dep_list        *list,
  *
  * This is the core function of directory diffing submodule.
  *
+ * Entries are matched through hash indices on file names and inode
+ * numbers, so the whole calculation takes a linear time of the listings
+ * size. The callbacks are invoked in the same order the plain pairwise
+ * comparison would produce them.
+ *
  * @param[in] before The previous contents of the directory.
  * @param[in] after  The current contents of the directory.
  * @param[in] cbs    A pointer to user callbacks (#traverse_callbacks).
@@ -491,31 +1082,40 @@ dl_calculate (dep_list           *before,
     assert (cbs != NULL);
 
     int need_update = 0;
+    dl_array was, now;
+    dl_index names;
+    gssize *pairs = NULL;
 
-    dep_list *was = dl_shallow_copy (before);
-    dep_list *pre = dl_shallow_copy (before);
-    dep_list *now = dl_shallow_copy (after);
-    dep_list *lst = dl_shallow_copy (after);
+    dl_array_init (&was, before);
+    dl_array_init (&now, after);
+    dl_index_init (&names, &now, DL_KEY_NAME, 0);
+
+    if (cbs->changed) {
+        pairs = g_new (gssize, was.n > 0 ? was.n : 1);
+    }
 
-    dl_diff (&was, &now); 
+    dl_detect_common (&was, &now, &names, pairs);
 
     need_update += dl_detect_moves (&was, &now, cbs, udata);
-    need_update += dl_detect_replacements (&was, &lst, cbs, udata);
-    dl_detect_overwrites (&pre, &lst, cbs, udata);
+    need_update += dl_detect_replacements (&was, &now, cbs, udata);
+    dl_detect_overwrites (&was, &now, &names, cbs, udata);
+
+    if (pairs != NULL) {
+        dl_detect_changes (&was, &now, pairs, cbs, udata);
+        g_free (pairs);
+    }
  
     if (need_update) {
         cb_invoke (cbs, names_updated, udata);
     }
 
-    dl_emit_single_cb_on (was, cbs->removed, udata);
-    dl_emit_single_cb_on (now, cbs->added, udata);
+    dl_emit_single_cb_on (&was, DL_COMMON | DL_MOVED | DL_REPLACED, cbs->removed, udata);
+    dl_emit_single_cb_on (&now, DL_COMMON | DL_MOVED, cbs->added, udata);
 
-    cb_invoke (cbs, many_added, udata, now);
-    cb_invoke (cbs, many_removed, udata, was);
-    
-    dl_shallow_free (lst);
-    dl_shallow_free (now);
-    dl_shallow_free (pre);
-    dl_shallow_free (was);
-}
+    dl_emit_list_cb_on (&now, DL_COMMON | DL_MOVED, cbs->many_added, udata);
+    dl_emit_list_cb_on (&was, DL_COMMON | DL_MOVED | DL_REPLACED, cbs->many_removed, udata);
 
+    dl_index_free (&names);
+    dl_array_free (&now);
+    dl_array_free (&was);
+}
@@ -23,15 +23,38 @@
 #ifndef __DEP_LIST_H__
 #define __DEP_LIST_H__
 
-#include <sys/types.h> /* ino_t */
+#include <sys/types.h> /* ino_t, off_t */
+#include <time.h>      /* time_t */
+
+/**
+ * Metadata of a directory entry.
+ *
+ * Only recorded in the listings made with DL_LISTING_META, `valid' is
+ * zero otherwise (or if the entry vanished before it could be examined).
+ **/
+typedef struct dl_meta {
+    off_t  size;
+    time_t mtime;
+    long   mtime_nsec;
+    time_t ctime;
+    long   ctime_nsec;
+    int    is_dir;
+    int    valid;
+} dl_meta;
 
 typedef struct dep_list {
     struct dep_list *next;
 
     char *path;
     ino_t inode;
+    dl_meta meta;
 } dep_list;
 
+/* Flags for dl_listing_full() */
+enum {
+    DL_LISTING_META = 1 << 0 /* record the metadata of each entry */
+};
+
 typedef void (* no_entry_cb)     (void *udata);
 typedef void (* single_entry_cb) (void *udata, const char *path, ino_t inode);
 typedef void (* dual_entry_cb)   (void *udata,
@@ -49,15 +72,18 @@ typedef struct traverse_cbs {
     list_cb          many_added;
     list_cb          many_removed;
     no_entry_cb      names_updated;
+    single_entry_cb  changed;
 } traverse_cbs;
 
-dep_list* dl_create       (char *path, ino_t inode);
+dep_list* dl_append       (dep_list *dl, const char *path, ino_t inode);
 void      dl_print        (const dep_list *dl);
 dep_list* dl_shallow_copy (const dep_list *dl);
 void      dl_shallow_free (dep_list *dl);
 void      dl_free         (dep_list *dl);
-dep_list* dl_listing      (const char *path);
-void      dl_diff         (dep_list **before, dep_list **after);
+dep_list* dl_listing      (const char *path, const dep_list *previous);
+dep_list* dl_listing_full (const char     *path,
+                           const dep_list *previous,
+                           int             flags);
 
 void
 dl_calculate (dep_list            *before,
@@ -141,6 +141,10 @@ g_kqueue_directory_monitor_constructor (GType                 type,
   g_assert (sub != NULL);
   kqueue_monitor->sub = sub;
 
+  /* Reporting in-place changes of the children costs a stat call per
+   * entry on every rescan, so it has to be asked for */
+  sub->child_changes = g_getenv ("GIO_KQUEUE_CHILD_CHANGES") != NULL;
+
   if (!_ke_is_excluded (path))
     _kh_add_sub (sub);
   else
@@ -163,6 +167,14 @@ g_kqueue_directory_monitor_is_supported (void)
   return _kh_startup ();
 }
 
+static void
+g_kqueue_directory_monitor_get_statistics (GFileMonitor    *monitor,
+                                            GVariantBuilder *builder)
+{
+  G_FILE_MONITOR_CLASS (g_kqueue_directory_monitor_parent_class)->get_statistics (monitor, builder);
+  _kh_get_statistics (builder);
+}
+
 static void
 g_kqueue_directory_monitor_class_init (GKqueueDirectoryMonitorClass *klass)
 {
@@ -173,6 +185,7 @@ g_kqueue_directory_monitor_class_init (GKqueueDirectoryMonitorClass *klass)
   gobject_class->finalize = g_kqueue_directory_monitor_finalize;
   gobject_class->constructor = g_kqueue_directory_monitor_constructor;
   directory_monitor_class->cancel = g_kqueue_directory_monitor_cancel;
+  directory_monitor_class->get_statistics = g_kqueue_directory_monitor_get_statistics;
 
   local_directory_monitor_class->mount_notify = TRUE; /* TODO: ??? */
   local_directory_monitor_class->is_supported = g_kqueue_directory_monitor_is_supported;
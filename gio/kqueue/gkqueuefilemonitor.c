@@ -169,6 +169,14 @@ g_kqueue_file_monitor_is_supported (void)
   return _kh_startup ();
 }
 
+static void
+g_kqueue_file_monitor_get_statistics (GFileMonitor    *monitor,
+                                       GVariantBuilder *builder)
+{
+  G_FILE_MONITOR_CLASS (g_kqueue_file_monitor_parent_class)->get_statistics (monitor, builder);
+  _kh_get_statistics (builder);
+}
+
 static void
 g_kqueue_file_monitor_class_init (GKqueueFileMonitorClass *klass)
 {
@@ -179,6 +187,7 @@ g_kqueue_file_monitor_class_init (GKqueueFileMonitorClass *klass)
   gobject_class->finalize = g_kqueue_file_monitor_finalize;
   gobject_class->constructor = g_kqueue_file_monitor_constructor;
   file_monitor_class->cancel = g_kqueue_file_monitor_cancel;
+  file_monitor_class->get_statistics = g_kqueue_file_monitor_get_statistics;
 
   local_file_monitor_class->is_supported = g_kqueue_file_monitor_is_supported;
 }
@@ -0,0 +1,108 @@
+/*******************************************************************************
+  Copyright (c) 2011, 2012 Dmitry Matveev <me@dmitrymatveev.co.uk>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include "config.h"
+
+#include "gkqueuetreemonitor.h"
+#include "kqueue-helper.h"
+#include "kqueue-exclusions.h"
+#include <gio/giomodule.h>
+
+/* Every directory of a tree is a kqueue_sub of its own, with the tree
+ * monitor as the user data. The directory contents are diffed by the
+ * helper as usual. Excluded directories are left out of the tree. */
+
+struct _GKqueueTreeMonitor
+{
+  GLocalTreeMonitor parent_instance;
+};
+
+#define g_kqueue_tree_monitor_get_type _g_kqueue_tree_monitor_get_type
+G_DEFINE_TYPE_WITH_CODE (GKqueueTreeMonitor, g_kqueue_tree_monitor, G_TYPE_LOCAL_TREE_MONITOR,
+                         g_io_extension_point_implement (G_LOCAL_TREE_MONITOR_EXTENSION_POINT_NAME,
+                                                         g_define_type_id,
+                                                         "kqueue",
+                                                         20))
+
+static gpointer
+g_kqueue_tree_monitor_watch_dir (GLocalTreeMonitor *tree,
+                                 const gchar       *dirname,
+                                 gboolean           is_root)
+{
+  kqueue_sub *sub;
+  gboolean pair_moves;
+
+  if (_ke_is_excluded (dirname))
+    return NULL;
+
+  pair_moves = (tree->flags & G_FILE_MONITOR_SEND_MOVED) ? TRUE : FALSE;
+
+  sub = _kh_sub_new (dirname, pair_moves, tree);
+  g_assert (sub != NULL);
+  sub->children_only = !is_root;
+
+  _kh_add_sub (sub);
+
+  return sub;
+}
+
+static void
+g_kqueue_tree_monitor_unwatch_dir (GLocalTreeMonitor *tree,
+                                   gpointer           watch)
+{
+  kqueue_sub *sub = watch;
+
+  _kh_cancel_sub (sub);
+  _kh_sub_free (sub);
+}
+
+static gboolean
+g_kqueue_tree_monitor_is_supported (void)
+{
+  return _kh_startup ();
+}
+
+static void
+g_kqueue_tree_monitor_get_statistics (GFileMonitor    *monitor,
+                                      GVariantBuilder *builder)
+{
+  G_FILE_MONITOR_CLASS (g_kqueue_tree_monitor_parent_class)->get_statistics (monitor, builder);
+  _kh_get_statistics (builder);
+}
+
+static void
+g_kqueue_tree_monitor_class_init (GKqueueTreeMonitorClass *klass)
+{
+  GFileMonitorClass *file_monitor_class = G_FILE_MONITOR_CLASS (klass);
+  GLocalTreeMonitorClass *local_tree_monitor_class = G_LOCAL_TREE_MONITOR_CLASS (klass);
+
+  file_monitor_class->get_statistics = g_kqueue_tree_monitor_get_statistics;
+
+  local_tree_monitor_class->is_supported = g_kqueue_tree_monitor_is_supported;
+  local_tree_monitor_class->watch_dir = g_kqueue_tree_monitor_watch_dir;
+  local_tree_monitor_class->unwatch_dir = g_kqueue_tree_monitor_unwatch_dir;
+}
+
+static void
+g_kqueue_tree_monitor_init (GKqueueTreeMonitor *monitor)
+{
+}
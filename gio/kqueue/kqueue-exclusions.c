@@ -20,30 +20,170 @@
   THE SOFTWARE.
 *******************************************************************************/
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "kqueue-exclusions.h"
 
 static gboolean ke_debug_enabled = TRUE;
 #define KE_W if (ke_debug_enabled) g_warning
 
-static GSList *exclude_list = NULL;
-G_GNUC_INTERNAL G_LOCK_DEFINE (exclude_list_lock);
-
 #define CFG_FILE "gio-kqueue.conf"
 
+/* How often (in seconds) the configuration files are checked
+ * for modifications */
+#define KE_CHECK_INTERVAL 1
+
+/* The glob trie lookups don't allocate for tables up to this size */
+#define KE_ACTIVE_MAX 64
+
+/**
+ * ke_node:
+ * @c: the byte on the edge leading to this node
+ * @terminal: %TRUE if an exclusion ends at this node
+ * @child: the index of the first child, 0 if none
+ * @sibling: the index of the next sibling, 0 if none
+ *
+ * A node of the prefix trie. Node 0 is the root.
+ */
+typedef struct {
+  gchar c;
+  gboolean terminal;
+  guint child;
+  guint sibling;
+} ke_node;
+
+/**
+ * ke_glob_edge:
+ * @text: a path component with wildcards
+ * @spec: @text, compiled
+ * @child: the index of the node this edge leads to
+ *
+ * An edge of the glob trie, taken by the path components matching @spec.
+ */
+typedef struct {
+  gchar *text;
+  GPatternSpec *spec;
+  guint child;
+} ke_glob_edge;
+
+/**
+ * ke_glob_node:
+ * @literals: maps a path component to the index of a child node,
+ *     %NULL if there are no such children
+ * @edges: a #GSList of #ke_glob_edge
+ * @terminal: %TRUE if a glob exclusion ends at this node
+ *
+ * A node of the glob trie. Glob exclusions are split into path components,
+ * so a wildcard never matches a '/'. Node 0 is the root for the absolute
+ * patterns, node 1 is the root for the relative ones, which can match
+ * starting from any component of a path.
+ */
+typedef struct {
+  GHashTable *literals;
+  GSList *edges;
+  gboolean terminal;
+} ke_glob_node;
+
+#define KE_GLOB_ROOT     0
+#define KE_GLOB_FLOATING 1
+
 /**
- * _ke_free:
- * @list - a pointer to a single-linked list.
+ * ke_table:
+ * @nodes: the prefix trie nodes
+ * @n_nodes: the number of prefix trie nodes
+ * @globs: the glob trie nodes
+ * @n_globs: the number of glob trie nodes
  *
- * Frees the memory allocated for the exclusion list, including the
- * memory for the string items.
+ * A compiled set of exclusions. Never modified once published.
+ */
+typedef struct {
+  ke_node *nodes;
+  guint n_nodes;
+  ke_glob_node *globs;
+  guint n_globs;
+} ke_table;
+
+/**
+ * ke_stamp:
+ * @exists: %TRUE if the file existed when the table was built
+ * @ino: the inode number
+ * @size: the file size
+ * @mtime: the last modification time
+ *
+ * Identifies a version of a configuration file.
+ */
+typedef struct {
+  gboolean exists;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+} ke_stamp;
+
+/* The published table. Readers don't take any locks: they announce
+ * themselves in table_readers, and a replaced table is only freed once
+ * nobody is reading. */
+static ke_table * volatile current_table = NULL;
+static volatile gint table_readers = 0;
+
+/* Replaced tables, waiting to be freed. Protected by rebuild_lock */
+static GSList *retired_tables = NULL;
+G_GNUC_INTERNAL G_LOCK_DEFINE (rebuild_lock);
+
+static ke_stamp local_stamp;
+static ke_stamp system_stamp;
+/* Monotonic time of the last check, in seconds. 0 means never */
+static volatile gint last_check = 0;
+
+
+/**
+ * _ke_now:
+ *
+ * Returns: the monotonic time in seconds, never 0.
+ **/
+static gint
+_ke_now ()
+{
+  return (gint) (g_get_monotonic_time () / G_USEC_PER_SEC) + 1;
+}
+
+/**
+ * _ke_table_free:
+ * @table: a #ke_table
+ *
+ * Frees the memory allocated for the exclusion table, including the
+ * compiled patterns.
  **/
 static void
-_ke_free (GSList *list)
+_ke_table_free (ke_table *table)
 {
-  g_assert (list != NULL);
-  g_slist_free_full (list, g_free);
+  guint i;
+
+  g_assert (table != NULL);
+
+  for (i = 0; i < table->n_globs; i++)
+    {
+      ke_glob_node *node = &table->globs[i];
+      GSList *head = NULL;
+
+      if (node->literals != NULL)
+        g_hash_table_destroy (node->literals);
+
+      for (head = node->edges; head != NULL; head = head->next)
+        {
+          ke_glob_edge *edge = head->data;
+          g_pattern_spec_free (edge->spec);
+          g_free (edge->text);
+          g_slice_free (ke_glob_edge, edge);
+        }
+      g_slist_free (node->edges);
+    }
+
+  g_free (table->nodes);
+  g_free (table->globs);
+  g_free (table);
 }
 
 /**
@@ -55,7 +195,7 @@ _ke_free (GSList *list)
 static gchar*
 _ke_system_config ()
 {
-  return strdup ("/etc/" CFG_FILE);
+  return g_strdup ("/etc/" CFG_FILE);
 }
 
 /**
@@ -70,75 +210,450 @@ _ke_local_config ()
   return g_build_filename (g_get_user_config_dir (), CFG_FILE, NULL); 
 }
 
+/**
+ * _ke_stamp:
+ * @stamp: a #ke_stamp to fill
+ * @cfg_path: a path to a configuration file
+ *
+ * Takes a stamp of the configuration file.
+ **/
+static void
+_ke_stamp (ke_stamp *stamp, const gchar *cfg_path)
+{
+  struct stat st;
+
+  memset (stamp, 0, sizeof (ke_stamp));
+  if (g_stat (cfg_path, &st) == 0)
+    {
+      stamp->exists = TRUE;
+      stamp->ino = st.st_ino;
+      stamp->size = st.st_size;
+      stamp->mtime = st.st_mtime;
+    }
+}
+
+/**
+ * _ke_insert_prefix:
+ * @nodes: a #GArray of #ke_node
+ * @entry: an exclusion
+ *
+ * Adds a plain exclusion to the prefix trie under construction.
+ **/
+static void
+_ke_insert_prefix (GArray *nodes, const gchar *entry)
+{
+  const gchar *p = NULL;
+  guint node = 0;
+
+  for (p = entry; *p != '\0'; p++)
+    {
+      guint next = g_array_index (nodes, ke_node, node).child;
+
+      while (next != 0 && g_array_index (nodes, ke_node, next).c != *p)
+        next = g_array_index (nodes, ke_node, next).sibling;
+
+      if (next == 0)
+        {
+          ke_node n;
+
+          memset (&n, 0, sizeof (ke_node));
+          n.c = *p;
+          n.sibling = g_array_index (nodes, ke_node, node).child;
+          next = nodes->len;
+          g_array_append_val (nodes, n);
+          g_array_index (nodes, ke_node, node).child = next;
+        }
+
+      node = next;
+    }
+
+  g_array_index (nodes, ke_node, node).terminal = TRUE;
+}
+
+/**
+ * _ke_glob_child:
+ * @globs: a #GArray of #ke_glob_node
+ * @node: the index of a parent node
+ * @component: a path component
+ *
+ * Finds or creates a child of a glob trie node.
+ *
+ * Returns: the index of the child node.
+ **/
+static guint
+_ke_glob_child (GArray *globs, guint node, const gchar *component)
+{
+  ke_glob_node *parent = &g_array_index (globs, ke_glob_node, node);
+  ke_glob_node child;
+  guint index = globs->len;
+
+  if (strpbrk (component, "*?") != NULL)
+    {
+      ke_glob_edge *edge = NULL;
+      GSList *head = NULL;
+
+      for (head = parent->edges; head != NULL; head = head->next)
+        if (strcmp (((ke_glob_edge *) head->data)->text, component) == 0)
+          return ((ke_glob_edge *) head->data)->child;
+
+      edge = g_slice_new (ke_glob_edge);
+      edge->text = g_strdup (component);
+      edge->spec = g_pattern_spec_new (component);
+      edge->child = index;
+      parent->edges = g_slist_prepend (parent->edges, edge);
+    }
+  else
+    {
+      gpointer found = NULL;
+
+      if (parent->literals == NULL)
+        parent->literals = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      else if ((found = g_hash_table_lookup (parent->literals, component)) != NULL)
+        return GPOINTER_TO_UINT (found);
+
+      g_hash_table_insert (parent->literals, g_strdup (component), GUINT_TO_POINTER (index));
+    }
+
+  /* Appending may move the parent, so it is done last */
+  memset (&child, 0, sizeof (ke_glob_node));
+  g_array_append_val (globs, child);
+  return index;
+}
+
+/**
+ * _ke_insert_glob:
+ * @globs: a #GArray of #ke_glob_node
+ * @entry: an exclusion with wildcards
+ *
+ * Adds a glob exclusion to the glob trie under construction.
+ **/
+static void
+_ke_insert_glob (GArray *globs, const gchar *entry)
+{
+  gchar **components = NULL;
+  guint node = (entry[0] == '/') ? KE_GLOB_ROOT : KE_GLOB_FLOATING;
+  guint i;
+
+  components = g_strsplit (entry, "/", -1);
+  for (i = 0; components[i] != NULL; i++)
+    if (components[i][0] != '\0')
+      node = _ke_glob_child (globs, node, components[i]);
+  g_strfreev (components);
+
+  g_array_index (globs, ke_glob_node, node).terminal = TRUE;
+}
+
 /**
  * _ke_fill:
- * @list - a pointer to a pointer to a list.
- * @cfg_path - a path to a file to read the lines from.
+ * @nodes: a #GArray of #ke_node
+ * @globs: a #GArray of #ke_glob_node
+ * @cfg_path: a path to a file to read the lines from.
  *
- * Reads the specified file and prepends its non-empty lines
- * to the list. List head pointer will be changed.
+ * Reads the specified file and adds its non-empty lines to the tries.
+ *
+ * A line is a plain prefix of the paths to exclude, unless it contains
+ * '*' or '?' wildcards. Such a line is a glob pattern, matched against
+ * whole path components; it excludes the matching paths and everything
+ * below them. A pattern which doesn't start with '/' can match starting
+ * from any component, e.g. "*.git" excludes all the Git directories.
  **/
 static void
-_ke_fill (GSList **list, const gchar *cfg_path)
+_ke_fill (GArray *nodes, GArray *globs, const gchar *cfg_path)
 {
-  g_assert (list != NULL);
-  g_assert (cfg_path != NULL);
+  gchar *contents = NULL;
+  gchar **lines = NULL;
+  GError *error = NULL;
+  guint i;
 
-  GIOChannel *ch = NULL;
-  gchar *line = NULL;
-  gsize len = 0;
-  gsize term = 0;
-  GIOStatus st = G_IO_STATUS_NORMAL;
- 
-  ch = g_io_channel_new_file (cfg_path, "r", NULL);
+  g_assert (nodes != NULL);
+  g_assert (globs != NULL);
+  g_assert (cfg_path != NULL);
 
-  if (ch == NULL) 
+  if (!g_file_get_contents (cfg_path, &contents, NULL, &error))
     {
-      KE_W ("Failed to open config file %s\n", cfg_path);
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        KE_W ("Failed to read config file %s: %s\n", cfg_path, error->message);
+      g_error_free (error);
       return;
     }
 
-  do
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
     {
-      st = g_io_channel_read_line (ch, &line, &len, &term, NULL);
-      if (line != NULL && len > 0 && term > 0)
-        {
-          line[term] = '\0';
-          *list = g_slist_prepend (*list, line);
-        }
+      gsize len = strlen (lines[i]);
+
+      if (len > 0 && lines[i][len - 1] == '\r')
+        lines[i][--len] = '\0';
+      if (len == 0)
+        continue;
+
+      if (strpbrk (lines[i], "*?") != NULL)
+        _ke_insert_glob (globs, lines[i]);
+      else
+        _ke_insert_prefix (nodes, lines[i]);
     }
-  while (st != G_IO_STATUS_EOF);
 
-  g_io_channel_shutdown (ch, FALSE, NULL);
-  g_io_channel_unref (ch);
+  g_strfreev (lines);
+  g_free (contents);
 }
 
 /**
  * ke_rebuild:
  *
  * Reads the configuration files again and rebuilds the exclusion list.
+ *
+ * The new table replaces the current one atomically, lookups running
+ * concurrently see either the old or the new set of exclusions.
  **/
 void
 _ke_rebuild ()
 {
   gchar *local_cfg_path  = NULL;  
   gchar *system_cfg_path = NULL; 
+  ke_table *table = NULL;
+  ke_table *old = NULL;
+  GArray *nodes = NULL;
+  GArray *globs = NULL;
+  ke_node root;
+  ke_glob_node glob_root;
 
-  G_LOCK (exclude_list_lock);
-
-  if (exclude_list != NULL)
-    _ke_free (exclude_list);
+  G_LOCK (rebuild_lock);
 
   local_cfg_path  = _ke_local_config ();
   system_cfg_path = _ke_system_config ();
 
-  _ke_fill (&exclude_list, local_cfg_path );
-  _ke_fill (&exclude_list, system_cfg_path );
+  _ke_stamp (&local_stamp, local_cfg_path);
+  _ke_stamp (&system_stamp, system_cfg_path);
+
+  memset (&root, 0, sizeof (ke_node));
+  nodes = g_array_new (FALSE, FALSE, sizeof (ke_node));
+  g_array_append_val (nodes, root);
+
+  memset (&glob_root, 0, sizeof (ke_glob_node));
+  globs = g_array_new (FALSE, FALSE, sizeof (ke_glob_node));
+  g_array_append_val (globs, glob_root); /* KE_GLOB_ROOT */
+  g_array_append_val (globs, glob_root); /* KE_GLOB_FLOATING */
+
+  _ke_fill (nodes, globs, local_cfg_path );
+  _ke_fill (nodes, globs, system_cfg_path );
+
+  g_free (local_cfg_path);
+  g_free (system_cfg_path); 
+
+  table = g_new0 (ke_table, 1);
+  table->n_nodes = nodes->len;
+  table->nodes = (ke_node *) g_array_free (nodes, FALSE);
+  table->n_globs = globs->len;
+  table->globs = (ke_glob_node *) g_array_free (globs, FALSE);
+
+  do
+    old = g_atomic_pointer_get (&current_table);
+  while (!g_atomic_pointer_compare_and_exchange ((gpointer *) &current_table, old, table));
+
+  if (old != NULL)
+    retired_tables = g_slist_prepend (retired_tables, old);
+
+  /* A reader which came after the exchange can only see the new table */
+  if (g_atomic_int_get (&table_readers) == 0)
+    {
+      g_slist_free_full (retired_tables, (GDestroyNotify) _ke_table_free);
+      retired_tables = NULL;
+    }
+
+  g_atomic_int_set (&last_check, _ke_now ());
+
+  G_UNLOCK (rebuild_lock);
+}
+
+/**
+ * _ke_check_config:
+ *
+ * Rebuilds the exclusion table if any of the configuration files has
+ * been modified. The files are checked at most once per
+ * KE_CHECK_INTERVAL.
+ **/
+static void
+_ke_check_config ()
+{
+  gint now = _ke_now ();
+  gint last = g_atomic_int_get (&last_check);
+  gchar *local_cfg_path  = NULL;  
+  gchar *system_cfg_path = NULL; 
+  ke_stamp local, system;
+
+  if (last != 0 && now - last < KE_CHECK_INTERVAL)
+    return;
+
+  G_LOCK (rebuild_lock);
 
+  /* Somebody else may have checked in the meantime */
+  last = g_atomic_int_get (&last_check);
+  if (last != 0 && now - last < KE_CHECK_INTERVAL)
+    {
+      G_UNLOCK (rebuild_lock);
+      return;
+    }
+  g_atomic_int_set (&last_check, now);
+
+  local_cfg_path  = _ke_local_config ();
+  system_cfg_path = _ke_system_config ();
+  _ke_stamp (&local, local_cfg_path);
+  _ke_stamp (&system, system_cfg_path);
   g_free (local_cfg_path);
   g_free (system_cfg_path); 
 
-  G_UNLOCK (exclude_list_lock);
+  G_UNLOCK (rebuild_lock);
+
+  if (memcmp (&local, &local_stamp, sizeof (ke_stamp)) != 0 ||
+      memcmp (&system, &system_stamp, sizeof (ke_stamp)) != 0)
+    _ke_rebuild ();
+}
+
+/**
+ * _ke_lookup_prefix:
+ * @table: a #ke_table
+ * @full_path: a path to check
+ *
+ * Walks the prefix trie along @full_path.
+ *
+ * Returns: %TRUE if a plain exclusion is a prefix of @full_path.
+ **/
+static gboolean
+_ke_lookup_prefix (const ke_table *table, const char *full_path)
+{
+  const ke_node *nodes = table->nodes;
+  const char *p = full_path;
+  guint node = 0;
+
+  for (;;)
+    {
+      guint next;
+
+      if (nodes[node].terminal)
+        return TRUE;
+
+      if (*p == '\0')
+        return FALSE;
+
+      for (next = nodes[node].child; next != 0; next = nodes[next].sibling)
+        if (nodes[next].c == *p)
+          break;
+
+      if (next == 0)
+        return FALSE;
+
+      node = next;
+      p++;
+    }
+}
+
+/**
+ * _ke_lookup_globs:
+ * @table: a #ke_table
+ * @full_path: a path to check
+ *
+ * Walks the glob trie along the components of @full_path, following
+ * all the matching edges at once.
+ *
+ * Returns: %TRUE if a glob exclusion matches @full_path or any of its
+ *     parent directories.
+ **/
+static gboolean
+_ke_lookup_globs (const ke_table *table, const char *full_path)
+{
+  const ke_glob_node *globs = table->globs;
+  gboolean floating = (globs[KE_GLOB_FLOATING].literals != NULL ||
+                       globs[KE_GLOB_FLOATING].edges != NULL);
+  gboolean retval = FALSE;
+  guint stack[2][KE_ACTIVE_MAX];
+  guint *active = stack[0];
+  guint *next = stack[1];
+  guint *swap = NULL;
+  guint n_active = 0;
+  gchar buffer[256];
+  const char *p = full_path;
+
+  /* Each node has a single parent, so there are never more active
+   * nodes than nodes */
+  if (table->n_globs > KE_ACTIVE_MAX)
+    {
+      active = g_new (guint, table->n_globs);
+      next = g_new (guint, table->n_globs);
+    }
+
+  active[n_active++] = KE_GLOB_ROOT;
+  if (floating)
+    active[n_active++] = KE_GLOB_FLOATING;
+
+  while (n_active > 0 && !retval)
+    {
+      const char *end = NULL;
+      gchar *component = NULL;
+      guint n_next = 0;
+      guint i;
+      gsize len;
+
+      while (*p == '/')
+        p++;
+      if (*p == '\0')
+        break;
+
+      end = strchr (p, '/');
+      len = end ? (gsize) (end - p) : strlen (p);
+      if (len < sizeof (buffer))
+        {
+          memcpy (buffer, p, len);
+          buffer[len] = '\0';
+          component = buffer;
+        }
+      else
+        component = g_strndup (p, len);
+      p += len;
+
+      for (i = 0; i < n_active; i++)
+        {
+          const ke_glob_node *node = &globs[active[i]];
+          GSList *head = NULL;
+
+          if (node->literals != NULL)
+            {
+              gpointer found = g_hash_table_lookup (node->literals, component);
+              if (found != NULL)
+                next[n_next++] = GPOINTER_TO_UINT (found);
+            }
+
+          for (head = node->edges; head != NULL; head = head->next)
+            {
+              ke_glob_edge *edge = head->data;
+              if (g_pattern_match_string (edge->spec, component))
+                next[n_next++] = edge->child;
+            }
+        }
+
+      if (component != buffer)
+        g_free (component);
+
+      /* A relative pattern may also start at the next component */
+      if (floating)
+        next[n_next++] = KE_GLOB_FLOATING;
+
+      for (i = 0; i < n_next; i++)
+        if (globs[next[i]].terminal)
+          retval = TRUE;
+
+      n_active = n_next;
+      swap = active;
+      active = next;
+      next = swap;
+    }
+
+  if (table->n_globs > KE_ACTIVE_MAX)
+    {
+      g_free (active);
+      g_free (next);
+    }
+
+  return retval;
 }
 
 /**
@@ -147,6 +662,10 @@ _ke_rebuild ()
  *
  * Checks if the file is on an excluded location.
  *
+ * The lookup does not take any locks. It runs in O(path length) for the
+ * plain exclusions, the glob exclusions cost a hash lookup per path
+ * component plus the wildcard components that have to be tried.
+ *
  * Returns: TRUE if the file should be excluded from the kqueue-powered
  *      monitoring, FALSE otherwise.
  **/
@@ -154,21 +673,18 @@ gboolean
 _ke_is_excluded (const char *full_path)
 {
   gboolean retval = FALSE;
-  GSList *head = NULL; 
-  
-  G_LOCK (exclude_list_lock);
-  head = exclude_list;
+  ke_table *table = NULL;
 
-  while (head != NULL)
-    {
-      if (head->data != NULL && g_str_has_prefix (full_path, head->data))
-        {
-          retval = TRUE;
-          break;
-        }
-      head = g_slist_next (head);
-    }
+  g_assert (full_path != NULL);
+
+  _ke_check_config ();
+
+  g_atomic_int_inc (&table_readers);
+  table = g_atomic_pointer_get (&current_table);
+  if (table != NULL)
+    retval = (_ke_lookup_prefix (table, full_path) ||
+              (table->n_globs > 2 && _ke_lookup_globs (table, full_path)));
+  g_atomic_int_add (&table_readers, -1);
 
-  G_UNLOCK (exclude_list_lock);
   return retval;
 }
@@ -22,6 +22,7 @@
 
 #include "config.h"
 #include <sys/types.h>
+#include <sys/param.h>
 #include <sys/event.h>
 #include <sys/time.h>
 #include <sys/socket.h>
@@ -43,6 +44,13 @@
 static gboolean kh_debug_enabled = FALSE;
 #define KH_W if (kh_debug_enabled) g_warning
 
+/* How many notifications are read from the kqueue thread at once */
+#define KH_BATCH_SIZE 512
+
+/* How many reads a single dispatch does at most, so a busy kqueue
+ * thread cannot keep the main loop from running anything else */
+#define KH_MAX_READS_PER_DISPATCH 16
+
 G_GNUC_INTERNAL G_LOCK_DEFINE (kqueue_lock);
 
 static GHashTable *subs_hash_table = NULL;
@@ -62,6 +70,7 @@ void _kh_file_appeared_cb (kqueue_sub *sub);
  *      conversion has been done (out)
  *
  * Translates kqueue filter flags into GIO event flags.
+ * NOTE_RENAME is handled separately, see kh_emit_renamed().
  *
  * Returns: a #GFileMonitorEvent
  **/
@@ -89,11 +98,6 @@ convert_kqueue_events_to_gio (uint32_t flags, gboolean *done)
       *done = TRUE;
       return G_FILE_MONITOR_EVENT_CHANGED;
     }
-  if (flags & NOTE_RENAME)
-    {
-      *done = TRUE;
-      return G_FILE_MONITOR_EVENT_MOVED;
-    }
   if (flags & NOTE_REVOKE)
     {
       *done = TRUE;
@@ -300,6 +304,45 @@ handle_overwritten (void *udata, const char *path, ino_t inode)
   g_object_unref (file);
 }
 
+/**
+ * handle_changed:
+ * @udata: a pointer to user data (#handle_context).
+ * @path: file name of the changed file.
+ * @inode: inode number of the changed file.
+ *
+ * A callback function for the directory diff calculation routine,
+ * produces G_FILE_MONITOR_EVENT_CHANGED event for a file which size
+ * or timestamps differ from the previous directory snapshot.
+ **/
+static void
+handle_changed (void *udata, const char *path, ino_t inode)
+{
+  handle_ctx *ctx = NULL;
+  GFile *file = NULL;
+  gchar *fpath = NULL;
+
+  (void) inode;
+  ctx = (handle_ctx *) udata;
+  g_assert (udata != NULL);
+  g_assert (ctx->sub != NULL);
+  g_assert (ctx->monitor != NULL);
+
+  fpath = _ku_path_concat (ctx->sub->filename, path);
+  if (fpath == NULL)
+    {
+      KH_W ("Failed to allocate a string for a new event");
+      return;
+    }
+
+  file = g_file_new_for_path (fpath);
+  g_file_monitor_emit_event (ctx->monitor,
+                             file,
+                             NULL,
+                             G_FILE_MONITOR_EVENT_CHANGED);
+  g_free (fpath);
+  g_object_unref (file);
+}
+
 static const traverse_cbs cbs = {
   handle_created,
   handle_deleted,
@@ -309,6 +352,7 @@ static const traverse_cbs cbs = {
   NULL, /* many added */
   NULL, /* many removed */
   NULL, /* names updated */
+  handle_changed,
 };
 
 
@@ -326,7 +370,10 @@ _kh_dir_diff (kqueue_sub *sub, GFileMonitor *monitor)
   ctx.monitor = monitor;
 
   was = sub->deps;
-  sub->deps = dl_listing (sub->filename);
+  if (sub->child_changes)
+    sub->deps = dl_listing_full (sub->filename, was, DL_LISTING_META);
+  else
+    sub->deps = dl_listing (sub->filename, was);
  
   dl_calculate (was, sub->deps, &cbs, &ctx);
 
@@ -335,52 +382,155 @@ _kh_dir_diff (kqueue_sub *sub, GFileMonitor *monitor)
 
 
 /**
- * process_kqueue_notifications:
- * @gioc: unused.
- * @cond: unused.
- * @data: unused.
+ * kh_pending:
+ * @fd: the file descriptor of a subscription
+ * @flags: kqueue flags, merged from all the notifications on @fd
+ * @count: the number of raw notifications merged
  *
- * Processes notifications, coming from the kqueue thread.
+ * A notification waiting to be dispatched.
+ */
+typedef struct {
+  int fd;
+  uint32_t flags;
+  guint count;
+} kh_pending;
+
+/* Pending notifications, in the order of arrival. The table maps
+ * a file descriptor to its index in the array. */
+static GArray *pending_array = NULL;
+static GHashTable *pending_table = NULL;
+static guint pending_flush_id = 0;
+
+/* If GIO_KQUEUE_COALESCE_MSECS is set, notifications are collected for
+ * that long before being dispatched, so bursts spread over several reads
+ * are still diffed once. */
+static guint coalesce_msecs = 0;
+
+/* The counters, and the length of pending_array, are also read by
+ * _kh_get_statistics() from any thread */
+static kh_stats stats;
+G_LOCK_DEFINE_STATIC (stats_lock);
+
+/* A read buffer. May keep an incomplete notification between reads. */
+static struct kqueue_notification read_buffer[KH_BATCH_SIZE];
+static gsize read_buffer_used = 0;
+
+
+/**
+ * kh_get_fd_path:
+ * @fd: an open file descriptor
  *
- * Reads notifications from the command file descriptor, emits the
- * "changed" event on the appropriate monitor.
+ * Finds out the current path of an open file, if the system is able
+ * to tell it.
  *
- * A typical GIO Channel callback function.
+ * Returns: a newly allocated path, or %NULL.
+ **/
+static gchar *
+kh_get_fd_path (int fd)
+{
+#ifdef F_GETPATH
+  char buf[MAXPATHLEN];
+
+  if (fcntl (fd, F_GETPATH, buf) != -1)
+    return g_strdup (buf);
+#else
+  (void) fd;
+#endif
+  return NULL;
+}
+
+/**
+ * kh_emit_renamed:
+ * @sub: a #kqueue_sub whose file has been renamed
+ * @monitor: a #GFileMonitor of the subscription
+ * @new_path: the new path of the file, or %NULL if unknown
  *
- * Returns: %TRUE
+ * Reports that the monitored file itself has been renamed. With
+ * G_FILE_MONITOR_SEND_MOVED and a known destination this is a single
+ * G_FILE_MONITOR_EVENT_MOVED event, otherwise the file has just
+ * disappeared from the monitored path.
  **/
-static gboolean
-process_kqueue_notifications (GIOChannel   *gioc,
-                              GIOCondition  cond,
-                              gpointer      data)
+static void
+kh_emit_renamed (kqueue_sub   *sub,
+                 GFileMonitor *monitor,
+                 const gchar  *new_path)
+{
+  GFile *file = NULL;
+  GFile *other = NULL;
+
+  file = g_file_new_for_path (sub->filename);
+
+  if (sub->pair_moves && new_path != NULL)
+    {
+      other = g_file_new_for_path (new_path);
+      g_file_monitor_emit_event (monitor,
+                                 file,
+                                 other,
+                                 G_FILE_MONITOR_EVENT_MOVED);
+      g_object_unref (other);
+    }
+  else
+    {
+      g_file_monitor_emit_event (monitor,
+                                 file,
+                                 NULL,
+                                 G_FILE_MONITOR_EVENT_DELETED);
+    }
+
+  g_object_unref (file);
+}
+
+
+/**
+ * kh_dispatch:
+ * @n: a merged notification
+ *
+ * Emits the "changed" event on the appropriate monitor.
+ **/
+static void
+kh_dispatch (const kh_pending *n)
 {
-  struct kqueue_notification n;
   kqueue_sub *sub = NULL;
   GFileMonitor *monitor = NULL;
   GFileMonitorEvent mask = 0;
-  
-  g_assert (kqueue_socket_pair[0] != -1);
-  if (!_ku_read (kqueue_socket_pair[0], &n, sizeof (struct kqueue_notification)))
-    {
-      KH_W ("Failed to read a kqueue notification, error %d", errno);
-      return TRUE;
-    }
+  uint32_t flags = n->flags;
+  gboolean renamed = FALSE;
+  gchar *new_path = NULL;
+  gint64 diff_start;
+  guint64 diff_time;
 
   G_LOCK (hash_lock);
-  sub = (kqueue_sub *) g_hash_table_lookup (subs_hash_table, GINT_TO_POINTER (n.fd));
+  sub = (kqueue_sub *) g_hash_table_lookup (subs_hash_table, GINT_TO_POINTER (n->fd));
   G_UNLOCK (hash_lock);
 
   if (sub == NULL)
     {
+      /* An ancestor directory of a missing file */
+      if (_km_notify (n->fd, flags))
+        return;
+
       KH_W ("Got a notification for a deleted or non-existing subscription %d",
-             n.fd);
-      return TRUE;
+             n->fd);
+      return;
     }
 
   monitor = G_FILE_MONITOR (sub->user_data);
   g_assert (monitor != NULL);
 
-  if (n.flags & (NOTE_DELETE | NOTE_REVOKE))
+  if (flags & NOTE_RENAME)
+    {
+      /* The descriptor follows the file to its new name, while the
+       * subscription is for the old path. Find out where the file has
+       * gone while the descriptor is still open, then handle it as
+       * a deletion from the monitored path. Directories renamed inside
+       * a monitored directory are paired by the directory diff. */
+      renamed = !(flags & (NOTE_DELETE | NOTE_REVOKE));
+      if (renamed && sub->pair_moves)
+        new_path = kh_get_fd_path (sub->fd);
+      flags &= ~(NOTE_RENAME | NOTE_WRITE | NOTE_EXTEND);
+    }
+
+  if (renamed || flags & (NOTE_DELETE | NOTE_REVOKE))
     {
       if (sub->deps)
         {
@@ -389,7 +539,7 @@ process_kqueue_notifications (GIOChannel   *gioc,
         }  
       _km_add_missing (sub);
 
-      if (!(n.flags & NOTE_REVOKE))
+      if (!(flags & NOTE_REVOKE))
         {
           /* Note that NOTE_REVOKE is issued by the kqueue thread
            * on EV_ERROR kevent. In this case, a file descriptor is
@@ -399,16 +549,37 @@ process_kqueue_notifications (GIOChannel   *gioc,
         }
     }
 
-  if (sub->is_dir && n.flags & (NOTE_WRITE | NOTE_EXTEND))
+  if (sub->is_dir && flags & (NOTE_WRITE | NOTE_EXTEND))
     {
+      KH_W ("Diffing %s, %u notifications collapsed", sub->filename, n->count);
+      diff_start = g_get_monotonic_time ();
       _kh_dir_diff (sub, monitor);  
-      n.flags &= ~(NOTE_WRITE | NOTE_EXTEND);
+      diff_time = g_get_monotonic_time () - diff_start;
+
+      G_LOCK (stats_lock);
+      ++stats.n_dir_diffs;
+      stats.n_diffed_notifications += n->count;
+      stats.max_collapsed = MAX (stats.max_collapsed, n->count);
+      stats.dir_diff_time += diff_time;
+      stats.max_dir_diff_time = MAX (stats.max_dir_diff_time, diff_time);
+      _g_file_monitor_histogram_add (&stats.dir_diff_times, diff_time);
+      G_UNLOCK (stats_lock);
+      flags &= ~(NOTE_WRITE | NOTE_EXTEND);
     }
 
-  if (n.flags)
+  /* The parent directory of a tree reports these */
+  if (sub->children_only)
+    {
+      flags = 0;
+      renamed = FALSE;
+      g_free (new_path);
+      new_path = NULL;
+    }
+
+  if (flags)
     {
       gboolean done = FALSE;
-      mask = convert_kqueue_events_to_gio (n.flags, &done);
+      mask = convert_kqueue_events_to_gio (flags, &done);
       if (done == TRUE)
         {
           GFile *file = g_file_new_for_path (sub->filename);
@@ -417,10 +588,275 @@ process_kqueue_notifications (GIOChannel   *gioc,
         }
     }
 
+  if (renamed)
+    {
+      kh_emit_renamed (sub, monitor, new_path);
+      g_free (new_path);
+    }
+}
+
+
+/**
+ * kh_flush_pending:
+ * @unused: unused
+ *
+ * Dispatches all the pending notifications, one per file descriptor.
+ *
+ * Returns: %FALSE
+ **/
+static gboolean
+kh_flush_pending (gpointer unused)
+{
+  GArray *batch;
+  guint i;
+
+  pending_flush_id = 0;
+
+  /* A dispatch may cancel subscriptions and even cause new notifications
+   * to be read, so detach the batch first */
+  G_LOCK (stats_lock);
+  batch = pending_array;
+  pending_array = g_array_new (FALSE, FALSE, sizeof (kh_pending));
+  ++stats.n_batches;
+  G_UNLOCK (stats_lock);
+  g_hash_table_remove_all (pending_table);
+
+  for (i = 0; i < batch->len; i++)
+    kh_dispatch (&g_array_index (batch, kh_pending, i));
+
+  g_array_free (batch, TRUE);
+  return FALSE;
+}
+
+
+/**
+ * kh_queue_notification:
+ * @n: a notification, read from the kqueue thread
+ *
+ * Merges a notification into the pending set. Called with the
+ * stats lock held.
+ **/
+static void
+kh_queue_notification (const struct kqueue_notification *n)
+{
+  gpointer index = NULL;
+
+  ++stats.n_notifications;
+
+  if (g_hash_table_lookup_extended (pending_table,
+                                    GINT_TO_POINTER (n->fd),
+                                    NULL,
+                                    &index))
+    {
+      kh_pending *p = &g_array_index (pending_array, kh_pending, GPOINTER_TO_UINT (index));
+      p->flags |= n->flags;
+      ++p->count;
+      ++stats.n_coalesced;
+    }
+  else
+    {
+      kh_pending p;
+      p.fd = n->fd;
+      p.flags = n->flags;
+      p.count = 1;
+
+      g_hash_table_insert (pending_table,
+                           GINT_TO_POINTER (n->fd),
+                           GUINT_TO_POINTER (pending_array->len));
+      g_array_append_val (pending_array, p);
+    }
+}
+
+
+/**
+ * kh_schedule_flush:
+ *
+ * Dispatches the pending notifications now or, if a coalescing window
+ * is set, when it expires.
+ **/
+static void
+kh_schedule_flush (void)
+{
+  if (pending_array->len > 0 && pending_flush_id == 0)
+    {
+      if (coalesce_msecs == 0)
+        kh_flush_pending (NULL);
+      else
+        pending_flush_id = g_timeout_add (coalesce_msecs, kh_flush_pending, NULL);
+    }
+}
+
+
+/**
+ * process_kqueue_notifications:
+ * @gioc: unused.
+ * @cond: unused.
+ * @data: unused.
+ *
+ * Processes notifications, coming from the kqueue thread.
+ *
+ * Drains the notifications available on the command file descriptor,
+ * up to %KH_MAX_READS_PER_DISPATCH buffers, and merges them per file
+ * descriptor, so a burst of changes in a directory results in a single
+ * directory diff. Whatever is left is read on the next dispatch. The
+ * merged notifications are dispatched immediately or, if a coalescing
+ * window is set, when it expires.
+ *
+ * A typical GIO Channel callback function.
+ *
+ * Returns: %TRUE
+ **/
+static gboolean
+process_kqueue_notifications (GIOChannel   *gioc,
+                              GIOCondition  cond,
+                              gpointer      data)
+{
+  gchar *buffer = (gchar *) read_buffer;
+  gssize received;
+  gsize i, complete;
+  guint n_reads;
+
+  g_assert (kqueue_socket_pair[0] != -1);
+
+  for (n_reads = 0; n_reads < KH_MAX_READS_PER_DISPATCH; n_reads++)
+    {
+      received = recv (kqueue_socket_pair[0],
+                       buffer + read_buffer_used,
+                       sizeof (read_buffer) - read_buffer_used,
+                       MSG_DONTWAIT);
+      if (received == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno != EAGAIN && errno != EWOULDBLOCK)
+            KH_W ("Failed to read kqueue notifications, error %d", errno);
+          break;
+        }
+      if (received == 0)
+        break;
+
+      read_buffer_used += received;
+      complete = read_buffer_used / sizeof (struct kqueue_notification);
+
+      G_LOCK (stats_lock);
+      for (i = 0; i < complete; i++)
+        kh_queue_notification (&read_buffer[i]);
+      G_UNLOCK (stats_lock);
+
+      /* Keep the tail of an incomplete notification */
+      read_buffer_used -= complete * sizeof (struct kqueue_notification);
+      memmove (buffer, &read_buffer[complete], read_buffer_used);
+    }
+
+  kh_schedule_flush ();
   return TRUE;
 }
 
 
+/**
+ * _kh_process_notifications:
+ * @notifications: notifications in the format of the kqueue thread
+ * @n_notifications: the number of @notifications
+ *
+ * Merges and dispatches @notifications as if they had been read from
+ * the kqueue thread in a single dispatch. Used to replay a recorded
+ * notification stream.
+ **/
+void
+_kh_process_notifications (const struct kqueue_notification *notifications,
+                           gsize                             n_notifications)
+{
+  gsize i;
+
+  g_assert (kqueue_socket_pair[0] != -1);
+
+  G_LOCK (stats_lock);
+  for (i = 0; i < n_notifications; i++)
+    kh_queue_notification (&notifications[i]);
+  G_UNLOCK (stats_lock);
+
+  kh_schedule_flush ();
+}
+
+
+/**
+ * _kh_get_stats:
+ * @out: a #kh_stats to fill
+ *
+ * Reports how many raw notifications were received from the kqueue thread
+ * and how many of them were collapsed.
+ **/
+void
+_kh_get_stats (kh_stats *out)
+{
+  g_assert (out != NULL);
+
+  G_LOCK (stats_lock);
+  *out = stats;
+  G_UNLOCK (stats_lock);
+}
+
+/**
+ * _kh_get_statistics:
+ * @builder: a #GVariantBuilder of type <literal>a{sv}</literal>
+ *
+ * Adds the state and the counters of the backend to the statistics
+ * of a monitor, see g_file_monitor_get_statistics().
+ **/
+void
+_kh_get_statistics (GVariantBuilder *builder)
+{
+  guint n_subs, n_missing, n_ancestors, n_pending;
+  kh_stats s;
+
+  G_LOCK (hash_lock);
+  n_subs = subs_hash_table ? g_hash_table_size (subs_hash_table) : 0;
+  G_UNLOCK (hash_lock);
+
+  _km_get_stats (&n_missing, &n_ancestors);
+
+  G_LOCK (stats_lock);
+  s = stats;
+  n_pending = pending_array ? pending_array->len : 0;
+  G_UNLOCK (stats_lock);
+
+  g_variant_builder_add (builder, "{sv}", "backend",
+                         g_variant_new_string ("kqueue"));
+  /* Every subscription and every ancestor holds an open descriptor */
+  g_variant_builder_add (builder, "{sv}", "watches",
+                         g_variant_new_uint32 (n_subs + n_ancestors));
+  g_variant_builder_add (builder, "{sv}", "subscriptions",
+                         g_variant_new_uint32 (n_subs));
+  g_variant_builder_add (builder, "{sv}", "missing",
+                         g_variant_new_uint32 (n_missing));
+  g_variant_builder_add (builder, "{sv}", "ancestor-watches",
+                         g_variant_new_uint32 (n_ancestors));
+  g_variant_builder_add (builder, "{sv}", "watch-failures",
+                         g_variant_new_uint64 (s.n_open_failures));
+  g_variant_builder_add (builder, "{sv}", "watch-limit-failures",
+                         g_variant_new_uint64 (s.n_fd_limit_failures));
+  g_variant_builder_add (builder, "{sv}", "queue-length",
+                         g_variant_new_uint32 (n_pending));
+  g_variant_builder_add (builder, "{sv}", "kernel-events",
+                         g_variant_new_uint64 (s.n_notifications));
+  g_variant_builder_add (builder, "{sv}", "kernel-events-coalesced",
+                         g_variant_new_uint64 (s.n_coalesced));
+  g_variant_builder_add (builder, "{sv}", "kernel-batches",
+                         g_variant_new_uint64 (s.n_batches));
+  g_variant_builder_add (builder, "{sv}", "dir-diffs",
+                         g_variant_new_uint64 (s.n_dir_diffs));
+  g_variant_builder_add (builder, "{sv}", "dir-diff-notifications",
+                         g_variant_new_uint64 (s.n_diffed_notifications));
+  g_variant_builder_add (builder, "{sv}", "dir-diff-max-collapsed",
+                         g_variant_new_uint32 (s.max_collapsed));
+  g_variant_builder_add (builder, "{sv}", "dir-diff-time",
+                         g_variant_new_uint64 (s.dir_diff_time));
+  g_variant_builder_add (builder, "{sv}", "dir-diff-time-max",
+                         g_variant_new_uint64 (s.max_dir_diff_time));
+  _g_file_monitor_statistics_add_histogram (builder, "dir-diff-time-histogram",
+                                            &s.dir_diff_times);
+}
+
 /**
  * _kh_startup_impl:
  * @unused: unused
@@ -433,6 +869,7 @@ static gpointer
 _kh_startup_impl (gpointer unused)
 {
   GIOChannel *channel = NULL;
+  const gchar *coalesce_value = NULL;
   gboolean result = FALSE;
 
   kqueue_descriptor = kqueue ();
@@ -463,6 +900,13 @@ _kh_startup_impl (gpointer unused)
   _km_init (_kh_file_appeared_cb);
   _ke_rebuild ();
 
+  coalesce_value = g_getenv ("GIO_KQUEUE_COALESCE_MSECS");
+  if (coalesce_value != NULL)
+    coalesce_msecs = (guint) g_ascii_strtoull (coalesce_value, NULL, 10);
+
+  pending_array = g_array_new (FALSE, FALSE, sizeof (kh_pending));
+  pending_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+
   channel = g_io_channel_unix_new (kqueue_socket_pair[0]);
   g_io_add_watch (channel, G_IO_IN, process_kqueue_notifications, NULL);
 
@@ -508,7 +952,14 @@ _kh_start_watching (kqueue_sub *sub)
 
   if (sub->fd == -1)
     {
-      KH_W ("failed to open file %s (error %d)", sub->filename, errno);
+      int errsv = errno;
+
+      KH_W ("failed to open file %s (error %d)", sub->filename, errsv);
+      G_LOCK (stats_lock);
+      ++stats.n_open_failures;
+      if (errsv == EMFILE || errsv == ENFILE)
+        ++stats.n_fd_limit_failures;
+      G_UNLOCK (stats_lock);
       return FALSE;
     }
 
@@ -521,22 +972,61 @@ _kh_start_watching (kqueue_sub *sub)
        * we need to scan in contents for the further diffs. Ideally this process
        * should be delegated to the GKqueueDirectoryMonitor, but for now I will
        * do it in a dirty way right here. */
-      if (sub->deps)
-        dl_free (sub->deps);
+      dep_list *was = sub->deps;
 
-      sub->deps = dl_listing (sub->filename);  
+      if (sub->child_changes)
+        sub->deps = dl_listing_full (sub->filename, was, DL_LISTING_META);
+      else
+        sub->deps = dl_listing (sub->filename, was);
+      dl_free (was);
     }
 
   G_LOCK (hash_lock);
   g_hash_table_insert (subs_hash_table, GINT_TO_POINTER (sub->fd), sub);
   G_UNLOCK (hash_lock);
 
-  _kqueue_thread_push_fd (sub->fd);
-  
+  _kh_add_fd (sub->fd);
+  return TRUE;
+}
+
+
+/**
+ * _kh_add_fd:
+ * @fd: a file descriptor
+ *
+ * Passes a file descriptor to the kqueue thread for monitoring.
+ * Notifications on @fd which do not belong to a subscription are
+ * handed to the kqueue-missing subsystem.
+ **/
+void
+_kh_add_fd (int fd)
+{
+  g_assert (kqueue_socket_pair[0] != -1);
+
+  _kqueue_thread_push_fd (fd);
+
   /* Bump the kqueue thread. It will pick up a new sub entry to monitor */
   if (!_ku_write (kqueue_socket_pair[0], "A", 1))
     KH_W ("Failed to bump the kqueue thread (add fd, error %d)", errno);
-  return TRUE;
+}
+
+
+/**
+ * _kh_remove_fd:
+ * @fd: a file descriptor
+ *
+ * Stops monitoring a file descriptor. It will be closed in the kqueue thread.
+ **/
+void
+_kh_remove_fd (int fd)
+{
+  g_assert (kqueue_socket_pair[0] != -1);
+
+  _kqueue_thread_remove_fd (fd);
+
+  /* Bump the kqueue thread. It will pick up a new sub entry to remove*/
+  if (!_ku_write (kqueue_socket_pair[0], "R", 1))
+    KH_W ("Failed to bump the kqueue thread (remove fd, error %d)", errno);
 }
 
 
@@ -594,11 +1084,7 @@ _kh_cancel_sub (kqueue_sub *sub)
   else
     {
       /* fd will be closed in the kqueue thread */
-      _kqueue_thread_remove_fd (sub->fd);
-
-      /* Bump the kqueue thread. It will pick up a new sub entry to remove*/
-      if (!_ku_write (kqueue_socket_pair[0], "R", 1))
-        KH_W ("Failed to bump the kqueue thread (remove fd, error %d)", errno);
+      _kh_remove_fd (sub->fd);
     }
 
   return TRUE;
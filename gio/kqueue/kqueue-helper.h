@@ -25,13 +25,55 @@
 
 #include "kqueue-sub.h"
 #include <gio/gfilemonitor.h>
+#include <gio/gfilemonitorprivate.h>
+
+struct kqueue_notification;
+
+/**
+ * kh_stats:
+ * @n_notifications: raw notifications received from the kqueue thread
+ * @n_coalesced: notifications merged into an earlier one on the same fd
+ * @n_batches: the number of dispatched batches
+ * @n_dir_diffs: the number of directory diffs performed
+ * @n_diffed_notifications: raw notifications served by these diffs
+ * @max_collapsed: the most notifications collapsed into a single diff
+ * @dir_diff_time: the time spent diffing directories, in microseconds
+ * @max_dir_diff_time: the longest directory diff, in microseconds
+ * @dir_diff_times: the distribution of the directory diff times
+ * @n_open_failures: files that could not be opened for watching
+ * @n_fd_limit_failures: the part of @n_open_failures due to the
+ *     file descriptor limits
+ *
+ * Notification processing counters of the kqueue backend.
+ */
+typedef struct {
+  guint64 n_notifications;
+  guint64 n_coalesced;
+  guint64 n_batches;
+  guint64 n_dir_diffs;
+  guint64 n_diffed_notifications;
+  guint   max_collapsed;
+  guint64 dir_diff_time;
+  guint64 max_dir_diff_time;
+  GFileMonitorHistogram dir_diff_times;
+  guint64 n_open_failures;
+  guint64 n_fd_limit_failures;
+} kh_stats;
 
 gboolean _kh_startup        (void);
 gboolean _kh_add_sub        (kqueue_sub *sub);
 gboolean _kh_cancel_sub     (kqueue_sub *sub);
 
 gboolean _kh_start_watching (kqueue_sub *sub);
+void     _kh_add_fd         (int fd);
+void     _kh_remove_fd      (int fd);
 
 void     _kh_dir_diff       (kqueue_sub *sub, GFileMonitor *monitor);
 
+void     _kh_process_notifications (const struct kqueue_notification *notifications,
+                                    gsize                             n_notifications);
+
+void     _kh_get_stats      (kh_stats *out);
+void     _kh_get_statistics (GVariantBuilder *builder);
+
 #endif /* __KQUEUE_HELPER_H */
@@ -20,24 +20,59 @@
   THE SOFTWARE.
 *******************************************************************************/
 
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include "kqueue-helper.h"
 #include "kqueue-sub.h"
 #include "kqueue-missing.h"
 
 
-#define SCAN_MISSING_TIME 4 /* 1/4 Hz */
+/* Subscriptions which can not be attached to an ancestor directory
+ * are polled, with the delay doubled after each unsuccessful scan. */
+#define KM_BACKOFF_MIN 1 /* seconds */
+#define KM_BACKOFF_MAX 32
+
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
 
 static gboolean km_scan_missing (gpointer user_data);
 
 static gboolean km_debug_enabled = FALSE;
 #define KM_W if (km_debug_enabled) g_warning
 
+/**
+ * km_ancestor:
+ * @path: a path of the nearest existing ancestor directory
+ * @fd: the file descriptor watched by kqueue
+ * @children: maps a name of the next path component to a #GSList
+ *     of subscriptions waiting for it
+ *
+ * A directory watched on behalf of missing subscriptions.
+ */
+typedef struct {
+  gchar *path;
+  int fd;
+  GHashTable *children;
+} km_ancestor;
+
+static GHashTable *path_ancestor_table = NULL;
+static GHashTable *fd_ancestor_table = NULL;
+static GHashTable *sub_ancestor_table = NULL;
+
 static GSList *missing_subs_list = NULL;
 G_GNUC_INTERNAL G_LOCK_DEFINE (missing_lock);
 
-static volatile gboolean scan_missing_running = FALSE;
+static guint scan_missing_id = 0;
+static guint scan_missing_secs = KM_BACKOFF_MIN;
 static on_create_cb file_appeared_callback;
 
 
@@ -52,6 +87,206 @@ void
 _km_init (on_create_cb cb)
 {
   file_appeared_callback = cb;
+
+  path_ancestor_table = g_hash_table_new (g_str_hash, g_str_equal);
+  fd_ancestor_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+  sub_ancestor_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+
+/**
+ * km_next_component:
+ * @ancestor: a path of an ancestor directory
+ * @path: a path below @ancestor
+ *
+ * Returns: a newly allocated name of the first component of @path
+ *     below @ancestor.
+ **/
+static gchar *
+km_next_component (const gchar *ancestor, const gchar *path)
+{
+  const gchar *start = path + strlen (ancestor);
+  const gchar *end = NULL;
+
+  while (*start == '/')
+    start++;
+  end = strchr (start, '/');
+
+  return end ? g_strndup (start, end - start) : g_strdup (start);
+}
+
+
+/**
+ * km_ancestor_release:
+ * @anc: a #km_ancestor
+ * @closed: %TRUE if the file descriptor was already closed by
+ *     the kqueue thread
+ *
+ * Stops watching an ancestor directory if there are no subscriptions
+ * waiting on it anymore.
+ **/
+static void
+km_ancestor_release (km_ancestor *anc, gboolean closed)
+{
+  if (g_hash_table_size (anc->children) > 0)
+    return;
+
+  KM_W ("no longer watching ancestor %s", anc->path);
+
+  g_hash_table_remove (fd_ancestor_table, GINT_TO_POINTER (anc->fd));
+  g_hash_table_remove (path_ancestor_table, anc->path);
+  if (!closed)
+    _kh_remove_fd (anc->fd);
+
+  g_hash_table_destroy (anc->children);
+  g_free (anc->path);
+  g_slice_free (km_ancestor, anc);
+}
+
+
+/**
+ * km_ancestor_take:
+ * @anc: a #km_ancestor
+ * @all: %TRUE to detach all the waiting subscriptions
+ *
+ * Detaches the subscriptions which have to be rechecked: the ones
+ * for which the next path component exists now, or all of them.
+ *
+ * Returns: a #GSList of #kqueue_sub.
+ **/
+static GSList *
+km_ancestor_take (km_ancestor *anc, gboolean all)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  GSList *subs = NULL;
+  GSList *l = NULL;
+
+  g_hash_table_iter_init (&iter, anc->children);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (!all)
+        {
+          struct stat buf;
+          gchar *child = g_build_filename (anc->path, key, NULL);
+          gboolean exists = (g_lstat (child, &buf) == 0);
+
+          g_free (child);
+          if (!exists)
+            continue;
+        }
+
+      subs = g_slist_concat (subs, value);
+      g_hash_table_iter_remove (&iter);
+    }
+
+  for (l = subs; l; l = l->next)
+    g_hash_table_remove (sub_ancestor_table, l->data);
+
+  return subs;
+}
+
+
+/**
+ * km_group:
+ * @sub: a #kqueue_sub
+ *
+ * Attaches a missing subscription to the nearest existing ancestor
+ * directory of its file, starting to watch that directory if needed.
+ *
+ * Returns: %TRUE on success, %FALSE if the subscription has to be polled.
+ **/
+static gboolean
+km_group (kqueue_sub *sub)
+{
+  km_ancestor *anc = NULL;
+  gchar *path = NULL;
+  gchar *component = NULL;
+  gchar *child = NULL;
+  GSList *waiting = NULL;
+  struct stat buf;
+
+  path = g_path_get_dirname (sub->filename);
+
+  while (anc == NULL)
+    {
+      gchar *parent = NULL;
+      int fd;
+
+      anc = g_hash_table_lookup (path_ancestor_table, path);
+      if (anc != NULL)
+        break;
+
+      fd = open (path, O_RDONLY | O_DIRECTORY);
+      if (fd != -1)
+        {
+          KM_W ("watching ancestor %s", path);
+          anc = g_slice_new (km_ancestor);
+          anc->path = g_strdup (path);
+          anc->fd = fd;
+          anc->children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+          g_hash_table_insert (path_ancestor_table, anc->path, anc);
+          g_hash_table_insert (fd_ancestor_table, GINT_TO_POINTER (fd), anc);
+          _kh_add_fd (fd);
+          break;
+        }
+
+      parent = g_path_get_dirname (path);
+      if ((errno != ENOENT && errno != ENOTDIR) || strcmp (parent, path) == 0)
+        {
+          KM_W ("can't watch an ancestor of %s (error %d)", sub->filename, errno);
+          g_free (parent);
+          g_free (path);
+          return FALSE;
+        }
+
+      g_free (path);
+      path = parent;
+    }
+  g_free (path);
+
+  /* If the next component already exists, it has either appeared before
+   * the ancestor was watched or it can't be opened for some other reason.
+   * Either way, a notification may never come */
+  component = km_next_component (anc->path, sub->filename);
+  child = g_build_filename (anc->path, component, NULL);
+  if (g_lstat (child, &buf) == 0)
+    {
+      g_free (child);
+      g_free (component);
+      km_ancestor_release (anc, FALSE);
+      return FALSE;
+    }
+  g_free (child);
+
+  waiting = g_hash_table_lookup (anc->children, component);
+  g_hash_table_insert (anc->children, component, g_slist_prepend (waiting, sub));
+  g_hash_table_insert (sub_ancestor_table, sub, anc);
+  return TRUE;
+}
+
+
+/**
+ * km_place:
+ * @sub: a #kqueue_sub
+ *
+ * Attaches a missing subscription to an ancestor directory or, if it is
+ * not possible, adds it to the polled list. missing_lock must be held.
+ **/
+static void
+km_place (kqueue_sub *sub)
+{
+  if (km_group (sub))
+    return;
+
+  KM_W ("polling for %s", sub->filename);
+  missing_subs_list = g_slist_prepend (missing_subs_list, sub);
+
+  /* Start over with the shortest delay */
+  scan_missing_secs = KM_BACKOFF_MIN;
+  if (scan_missing_id != 0)
+    g_source_remove (scan_missing_id);
+  scan_missing_id = g_timeout_add_seconds (scan_missing_secs, km_scan_missing, NULL);
 }
 
 
@@ -65,21 +300,94 @@ void
 _km_add_missing (kqueue_sub *sub)
 {
   G_LOCK (missing_lock);
-  if (g_slist_find (missing_subs_list, sub))
+  if (g_hash_table_lookup (sub_ancestor_table, sub) ||
+      g_slist_find (missing_subs_list, sub))
     {
       KM_W ("asked to add %s to missing list but it's already on the list!\n", sub->filename);
+      G_UNLOCK (missing_lock);
       return;
     }
 
   KM_W ("adding %s to missing list\n", sub->filename);
-  missing_subs_list = g_slist_prepend (missing_subs_list, sub);
+  km_place (sub);
   G_UNLOCK (missing_lock);
+}
+
+
+/**
+ * km_recheck:
+ * @subs: a #GSList of #kqueue_sub
+ *
+ * Tries to start watching each subscription. Invokes a user callback
+ * for the ones which have appeared, regroups the others.
+ **/
+static void
+km_recheck (GSList *subs)
+{
+  GSList *head;
+
+  for (head = subs; head; head = head->next)
+    {
+      kqueue_sub *sub = (kqueue_sub *) head->data;
+
+      if (_kh_start_watching (sub))
+        {
+          KM_W ("file %s now exists, starting watching", sub->filename);
+          if (file_appeared_callback)
+            file_appeared_callback (sub);
+        }
+      else
+        km_place (sub);
+    }
+}
+
+
+/**
+ * _km_notify:
+ * @fd: a file descriptor
+ * @flags: kqueue flags, see man kevent(2)
+ *
+ * Handles a notification on a watched ancestor directory. Only the
+ * subscriptions whose next path component has appeared are rechecked.
+ * If the ancestor itself has gone, all of its subscriptions are regrouped.
+ *
+ * Returns: %TRUE if @fd is an ancestor directory, %FALSE otherwise.
+ **/
+gboolean
+_km_notify (int fd, uint32_t flags)
+{
+  km_ancestor *anc = NULL;
+  GSList *subs = NULL;
 
-  if (!scan_missing_running)
+  G_LOCK (missing_lock);
+
+  anc = g_hash_table_lookup (fd_ancestor_table, GINT_TO_POINTER (fd));
+  if (anc == NULL)
+    {
+      G_UNLOCK (missing_lock);
+      return FALSE;
+    }
+
+  KM_W ("ancestor %s changed", anc->path);
+
+  if (flags & (NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE))
+    {
+      /* NOTE_REVOKE comes on EV_ERROR, the kqueue thread has already
+       * closed the file descriptor */
+      subs = km_ancestor_take (anc, TRUE);
+      km_ancestor_release (anc, flags & NOTE_REVOKE);
+    }
+  else if (flags & (NOTE_WRITE | NOTE_EXTEND))
     {
-      scan_missing_running = TRUE;
-      g_timeout_add_seconds (SCAN_MISSING_TIME, km_scan_missing, NULL);
+      subs = km_ancestor_take (anc, FALSE);
+      km_ancestor_release (anc, FALSE);
     }
+
+  km_recheck (subs);
+  g_slist_free (subs);
+
+  G_UNLOCK (missing_lock);
+  return TRUE;
 }
 
 
@@ -87,27 +395,32 @@ _km_add_missing (kqueue_sub *sub)
  * km_scan_missing:
  * @user_data: unused
  *
- * The core missing files watching routine.
+ * The fallback missing files watching routine.
  *
- * Traverses through a list of missing files, tries to start watching each with
- * kqueue, removes the appropriate entry and invokes a user callback if the file
- * has appeared.
+ * Traverses through a list of the polled missing files, tries to start
+ * watching each with kqueue or to attach it to an ancestor directory,
+ * removes the appropriate entry and invokes a user callback if the file
+ * has appeared. Reschedules itself with a doubled delay if any files
+ * are left.
  *
- * Returns: %FALSE if no missing files left, %TRUE otherwise.
+ * Returns: %FALSE
  **/
 static gboolean
 km_scan_missing (gpointer user_data)
 {
   GSList *head;
-  GSList *not_missing = NULL;
-  gboolean retval = FALSE;
+  GSList *subs = NULL;
   
   G_LOCK (missing_lock);
 
-  if (missing_subs_list)
+  scan_missing_id = 0;
+  subs = missing_subs_list;
+  missing_subs_list = NULL;
+
+  if (subs)
     KM_W ("we have a job");
 
-  for (head = missing_subs_list; head; head = head->next)
+  for (head = subs; head; head = head->next)
     {
       kqueue_sub *sub = (kqueue_sub *) head->data;
       g_assert (sub != NULL);
@@ -118,27 +431,38 @@ km_scan_missing (gpointer user_data)
           KM_W ("file %s now exists, starting watching", sub->filename);
           if (file_appeared_callback)
             file_appeared_callback (sub);
-          not_missing = g_slist_prepend (not_missing, head);
         }
+      else if (!km_group (sub))
+        missing_subs_list = g_slist_prepend (missing_subs_list, sub);
     }
+  g_slist_free (subs);
 
-  for (head = not_missing; head; head = head->next)
+  if (missing_subs_list != NULL)
     {
-      GSList *link = (GSList *) head->data;
-      missing_subs_list = g_slist_remove_link (missing_subs_list, link);
+      scan_missing_secs = MIN (scan_missing_secs * 2, KM_BACKOFF_MAX);
+      scan_missing_id = g_timeout_add_seconds (scan_missing_secs, km_scan_missing, NULL);
     }
-  g_slist_free (not_missing);
 
-  if (missing_subs_list == NULL)
-    {
-      scan_missing_running = FALSE;
-      retval = FALSE;
-    }
-  else
-    retval = TRUE;
+  G_UNLOCK (missing_lock);
+  return FALSE;
+}
+
 
+/**
+ * _km_get_stats:
+ * @n_missing: the number of missing subscriptions (out)
+ * @n_ancestors: the number of ancestor directories watched for them (out)
+ *
+ * Reports how many files are currently missing.
+ **/
+void
+_km_get_stats (guint *n_missing, guint *n_ancestors)
+{
+  G_LOCK (missing_lock);
+  *n_missing = (sub_ancestor_table ? g_hash_table_size (sub_ancestor_table) : 0) +
+               g_slist_length (missing_subs_list);
+  *n_ancestors = fd_ancestor_table ? g_hash_table_size (fd_ancestor_table) : 0;
   G_UNLOCK (missing_lock);
-  return retval;
 }
 
 
@@ -151,7 +475,29 @@ km_scan_missing (gpointer user_data)
 void
 _km_remove (kqueue_sub *sub)
 {
+  km_ancestor *anc = NULL;
+
   G_LOCK (missing_lock);
-  missing_subs_list = g_slist_remove (missing_subs_list, sub);
+
+  anc = g_hash_table_lookup (sub_ancestor_table, sub);
+  if (anc != NULL)
+    {
+      gchar *component = km_next_component (anc->path, sub->filename);
+      GSList *waiting = g_hash_table_lookup (anc->children, component);
+
+      waiting = g_slist_remove (waiting, sub);
+      if (waiting != NULL)
+        g_hash_table_insert (anc->children, component, waiting);
+      else
+        {
+          g_hash_table_remove (anc->children, component);
+          g_free (component);
+        }
+      g_hash_table_remove (sub_ancestor_table, sub);
+      km_ancestor_release (anc, FALSE);
+    }
+  else
+    missing_subs_list = g_slist_remove (missing_subs_list, sub);
+
   G_UNLOCK (missing_lock);
 }
@@ -25,8 +25,10 @@
 
 typedef void (*on_create_cb) (kqueue_sub *);
 
-void _km_init        (on_create_cb cb);
-void _km_add_missing (kqueue_sub *sub);
-void _km_remove      (kqueue_sub *sub);
+void     _km_init        (on_create_cb cb);
+void     _km_add_missing (kqueue_sub *sub);
+void     _km_remove      (kqueue_sub *sub);
+gboolean _km_notify      (int fd, uint32_t flags);
+void     _km_get_stats   (guint *n_missing, guint *n_ancestors);
 
 #endif /* __G_KQUEUE_MISSING_H */
@@ -52,6 +52,8 @@ _kh_sub_new (const gchar    *filename,
   sub->deps = NULL;
   /* I think that having such flag in the subscription is not good */
   sub->is_dir = 0;
+  sub->children_only = FALSE;
+  sub->child_changes = FALSE;
 
   KS_W ("new subscription for %s being setup\n", sub->filename);
   
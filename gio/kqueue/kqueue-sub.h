@@ -29,8 +29,15 @@
  * kqueue_sub:
  * @filename: a name of the file to monitor
  * @user_data: the pointer to user data
- * @pair_moves: unused (currently not implemented)
+ * @pair_moves: report renames as a single G_FILE_MONITOR_EVENT_MOVED
+ *     event instead of a DELETED/CREATED pair (G_FILE_MONITOR_SEND_MOVED)
  * @fd: the associated file descriptor (used by kqueue)
+ * @children_only: do not report the events about the file itself, only
+ *     the changes of a directory contents (used for the subdirectories of
+ *     a monitored tree)
+ * @child_changes: also record the metadata of the directory entries, so
+ *     that the in-place changes of the children are reported, at the
+ *     price of a stat call per entry on every rescan
  *
  * Represents a subscription on a file or directory.
  */
@@ -42,6 +49,8 @@ typedef struct
   int       fd;
   dep_list* deps;
   int       is_dir;
+  gboolean  children_only;
+  gboolean  child_changes;
 } kqueue_sub;
 
 kqueue_sub* _kh_sub_new  (const gchar* filename, gboolean pair_moves, gpointer user_data);
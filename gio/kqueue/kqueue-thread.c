@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/event.h>
 #include <sys/time.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <errno.h>
 #include <glib.h>
@@ -47,6 +48,9 @@ G_GNUC_INTERNAL G_LOCK_DEFINE (remove_lock);
 const uint32_t KQUEUE_VNODE_FLAGS =
   NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_RENAME;
 
+/* The maximum number of events received from kevent() at once */
+#define KT_BATCH_SIZE 256
+
 /* TODO: Probably it would be better to pass it as a thread param? */
 extern int kqueue_descriptor;
 
@@ -55,15 +59,18 @@ extern int kqueue_descriptor;
  * _kqueue_thread_collect_fds:
  * @events: a #kevents - the list of events to monitor. Will be extended
  *     with new items.
+ * @changes: a #kevents - the changelist for the next kevent() call.
+ *     Will be extended with new items.
  *
  * Picks up new file descriptors for monitoring from a global queue.
  *
  * To add new items to the list, use _kqueue_thread_push_fd().
  **/
 static void
-_kqueue_thread_collect_fds (kevents *events)
+_kqueue_thread_collect_fds (kevents *events, kevents *changes)
 {
   g_assert (events != NULL);
+  g_assert (changes != NULL);
   gint length = 0;
 
   G_LOCK (pick_up_lock);
@@ -71,17 +78,29 @@ _kqueue_thread_collect_fds (kevents *events)
     {
       gpointer fdp = NULL;
       kevents_extend_sz (events, length);
+      kevents_extend_sz (changes, length);
 
       while ((fdp = g_queue_pop_head (&pick_up_fds_queue)) != NULL)
         {
-          struct kevent *pevent = &events->memory[events->kq_size++];
-          EV_SET (pevent,
+          struct kevent event;
+
+          if (kevents_lookup (events, GPOINTER_TO_INT (fdp)) != -1)
+            {
+              KT_W ("fd %d is already monitored", GPOINTER_TO_INT (fdp));
+              continue;
+            }
+
+          /* The filter stays armed after it fires, so it is submitted
+           * to the kernel only once */
+          EV_SET (&event,
                   GPOINTER_TO_INT (fdp),
                   EVFILT_VNODE,
-                  EV_ADD | EV_ENABLE | EV_ONESHOT,
+                  EV_ADD | EV_ENABLE | EV_CLEAR,
                   KQUEUE_VNODE_FLAGS,
                   0,
                   0);
+          kevents_add (events, &event);
+          kevents_add (changes, &event);
         }
     }
   G_UNLOCK (pick_up_lock);
@@ -93,41 +112,42 @@ _kqueue_thread_collect_fds (kevents *events)
  * @events: a #kevents -- list of events to monitor. Cancelled
  *     subscriptions will be removed from it, and its size
  *     probably will be reduced.
+ * @changes: a #kevents -- the changelist for the next kevent() call.
+ *     Not yet submitted changes for the cancelled subscriptions will
+ *     be removed from it.
  *
  * Removes file descriptors from monitoring.
  *
  * This function will pick up file descriptors from a global list
- * to cancel monitoring on them. The list will be freed then.
+ * to cancel monitoring on them. The list will be freed then. Each
+ * descriptor is found through the pool index, in constant time.
+ *
+ * Closing a file descriptor removes its filters from the kqueue, so
+ * there is no need to submit EV_DELETE changes.
  *
  * To add new items to the list, use _kqueue_thread_remove_fd().
  **/
 static void
-_kqueue_thread_cleanup_fds (kevents *events)
+_kqueue_thread_cleanup_fds (kevents *events, kevents *changes)
 {
   g_assert (events != NULL);
+  g_assert (changes != NULL);
 
   G_LOCK (remove_lock);
   if (remove_fds_list)
     {
-      size_t oldsize = events->kq_size;
-      int i, j;
+      GSList *head;
 
-      for (i = 1, j = 1; i < oldsize; i++)
+      for (head = remove_fds_list; head != NULL; head = head->next)
         {
-          int fd = events->memory[i].ident;
-          GSList *elem = g_slist_find (remove_fds_list, GINT_TO_POINTER (fd));
-          if (elem == NULL)
-            {
-              if (i != j)
-                events->memory[j] = events->memory[i];
-              ++j;
-            }
-          else if (close (fd) == -1)
+          int fd = GPOINTER_TO_INT (head->data);
+
+          kevents_remove (changes, fd);
+          if (kevents_remove (events, fd) && close (fd) == -1)
             KT_W ("Failed to close fd %d, error %d", fd, errno);
         }
 
-      KT_W ("FD Clean up complete, kq_size now %d\n", j);
-      events->kq_size = j;
+      KT_W ("FD Clean up complete, kq_size now %zi\n", events->kq_size);
       kevents_reduce (events);
       g_slist_free (remove_fds_list);
       remove_fds_list = NULL;
@@ -149,18 +169,52 @@ _kqueue_thread_drop_fd (kevents *events, int fd)
 {
   g_assert (events != NULL);
 
-  int i;
-  for (i = 1; i < events->kq_size; i++)
+  if (kevents_remove (events, fd) && close (fd) == -1)
+    KT_W ("Failed to close fd %d, error %d", fd, errno);
+}
+
+
+/**
+ * _kqueue_thread_read_commands:
+ * @fd: the command file descriptor.
+ * @events: a #kevents -- list of events to monitor.
+ * @changes: a #kevents -- the changelist for the next kevent() call.
+ *
+ * Reads and executes all the pending control commands.
+ **/
+static void
+_kqueue_thread_read_commands (int fd, kevents *events, kevents *changes)
+{
+  char commands[64];
+  gboolean collect = FALSE;
+  gboolean cleanup = FALSE;
+
+  for (;;)
     {
-      if (events->memory[i].ident == fd)
-        {
-          if (close (fd) == -1)
-            KT_W ("Failed to close fd %d, error %d", fd, errno);
+      ssize_t i, received;
+
+      received = recv (fd, commands, sizeof (commands), MSG_DONTWAIT);
+      if (received == -1 && errno == EINTR)
+        continue;
+      if (received <= 0)
+        break;
 
-          events->memory[i] = events->memory[--events->kq_size];
-          return;
+      for (i = 0; i < received; i++)
+        {
+          if (commands[i] == 'A')
+            collect = TRUE;
+          else if (commands[i] == 'R')
+            cleanup = TRUE;
         }
-    } 
+    }
+
+  /* Both commands act on global lists, so it is enough to run each once.
+   * A descriptor can not be removed before it was added, so go in this
+   * order. */
+  if (collect)
+    _kqueue_thread_collect_fds (events, changes);
+  if (cleanup)
+    _kqueue_thread_cleanup_fds (events, changes);
 }
 
 /**
@@ -184,8 +238,13 @@ _kqueue_thread_drop_fd (kevents *events, int fd)
  * For details, see _kqueue_thread_collect_fds() and
  * _kqueue_thread_cleanup_fds().
  *
+ * Filters stay registered in the kqueue, so only the changes since the
+ * previous call are passed to kevent(). Up to %KT_BATCH_SIZE events
+ * are received at once.
+ *
  * Notifications, that thread writes into the command file descriptor,
- * are represented with #kqueue_notification objects.
+ * are represented with #kqueue_notification objects. All the
+ * notifications of a batch are written at once.
  *
  * Returns: %NULL
  **/
@@ -194,9 +253,14 @@ _kqueue_thread_func (void *arg)
 {
   int fd;
   kevents waiting;
+  kevents changes;
+  struct kevent control;
+  struct kevent received[KT_BATCH_SIZE];
+  struct kqueue_notification notifications[KT_BATCH_SIZE];
 
   g_assert (arg != NULL);
   kevents_init_sz (&waiting, 1);
+  kevents_init_sz (&changes, 1);
 
   fd = *(int *) arg;
 
@@ -206,26 +270,31 @@ _kqueue_thread_func (void *arg)
       return NULL;
     }
 
-  EV_SET (&waiting.memory[0],
+  EV_SET (&control,
           fd,
           EVFILT_READ,
-          EV_ADD | EV_ENABLE | EV_ONESHOT,
+          EV_ADD | EV_ENABLE,
           NOTE_LOWAT,
           1,
           0);
-  waiting.kq_size = 1;
+  kevents_add (&waiting, &control);
+  kevents_add (&changes, &control);
 
   for (;;) {
-    /* TODO: Provide more items in the `eventlist' to kqueue(2).
-     * Currently the backend takes notifications from the kernel one
-     * by one, i.e. there will be a lot of system calls and context
-     * switches when the application will monitor a lot of files with
-     * high filesystem activity on each. */
-     
-    struct kevent received;
-    KT_W ("Watching for %zi items", waiting.kq_size);
-    int ret = kevent (kqueue_descriptor, waiting.memory, waiting.kq_size, &received, 1, NULL);
-    KT_W ("Awoken.");
+    int i, n_notifications = 0;
+
+    KT_W ("Watching for %zi items, %zi changes", waiting.kq_size, changes.kq_size);
+    int ret = kevent (kqueue_descriptor,
+                      changes.memory,
+                      changes.kq_size,
+                      received,
+                      KT_BATCH_SIZE,
+                      NULL);
+    KT_W ("Awoken with %d events.", ret);
+
+    /* The changelist is applied before kevent() starts waiting, so
+     * it has been consumed even if the call was interrupted */
+    kevents_clear (&changes);
 
     if (ret == -1)
       {
@@ -236,36 +305,30 @@ _kqueue_thread_func (void *arg)
           return NULL;
       }
 
-    if (received.ident == fd)
+    for (i = 0; i < ret; i++)
       {
-        char c;
-        if (!_ku_read (fd, &c, 1))
+        if (received[i].ident == fd && received[i].filter == EVFILT_READ)
+          _kqueue_thread_read_commands (fd, &waiting, &changes);
+        else 
           {
-            KT_W ("Failed to read command, error %d", errno);
-            continue;
+            struct kqueue_notification *kn = &notifications[n_notifications++];
+            kn->fd = received[i].ident;
+
+            if (received[i].flags & EV_ERROR)
+              {
+                kn->flags = NOTE_REVOKE;
+                _kqueue_thread_drop_fd (&waiting, received[i].ident);
+              }
+            else
+              kn->flags = (received[i].fflags & ~NOTE_REVOKE);
           }
-        if (c == 'A')
-          _kqueue_thread_collect_fds (&waiting);
-        else if (c == 'R')
-          _kqueue_thread_cleanup_fds (&waiting);
       }
-    else 
-      {
-        struct kqueue_notification kn;
-        kn.fd = received.ident;
-
-        if (received.flags & EV_ERROR)
-          {
-            kn.flags = NOTE_REVOKE;
-            _kqueue_thread_drop_fd (&waiting, received.ident);
-          }
-        else
-          kn.flags = (received.fflags & ~NOTE_REVOKE);
 
-        if (!_ku_write (fd, &kn, sizeof (struct kqueue_notification)))
-          KT_W ("Failed to write a kqueue notification, error %d", errno);
-      }
+    if (n_notifications > 0 &&
+        !_ku_write (fd, notifications, n_notifications * sizeof (struct kqueue_notification)))
+      KT_W ("Failed to write kqueue notifications, error %d", errno);
   }
+  kevents_free (&changes);
   kevents_free (&waiting);
   return NULL;
 }
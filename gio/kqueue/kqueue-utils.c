@@ -121,10 +121,119 @@ kevents_free (kevents *kv)
   g_assert (kv != NULL);
 
   g_free (kv->memory);
+  g_free (kv->slots);
   memset (kv, 0, sizeof (kevents));
 }
 
 
+/**
+ * kevents_clear:
+ * @kv: a #kevents
+ *
+ * Empties the pool, keeping its memory for reuse. Only the index
+ * entries of the events in the pool are reset, so this is cheap for
+ * a small pool with a large index.
+ **/
+void
+kevents_clear (kevents *kv)
+{
+  g_assert (kv != NULL);
+  gsize i;
+
+  for (i = 0; i < kv->kq_size; i++)
+    kv->slots[kv->memory[i].ident] = 0;
+
+  kv->kq_size = 0;
+}
+
+
+/**
+ * kevents_add:
+ * @kv: a #kevents
+ * @kev: an event to add. Its ident should be a file descriptor, which
+ *     is not in the pool yet.
+ *
+ * Adds an event to the end of the pool and indexes it by the file
+ * descriptor.
+ **/
+void
+kevents_add (kevents *kv, const struct kevent *kev)
+{
+  g_assert (kv != NULL);
+  g_assert (kev != NULL);
+  gsize fd = kev->ident;
+
+  if (fd >= kv->n_slots)
+    {
+      gsize n_slots = MAX (2 * kv->n_slots, fd + KEVENTS_EXTEND_COUNT);
+      kv->slots = g_renew (gsize, kv->slots, n_slots);
+      memset (kv->slots + kv->n_slots, 0, (n_slots - kv->n_slots) * sizeof (gsize));
+      kv->n_slots = n_slots;
+    }
+
+  kevents_extend_sz (kv, 1);
+  kv->memory[kv->kq_size] = *kev;
+  kv->slots[fd] = ++kv->kq_size;
+}
+
+
+/**
+ * kevents_lookup:
+ * @kv: a #kevents
+ * @fd: a file descriptor
+ *
+ * Returns: the index of the event for @fd, or -1 if there is none.
+ **/
+gssize
+kevents_lookup (const kevents *kv, int fd)
+{
+  g_assert (kv != NULL);
+
+  gsize slot;
+
+  if (fd < 0 || (gsize) fd >= kv->n_slots)
+    return -1;
+
+  slot = kv->slots[fd];
+  if (slot == 0 || slot > kv->kq_size ||
+      (gsize) kv->memory[slot - 1].ident != (gsize) fd)
+    return -1;
+
+  return (gssize) slot - 1;
+}
+
+
+/**
+ * kevents_remove:
+ * @kv: a #kevents
+ * @fd: a file descriptor
+ *
+ * Removes the event for @fd from the pool in constant time. The last
+ * event of the pool is moved to the freed place, so the pool order
+ * is not preserved.
+ *
+ * Returns: %TRUE if the event was found, %FALSE otherwise.
+ **/
+gboolean
+kevents_remove (kevents *kv, int fd)
+{
+  g_assert (kv != NULL);
+  gssize index = kevents_lookup (kv, fd);
+
+  if (index == -1)
+    return FALSE;
+
+  kv->slots[fd] = 0;
+  if (index != --kv->kq_size)
+    {
+      kv->memory[index] = kv->memory[kv->kq_size];
+      kv->slots[kv->memory[index].ident] = index + 1;
+    }
+
+  return TRUE;
+}
+
+
 #define SAFE_GENERIC_OP(fcn, fd, data, size) \
   while (size > 0) \
     { \
@@ -26,10 +26,13 @@
 #include <sys/types.h> /* ino_t */
 
 /**
- * kqueue_notification:
+ * kevents:
  * @memory: a pointer to the allocated memory
  * @kq_size: the number of used items
  * @kq_allocated: the number of allocated items
+ * @slots: maps a file descriptor to its (index + 1) in @memory, 0 if
+ *     the descriptor is not in the pool
+ * @n_slots: the size of @slots
  *
  * Represents a pool of (struct kevent) objects.
  */
@@ -37,12 +40,19 @@ typedef struct {
   struct kevent *memory;
   gsize kq_size;
   gsize kq_allocated;
+  gsize *slots;
+  gsize n_slots;
 } kevents;
 
-void kevents_init_sz   (kevents *kv, gsize n_initial);
-void kevents_extend_sz (kevents *kv, gsize n_new);
-void kevents_reduce    (kevents *kv);
-void kevents_free      (kevents *kv);
+void     kevents_init_sz   (kevents *kv, gsize n_initial);
+void     kevents_extend_sz (kevents *kv, gsize n_new);
+void     kevents_reduce    (kevents *kv);
+void     kevents_free      (kevents *kv);
+void     kevents_clear     (kevents *kv);
+
+void     kevents_add       (kevents *kv, const struct kevent *kev);
+gssize   kevents_lookup    (const kevents *kv, int fd);
+gboolean kevents_remove    (kevents *kv, int fd);
 
 
 gboolean _ku_read             (int fd, gpointer data, gsize size);
@@ -1,6 +1,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <gio/gfiledescriptorbased.h>
 
@@ -590,9 +594,1814 @@ test_replace_load (void)
   free (path);
 }
 
+typedef struct
+{
+  GMainLoop *loop;
+  gchar *path;
+  gint created;
+} MissingData;
+
+static void
+missing_changed (GFileMonitor      *monitor,
+                 GFile             *file,
+                 GFile             *other_file,
+                 GFileMonitorEvent  event_type,
+                 gpointer           user_data)
+{
+  MissingData *data = user_data;
+  gchar *path;
+
+  path = g_file_get_path (file);
+  if (event_type == G_FILE_MONITOR_EVENT_CREATED &&
+      strcmp (path, data->path) == 0)
+    {
+      data->created++;
+      g_main_loop_quit (data->loop);
+    }
+  g_free (path);
+}
+
+static gboolean
+missing_timeout (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return FALSE;
+}
+
+/*
+ * A missing file several levels below the nearest existing directory
+ * must be noticed soon after it appears, without waking up monitors
+ * of unrelated missing files.
+ */
+static void
+test_monitor_missing (void)
+{
+  GError *error;
+  gchar *dir;
+  gchar *parent;
+  GFile *file;
+  GFile *other_file;
+  GFileMonitor *monitor;
+  GFileMonitor *other_monitor;
+  GMainLoop *loop;
+  MissingData data;
+  MissingData other_data;
+  guint timeout;
+  gboolean ret;
+
+  dir = g_build_filename (g_get_tmp_dir (), "g_file_monitor_missing_XXXXXX", NULL);
+  g_assert (mkdtemp (dir) != NULL);
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  data.loop = loop;
+  data.path = g_build_filename (dir, "a", "b", "c", NULL);
+  data.created = 0;
+  other_data.loop = loop;
+  other_data.path = g_build_filename (dir, "x", "y", NULL);
+  other_data.created = 0;
+
+  error = NULL;
+  file = g_file_new_for_path (data.path);
+  monitor = g_file_monitor_file (file, 0, NULL, &error);
+  g_assert_no_error (error);
+  g_signal_connect (monitor, "changed", G_CALLBACK (missing_changed), &data);
+
+  other_file = g_file_new_for_path (other_data.path);
+  other_monitor = g_file_monitor_file (other_file, 0, NULL, &error);
+  g_assert_no_error (error);
+  g_signal_connect (other_monitor, "changed", G_CALLBACK (missing_changed), &other_data);
+
+  parent = g_path_get_dirname (data.path);
+  g_assert_cmpint (g_mkdir_with_parents (parent, 0700), ==, 0);
+  ret = g_file_set_contents (data.path, "", 0, &error);
+  g_assert_no_error (error);
+  g_assert (ret);
+
+  /* Shorter than the interval missing files used to be polled at */
+  timeout = g_timeout_add (3000, missing_timeout, loop);
+  g_main_loop_run (loop);
+
+  g_assert_cmpint (data.created, ==, 1);
+  g_assert_cmpint (other_data.created, ==, 0);
+  g_source_remove (timeout);
+
+  g_file_monitor_cancel (monitor);
+  g_file_monitor_cancel (other_monitor);
+  g_object_unref (monitor);
+  g_object_unref (other_monitor);
+  g_object_unref (file);
+  g_object_unref (other_file);
+  g_main_loop_unref (loop);
+
+  remove (data.path);
+  remove (parent);
+  g_free (parent);
+  parent = g_build_filename (dir, "a", NULL);
+  remove (parent);
+  remove (dir);
+
+  g_free (parent);
+  g_free (data.path);
+  g_free (other_data.path);
+  g_free (dir);
+}
+
+typedef struct
+{
+  goffset last;
+  goffset total;
+  gint calls;
+  GCancellable *cancel_at_half;
+} CopyProgress;
+
+static void
+copy_progress_cb (goffset  current_num_bytes,
+                  goffset  total_num_bytes,
+                  gpointer user_data)
+{
+  CopyProgress *progress = user_data;
+
+  g_assert_cmpint (current_num_bytes, >=, progress->last);
+  progress->last = current_num_bytes;
+  progress->total = total_num_bytes;
+  progress->calls++;
+
+  if (progress->cancel_at_half &&
+      current_num_bytes >= total_num_bytes / 2)
+    g_cancellable_cancel (progress->cancel_at_half);
+}
+
+static gchar *
+make_copy_source (const gchar *dir,
+                  gsize        size)
+{
+  gchar *path, *data;
+  gsize i;
+
+  data = g_malloc (size);
+  for (i = 0; i < size; i++)
+    data[i] = (i * 7 + i / 4096) & 0xff;
+
+  path = g_build_filename (dir, "source", NULL);
+  g_assert (g_file_set_contents (path, data, size, NULL));
+  g_free (data);
+
+  return path;
+}
+
+/* Large copies report progress and arrive intact, whichever way the
+ * kernel copies them.
+ */
+static void
+test_copy_large (void)
+{
+  GFile *source, *destination;
+  CopyProgress progress = { 0, };
+  gchar *dir, *source_path, *dest_path;
+  gchar *a, *b;
+  gsize a_len, b_len;
+  GError *error = NULL;
+  gsize size = 24 * 1024 * 1024 + 123;
+
+  dir = g_build_filename (g_get_tmp_dir (), "g_file_copy_XXXXXX", NULL);
+  g_assert (mkdtemp (dir) != NULL);
+  source_path = make_copy_source (dir, size);
+  dest_path = g_build_filename (dir, "destination", NULL);
+
+  source = g_file_new_for_path (source_path);
+  destination = g_file_new_for_path (dest_path);
+
+  g_assert (g_file_copy (source, destination, G_FILE_COPY_NONE, NULL,
+                         copy_progress_cb, &progress, &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (progress.calls, >=, 1);
+  g_assert_cmpint (progress.last, ==, size);
+  g_assert_cmpint (progress.total, ==, size);
+
+  g_assert (g_file_get_contents (source_path, &a, &a_len, NULL));
+  g_assert (g_file_get_contents (dest_path, &b, &b_len, NULL));
+  g_assert_cmpuint (a_len, ==, b_len);
+  g_assert (memcmp (a, b, a_len) == 0);
+  g_free (a);
+  g_free (b);
+
+  /* Overwriting goes through the same path */
+  progress.last = 0;
+  g_assert (g_file_copy (source, destination, G_FILE_COPY_OVERWRITE, NULL,
+                         copy_progress_cb, &progress, &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (progress.last, ==, size);
+
+  g_object_unref (source);
+  g_object_unref (destination);
+  remove (source_path);
+  remove (dest_path);
+  remove (dir);
+  g_free (source_path);
+  g_free (dest_path);
+  g_free (dir);
+}
+
+/* Cancelling from the progress callback stops the copy */
+static void
+test_copy_cancel (void)
+{
+  GFile *source, *destination;
+  CopyProgress progress = { 0, };
+  gchar *dir, *source_path, *dest_path;
+  GError *error = NULL;
+  gsize size = 64 * 1024 * 1024;
+  gboolean ret;
+
+  dir = g_build_filename (g_get_tmp_dir (), "g_file_copy_XXXXXX", NULL);
+  g_assert (mkdtemp (dir) != NULL);
+  source_path = make_copy_source (dir, size);
+  dest_path = g_build_filename (dir, "destination", NULL);
+
+  source = g_file_new_for_path (source_path);
+  destination = g_file_new_for_path (dest_path);
+  progress.cancel_at_half = g_cancellable_new ();
+
+  ret = g_file_copy (source, destination, G_FILE_COPY_NONE,
+                     progress.cancel_at_half,
+                     copy_progress_cb, &progress, &error);
+
+  /* A reflink copies everything at once, before it can be cancelled */
+  if (ret)
+    g_assert_cmpint (progress.last, ==, size);
+  else
+    {
+      g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+      g_assert_cmpint (progress.last, <, size);
+      g_clear_error (&error);
+    }
+
+  g_object_unref (progress.cancel_at_half);
+  g_object_unref (source);
+  g_object_unref (destination);
+  remove (source_path);
+  remove (dest_path);
+  remove (dir);
+  g_free (source_path);
+  g_free (dest_path);
+  g_free (dir);
+}
+
+/* Copy throughput in each directory listed in GIO_COPY_BENCH_DIRS
+ * (colon separated, e.g. mount points of tmpfs, ext4 and btrfs loop
+ * images), or in the temporary directory.
+ */
+static void
+test_copy_throughput (void)
+{
+  const gchar *dirs_env;
+  gchar **dirs;
+  gsize size = 256 * 1024 * 1024;
+  gint i;
+
+  dirs_env = g_getenv ("GIO_COPY_BENCH_DIRS");
+  dirs = g_strsplit (dirs_env ? dirs_env : g_get_tmp_dir (), ":", -1);
+
+  for (i = 0; dirs[i]; i++)
+    {
+      GFile *source, *destination;
+      gchar *dir, *source_path, *dest_path;
+      GError *error = NULL;
+      GTimer *timer;
+      gdouble elapsed;
+
+      dir = g_build_filename (dirs[i], "g_file_copy_bench_XXXXXX", NULL);
+      g_assert (mkdtemp (dir) != NULL);
+      source_path = make_copy_source (dir, size);
+      dest_path = g_build_filename (dir, "destination", NULL);
+      source = g_file_new_for_path (source_path);
+      destination = g_file_new_for_path (dest_path);
+
+      timer = g_timer_new ();
+      g_assert (g_file_copy (source, destination, G_FILE_COPY_NONE, NULL,
+                             NULL, NULL, &error));
+      g_assert_no_error (error);
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      g_test_minimized_result (elapsed, "copy of %" G_GSIZE_FORMAT " MiB in %s: %.3f s",
+                               size / (1024 * 1024), dirs[i], elapsed);
+      g_test_message ("%s: %.1f MiB/s", dirs[i],
+                      size / (1024.0 * 1024.0) / MAX (elapsed, 1e-6));
+
+      g_object_unref (source);
+      g_object_unref (destination);
+      remove (source_path);
+      remove (dest_path);
+      remove (dir);
+      g_free (source_path);
+      g_free (dest_path);
+      g_free (dir);
+    }
+
+  g_strfreev (dirs);
+}
+
+static void
+make_tree (const gchar *dir,
+           gint         depth,
+           gint         n_files,
+           gint         n_dirs)
+{
+  gint i;
+
+  for (i = 0; i < n_files; i++)
+    {
+      gchar *name = g_strdup_printf ("%s/file%d", dir, i);
+      gchar *contents = g_strdup_printf ("%s %d", name, i * 1000);
+
+      g_assert (g_file_set_contents (name, contents, -1, NULL));
+      g_free (contents);
+      g_free (name);
+    }
+
+  if (depth == 0)
+    return;
+
+  for (i = 0; i < n_dirs; i++)
+    {
+      gchar *name = g_strdup_printf ("%s/dir%d", dir, i);
+
+      g_assert_cmpint (g_mkdir (name, 0755), ==, 0);
+      make_tree (name, depth - 1, n_files, n_dirs);
+      g_free (name);
+    }
+}
+
+/* Compares two trees, returns the number of files in them */
+static gint
+compare_trees (const gchar *a,
+               const gchar *b)
+{
+  GDir *dir;
+  const gchar *name;
+  gint n = 0;
+
+  dir = g_dir_open (a, 0, NULL);
+  g_assert (dir != NULL);
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *pa = g_build_filename (a, name, NULL);
+      gchar *pb = g_build_filename (b, name, NULL);
+
+      if (g_file_test (pa, G_FILE_TEST_IS_SYMLINK))
+        {
+          gchar *ta = g_file_read_link (pa, NULL);
+          gchar *tb = g_file_read_link (pb, NULL);
+
+          g_assert_cmpstr (ta, ==, tb);
+          g_free (ta);
+          g_free (tb);
+          n++;
+        }
+      else if (g_file_test (pa, G_FILE_TEST_IS_DIR))
+        {
+          g_assert (g_file_test (pb, G_FILE_TEST_IS_DIR));
+          n += compare_trees (pa, pb);
+        }
+      else
+        {
+          gchar *ca, *cb;
+
+          g_assert (g_file_get_contents (pa, &ca, NULL, NULL));
+          g_assert (g_file_get_contents (pb, &cb, NULL, NULL));
+          g_assert_cmpstr (ca, ==, cb);
+          g_free (ca);
+          g_free (cb);
+          n++;
+        }
+      g_free (pa);
+      g_free (pb);
+    }
+  g_dir_close (dir);
+
+  return n;
+}
+
+static void
+remove_tree (const gchar *path)
+{
+  GDir *dir;
+  const gchar *name;
+
+  if (!g_file_test (path, G_FILE_TEST_IS_SYMLINK) &&
+      (dir = g_dir_open (path, 0, NULL)) != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child = g_build_filename (path, name, NULL);
+          remove_tree (child);
+          g_free (child);
+        }
+      g_dir_close (dir);
+      g_rmdir (path);
+    }
+  else
+    g_remove (path);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  gboolean result;
+  GError *error;
+  goffset last;
+  goffset total;
+} CopyTreeData;
+
+static void
+copy_tree_progress_cb (goffset  current_num_bytes,
+                       goffset  total_num_bytes,
+                       gpointer user_data)
+{
+  CopyTreeData *data = user_data;
+
+  g_assert_cmpint (current_num_bytes, >=, data->last);
+  data->last = current_num_bytes;
+  data->total = total_num_bytes;
+}
+
+static void
+copy_tree_cb (GObject      *source,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+  CopyTreeData *data = user_data;
+
+  data->result = g_file_copy_tree_finish (G_FILE (source), res, &data->error);
+  g_main_loop_quit (data->loop);
+}
+
+static gboolean
+copy_tree (const gchar        *source_path,
+           const gchar        *dest_path,
+           GFileCopyFlags      flags,
+           GFileCopyTreeFlags  tree_flags,
+           guint               max_workers,
+           CopyTreeData       *data,
+           GError            **error)
+{
+  GFile *source, *destination;
+
+  source = g_file_new_for_path (source_path);
+  destination = g_file_new_for_path (dest_path);
+  data->loop = g_main_loop_new (NULL, FALSE);
+  data->error = NULL;
+  data->last = 0;
+  data->total = 0;
+
+  g_file_copy_tree_async (source, destination, flags, tree_flags, max_workers,
+                          G_PRIORITY_DEFAULT, NULL,
+                          copy_tree_progress_cb, data,
+                          copy_tree_cb, data);
+  g_main_loop_run (data->loop);
+
+  g_main_loop_unref (data->loop);
+  g_object_unref (source);
+  g_object_unref (destination);
+
+  if (data->error)
+    g_propagate_error (error, data->error);
+
+  return data->result;
+}
+
+/* A tree is copied with its symlinks and directory permissions */
+static void
+test_copy_tree (void)
+{
+  CopyTreeData data;
+  gchar *dir, *source, *dest, *path;
+  GError *error = NULL;
+  struct stat buf;
+
+  dir = g_build_filename (g_get_tmp_dir (), "g_file_copy_tree_XXXXXX", NULL);
+  g_assert (mkdtemp (dir) != NULL);
+  source = g_build_filename (dir, "source", NULL);
+  dest = g_build_filename (dir, "destination", NULL);
+
+  g_assert_cmpint (g_mkdir (source, 0755), ==, 0);
+  make_tree (source, 2, 5, 3);
+  path = g_build_filename (source, "dir1", "link", NULL);
+  g_assert_cmpint (symlink ("../file0", path), ==, 0);
+  g_free (path);
+  path = g_build_filename (source, "dir2", NULL);
+  g_assert_cmpint (g_chmod (path, 0500), ==, 0);
+  g_free (path);
+
+  g_assert (copy_tree (source, dest, G_FILE_COPY_NONE, G_FILE_COPY_TREE_NONE,
+                       4, &data, &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (compare_trees (source, dest), ==, 5 + 3 * (5 + 3 * 5) + 1);
+  g_assert_cmpint (data.last, ==, data.total);
+  g_assert_cmpint (data.total, >, 0);
+
+  /* Permissions are applied once the directory is filled */
+  path = g_build_filename (dest, "dir2", NULL);
+  g_assert_cmpint (g_stat (path, &buf), ==, 0);
+  g_assert_cmpint (buf.st_mode & 0777, ==, 0500);
+  g_assert_cmpint (g_chmod (path, 0755), ==, 0);
+  g_free (path);
+  path = g_build_filename (source, "dir2", NULL);
+  g_assert_cmpint (g_chmod (path, 0755), ==, 0);
+  g_free (path);
+
+  /* A single file is copied as well */
+  path = g_build_filename (source, "file1", NULL);
+  g_free (dest);
+  dest = g_build_filename (dir, "single", NULL);
+  g_assert (copy_tree (path, dest, G_FILE_COPY_NONE, G_FILE_COPY_TREE_NONE,
+                       0, &data, &error));
+  g_assert_no_error (error);
+  g_assert (g_file_test (dest, G_FILE_TEST_IS_REGULAR));
+  g_free (path);
+
+  remove_tree (dir);
+  g_free (source);
+  g_free (dest);
+  g_free (dir);
+}
+
+/* Existing destinations fail, merge, skip or are overwritten, and a
+ * missing source fails
+ */
+static void
+test_copy_tree_conflicts (void)
+{
+  CopyTreeData data;
+  gchar *dir, *source, *dest, *path, *contents;
+  GError *error = NULL;
+
+  dir = g_build_filename (g_get_tmp_dir (), "g_file_copy_tree_XXXXXX", NULL);
+  g_assert (mkdtemp (dir) != NULL);
+  source = g_build_filename (dir, "source", NULL);
+  dest = g_build_filename (dir, "destination", NULL);
+
+  g_assert_cmpint (g_mkdir (source, 0755), ==, 0);
+  make_tree (source, 1, 3, 2);
+  g_assert_cmpint (g_mkdir (dest, 0755), ==, 0);
+  path = g_build_filename (dest, "file1", NULL);
+  g_assert (g_file_set_contents (path, "old", -1, NULL));
+
+  g_assert (!copy_tree (source, dest, G_FILE_COPY_NONE, G_FILE_COPY_TREE_NONE,
+                        2, &data, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS);
+  g_clear_error (&error);
+
+  g_assert (!copy_tree (source, dest, G_FILE_COPY_NONE, G_FILE_COPY_TREE_MERGE,
+                        2, &data, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS);
+  g_clear_error (&error);
+
+  g_assert (copy_tree (source, dest, G_FILE_COPY_OVERWRITE,
+                       G_FILE_COPY_TREE_MERGE | G_FILE_COPY_TREE_SKIP_EXISTING,
+                       2, &data, &error));
+  g_assert_no_error (error);
+  g_assert (g_file_get_contents (path, &contents, NULL, NULL));
+  g_assert_cmpstr (contents, ==, "old");
+  g_free (contents);
+
+  g_assert (copy_tree (source, dest, G_FILE_COPY_OVERWRITE, G_FILE_COPY_TREE_MERGE,
+                       2, &data, &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (compare_trees (source, dest), ==, 3 + 2 * 3);
+  g_free (path);
+
+  /* A missing source is reported like any other error */
+  path = g_build_filename (dir, "missing", NULL);
+  g_assert (!copy_tree (path, dest, G_FILE_COPY_NONE, G_FILE_COPY_TREE_MERGE,
+                        2, &data, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&error);
+  g_free (path);
+
+  remove_tree (dir);
+  g_free (source);
+  g_free (dest);
+  g_free (dir);
+}
+
+/* Copy time of a tree of small files by number of workers. The tree
+ * has GIO_COPY_TREE_BENCH_FILES files (200000 by default), in the
+ * first directory of GIO_COPY_BENCH_DIRS or the temporary directory.
+ */
+static void
+test_copy_tree_scaling (void)
+{
+  const gchar *env;
+  gchar **dirs;
+  gchar *dir, *source;
+  gint n_files, per_dir, n_dirs;
+  guint workers;
+
+  env = g_getenv ("GIO_COPY_TREE_BENCH_FILES");
+  n_files = env ? atoi (env) : 200000;
+  env = g_getenv ("GIO_COPY_BENCH_DIRS");
+  dirs = g_strsplit (env ? env : g_get_tmp_dir (), ":", -1);
+
+  dir = g_build_filename (dirs[0], "g_file_copy_tree_bench_XXXXXX", NULL);
+  g_assert (mkdtemp (dir) != NULL);
+  source = g_build_filename (dir, "source", NULL);
+  g_assert_cmpint (g_mkdir (source, 0755), ==, 0);
+
+  /* Two levels of directories holding 100 files each */
+  per_dir = 100;
+  for (n_dirs = 1; (n_dirs + 1) * (n_dirs + 1) * per_dir <= n_files; n_dirs++)
+    ;
+  make_tree (source, 2, per_dir, n_dirs);
+
+  for (workers = 1; workers <= 16; workers *= 2)
+    {
+      CopyTreeData data;
+      GError *error = NULL;
+      gchar *dest;
+      GTimer *timer;
+      gdouble elapsed;
+
+      dest = g_strdup_printf ("%s/copy-%u", dir, workers);
+      timer = g_timer_new ();
+      g_assert (copy_tree (source, dest, G_FILE_COPY_NONE, G_FILE_COPY_TREE_NONE,
+                           workers, &data, &error));
+      g_assert_no_error (error);
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      g_test_minimized_result (elapsed, "tree copy with %u workers: %.3f s",
+                               workers, elapsed);
+      remove_tree (dest);
+      g_free (dest);
+    }
+
+  remove_tree (dir);
+  g_free (source);
+  g_free (dir);
+  g_strfreev (dirs);
+}
+
+static void
+compare_enumerated_infos (GFile               *dir,
+                          const gchar         *attributes,
+                          GFileQueryInfoFlags  flags)
+{
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+  GError *error = NULL;
+  gint n_infos;
+
+  enumerator = g_file_enumerate_children (dir, attributes, flags, NULL, &error);
+  g_assert_no_error (error);
+
+  n_infos = 0;
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL)
+    {
+      GFile *child;
+      GFileInfo *expected;
+      gchar **names;
+      gint i;
+
+      child = g_file_get_child (dir, g_file_info_get_name (info));
+      expected = g_file_query_info (child, attributes, flags, NULL, &error);
+      g_assert_no_error (error);
+
+      names = g_file_info_list_attributes (expected, NULL);
+      for (i = 0; names[i] != NULL; i++)
+        {
+          gchar *a, *b;
+
+          a = g_file_info_get_attribute_as_string (expected, names[i]);
+          b = g_file_info_get_attribute_as_string (info, names[i]);
+          if (g_strcmp0 (a, b) != 0)
+            g_error ("%s of %s with '%s': expected %s, got %s",
+                     names[i], g_file_info_get_name (info), attributes, a, b);
+          g_free (a);
+          g_free (b);
+        }
+      g_strfreev (names);
+
+      names = g_file_info_list_attributes (info, NULL);
+      for (i = 0; names[i] != NULL; i++)
+        g_assert (g_file_info_has_attribute (expected, names[i]));
+      g_strfreev (names);
+
+      g_object_unref (expected);
+      g_object_unref (child);
+      g_object_unref (info);
+      n_infos++;
+    }
+  g_assert_no_error (error);
+  g_assert_cmpint (n_infos, ==, 8);
+
+  g_object_unref (enumerator);
+}
+
+/* Enumerating with attributes that only need the directory entry or
+ * a stat must give the same results as querying each file.
+ */
+static void
+test_enumerate_fast (void)
+{
+  static const gchar *attributes[] = {
+    "standard::name",
+    "standard::name,standard::type",
+    "standard::name,standard::type,standard::is-hidden,standard::is-backup,standard::is-symlink,"
+    "standard::display-name,standard::edit-name,standard::copy-name",
+    "standard::name,standard::type,standard::size,standard::symlink-target,standard::is-backup,"
+    "time::modified,time::modified-usec,time::changed,unix::inode,unix::mode,"
+    "unix::nlink,unix::uid,etag::value,id::file,id::filesystem",
+    "standard::name,standard::type,standard::content-type,access::can-read,unix::is-mountpoint"
+  };
+  gchar *path, *name;
+  GFile *dir;
+  gint i;
+
+  path = g_build_filename (g_get_tmp_dir (), "g_file_enumerate_XXXXXX", NULL);
+  g_assert (mkdtemp (path) != NULL);
+
+  name = g_build_filename (path, "regular", NULL);
+  g_assert (g_file_set_contents (name, "content", -1, NULL));
+  g_free (name);
+  name = g_build_filename (path, ".hidden", NULL);
+  g_assert (g_file_set_contents (name, "", -1, NULL));
+  g_free (name);
+  name = g_build_filename (path, "backup~", NULL);
+  g_assert (g_file_set_contents (name, "old", -1, NULL));
+  g_free (name);
+  name = g_build_filename (path, "directory", NULL);
+  g_assert_cmpint (g_mkdir (name, 0755), ==, 0);
+  g_free (name);
+  name = g_build_filename (path, "fifo", NULL);
+  g_assert_cmpint (mkfifo (name, 0644), ==, 0);
+  g_free (name);
+  name = g_build_filename (path, "link", NULL);
+  g_assert_cmpint (symlink ("regular", name), ==, 0);
+  g_free (name);
+  name = g_build_filename (path, "dirlink", NULL);
+  g_assert_cmpint (symlink ("directory", name), ==, 0);
+  g_free (name);
+  name = g_build_filename (path, "broken~", NULL);
+  g_assert_cmpint (symlink ("nonexistent", name), ==, 0);
+  g_free (name);
+
+  dir = g_file_new_for_path (path);
+  for (i = 0; i < G_N_ELEMENTS (attributes); i++)
+    {
+      compare_enumerated_infos (dir, attributes[i], G_FILE_QUERY_INFO_NONE);
+      compare_enumerated_infos (dir, attributes[i], G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS);
+    }
+  g_object_unref (dir);
+
+  remove_tree (path);
+  g_free (path);
+}
+
+static void
+make_flat_dir (const gchar *path,
+               gint         n_files)
+{
+  gint i;
+
+  for (i = 0; i < n_files; i++)
+    {
+      gchar *name;
+      int fd;
+
+      name = g_strdup_printf ("%s/file-%07d", path, i);
+      fd = g_open (name, O_CREAT | O_WRONLY, 0644);
+      g_assert_cmpint (fd, >=, 0);
+      close (fd);
+      g_free (name);
+    }
+}
+
+static gint
+count_children (const gchar *path,
+                const gchar *attributes)
+{
+  GFile *dir;
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+  GError *error = NULL;
+  gint n;
+
+  dir = g_file_new_for_path (path);
+  enumerator = g_file_enumerate_children (dir, attributes,
+                                          G_FILE_QUERY_INFO_NONE,
+                                          NULL, &error);
+  g_assert_no_error (error);
+
+  n = 0;
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL)
+    {
+      n++;
+      g_object_unref (info);
+    }
+  g_assert_no_error (error);
+
+  g_object_unref (enumerator);
+  g_object_unref (dir);
+
+  return n;
+}
+
+/* A directory that needs several batches of entries */
+static void
+test_enumerate_large (void)
+{
+  gchar *path;
+
+  path = g_build_filename (g_get_tmp_dir (), "g_file_enumerate_XXXXXX", NULL);
+  g_assert (mkdtemp (path) != NULL);
+  make_flat_dir (path, 10000);
+
+  g_assert_cmpint (count_children (path, "standard::name,standard::type"), ==, 10000);
+  g_assert_cmpint (count_children (path, "standard::size"), ==, 10000);
+  g_assert_cmpint (count_children (path, "standard::*"), ==, 10000);
+
+  remove_tree (path);
+  g_free (path);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GFileEnumerator *enumerator;
+  gint num_files;
+  GList *infos;
+  gint n_calls;
+} NextFilesData;
+
+static void
+next_files_cb (GObject      *source,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+  NextFilesData *data = user_data;
+  GError *error = NULL;
+  GList *files;
+
+  files = g_file_enumerator_next_files_finish (data->enumerator, res, &error);
+  g_assert_no_error (error);
+  data->n_calls++;
+
+  if (files == NULL)
+    {
+      g_main_loop_quit (data->loop);
+      return;
+    }
+
+  g_assert_cmpint (g_list_length (files), <=, data->num_files);
+  data->infos = g_list_concat (data->infos, files);
+
+  g_file_enumerator_next_files_async (data->enumerator, data->num_files,
+                                      G_PRIORITY_DEFAULT, NULL,
+                                      next_files_cb, data);
+}
+
+/* Returns the infos of @path, in the order next_files_async() gave them */
+static GList *
+enumerate_async (const gchar *path,
+                 const gchar *attributes,
+                 gint         num_files)
+{
+  NextFilesData data = { 0, };
+  GFile *dir;
+  GError *error = NULL;
+
+  dir = g_file_new_for_path (path);
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.num_files = num_files;
+  data.enumerator = g_file_enumerate_children (dir, attributes,
+                                               G_FILE_QUERY_INFO_NONE,
+                                               NULL, &error);
+  g_assert_no_error (error);
+
+  g_file_enumerator_next_files_async (data.enumerator, num_files,
+                                      G_PRIORITY_DEFAULT, NULL,
+                                      next_files_cb, &data);
+  g_main_loop_run (data.loop);
+
+  g_object_unref (data.enumerator);
+  g_main_loop_unref (data.loop);
+  g_object_unref (dir);
+
+  return data.infos;
+}
+
+static GList *
+enumerate_sync (const gchar *path,
+                const gchar *attributes)
+{
+  GFile *dir;
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+  GError *error = NULL;
+  GList *infos = NULL;
+
+  dir = g_file_new_for_path (path);
+  enumerator = g_file_enumerate_children (dir, attributes,
+                                          G_FILE_QUERY_INFO_NONE,
+                                          NULL, &error);
+  g_assert_no_error (error);
+
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL)
+    infos = g_list_prepend (infos, info);
+  g_assert_no_error (error);
+
+  g_object_unref (enumerator);
+  g_object_unref (dir);
+
+  return g_list_reverse (infos);
+}
+
+static void
+free_infos (GList *infos)
+{
+  g_list_foreach (infos, (GFunc) g_object_unref, NULL);
+  g_list_free (infos);
+}
+
+/* next_files_async() must return the same files, in the same order,
+ * as next_file(), however many threads it uses.
+ */
+static void
+test_enumerate_async (void)
+{
+  static const gchar *attributes[] = {
+    "standard::name,standard::type",
+    "standard::name,standard::size,unix::inode",
+    "standard::name,standard::content-type"
+  };
+  static const gint num_files[] = { 1, 7, 100, 5000, G_MAXINT };
+  gchar *path;
+  gint i, j;
+
+  path = g_build_filename (g_get_tmp_dir (), "g_file_enumerate_XXXXXX", NULL);
+  g_assert (mkdtemp (path) != NULL);
+  make_flat_dir (path, 3000);
+
+  for (i = 0; i < G_N_ELEMENTS (attributes); i++)
+    {
+      GList *expected;
+
+      expected = enumerate_sync (path, attributes[i]);
+      g_assert_cmpint (g_list_length (expected), ==, 3000);
+
+      for (j = 0; j < G_N_ELEMENTS (num_files); j++)
+        {
+          GList *infos, *l, *e;
+
+          if (num_files[j] == 1 && i > 0)
+            continue;
+
+          infos = enumerate_async (path, attributes[i], num_files[j]);
+          g_assert_cmpint (g_list_length (infos), ==, 3000);
+
+          for (l = infos, e = expected; l != NULL; l = l->next, e = e->next)
+            {
+              g_assert_cmpstr (g_file_info_get_name (l->data), ==,
+                               g_file_info_get_name (e->data));
+              if (i == 1)
+                g_assert_cmpint (g_file_info_get_attribute_uint64 (l->data, "unix::inode"), ==,
+                                 g_file_info_get_attribute_uint64 (e->data, "unix::inode"));
+            }
+
+          free_infos (infos);
+        }
+
+      free_infos (expected);
+    }
+
+  remove_tree (path);
+  g_free (path);
+}
+
+static void
+next_files_then_sync_cb (GObject      *source,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  NextFilesData *data = user_data;
+  GError *error = NULL;
+
+  data->infos = g_file_enumerator_next_files_finish (data->enumerator, res, &error);
+  g_assert_no_error (error);
+  g_main_loop_quit (data->loop);
+}
+
+/* A next_file() after next_files_async() picks up where it left off,
+ * including whatever was prefetched.
+ */
+static void
+test_enumerate_async_then_sync (void)
+{
+  NextFilesData data = { 0, };
+  GFile *dir;
+  GFileInfo *info;
+  GError *error = NULL;
+  GHashTable *seen;
+  GList *l;
+  gchar *path;
+
+  path = g_build_filename (g_get_tmp_dir (), "g_file_enumerate_XXXXXX", NULL);
+  g_assert (mkdtemp (path) != NULL);
+  make_flat_dir (path, 1000);
+
+  dir = g_file_new_for_path (path);
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.enumerator = g_file_enumerate_children (dir, "standard::name,standard::size",
+                                               G_FILE_QUERY_INFO_NONE,
+                                               NULL, &error);
+  g_assert_no_error (error);
+
+  g_file_enumerator_next_files_async (data.enumerator, 100,
+                                      G_PRIORITY_DEFAULT, NULL,
+                                      next_files_then_sync_cb, &data);
+  g_main_loop_run (data.loop);
+  g_assert_cmpint (g_list_length (data.infos), ==, 100);
+
+  seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (l = data.infos; l != NULL; l = l->next)
+    g_hash_table_insert (seen, g_strdup (g_file_info_get_name (l->data)), l);
+  free_infos (data.infos);
+
+  while ((info = g_file_enumerator_next_file (data.enumerator, NULL, &error)) != NULL)
+    {
+      g_assert (!g_hash_table_lookup (seen, g_file_info_get_name (info)));
+      g_hash_table_insert (seen, g_strdup (g_file_info_get_name (info)), info);
+      g_object_unref (info);
+    }
+  g_assert_no_error (error);
+  g_assert_cmpint (g_hash_table_size (seen), ==, 1000);
+
+  g_assert (g_file_enumerator_close (data.enumerator, NULL, &error));
+  g_assert_no_error (error);
+
+  g_hash_table_destroy (seen);
+  g_object_unref (data.enumerator);
+  g_main_loop_unref (data.loop);
+  g_object_unref (dir);
+  remove_tree (path);
+  g_free (path);
+}
+
+/* Time to sniff the content type of GIO_ENUMERATE_ASYNC_BENCH_FILES
+ * files (20000 by default) with next_files_async(), by number of
+ * threads. The directory is created in the first directory of
+ * GIO_COPY_BENCH_DIRS or the temporary directory; it is most
+ * interesting on a network filesystem.
+ */
+static void
+test_enumerate_async_scaling (void)
+{
+  const gchar *env;
+  gchar **dirs;
+  gchar *path;
+  gint n_files, i;
+  guint threads;
+
+  env = g_getenv ("GIO_ENUMERATE_ASYNC_BENCH_FILES");
+  n_files = env ? atoi (env) : 20000;
+  env = g_getenv ("GIO_COPY_BENCH_DIRS");
+  dirs = g_strsplit (env ? env : g_get_tmp_dir (), ":", -1);
+
+  path = g_build_filename (dirs[0], "g_file_enumerate_bench_XXXXXX", NULL);
+  g_assert (mkdtemp (path) != NULL);
+  for (i = 0; i < n_files; i++)
+    {
+      gchar *name;
+
+      name = g_strdup_printf ("%s/file-%07d", path, i);
+      g_assert (g_file_set_contents (name, "#!/bin/sh\necho hello\n", -1, NULL));
+      g_free (name);
+    }
+
+  for (threads = 1; threads <= 16; threads *= 2)
+    {
+      gchar *value;
+      GTimer *timer;
+      gdouble elapsed;
+      GList *infos;
+
+      value = g_strdup_printf ("%u", threads);
+      g_setenv ("GIO_ENUMERATOR_THREADS", value, TRUE);
+      g_free (value);
+
+      timer = g_timer_new ();
+      infos = enumerate_async (path, "standard::name,standard::content-type", 100);
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      g_assert_cmpint (g_list_length (infos), ==, n_files);
+      free_infos (infos);
+
+      g_test_minimized_result (elapsed, "next_files_async with %u threads: %.3f s",
+                               threads, elapsed);
+    }
+  g_unsetenv ("GIO_ENUMERATOR_THREADS");
+
+  remove_tree (path);
+  g_free (path);
+  g_strfreev (dirs);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GHashTable *results;
+  GHashTable *errors;
+  gint n_chunks;
+  gboolean done;
+  GError *error;
+} QueryInfoMultipleData;
+
+static void
+query_info_chunk_cb (GFile     **files,
+                     GFileInfo **infos,
+                     GError    **errors,
+                     guint       n_files,
+                     gpointer    user_data)
+{
+  QueryInfoMultipleData *data = user_data;
+  guint i;
+
+  g_assert (!data->done);
+  data->n_chunks++;
+
+  for (i = 0; i < n_files; i++)
+    {
+      g_assert (!g_hash_table_lookup (data->results, files[i]));
+      g_assert (!g_hash_table_lookup (data->errors, files[i]));
+      g_assert ((infos[i] == NULL) != (errors[i] == NULL));
+      if (infos[i])
+        g_hash_table_insert (data->results, g_object_ref (files[i]),
+                             g_object_ref (infos[i]));
+      else
+        g_hash_table_insert (data->errors, g_object_ref (files[i]),
+                             g_error_copy (errors[i]));
+    }
+}
+
+static void
+query_info_multiple_cb (GObject      *source,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  QueryInfoMultipleData *data = user_data;
+
+  g_assert (source == NULL);
+  g_file_query_info_multiple_finish (res, &data->error);
+  data->done = TRUE;
+  g_main_loop_quit (data->loop);
+}
+
+/* Returns the infos by file, and the errors in @errors */
+static GHashTable *
+query_info_multiple (GPtrArray    *files,
+                     const gchar  *attributes,
+                     GCancellable *cancellable,
+                     gint         *n_chunks,
+                     GHashTable  **errors,
+                     GError      **error)
+{
+  QueryInfoMultipleData data = { 0, };
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.results = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal,
+                                        g_object_unref, g_object_unref);
+  data.errors = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal,
+                                       g_object_unref, (GDestroyNotify) g_error_free);
+
+  g_file_query_info_multiple_async ((GFile **) files->pdata, files->len,
+                                    attributes, G_FILE_QUERY_INFO_NONE,
+                                    G_PRIORITY_DEFAULT, cancellable,
+                                    query_info_chunk_cb, &data,
+                                    query_info_multiple_cb, &data);
+  g_main_loop_run (data.loop);
+  g_main_loop_unref (data.loop);
+
+  if (n_chunks)
+    *n_chunks = data.n_chunks;
+  if (errors)
+    *errors = data.errors;
+  else
+    g_hash_table_destroy (data.errors);
+  if (data.error)
+    g_propagate_error (error, data.error);
+
+  return data.results;
+}
+
+static void
+test_query_info_multiple (void)
+{
+  static const gchar *attributes[] = {
+    "standard::name,standard::size,time::modified",
+    "standard::name,standard::size,standard::content-type"
+  };
+  gchar *paths[2], *name;
+  GPtrArray *files;
+  gint i, j, n_chunks;
+
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = 0; i < 2; i++)
+    {
+      paths[i] = g_build_filename (g_get_tmp_dir (), "g_file_query_info_XXXXXX", NULL);
+      g_assert (mkdtemp (paths[i]) != NULL);
+      make_flat_dir (paths[i], 300);
+
+      for (j = 0; j < 300; j++)
+        {
+          name = g_strdup_printf ("%s/file-%07d", paths[i], j);
+          g_ptr_array_add (files, g_file_new_for_path (name));
+          g_free (name);
+        }
+      name = g_build_filename (paths[i], "missing", NULL);
+      g_ptr_array_add (files, g_file_new_for_path (name));
+      g_free (name);
+    }
+  g_ptr_array_add (files, g_file_new_for_uri ("no-such-scheme:///file"));
+
+  /* Mix up the directories */
+  for (i = 0; i < files->len; i += 2)
+    {
+      gpointer tmp = files->pdata[i];
+      files->pdata[i] = files->pdata[files->len - 1 - i];
+      files->pdata[files->len - 1 - i] = tmp;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (attributes); i++)
+    {
+      GHashTable *results, *errors;
+      GError *error = NULL;
+
+      results = query_info_multiple (files, attributes[i], NULL, &n_chunks, &errors, &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (g_hash_table_size (results), ==, files->len - 3);
+      g_assert_cmpint (g_hash_table_size (errors), ==, 3);
+      g_assert_cmpint (n_chunks, >, 2);
+
+      for (j = 0; j < files->len; j++)
+        {
+          GFile *file = files->pdata[j];
+          GFileInfo *result = g_hash_table_lookup (results, file);
+          GFileInfo *expected;
+
+          expected = g_file_query_info (file, attributes[i], G_FILE_QUERY_INFO_NONE,
+                                        NULL, &error);
+          if (expected == NULL)
+            {
+              GError *result_error = g_hash_table_lookup (errors, file);
+
+              g_assert (result == NULL);
+              g_assert_error (result_error, error->domain, error->code);
+              g_clear_error (&error);
+              continue;
+            }
+
+          g_assert (result != NULL);
+          g_assert_cmpstr (g_file_info_get_name (result), ==, g_file_info_get_name (expected));
+          g_assert_cmpint (g_file_info_get_size (result), ==, g_file_info_get_size (expected));
+          g_assert_cmpstr (g_file_info_get_attribute_string (result, "standard::content-type"), ==,
+                           g_file_info_get_attribute_string (expected, "standard::content-type"));
+          g_object_unref (expected);
+        }
+
+      g_hash_table_destroy (results);
+      g_hash_table_destroy (errors);
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      remove_tree (paths[i]);
+      g_free (paths[i]);
+    }
+  g_ptr_array_free (files, TRUE);
+}
+
+static void
+test_query_info_multiple_cancel (void)
+{
+  GCancellable *cancellable;
+  GPtrArray *files;
+  GHashTable *results;
+  GError *error = NULL;
+
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (files, g_file_new_for_path (g_get_tmp_dir ()));
+
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+
+  results = query_info_multiple (files, "standard::name", cancellable, NULL, NULL, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_cmpint (g_hash_table_size (results), ==, 0);
+  g_clear_error (&error);
+  g_hash_table_destroy (results);
+
+  results = query_info_multiple (files, "standard::name", NULL, NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (g_hash_table_size (results), ==, 1);
+
+  g_hash_table_destroy (results);
+  g_object_unref (cancellable);
+  g_ptr_array_free (files, TRUE);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  gint pending;
+} QueryInfoEachData;
+
+static void
+query_info_each_cb (GObject      *source,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  QueryInfoEachData *data = user_data;
+  GFileInfo *info;
+
+  info = g_file_query_info_finish (G_FILE (source), res, NULL);
+  g_assert (info != NULL);
+  g_object_unref (info);
+
+  if (--data->pending == 0)
+    g_main_loop_quit (data->loop);
+}
+
+/* Time to query GIO_QUERY_INFO_BENCH_FILES files (10000 by default),
+ * spread over 100 directories, with one g_file_query_info_async()
+ * per file and with g_file_query_info_multiple_async().
+ */
+static void
+test_query_info_multiple_throughput (void)
+{
+  static const gchar *attributes[] = {
+    "standard::name,standard::type,standard::size,time::modified",
+    "standard::*"
+  };
+  const gchar *env;
+  GPtrArray *files;
+  gchar *path;
+  gint n_files, i, j;
+
+  env = g_getenv ("GIO_QUERY_INFO_BENCH_FILES");
+  n_files = env ? atoi (env) : 10000;
+
+  path = g_build_filename (g_get_tmp_dir (), "g_file_query_info_bench_XXXXXX", NULL);
+  g_assert (mkdtemp (path) != NULL);
+
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = 0; i < 100; i++)
+    {
+      gchar *dir = g_strdup_printf ("%s/dir-%03d", path, i);
+
+      g_assert_cmpint (g_mkdir (dir, 0755), ==, 0);
+      make_flat_dir (dir, n_files / 100);
+      for (j = 0; j < n_files / 100; j++)
+        {
+          gchar *name = g_strdup_printf ("%s/file-%07d", dir, j);
+          g_ptr_array_add (files, g_file_new_for_path (name));
+          g_free (name);
+        }
+      g_free (dir);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (attributes); i++)
+    {
+      QueryInfoEachData data;
+      GHashTable *results;
+      GError *error = NULL;
+      GTimer *timer;
+      gdouble elapsed;
+
+      timer = g_timer_new ();
+      data.loop = g_main_loop_new (NULL, FALSE);
+      data.pending = files->len;
+      for (j = 0; j < files->len; j++)
+        g_file_query_info_async (files->pdata[j], attributes[i],
+                                 G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT,
+                                 NULL, query_info_each_cb, &data);
+      g_main_loop_run (data.loop);
+      g_main_loop_unref (data.loop);
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_test_minimized_result (elapsed, "%u x g_file_query_info_async ('%s'): %.3f s",
+                               files->len, attributes[i], elapsed);
+
+      g_timer_start (timer);
+      results = query_info_multiple (files, attributes[i], NULL, NULL, NULL, &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (g_hash_table_size (results), ==, files->len);
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_test_minimized_result (elapsed, "g_file_query_info_multiple_async ('%s'): %.3f s",
+                               attributes[i], elapsed);
+
+      g_hash_table_destroy (results);
+      g_timer_destroy (timer);
+    }
+
+  remove_tree (path);
+  g_free (path);
+  g_ptr_array_free (files, TRUE);
+}
+
+/* Enumeration time of a directory of GIO_ENUMERATE_BENCH_FILES files
+ * (1000000 by default), created in the first directory of
+ * GIO_COPY_BENCH_DIRS or the temporary directory.
+ */
+static void
+test_enumerate_throughput (void)
+{
+  static const gchar *attributes[] = {
+    "standard::name,standard::type",
+    "standard::name,standard::size,time::modified",
+    "standard::*"
+  };
+  const gchar *env;
+  gchar **dirs;
+  gchar *path;
+  gint n_files, i;
+
+  env = g_getenv ("GIO_ENUMERATE_BENCH_FILES");
+  n_files = env ? atoi (env) : 1000000;
+  env = g_getenv ("GIO_COPY_BENCH_DIRS");
+  dirs = g_strsplit (env ? env : g_get_tmp_dir (), ":", -1);
+
+  path = g_build_filename (dirs[0], "g_file_enumerate_bench_XXXXXX", NULL);
+  g_assert (mkdtemp (path) != NULL);
+  make_flat_dir (path, n_files);
+
+  for (i = 0; i < G_N_ELEMENTS (attributes); i++)
+    {
+      GTimer *timer;
+      gdouble elapsed;
+
+      timer = g_timer_new ();
+      g_assert_cmpint (count_children (path, attributes[i]), ==, n_files);
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      g_test_minimized_result (elapsed, "enumerating %d files with '%s': %.3f s",
+                               n_files, attributes[i], elapsed);
+    }
+
+  remove_tree (path);
+  g_free (path);
+  g_strfreev (dirs);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GInputStream *in;
+  GOutputStream *out;
+  const gchar *data;
+  gsize length;
+  gsize pos;
+  gchar buffer[1000];
+} AsyncRWData;
+
+static void
+async_write_cb (GObject      *source,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+  AsyncRWData *data = user_data;
+  GError *error = NULL;
+  gssize n;
+
+  n = g_output_stream_write_finish (G_OUTPUT_STREAM (source), res, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (n, >, 0);
+
+  data->pos += n;
+  if (data->pos < data->length)
+    g_output_stream_write_async (data->out, data->data + data->pos,
+                                 MIN (1000, data->length - data->pos),
+                                 G_PRIORITY_DEFAULT, NULL,
+                                 async_write_cb, data);
+  else
+    g_main_loop_quit (data->loop);
+}
+
+static void
+async_read_cancelled_cb (GObject      *source,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  AsyncRWData *data = user_data;
+  GError *error = NULL;
+
+  g_assert_cmpint (g_input_stream_read_finish (G_INPUT_STREAM (source), res, &error), ==, -1);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_error_free (error);
+
+  g_main_loop_quit (data->loop);
+}
+
+static void
+async_read_cb (GObject      *source,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+  AsyncRWData *data = user_data;
+  GError *error = NULL;
+  gssize n;
+
+  n = g_input_stream_read_finish (G_INPUT_STREAM (source), res, &error);
+  g_assert_no_error (error);
+
+  if (n == 0)
+    {
+      g_assert_cmpint (data->pos, ==, data->length);
+      g_main_loop_quit (data->loop);
+      return;
+    }
+
+  g_assert_cmpint (data->pos + n, <=, data->length);
+  g_assert (memcmp (data->buffer, data->data + data->pos, n) == 0);
+  data->pos += n;
+
+  g_input_stream_read_async (data->in, data->buffer, sizeof (data->buffer),
+                             G_PRIORITY_DEFAULT, NULL,
+                             async_read_cb, data);
+}
+
+/* Writes a file in chunks with g_output_stream_write_async() and reads
+ * it back with g_input_stream_read_async(), in a thread-default context
+ * of its own, so that the requests go through the ring of that context
+ * where io_uring is available.
+ */
+static void
+test_async_read_write (void)
+{
+  GMainContext *context;
+  AsyncRWData data;
+  GFileIOStream *iostream;
+  GCancellable *cancellable;
+  GFile *file;
+  GError *error = NULL;
+  gchar *contents;
+  gchar *path;
+  gsize i;
+  gint fd;
+
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  memset (&data, 0, sizeof (data));
+  data.length = 100 * 1000 + 123;
+  contents = g_malloc (data.length);
+  for (i = 0; i < data.length; i++)
+    contents[i] = g_random_int_range (0, 256);
+  data.data = contents;
+  data.loop = g_main_loop_new (context, FALSE);
+
+  fd = g_file_open_tmp ("g_file_async_rw_XXXXXX", &path, &error);
+  g_assert_no_error (error);
+  close (fd);
+  file = g_file_new_for_path (path);
+  data.out = G_OUTPUT_STREAM (g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error));
+  g_assert_no_error (error);
+  g_output_stream_write_async (data.out, data.data, 1000, G_PRIORITY_DEFAULT,
+                               NULL, async_write_cb, &data);
+  g_main_loop_run (data.loop);
+  g_output_stream_close (data.out, NULL, &error);
+  g_assert_no_error (error);
+  g_object_unref (data.out);
+
+  data.pos = 0;
+  data.in = G_INPUT_STREAM (g_file_read (file, NULL, &error));
+  g_assert_no_error (error);
+  g_input_stream_read_async (data.in, data.buffer, sizeof (data.buffer),
+                             G_PRIORITY_DEFAULT, NULL, async_read_cb, &data);
+  g_main_loop_run (data.loop);
+
+  /* A cancelled request fails without touching the file position */
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+  g_assert (g_seekable_seek (G_SEEKABLE (data.in), 10, G_SEEK_SET, NULL, &error));
+  g_input_stream_read_async (data.in, data.buffer, sizeof (data.buffer),
+                             G_PRIORITY_DEFAULT, cancellable,
+                             async_read_cancelled_cb, &data);
+  g_main_loop_run (data.loop);
+  g_assert_cmpint (g_seekable_tell (G_SEEKABLE (data.in)), ==, 10);
+  g_object_unref (cancellable);
+  g_object_unref (data.in);
+
+  /* The output stream of a read-write stream writes at the current
+   * position, like write() does.
+   */
+  iostream = g_file_open_readwrite (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (g_seekable_seek (G_SEEKABLE (iostream), 10, G_SEEK_SET, NULL, &error));
+  data.out = g_io_stream_get_output_stream (G_IO_STREAM (iostream));
+  data.pos = 10;
+  data.length = 1010;
+  g_output_stream_write_async (data.out, data.data + 10, 1000, G_PRIORITY_DEFAULT,
+                               NULL, async_write_cb, &data);
+  g_main_loop_run (data.loop);
+  g_assert_cmpint (g_seekable_tell (G_SEEKABLE (iostream)), ==, 1010);
+  g_object_unref (iostream);
+
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+  g_free (path);
+  g_free (contents);
+  g_main_loop_unref (data.loop);
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+}
+
+/* A read on a FIFO may block for as long as there is no writer, so it
+ * must stay cancellable after it has been started.
+ */
+static void
+test_async_read_fifo_cancel (void)
+{
+  GMainContext *context;
+  AsyncRWData data;
+  GCancellable *cancellable;
+  GFile *file;
+  GError *error = NULL;
+  gchar *dir, *path;
+  gint fd;
+
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  memset (&data, 0, sizeof (data));
+  data.loop = g_main_loop_new (context, FALSE);
+
+  dir = g_build_filename (g_get_tmp_dir (), "g_file_fifo_XXXXXX", NULL);
+  g_assert (mkdtemp (dir) != NULL);
+  path = g_build_filename (dir, "fifo", NULL);
+  g_assert_cmpint (mkfifo (path, 0600), ==, 0);
+
+  /* Opening the writing end first keeps g_file_read() from blocking */
+  fd = g_open (path, O_RDWR | O_NONBLOCK, 0);
+  g_assert_cmpint (fd, >=, 0);
+  file = g_file_new_for_path (path);
+  data.in = G_INPUT_STREAM (g_file_read (file, NULL, &error));
+  g_assert_no_error (error);
+
+  cancellable = g_cancellable_new ();
+  g_input_stream_read_async (data.in, data.buffer, sizeof (data.buffer),
+                             G_PRIORITY_DEFAULT, cancellable,
+                             async_read_cancelled_cb, &data);
+  g_cancellable_cancel (cancellable);
+
+  /* Lets a read that is blocked complete */
+  g_assert_cmpint (write (fd, "x", 1), ==, 1);
+  g_main_loop_run (data.loop);
+
+  g_object_unref (cancellable);
+  g_object_unref (data.in);
+  close (fd);
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+  g_rmdir (dir);
+  g_free (path);
+  g_free (dir);
+  g_main_loop_unref (data.loop);
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  gint pending;
+  guint64 total;
+} AsyncReadBenchData;
+
+typedef struct
+{
+  AsyncReadBenchData *bench;
+  GInputStream *in;
+  gchar buffer[4096];
+} AsyncReadBenchStream;
+
+static void
+async_read_bench_cb (GObject      *source,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  AsyncReadBenchStream *stream = user_data;
+  gssize n;
+
+  n = g_input_stream_read_finish (G_INPUT_STREAM (source), res, NULL);
+  g_assert_cmpint (n, >=, 0);
+
+  if (n > 0)
+    {
+      stream->bench->total += n;
+      g_input_stream_read_async (stream->in, stream->buffer, sizeof (stream->buffer),
+                                 G_PRIORITY_DEFAULT, NULL,
+                                 async_read_bench_cb, stream);
+    }
+  else if (--stream->bench->pending == 0)
+    g_main_loop_quit (stream->bench->loop);
+}
+
+/* Reads GIO_ASYNC_READ_BENCH_FILES files (1000 by default) of 64 KiB
+ * concurrently, 4 KiB per g_input_stream_read_async(), once through
+ * io_uring and once through the thread pool (GIO_DISABLE_IO_URING).
+ * Each run uses a fresh thread-default context, so it gets a fresh ring.
+ */
+static void
+test_async_read_throughput (void)
+{
+  static const gchar *modes[] = { "io_uring", "threads" };
+  const gchar *env;
+  gchar *path;
+  gchar *contents;
+  gint n_files, i, j;
+
+  env = g_getenv ("GIO_ASYNC_READ_BENCH_FILES");
+  n_files = env ? atoi (env) : 1000;
+
+  path = g_build_filename (g_get_tmp_dir (), "g_file_async_read_bench_XXXXXX", NULL);
+  g_assert (mkdtemp (path) != NULL);
+  contents = g_malloc0 (64 * 1024);
+  for (i = 0; i < n_files; i++)
+    {
+      gchar *name = g_strdup_printf ("%s/file-%07d", path, i);
+      g_assert (g_file_set_contents (name, contents, 64 * 1024, NULL));
+      g_free (name);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      AsyncReadBenchData bench;
+      AsyncReadBenchStream *streams;
+      GMainContext *context;
+      GTimer *timer;
+      gdouble elapsed;
+
+      if (i == 0)
+        g_unsetenv ("GIO_DISABLE_IO_URING");
+      else
+        g_setenv ("GIO_DISABLE_IO_URING", "1", TRUE);
+
+      context = g_main_context_new ();
+      g_main_context_push_thread_default (context);
+
+      streams = g_new0 (AsyncReadBenchStream, n_files);
+      for (j = 0; j < n_files; j++)
+        {
+          gchar *name = g_strdup_printf ("%s/file-%07d", path, j);
+          GFile *file = g_file_new_for_path (name);
+
+          streams[j].bench = &bench;
+          streams[j].in = G_INPUT_STREAM (g_file_read (file, NULL, NULL));
+          g_assert (streams[j].in != NULL);
+          g_object_unref (file);
+          g_free (name);
+        }
+
+      bench.loop = g_main_loop_new (context, FALSE);
+      bench.pending = n_files;
+      bench.total = 0;
+
+      timer = g_timer_new ();
+      for (j = 0; j < n_files; j++)
+        g_input_stream_read_async (streams[j].in, streams[j].buffer, sizeof (streams[j].buffer),
+                                   G_PRIORITY_DEFAULT, NULL,
+                                   async_read_bench_cb, &streams[j]);
+      g_main_loop_run (bench.loop);
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      g_assert_cmpuint (bench.total, ==, (guint64) n_files * 64 * 1024);
+      g_test_minimized_result (elapsed, "%d concurrent async readers (%s): %.3f s",
+                               n_files, modes[i], elapsed);
+
+      for (j = 0; j < n_files; j++)
+        g_object_unref (streams[j].in);
+      g_free (streams);
+      g_main_loop_unref (bench.loop);
+      g_main_context_pop_thread_default (context);
+      g_main_context_unref (context);
+    }
+
+  g_unsetenv ("GIO_DISABLE_IO_URING");
+  remove_tree (path);
+  g_free (contents);
+  g_free (path);
+}
+
 int
 main (int argc, char *argv[])
 {
+  g_thread_init (NULL);
   g_type_init ();
 
   g_test_init (&argc, &argv, NULL);
@@ -607,6 +2416,29 @@ main (int argc, char *argv[])
   g_test_add_data_func ("/file/async-create-delete/25", GINT_TO_POINTER (25), test_create_delete);
   g_test_add_data_func ("/file/async-create-delete/4096", GINT_TO_POINTER (4096), test_create_delete);
   g_test_add_func ("/file/replace-load", test_replace_load);
+  g_test_add_func ("/file/monitor-missing", test_monitor_missing);
+  g_test_add_func ("/file/copy-large", test_copy_large);
+  g_test_add_func ("/file/copy-cancel", test_copy_cancel);
+  g_test_add_func ("/file/copy-tree", test_copy_tree);
+  g_test_add_func ("/file/copy-tree-conflicts", test_copy_tree_conflicts);
+  g_test_add_func ("/file/enumerate-fast", test_enumerate_fast);
+  g_test_add_func ("/file/enumerate-large", test_enumerate_large);
+  g_test_add_func ("/file/enumerate-async", test_enumerate_async);
+  g_test_add_func ("/file/enumerate-async-then-sync", test_enumerate_async_then_sync);
+  g_test_add_func ("/file/query-info-multiple", test_query_info_multiple);
+  g_test_add_func ("/file/query-info-multiple-cancel", test_query_info_multiple_cancel);
+  g_test_add_func ("/file/async-read-write", test_async_read_write);
+  g_test_add_func ("/file/async-read-fifo-cancel", test_async_read_fifo_cancel);
+
+  if (g_test_perf ())
+    {
+      g_test_add_func ("/file/copy-throughput", test_copy_throughput);
+      g_test_add_func ("/file/copy-tree-scaling", test_copy_tree_scaling);
+      g_test_add_func ("/file/enumerate-throughput", test_enumerate_throughput);
+      g_test_add_func ("/file/enumerate-async-scaling", test_enumerate_async_scaling);
+      g_test_add_func ("/file/query-info-multiple-throughput", test_query_info_multiple_throughput);
+      g_test_add_func ("/file/async-read-throughput", test_async_read_throughput);
+    }
 
   return g_test_run ();
 }
@@ -0,0 +1,186 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#define WAIT_TIMEOUT 10 /* seconds */
+
+typedef struct {
+  GMainLoop *loop;
+  GFileMonitorEvent expected;
+  gchar *expected_name;
+  gboolean seen;
+} Watch;
+
+static void
+changed_cb (GFileMonitor      *monitor,
+            GFile             *file,
+            GFile             *other_file,
+            GFileMonitorEvent  event_type,
+            gpointer           user_data)
+{
+  Watch *w = user_data;
+  gchar *name;
+
+  name = g_file_get_basename (file);
+  if (event_type == w->expected && strcmp (name, w->expected_name) == 0)
+    {
+      w->seen = TRUE;
+      g_main_loop_quit (w->loop);
+    }
+  g_free (name);
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return FALSE;
+}
+
+static gboolean
+wait_for (Watch             *w,
+          GFileMonitorEvent  event,
+          const gchar       *name)
+{
+  guint id;
+
+  w->expected = event;
+  w->expected_name = g_strdup (name);
+  w->seen = FALSE;
+
+  id = g_timeout_add_seconds (WAIT_TIMEOUT, timeout_cb, w->loop);
+  g_main_loop_run (w->loop);
+  g_source_remove (id);
+
+  g_free (w->expected_name);
+  w->expected_name = NULL;
+
+  return w->seen;
+}
+
+static GFileMonitor *
+monitor_dir (const gchar *path, Watch *w)
+{
+  GFileMonitor *monitor;
+  GFile *file;
+  GError *error = NULL;
+
+  file = g_file_new_for_path (path);
+  monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, &error);
+  g_assert_no_error (error);
+  g_signal_connect (monitor, "changed", G_CALLBACK (changed_cb), w);
+  g_object_unref (file);
+
+  return monitor;
+}
+
+/* With a budget of one watch, the second directory is polled and
+ * still reports its changes.
+ */
+static void
+test_polled_dir (void)
+{
+  GFileMonitor *watched, *polled;
+  GVariant *stats;
+  const gchar *backend;
+  gchar *dir, *a, *b, *file;
+  guint32 budget, n_polled;
+  Watch w;
+  FILE *f;
+
+  dir = g_strdup ("inotify-budget-XXXXXX");
+  g_assert (mkdtemp (dir) != NULL);
+  a = g_build_filename (dir, "a", NULL);
+  b = g_build_filename (dir, "b", NULL);
+  g_assert_cmpint (g_mkdir (a, 0755), ==, 0);
+  g_assert_cmpint (g_mkdir (b, 0755), ==, 0);
+
+  w.loop = g_main_loop_new (NULL, FALSE);
+  w.expected_name = NULL;
+  watched = monitor_dir (a, &w);
+  polled = monitor_dir (b, &w);
+
+  stats = g_file_monitor_get_statistics (polled);
+  if (!g_variant_lookup (stats, "backend", "&s", &backend) ||
+      strcmp (backend, "inotify") != 0)
+    {
+      g_test_message ("not using inotify, skipping");
+      goto out;
+    }
+  g_assert (g_variant_lookup (stats, "watch-budget", "u", &budget));
+  g_assert_cmpuint (budget, ==, 1);
+  g_assert (g_variant_lookup (stats, "polled-directories", "u", &n_polled));
+  g_assert_cmpuint (n_polled, ==, 1);
+
+  file = g_build_filename (b, "file", NULL);
+  g_assert (g_file_set_contents (file, "x", 1, NULL));
+  g_assert (wait_for (&w, G_FILE_MONITOR_EVENT_CREATED, "file"));
+
+  /* Write in place, g_file_set_contents() would replace the inode */
+  f = g_fopen (file, "a");
+  g_assert (f != NULL);
+  fputs ("yz", f);
+  fclose (f);
+  g_assert (wait_for (&w, G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT, "file"));
+
+  g_assert_cmpint (g_remove (file), ==, 0);
+  g_assert (wait_for (&w, G_FILE_MONITOR_EVENT_DELETED, "file"));
+  g_free (file);
+
+  /* The watched directory is unaffected */
+  file = g_build_filename (a, "other", NULL);
+  g_assert (g_file_set_contents (file, "x", 1, NULL));
+  g_assert (wait_for (&w, G_FILE_MONITOR_EVENT_CREATED, "other"));
+  g_remove (file);
+  g_free (file);
+
+ out:
+  g_variant_unref (stats);
+  g_file_monitor_cancel (watched);
+  g_file_monitor_cancel (polled);
+  g_object_unref (watched);
+  g_object_unref (polled);
+  g_main_loop_unref (w.loop);
+  g_rmdir (a);
+  g_rmdir (b);
+  g_rmdir (dir);
+  g_free (a);
+  g_free (b);
+  g_free (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  /* Read once, when the inotify backend starts */
+  g_setenv ("GIO_INOTIFY_WATCH_BUDGET", "1", TRUE);
+
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/inotify-budget/polled-dir", test_polled_dir);
+
+  return g_test_run ();
+}
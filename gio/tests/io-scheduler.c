@@ -0,0 +1,407 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <gio/gio.h>
+
+/* Must match the scheduler */
+#define MAX_THREADS_PER_POOL 10
+
+static GMutex *lock;
+static GCond *cond;
+
+static gint n_done;
+
+/* Blockers occupy worker threads until released */
+static gint n_blocked;
+static gint n_to_release;
+
+static gboolean
+blocker_job (GIOSchedulerJob *job,
+             GCancellable    *cancellable,
+             gpointer         user_data)
+{
+  g_mutex_lock (lock);
+  n_blocked++;
+  g_cond_broadcast (cond);
+  while (n_to_release == 0)
+    g_cond_wait (cond, lock);
+  n_to_release--;
+  n_blocked--;
+  g_cond_broadcast (cond);
+  g_mutex_unlock (lock);
+
+  return FALSE;
+}
+
+static void
+block_workers (gint n)
+{
+  gint i;
+
+  /* Let the blockers of the previous test go first */
+  g_mutex_lock (lock);
+  while (n_blocked > 0)
+    g_cond_wait (cond, lock);
+  n_to_release = 0;
+  g_mutex_unlock (lock);
+
+  for (i = 0; i < n; i++)
+    g_io_scheduler_push_job (blocker_job, NULL, NULL, G_PRIORITY_HIGH, NULL);
+
+  g_mutex_lock (lock);
+  while (n_blocked < n)
+    g_cond_wait (cond, lock);
+  g_mutex_unlock (lock);
+}
+
+static void
+release_workers (gint n)
+{
+  g_mutex_lock (lock);
+  n_to_release += n;
+  g_cond_broadcast (cond);
+  g_mutex_unlock (lock);
+}
+
+static void
+wait_done (gint n)
+{
+  g_mutex_lock (lock);
+  while (n_done < n)
+    g_cond_wait (cond, lock);
+  g_mutex_unlock (lock);
+}
+
+static gboolean
+count_job (GIOSchedulerJob *job,
+           GCancellable    *cancellable,
+           gpointer         user_data)
+{
+  g_mutex_lock (lock);
+  n_done++;
+  g_cond_broadcast (cond);
+  g_mutex_unlock (lock);
+
+  return FALSE;
+}
+
+static guint64
+get_pool_counter (GVariant   *statistics,
+                  const char *pool,
+                  const char *key)
+{
+  GVariant *dict;
+  guint64 value;
+
+  dict = g_variant_lookup_value (statistics, pool, G_VARIANT_TYPE ("a{sv}"));
+  g_assert (dict != NULL);
+  g_assert (g_variant_lookup (dict, key, "t", &value));
+  g_variant_unref (dict);
+
+  return value;
+}
+
+static guint64
+get_histogram_total (GVariant   *statistics,
+                     const char *pool,
+                     const char *key)
+{
+  GVariant *dict, *histogram;
+  guint64 total;
+  gsize i;
+
+  dict = g_variant_lookup_value (statistics, pool, G_VARIANT_TYPE ("a{sv}"));
+  histogram = g_variant_lookup_value (dict, key, G_VARIANT_TYPE ("at"));
+  g_assert (histogram != NULL);
+
+  total = 0;
+  for (i = 0; i < g_variant_n_children (histogram); i++)
+    {
+      guint64 bucket;
+
+      g_variant_get_child (histogram, i, "t", &bucket);
+      total += bucket;
+    }
+
+  g_variant_unref (histogram);
+  g_variant_unref (dict);
+
+  return total;
+}
+
+static void
+test_run (void)
+{
+  GVariant *before, *after;
+  guint64 n_run;
+  gint i;
+
+  before = g_io_scheduler_get_statistics ();
+
+  n_done = 0;
+  for (i = 0; i < 100; i++)
+    g_io_scheduler_push_job (count_job, NULL, NULL, G_PRIORITY_DEFAULT, NULL);
+  wait_done (100);
+
+  /* The counters are updated after the job returns */
+  do
+    {
+      after = g_io_scheduler_get_statistics ();
+      n_run = get_pool_counter (after, "local", "jobs-run") -
+        get_pool_counter (before, "local", "jobs-run");
+      if (n_run < 100)
+        {
+          g_variant_unref (after);
+          g_usleep (1000);
+        }
+    }
+  while (n_run < 100);
+
+  g_assert_cmpuint (n_run, ==, 100);
+  g_assert_cmpuint (get_histogram_total (after, "local", "queue-wait-histogram") -
+                    get_histogram_total (before, "local", "queue-wait-histogram"), ==, 100);
+  g_assert_cmpuint (get_histogram_total (after, "local", "run-time-histogram") -
+                    get_histogram_total (before, "local", "run-time-histogram"), ==, 100);
+  g_assert_cmpuint (get_pool_counter (after, "remote", "jobs-run"), ==,
+                    get_pool_counter (before, "remote", "jobs-run"));
+
+  g_variant_unref (before);
+  g_variant_unref (after);
+}
+
+static GArray *order;
+
+static gboolean
+record_job (GIOSchedulerJob *job,
+            GCancellable    *cancellable,
+            gpointer         user_data)
+{
+  g_mutex_lock (lock);
+  g_array_append_val (order, user_data);
+  n_done++;
+  g_cond_broadcast (cond);
+  g_mutex_unlock (lock);
+
+  return FALSE;
+}
+
+/* With a single thread left to run them, queued jobs run by
+ * priority even though they were spread over the queues of
+ * all the threads.
+ */
+static void
+test_priority (void)
+{
+  gint i;
+
+  order = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  n_done = 0;
+
+  block_workers (MAX_THREADS_PER_POOL);
+  for (i = 0; i < 20; i++)
+    g_io_scheduler_push_job (record_job, GINT_TO_POINTER (G_PRIORITY_LOW),
+                             NULL, G_PRIORITY_LOW, NULL);
+  for (i = 0; i < 20; i++)
+    g_io_scheduler_push_job (record_job, GINT_TO_POINTER (G_PRIORITY_DEFAULT),
+                             NULL, G_PRIORITY_DEFAULT, NULL);
+  for (i = 0; i < 20; i++)
+    g_io_scheduler_push_job (record_job, GINT_TO_POINTER (G_PRIORITY_HIGH),
+                             NULL, G_PRIORITY_HIGH, NULL);
+
+  release_workers (1);
+  wait_done (60);
+
+  for (i = 0; i < 60; i++)
+    {
+      gint expected;
+
+      expected = i < 20 ? G_PRIORITY_HIGH : i < 40 ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW;
+      g_assert_cmpint (GPOINTER_TO_INT (g_array_index (order, gpointer, i)), ==, expected);
+    }
+
+  release_workers (MAX_THREADS_PER_POOL - 1);
+  g_array_free (order, TRUE);
+}
+
+static void
+run_in_thread_func (GSimpleAsyncResult *res,
+                    GObject            *object,
+                    GCancellable       *cancellable)
+{
+  g_simple_async_result_set_op_res_gboolean (res, TRUE);
+}
+
+static void
+run_in_thread_done (GObject      *source,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  g_main_loop_quit (user_data);
+}
+
+/* Operations on remote files still run while all the threads for
+ * local I/O are busy.
+ */
+static void
+test_pools (void)
+{
+  GSimpleAsyncResult *res;
+  GMainLoop *loop;
+  GFile *file;
+
+  block_workers (MAX_THREADS_PER_POOL);
+
+  file = g_file_new_for_uri ("remote-scheduler-test://host/file");
+  g_assert (!g_file_is_native (file));
+
+  loop = g_main_loop_new (NULL, FALSE);
+  res = g_simple_async_result_new (G_OBJECT (file), run_in_thread_done, loop, test_pools);
+  g_simple_async_result_run_in_thread (res, run_in_thread_func, G_PRIORITY_DEFAULT, NULL);
+  g_object_unref (res);
+  g_main_loop_run (loop);
+
+  g_mutex_lock (lock);
+  g_assert_cmpint (n_blocked, ==, MAX_THREADS_PER_POOL);
+  g_mutex_unlock (lock);
+
+  release_workers (MAX_THREADS_PER_POOL);
+
+  g_main_loop_unref (loop);
+  g_object_unref (file);
+}
+
+static gboolean
+cancellable_job (GIOSchedulerJob *job,
+                 GCancellable    *cancellable,
+                 gpointer         user_data)
+{
+  g_assert (g_cancellable_is_cancelled (cancellable));
+
+  return count_job (job, cancellable, user_data);
+}
+
+static void
+test_cancel_all (void)
+{
+  GCancellable *cancellables[10];
+  gint i;
+
+  n_done = 0;
+  block_workers (MAX_THREADS_PER_POOL);
+
+  for (i = 0; i < G_N_ELEMENTS (cancellables); i++)
+    {
+      cancellables[i] = g_cancellable_new ();
+      g_io_scheduler_push_job (cancellable_job, NULL, NULL,
+                               G_PRIORITY_DEFAULT, cancellables[i]);
+    }
+
+  g_io_scheduler_cancel_all_jobs ();
+  for (i = 0; i < G_N_ELEMENTS (cancellables); i++)
+    g_assert (g_cancellable_is_cancelled (cancellables[i]));
+
+  release_workers (MAX_THREADS_PER_POOL);
+  wait_done (G_N_ELEMENTS (cancellables));
+
+  for (i = 0; i < G_N_ELEMENTS (cancellables); i++)
+    g_object_unref (cancellables[i]);
+}
+
+static volatile gint n_tiny_done;
+
+static gboolean
+tiny_job (GIOSchedulerJob *job,
+          GCancellable    *cancellable,
+          gpointer         user_data)
+{
+  if (g_atomic_int_exchange_and_add (&n_tiny_done, 1) + 1 == GPOINTER_TO_INT (user_data))
+    {
+      g_mutex_lock (lock);
+      g_cond_broadcast (cond);
+      g_mutex_unlock (lock);
+    }
+
+  return FALSE;
+}
+
+/* Pushes GIO_SCHEDULER_BENCH_JOBS (1000000 by default) jobs that do
+ * nothing and waits for them to complete.
+ */
+static void
+test_push_throughput (void)
+{
+  const gchar *env;
+  GVariant *statistics, *dict;
+  GTimer *timer;
+  gdouble elapsed;
+  guint64 n_stolen;
+  gint n_jobs, i;
+  gchar *str;
+
+  env = g_getenv ("GIO_SCHEDULER_BENCH_JOBS");
+  n_jobs = env ? atoi (env) : 1000000;
+
+  n_tiny_done = 0;
+  timer = g_timer_new ();
+  for (i = 0; i < n_jobs; i++)
+    g_io_scheduler_push_job (tiny_job, GINT_TO_POINTER (n_jobs), NULL,
+                             G_PRIORITY_DEFAULT, NULL);
+
+  g_mutex_lock (lock);
+  while (g_atomic_int_get (&n_tiny_done) < n_jobs)
+    g_cond_wait (cond, lock);
+  g_mutex_unlock (lock);
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  g_test_minimized_result (elapsed, "%d jobs: %.3f s (%.0f jobs/s)",
+                           n_jobs, elapsed, n_jobs / elapsed);
+
+  statistics = g_io_scheduler_get_statistics ();
+  dict = g_variant_lookup_value (statistics, "local", G_VARIANT_TYPE ("a{sv}"));
+  n_stolen = get_pool_counter (statistics, "local", "jobs-stolen");
+  str = g_variant_print (dict, FALSE);
+  g_test_message ("%" G_GUINT64_FORMAT " jobs stolen; %s", n_stolen, str);
+  g_free (str);
+  g_variant_unref (dict);
+  g_variant_unref (statistics);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_thread_init (NULL);
+  g_type_init ();
+
+  g_test_init (&argc, &argv, NULL);
+
+  lock = g_mutex_new ();
+  cond = g_cond_new ();
+
+  g_test_add_func ("/io-scheduler/run", test_run);
+  g_test_add_func ("/io-scheduler/priority", test_priority);
+  g_test_add_func ("/io-scheduler/pools", test_pools);
+  g_test_add_func ("/io-scheduler/cancel-all", test_cancel_all);
+
+  if (g_test_perf ())
+    g_test_add_func ("/io-scheduler/push-throughput", test_push_throughput);
+
+  return g_test_run ();
+}
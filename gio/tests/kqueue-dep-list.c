@@ -0,0 +1,662 @@
+/* GIO kqueue backend: directory diff tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utime.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dep-list.h"
+
+/* The diff engine does not depend on kqueue, so it is tested (and
+ * benchmarked) on every platform. */
+
+static void
+log_added (void *udata, const char *path, ino_t inode)
+{
+  g_string_append_printf (udata, "added %s:%lu\n", path, (gulong) inode);
+}
+
+static void
+log_removed (void *udata, const char *path, ino_t inode)
+{
+  g_string_append_printf (udata, "removed %s:%lu\n", path, (gulong) inode);
+}
+
+static void
+log_replaced (void *udata,
+              const char *from_path, ino_t from_inode,
+              const char *to_path, ino_t to_inode)
+{
+  g_string_append_printf (udata, "replaced %s:%lu %s:%lu\n",
+                          from_path, (gulong) from_inode,
+                          to_path, (gulong) to_inode);
+}
+
+static void
+log_overwritten (void *udata, const char *path, ino_t inode)
+{
+  g_string_append_printf (udata, "overwritten %s:%lu\n", path, (gulong) inode);
+}
+
+static void
+log_moved (void *udata,
+           const char *from_path, ino_t from_inode,
+           const char *to_path, ino_t to_inode)
+{
+  g_string_append_printf (udata, "moved %s:%lu %s:%lu\n",
+                          from_path, (gulong) from_inode,
+                          to_path, (gulong) to_inode);
+}
+
+static void
+log_list (GString *log, const char *what, const dep_list *list)
+{
+  g_string_append (log, what);
+  for (; list != NULL; list = list->next)
+    g_string_append_printf (log, " %s", list->path);
+  g_string_append_c (log, '\n');
+}
+
+static void
+log_many_added (void *udata, const dep_list *list)
+{
+  log_list (udata, "many-added", list);
+}
+
+static void
+log_many_removed (void *udata, const dep_list *list)
+{
+  log_list (udata, "many-removed", list);
+}
+
+static void
+log_names_updated (void *udata)
+{
+  g_string_append (udata, "names-updated\n");
+}
+
+static void
+log_changed (void *udata, const char *path, ino_t inode)
+{
+  g_string_append_printf (udata, "changed %s\n", path);
+}
+
+static const traverse_cbs log_cbs = {
+  log_added,
+  log_removed,
+  log_replaced,
+  log_overwritten,
+  log_moved,
+  log_many_added,
+  log_many_removed,
+  log_names_updated,
+  log_changed,
+};
+
+/* Builds a list from a "name:inode name:inode ..." string */
+static dep_list *
+make_list (const gchar *spec)
+{
+  gchar **items;
+  dep_list *head = NULL;
+  gint i;
+
+  items = g_strsplit (spec, " ", -1);
+  for (i = 0; items[i] != NULL; i++)
+    {
+      gchar *colon;
+
+      if (items[i][0] == '\0')
+        continue;
+
+      colon = strchr (items[i], ':');
+      g_assert (colon != NULL);
+      *colon = '\0';
+
+      head = dl_append (head, items[i], (ino_t) strtoul (colon + 1, NULL, 10));
+      g_assert (head != NULL);
+    }
+  g_strfreev (items);
+
+  return head;
+}
+
+/* The straightforward pairwise comparison the diff engine must agree with */
+
+typedef struct {
+  const dep_list *item;
+  gboolean gone;
+} ref_item;
+
+static ref_item *
+ref_items (const dep_list *dl, gsize *n)
+{
+  GArray *arr = g_array_new (FALSE, FALSE, sizeof (ref_item));
+
+  for (; dl != NULL; dl = dl->next)
+    {
+      ref_item it = { dl, FALSE };
+      g_array_append_val (arr, it);
+    }
+
+  *n = arr->len;
+  return (ref_item *) g_array_free (arr, FALSE);
+}
+
+static void
+ref_calculate (const dep_list *before, const dep_list *after, GString *log)
+{
+  ref_item *was, *pre, *now, *lst;
+  gsize n_before, n_after, i, j;
+  gint need_update = 0;
+  GString *many;
+
+  was = ref_items (before, &n_before);
+  pre = ref_items (before, &n_before);
+  now = ref_items (after, &n_after);
+  lst = ref_items (after, &n_after);
+
+  for (i = 0; i < n_before; i++)
+    for (j = 0; j < n_after; j++)
+      if (!now[j].gone && !strcmp (was[i].item->path, now[j].item->path))
+        {
+          was[i].gone = now[j].gone = TRUE;
+          break;
+        }
+
+  for (i = 0; i < n_before; i++)
+    for (j = 0; !was[i].gone && j < n_after; j++)
+      if (!now[j].gone && was[i].item->inode == now[j].item->inode)
+        {
+          log_moved (log, was[i].item->path, was[i].item->inode,
+                     now[j].item->path, now[j].item->inode);
+          was[i].gone = now[j].gone = TRUE;
+          need_update++;
+        }
+
+  for (i = 0; i < n_before; i++)
+    for (j = 0; !was[i].gone && j < n_after; j++)
+      if (!lst[j].gone && was[i].item->inode == lst[j].item->inode)
+        {
+          log_replaced (log, was[i].item->path, was[i].item->inode,
+                        lst[j].item->path, lst[j].item->inode);
+          was[i].gone = lst[j].gone = TRUE;
+          need_update++;
+        }
+
+  for (i = 0; i < n_before; i++)
+    for (j = 0; !pre[i].gone && j < n_after; j++)
+      if (!lst[j].gone
+          && !strcmp (pre[i].item->path, lst[j].item->path)
+          && pre[i].item->inode != lst[j].item->inode)
+        {
+          log_overwritten (log, lst[j].item->path, lst[j].item->inode);
+          pre[i].gone = lst[j].gone = TRUE;
+        }
+
+  if (need_update)
+    log_names_updated (log);
+
+  for (i = 0; i < n_before; i++)
+    if (!was[i].gone)
+      log_removed (log, was[i].item->path, was[i].item->inode);
+  for (j = 0; j < n_after; j++)
+    if (!now[j].gone)
+      log_added (log, now[j].item->path, now[j].item->inode);
+
+  many = g_string_new ("many-added");
+  for (j = 0; j < n_after; j++)
+    if (!now[j].gone)
+      g_string_append_printf (many, " %s", now[j].item->path);
+  g_string_append (many, "\nmany-removed");
+  for (i = 0; i < n_before; i++)
+    if (!was[i].gone)
+      g_string_append_printf (many, " %s", was[i].item->path);
+  g_string_append_printf (log, "%s\n", many->str);
+  g_string_free (many, TRUE);
+
+  g_free (was);
+  g_free (pre);
+  g_free (now);
+  g_free (lst);
+}
+
+static gchar *
+calculate (const gchar *before_spec, const gchar *after_spec)
+{
+  dep_list *before = make_list (before_spec);
+  dep_list *after = make_list (after_spec);
+  GString *log = g_string_new (NULL);
+
+  dl_calculate (before, after, &log_cbs, log);
+
+  dl_free (before);
+  dl_free (after);
+  return g_string_free (log, FALSE);
+}
+
+static void
+test_simple (void)
+{
+  gchar *log;
+
+  log = calculate ("a:1 b:2", "a:1 b:2");
+  g_assert_cmpstr (log, ==, "many-added\nmany-removed\n");
+  g_free (log);
+
+  log = calculate ("a:1", "a:1 b:2 c:3");
+  g_assert_cmpstr (log, ==,
+                   "added b:2\n"
+                   "added c:3\n"
+                   "many-added b c\n"
+                   "many-removed\n");
+  g_free (log);
+
+  log = calculate ("a:1 b:2 c:3", "b:2");
+  g_assert_cmpstr (log, ==,
+                   "removed a:1\n"
+                   "removed c:3\n"
+                   "many-added\n"
+                   "many-removed a c\n");
+  g_free (log);
+
+  log = calculate ("", "");
+  g_assert_cmpstr (log, ==, "many-added\nmany-removed\n");
+  g_free (log);
+}
+
+static void
+test_moves (void)
+{
+  gchar *log;
+
+  /* mv a c */
+  log = calculate ("a:1 b:2", "b:2 c:1");
+  g_assert_cmpstr (log, ==,
+                   "moved a:1 c:1\n"
+                   "names-updated\n"
+                   "many-added\n"
+                   "many-removed\n");
+  g_free (log);
+
+  /* mv a b (b existed before) */
+  log = calculate ("a:1 b:2", "b:1");
+  g_assert_cmpstr (log, ==,
+                   "replaced a:1 b:1\n"
+                   "names-updated\n"
+                   "many-added\n"
+                   "many-removed\n");
+  g_free (log);
+
+  /* mv /elsewhere/x b */
+  log = calculate ("a:1 b:2", "a:1 b:3");
+  g_assert_cmpstr (log, ==,
+                   "overwritten b:3\n"
+                   "many-added\n"
+                   "many-removed\n");
+  g_free (log);
+}
+
+static void
+test_hard_links (void)
+{
+  gchar *log;
+
+  /* Several names for the same inode must be paired in the list order */
+  log = calculate ("a:1 b:1 c:1 d:2", "x:1 y:1 d:2 z:1");
+  g_assert_cmpstr (log, ==,
+                   "moved a:1 x:1\n"
+                   "moved b:1 y:1\n"
+                   "moved c:1 z:1\n"
+                   "names-updated\n"
+                   "many-added\n"
+                   "many-removed\n");
+  g_free (log);
+}
+
+static gchar *
+random_spec (GRand *rand, gint n, gint inodes, const gchar *prefix)
+{
+  GString *spec = g_string_new (NULL);
+  gint i;
+
+  for (i = 0; i < n; i++)
+    g_string_append_printf (spec, "%s%d:%d ",
+                            prefix,
+                            g_rand_int_range (rand, 0, n * 2),
+                            g_rand_int_range (rand, 1, inodes + 1));
+
+  return g_string_free (spec, FALSE);
+}
+
+static void
+test_random (void)
+{
+  GRand *rand = g_rand_new_with_seed (g_test_rand_int ());
+  gint iteration;
+
+  for (iteration = 0; iteration < 2000; iteration++)
+    {
+      gint n = g_rand_int_range (rand, 0, 24);
+      gint inodes = g_rand_int_range (rand, 1, 2 * n + 2);
+      gchar *before_spec = random_spec (rand, n, inodes, "f");
+      gchar *after_spec = random_spec (rand, g_rand_int_range (rand, 0, 24), inodes, "f");
+      dep_list *before = make_list (before_spec);
+      dep_list *after = make_list (after_spec);
+      GString *expected = g_string_new (NULL);
+      gchar *log;
+
+      ref_calculate (before, after, expected);
+      log = calculate (before_spec, after_spec);
+      g_assert_cmpstr (log, ==, expected->str);
+
+      g_free (log);
+      g_string_free (expected, TRUE);
+      dl_free (before);
+      dl_free (after);
+      g_free (before_spec);
+      g_free (after_spec);
+    }
+
+  g_rand_free (rand);
+}
+
+static void
+test_listing (void)
+{
+  gchar *dir;
+  gchar *path;
+  dep_list *first, *second, *it;
+  const gchar *kept = NULL;
+  gint i, n;
+
+  dir = g_strdup ("kqueue-dep-list-XXXXXX");
+  g_assert (mkdtemp (dir) != NULL);
+
+  for (i = 0; i < 100; i++)
+    {
+      path = g_strdup_printf ("%s/file-%d", dir, i);
+      g_assert (g_file_set_contents (path, "", 0, NULL));
+      g_free (path);
+    }
+
+  first = dl_listing (dir, NULL);
+  for (it = first, n = 0; it != NULL; it = it->next, n++)
+    if (strcmp (it->path, "file-42") == 0)
+      kept = it->path;
+  g_assert_cmpint (n, ==, 100);
+  g_assert (kept != NULL);
+
+  path = g_strdup_printf ("%s/file-7", dir);
+  g_remove (path);
+  g_free (path);
+
+  /* The names of the files left in the directory are shared with the
+   * previous listing */
+  second = dl_listing (dir, first);
+  for (it = second, n = 0; it != NULL; it = it->next, n++)
+    {
+      g_assert_cmpstr (it->path, !=, "file-7");
+      if (strcmp (it->path, "file-42") == 0)
+        g_assert (it->path == kept);
+    }
+  g_assert_cmpint (n, ==, 99);
+
+  dl_free (first);
+  g_assert (strcmp (kept, "file-42") == 0);
+  dl_free (second);
+
+  for (i = 0; i < 100; i++)
+    {
+      path = g_strdup_printf ("%s/file-%d", dir, i);
+      g_remove (path);
+      g_free (path);
+    }
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+static void
+test_meta (void)
+{
+  gchar *dir;
+  gchar *path;
+  dep_list *plain, *first, *second, *third;
+  GString *log;
+  struct utimbuf times;
+  FILE *stream;
+  gint i;
+
+  dir = g_strdup ("kqueue-dep-list-XXXXXX");
+  g_assert (mkdtemp (dir) != NULL);
+
+  for (i = 0; i < 3; i++)
+    {
+      path = g_strdup_printf ("%s/file-%d", dir, i);
+      g_assert (g_file_set_contents (path, "data", -1, NULL));
+      g_free (path);
+    }
+
+  plain = dl_listing (dir, NULL);
+  first = dl_listing_full (dir, NULL, DL_LISTING_META);
+
+  /* Grow one file and touch another, leave the third one alone */
+  path = g_strdup_printf ("%s/file-0", dir);
+  stream = g_fopen (path, "a");
+  g_assert (stream != NULL);
+  fputs ("more data", stream);
+  fclose (stream);
+  g_free (path);
+
+  path = g_strdup_printf ("%s/file-1", dir);
+  times.actime = times.modtime = 1000000;
+  g_assert_cmpint (g_utime (path, &times), ==, 0);
+  g_free (path);
+
+  log = g_string_new (NULL);
+  second = dl_listing_full (dir, first, DL_LISTING_META);
+  dl_calculate (first, second, &log_cbs, log);
+  g_assert (strstr (log->str, "changed file-0\n") != NULL);
+  g_assert (strstr (log->str, "changed file-1\n") != NULL);
+  g_assert (strstr (log->str, "file-2") == NULL);
+  g_string_free (log, TRUE);
+
+  /* Without metadata only the directory entries are compared */
+  log = g_string_new (NULL);
+  third = dl_listing (dir, plain);
+  dl_calculate (plain, third, &log_cbs, log);
+  g_assert_cmpstr (log->str, ==, "many-added\nmany-removed\n");
+  g_string_free (log, TRUE);
+
+  dl_free (plain);
+  dl_free (first);
+  dl_free (second);
+  dl_free (third);
+
+  for (i = 0; i < 3; i++)
+    {
+      path = g_strdup_printf ("%s/file-%d", dir, i);
+      g_remove (path);
+      g_free (path);
+    }
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+/* A subdirectory whose own entries change is not reported as changed,
+ * while a file next to it still is.
+ */
+static void
+test_meta_subdir (void)
+{
+  gchar *dir, *sub, *path, *file;
+  dep_list *first, *second;
+  struct utimbuf times;
+  GString *log;
+
+  dir = g_strdup ("kqueue-dep-list-XXXXXX");
+  g_assert (mkdtemp (dir) != NULL);
+  sub = g_strdup_printf ("%s/subdir", dir);
+  g_assert_cmpint (g_mkdir (sub, 0755), ==, 0);
+  file = g_strdup_printf ("%s/file", dir);
+  g_assert (g_file_set_contents (file, "data", -1, NULL));
+
+  /* Move the times back, so the changes below are visible even with
+   * a coarse timestamp granularity */
+  times.actime = times.modtime = 1000000;
+  g_assert_cmpint (g_utime (sub, &times), ==, 0);
+  g_assert_cmpint (g_utime (file, &times), ==, 0);
+
+  first = dl_listing_full (dir, NULL, DL_LISTING_META);
+
+  path = g_strdup_printf ("%s/inner", sub);
+  g_assert (g_file_set_contents (path, "data", -1, NULL));
+  times.actime = times.modtime = 2000000;
+  g_assert_cmpint (g_utime (file, &times), ==, 0);
+
+  log = g_string_new (NULL);
+  second = dl_listing_full (dir, first, DL_LISTING_META);
+  dl_calculate (first, second, &log_cbs, log);
+  g_assert (strstr (log->str, "changed file\n") != NULL);
+  g_assert (strstr (log->str, "subdir") == NULL);
+  g_string_free (log, TRUE);
+
+  dl_free (first);
+  dl_free (second);
+
+  g_remove (path);
+  g_rmdir (sub);
+  g_remove (file);
+  g_rmdir (dir);
+  g_free (path);
+  g_free (file);
+  g_free (sub);
+  g_free (dir);
+}
+
+static void
+count_single (void *udata, const char *path, ino_t inode)
+{
+  (*(guint *) udata)++;
+}
+
+static void
+count_dual (void *udata,
+            const char *from_path, ino_t from_inode,
+            const char *to_path, ino_t to_inode)
+{
+  (*(guint *) udata)++;
+}
+
+static const traverse_cbs count_cbs = {
+  count_single,
+  count_single,
+  count_dual,
+  count_single,
+  count_dual,
+  NULL,
+  NULL,
+  NULL,
+};
+
+/* A synthetic listing of a big spool directory and its next state, with
+ * 1% of the entries renamed, 1% replaced with new files and 1% removed.
+ * Returns the number of expected events. */
+static guint
+make_spool (guint n, dep_list **before, dep_list **after)
+{
+  guint events = 0;
+  dep_list *bhead = NULL;
+  dep_list *ahead = NULL;
+  gchar name[32];
+  guint i;
+
+  for (i = 0; i < n; i++)
+    {
+      g_snprintf (name, sizeof (name), "file-%07u", i);
+      bhead = dl_append (bhead, name, i + 1);
+
+      if (i % 100 == 1)
+        {
+          g_snprintf (name, sizeof (name), "moved-%07u", i);
+          ahead = dl_append (ahead, name, i + 1);
+          events += 1;
+        }
+      else if (i % 100 == 2)
+        {
+          g_snprintf (name, sizeof (name), "new-%07u", i);
+          ahead = dl_append (ahead, name, n + i + 1);
+          events += 2;
+        }
+      else if (i % 100 != 3)
+        ahead = dl_append (ahead, name, i + 1);
+      else
+        events += 1;
+    }
+
+  *before = bhead;
+  *after = ahead;
+  return events;
+}
+
+static void
+test_perf (gconstpointer data)
+{
+  guint n = GPOINTER_TO_UINT (data);
+  dep_list *before, *after;
+  guint expected, events = 0;
+  gdouble elapsed;
+
+  if (!g_test_perf ())
+    return;
+
+  expected = make_spool (n, &before, &after);
+
+  g_test_timer_start ();
+  dl_calculate (before, after, &count_cbs, &events);
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert_cmpuint (events, ==, expected);
+  g_test_minimized_result (elapsed, "%8u entries, %u events: %.4f s",
+                           n, events, elapsed);
+
+  dl_free (before);
+  dl_free (after);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/kqueue/dep-list/simple", test_simple);
+  g_test_add_func ("/kqueue/dep-list/moves", test_moves);
+  g_test_add_func ("/kqueue/dep-list/hard-links", test_hard_links);
+  g_test_add_func ("/kqueue/dep-list/random", test_random);
+  g_test_add_func ("/kqueue/dep-list/listing", test_listing);
+  g_test_add_func ("/kqueue/dep-list/meta", test_meta);
+  g_test_add_func ("/kqueue/dep-list/meta-subdir", test_meta_subdir);
+  g_test_add_data_func ("/kqueue/dep-list/perf/1k", GUINT_TO_POINTER (1000), test_perf);
+  g_test_add_data_func ("/kqueue/dep-list/perf/100k", GUINT_TO_POINTER (100000), test_perf);
+  g_test_add_data_func ("/kqueue/dep-list/perf/1M", GUINT_TO_POINTER (1000000), test_perf);
+
+  return g_test_run ();
+}
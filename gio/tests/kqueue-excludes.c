@@ -0,0 +1,246 @@
+/* GIO kqueue backend: exclusion list tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "kqueue-exclusions.h"
+
+/* The exclusion list does not depend on kqueue, so it is tested (and
+ * benchmarked) on every platform. The user configuration file is
+ * redirected to a temporary directory. */
+
+static gchar *config_dir;
+static gchar *config_path;
+
+static void
+write_config (const gchar *contents)
+{
+  GError *error = NULL;
+
+  g_file_set_contents (config_path, contents, -1, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_prefix (void)
+{
+  write_config ("/tmp/excluded\n"
+                "\n"
+                "/var/cache/\r\n");
+  _ke_rebuild ();
+
+  g_assert (_ke_is_excluded ("/tmp/excluded"));
+  g_assert (_ke_is_excluded ("/tmp/excluded/file"));
+  /* Entries are plain prefixes, not path components */
+  g_assert (_ke_is_excluded ("/tmp/excludedfile"));
+  g_assert (_ke_is_excluded ("/var/cache/x"));
+
+  g_assert (!_ke_is_excluded ("/tmp/exclude"));
+  g_assert (!_ke_is_excluded ("/tmp/other"));
+  g_assert (!_ke_is_excluded ("/var/cache"));
+  g_assert (!_ke_is_excluded ("/"));
+  g_assert (!_ke_is_excluded (""));
+}
+
+static void
+test_globs (void)
+{
+  write_config ("/home/*/.cache\n"
+                "*.git\n"
+                "/mnt/disk?\n"
+                "/srv/\n");
+  _ke_rebuild ();
+
+  /* A glob excludes the matching paths and everything below them */
+  g_assert (_ke_is_excluded ("/home/user/.cache"));
+  g_assert (_ke_is_excluded ("/home/user/.cache/thumbnails/large"));
+  g_assert (_ke_is_excluded ("/src/glib/.git"));
+  g_assert (_ke_is_excluded ("/src/glib/.git/objects"));
+  g_assert (_ke_is_excluded ("/mnt/disk1"));
+  g_assert (_ke_is_excluded ("/mnt/disk2/music"));
+  g_assert (_ke_is_excluded ("/srv/www"));
+
+  g_assert (!_ke_is_excluded ("/home/user/.cachefile"));
+  g_assert (!_ke_is_excluded ("/home/user/cache"));
+  /* Wildcards don't match across components */
+  g_assert (!_ke_is_excluded ("/home/user/src/.cache"));
+  g_assert (!_ke_is_excluded ("/src/glib/gitignore"));
+  g_assert (!_ke_is_excluded ("/mnt/disk12"));
+  g_assert (!_ke_is_excluded ("/mnt/disk"));
+}
+
+static void
+test_reload (void)
+{
+  write_config ("/tmp/first\n");
+  _ke_rebuild ();
+
+  g_assert (_ke_is_excluded ("/tmp/first/a"));
+  g_assert (!_ke_is_excluded ("/tmp/second/a"));
+
+  /* The configuration is checked at most once a second */
+  write_config ("/tmp/second/\n");
+  g_usleep (G_USEC_PER_SEC + G_USEC_PER_SEC / 10);
+
+  g_assert (!_ke_is_excluded ("/tmp/first/a"));
+  g_assert (_ke_is_excluded ("/tmp/second/a"));
+
+  g_remove (config_path);
+  g_usleep (G_USEC_PER_SEC + G_USEC_PER_SEC / 10);
+
+  g_assert (!_ke_is_excluded ("/tmp/second/a"));
+}
+
+static volatile gboolean readers_stop;
+
+static gpointer
+reader_thread (gpointer data)
+{
+  guint n = 0;
+
+  while (!readers_stop)
+    {
+      g_assert (_ke_is_excluded ("/tmp/always/excluded"));
+      g_assert (!_ke_is_excluded ("/tmp/never"));
+      n++;
+    }
+
+  return GUINT_TO_POINTER (n);
+}
+
+static void
+test_concurrent (void)
+{
+  GThread *threads[4];
+  guint i, lookups = 0;
+
+  write_config ("/tmp/always/\n"
+                "/tmp/*/sometimes\n");
+  _ke_rebuild ();
+
+  readers_stop = FALSE;
+  for (i = 0; i < G_N_ELEMENTS (threads); i++)
+    {
+      threads[i] = g_thread_create (reader_thread, NULL, TRUE, NULL);
+      g_assert (threads[i] != NULL);
+    }
+
+  /* Tables are replaced under the readers' feet */
+  for (i = 0; i < 200; i++)
+    _ke_rebuild ();
+
+  readers_stop = TRUE;
+  for (i = 0; i < G_N_ELEMENTS (threads); i++)
+    lookups += GPOINTER_TO_UINT (g_thread_join (threads[i]));
+
+  g_test_message ("%u lookups during 200 rebuilds", lookups);
+
+  /* Frees the retired tables */
+  _ke_rebuild ();
+}
+
+static void
+test_perf (void)
+{
+  GString *config;
+  GSList *naive = NULL, *l;
+  gchar *paths[64];
+  GTimer *timer;
+  gdouble elapsed, naive_elapsed;
+  guint i, n_excluded = 0, n_naive = 0;
+
+  if (!g_test_perf ())
+    return;
+
+  config = g_string_new (NULL);
+  for (i = 0; i < 300; i++)
+    {
+      gchar *rule = g_strdup_printf ("/srv/projects/rule-%03u/", i);
+      g_string_append_printf (config, "%s\n", rule);
+      naive = g_slist_prepend (naive, rule);
+    }
+  for (i = 0; i < 20; i++)
+    g_string_append_printf (config, "/home/*/build-%02u\n", i);
+  write_config (config->str);
+  g_string_free (config, TRUE);
+  _ke_rebuild ();
+
+  for (i = 0; i < G_N_ELEMENTS (paths); i++)
+    paths[i] = g_strdup_printf (i % 2 ? "/srv/projects/rule-%03u/src/file.c"
+                                      : "/home/user/src/module-%03u/file.c",
+                                i * 7);
+
+  timer = g_timer_new ();
+  for (i = 0; i < 1000000; i++)
+    n_excluded += _ke_is_excluded (paths[i % G_N_ELEMENTS (paths)]);
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  /* The list walk which was used before */
+  g_timer_start (timer);
+  for (i = 0; i < 1000000; i++)
+    for (l = naive; l != NULL; l = l->next)
+      if (g_str_has_prefix (paths[i % G_N_ELEMENTS (paths)], l->data))
+        {
+          n_naive++;
+          break;
+        }
+  naive_elapsed = g_timer_elapsed (timer, NULL);
+
+  g_assert_cmpuint (n_excluded, ==, n_naive);
+
+  g_test_message ("prefix list walk: %.4f s", naive_elapsed);
+  g_test_minimized_result (elapsed, "1M lookups, 320 rules: %.4f s", elapsed);
+
+  g_timer_destroy (timer);
+  for (i = 0; i < G_N_ELEMENTS (paths); i++)
+    g_free (paths[i]);
+  g_slist_free_full (naive, g_free);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int retval;
+
+  g_thread_init (NULL);
+  g_test_init (&argc, &argv, NULL);
+
+  config_dir = g_strdup ("kqueue-excludes-XXXXXX");
+  g_assert (mkdtemp (config_dir) != NULL);
+  g_setenv ("XDG_CONFIG_HOME", config_dir, TRUE);
+  config_path = g_build_filename (g_get_user_config_dir (), "gio-kqueue.conf", NULL);
+  g_assert (g_str_has_prefix (config_path, config_dir));
+
+  g_test_add_func ("/kqueue/exclusions/prefix", test_prefix);
+  g_test_add_func ("/kqueue/exclusions/globs", test_globs);
+  g_test_add_func ("/kqueue/exclusions/reload", test_reload);
+  g_test_add_func ("/kqueue/exclusions/concurrent", test_concurrent);
+  g_test_add_func ("/kqueue/exclusions/perf/1M", test_perf);
+
+  retval = g_test_run ();
+
+  g_remove (config_path);
+  g_rmdir (config_dir);
+  g_free (config_path);
+  g_free (config_dir);
+
+  return retval;
+}
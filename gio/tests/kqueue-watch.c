@@ -0,0 +1,324 @@
+/* GIO kqueue backend: kqueue thread tests and benchmark
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "kqueue-thread.h"
+#include "kqueue-utils.h"
+
+/* The kqueue thread is driven directly, without the helper and GIO
+ * monitors. With --with-libkqueue this runs on Linux as well. */
+
+int kqueue_descriptor = -1;
+static int socket_pair[] = {-1, -1};
+static pthread_t thread;
+
+static void
+start_thread (void)
+{
+  if (kqueue_descriptor != -1)
+    return;
+
+  kqueue_descriptor = kqueue ();
+  g_assert_cmpint (kqueue_descriptor, !=, -1);
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM, 0, socket_pair), ==, 0);
+  g_assert_cmpint (pthread_create (&thread, NULL, _kqueue_thread_func, &socket_pair[1]), ==, 0);
+}
+
+typedef struct {
+  gchar *dir;
+  gint n_files;
+  int *fds;
+} watch_set;
+
+static void
+watch_set_init (watch_set *set, gint n_files)
+{
+  gint i;
+
+  set->dir = g_strdup ("kqueue-watch-XXXXXX");
+  g_assert (mkdtemp (set->dir) != NULL);
+  set->n_files = n_files;
+  set->fds = g_new (int, n_files);
+
+  for (i = 0; i < n_files; i++)
+    {
+      gchar *path = g_strdup_printf ("%s/%d", set->dir, i);
+      set->fds[i] = open (path, O_RDWR | O_CREAT, 0600);
+      g_assert_cmpint (set->fds[i], !=, -1);
+      g_free (path);
+    }
+}
+
+static void
+watch_set_clear (watch_set *set)
+{
+  gint i;
+
+  for (i = 0; i < set->n_files; i++)
+    {
+      gchar *path = g_strdup_printf ("%s/%d", set->dir, i);
+      _kqueue_thread_remove_fd (set->fds[i]);
+      g_remove (path);
+      g_free (path);
+    }
+  g_assert (_ku_write (socket_pair[0], "R", 1));
+
+  g_rmdir (set->dir);
+  g_free (set->dir);
+  g_free (set->fds);
+}
+
+/* Writes to every file and waits until all of them are reported.
+ * Returns the number of reads it took. */
+static guint
+touch_and_collect (watch_set *set)
+{
+  GHashTable *seen = g_hash_table_new (g_direct_hash, g_direct_equal);
+  struct kqueue_notification buffer[512];
+  gsize pending = 0;
+  guint reads = 0;
+  gint i;
+
+  for (i = 0; i < set->n_files; i++)
+    g_assert_cmpint (write (set->fds[i], "x", 1), ==, 1);
+
+  while (g_hash_table_size (seen) < set->n_files)
+    {
+      gssize received;
+      gsize j;
+
+      received = read (socket_pair[0], (gchar *) buffer + pending, sizeof (buffer) - pending);
+      g_assert_cmpint (received, >, 0);
+      ++reads;
+
+      pending += received;
+      for (j = 0; j < pending / sizeof (struct kqueue_notification); j++)
+        {
+          g_assert (buffer[j].flags & (NOTE_WRITE | NOTE_EXTEND));
+          g_hash_table_insert (seen, GINT_TO_POINTER (buffer[j].fd), NULL);
+        }
+      memmove (buffer, &buffer[j], pending % sizeof (struct kqueue_notification));
+      pending %= sizeof (struct kqueue_notification);
+    }
+
+  g_hash_table_destroy (seen);
+  return reads;
+}
+
+static void
+watch_all (watch_set *set)
+{
+  gint i;
+
+  for (i = 0; i < set->n_files; i++)
+    _kqueue_thread_push_fd (set->fds[i]);
+  g_assert (_ku_write (socket_pair[0], "A", 1));
+
+  /* There is no acknowledgement for the command */
+  g_usleep (G_USEC_PER_SEC / 10);
+}
+
+static void
+test_notify (void)
+{
+  watch_set set;
+
+  start_thread ();
+  watch_set_init (&set, 16);
+  watch_all (&set);
+
+  /* The filters stay armed after the first notification */
+  touch_and_collect (&set);
+  touch_and_collect (&set);
+
+  watch_set_clear (&set);
+}
+
+static void
+check_pool (const kevents *kv, GHashTable *expected)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gsize i;
+
+  g_assert_cmpuint (kv->kq_size, ==, g_hash_table_size (expected));
+  g_assert_cmpuint (kv->kq_allocated, >=, kv->kq_size);
+
+  for (i = 0; i < kv->kq_size; i++)
+    {
+      g_assert (g_hash_table_lookup_extended (expected,
+                                              GINT_TO_POINTER (kv->memory[i].ident),
+                                              NULL, NULL));
+      g_assert_cmpint (kevents_lookup (kv, kv->memory[i].ident), ==, i);
+    }
+
+  g_hash_table_iter_init (&iter, expected);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_assert_cmpint (kevents_lookup (kv, GPOINTER_TO_INT (key)), !=, -1);
+}
+
+static void
+test_kevents_churn (void)
+{
+  GHashTable *expected = g_hash_table_new (g_direct_hash, g_direct_equal);
+  kevents kv;
+  gint step;
+
+  kevents_init_sz (&kv, 1);
+  g_assert_cmpuint (kv.kq_allocated, >=, 1);
+  g_assert_cmpuint (kv.kq_size, ==, 0);
+
+  kevents_extend_sz (&kv, 100);
+  g_assert_cmpuint (kv.kq_allocated, >=, 100);
+
+  for (step = 0; step < 100000; step++)
+    {
+      gint fd = g_test_rand_int_range (0, 4096);
+
+      /* Grow for a while, then shrink, then grow again */
+      if (g_hash_table_lookup_extended (expected, GINT_TO_POINTER (fd), NULL, NULL) ||
+          (step / 20000) % 2 == 1)
+        {
+          gboolean present = g_hash_table_remove (expected, GINT_TO_POINTER (fd));
+          g_assert_cmpint (kevents_remove (&kv, fd), ==, present);
+        }
+      else
+        {
+          struct kevent kev;
+          EV_SET (&kev, fd, EVFILT_VNODE, EV_ADD, 0, 0, 0);
+          kevents_add (&kv, &kev);
+          g_hash_table_insert (expected, GINT_TO_POINTER (fd), NULL);
+        }
+
+      if (step % 1000 == 0)
+        {
+          kevents_reduce (&kv);
+          if (kv.kq_size > 0)
+            g_assert (kv.kq_allocated < 3 * kv.kq_size || 2 * kv.kq_size < 10);
+          check_pool (&kv, expected);
+        }
+    }
+
+  check_pool (&kv, expected);
+  g_assert_cmpint (kevents_lookup (&kv, 100000), ==, -1);
+  g_assert (!kevents_remove (&kv, -1));
+
+  kevents_free (&kv);
+  g_assert (kv.memory == NULL);
+  g_assert_cmpuint (kv.kq_size, ==, 0);
+  g_hash_table_destroy (expected);
+}
+
+/* The kqueue thread empties its changelist after every kevent() call;
+ * removing an fd afterwards, as cancelling a monitor does, must not
+ * find the submitted entry or touch the ones added since.
+ */
+static void
+test_kevents_clear (void)
+{
+  struct kevent kev;
+  kevents kv;
+
+  kevents_init_sz (&kv, 1);
+
+  EV_SET (&kev, 5, EVFILT_VNODE, EV_ADD, 0, 0, 0);
+  kevents_add (&kv, &kev);
+  EV_SET (&kev, 7, EVFILT_VNODE, EV_ADD, 0, 0, 0);
+  kevents_add (&kv, &kev);
+
+  kevents_clear (&kv);
+  g_assert_cmpuint (kv.kq_size, ==, 0);
+  g_assert_cmpint (kevents_lookup (&kv, 5), ==, -1);
+  g_assert (!kevents_remove (&kv, 5));
+  g_assert_cmpuint (kv.kq_size, ==, 0);
+
+  /* fd 9 takes the slot 5 used to have */
+  EV_SET (&kev, 9, EVFILT_VNODE, EV_ADD, 0, 0, 0);
+  kevents_add (&kv, &kev);
+  g_assert (!kevents_remove (&kv, 5));
+  g_assert (!kevents_remove (&kv, 7));
+  g_assert_cmpint (kevents_lookup (&kv, 9), ==, 0);
+  g_assert (kevents_remove (&kv, 9));
+  g_assert_cmpuint (kv.kq_size, ==, 0);
+
+  kevents_free (&kv);
+}
+
+static void
+test_perf (void)
+{
+  struct rlimit limit;
+  watch_set set;
+  gdouble elapsed;
+  guint reads;
+  gint n_files = 10000;
+
+  if (!g_test_perf ())
+    return;
+
+  g_assert_cmpint (getrlimit (RLIMIT_NOFILE, &limit), ==, 0);
+  if (limit.rlim_cur < n_files + 64)
+    {
+      limit.rlim_cur = MIN (limit.rlim_max, (rlim_t) n_files + 64);
+      setrlimit (RLIMIT_NOFILE, &limit);
+      if (limit.rlim_cur < n_files + 64)
+        {
+          g_test_message ("Not enough file descriptors to watch %d files", n_files);
+          return;
+        }
+    }
+
+  start_thread ();
+  watch_set_init (&set, n_files);
+  watch_all (&set);
+
+  g_test_timer_start ();
+  reads = touch_and_collect (&set);
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_minimized_result (elapsed, "%d files changed: %.4f s, %u reads",
+                           n_files, elapsed, reads);
+
+  watch_set_clear (&set);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_thread_init (NULL);
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/kqueue/kevents/churn", test_kevents_churn);
+  g_test_add_func ("/kqueue/kevents/clear", test_kevents_clear);
+  g_test_add_func ("/kqueue/thread/notify", test_notify);
+  g_test_add_func ("/kqueue/thread/perf/10k", test_perf);
+
+  return g_test_run ();
+}
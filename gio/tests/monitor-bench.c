@@ -0,0 +1,1506 @@
+/* GIO file monitor backends: latency benchmark and record/replay harness
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "dep-list.h"
+#ifdef HAVE_KQUEUE
+#include "kqueue-helper.h"
+#include "kqueue-thread.h"
+#endif
+
+/* Scripted workloads are run against the default directory monitor
+ * implementation, and the time between each syscall and the matching
+ * GFileMonitor::changed emission is measured.
+ *
+ * If GIO_MONITOR_BENCH_RECORD is set, the syscalls ("op" lines) and the
+ * resulting event stream ("ev" lines) of every workload are appended to
+ * the named file. GIO_MONITOR_BENCH_REPLAY names such a file to be fed
+ * through the directory diff engine of the kqueue backend, the same way
+ * the kqueue helper does on NOTE_WRITE. The built-in workloads are always
+ * replayed as well, so the diff can be benchmarked without a kqueue
+ * kernel.
+ *
+ * With kqueue, the notifications of the root directory ("kn" lines, one
+ * per kevent() call) are recorded as well, and the recordings are
+ * replayed through the notification processing of the kqueue helper:
+ * merging, dispatch and diffing of the real directory.
+ */
+
+#define BENCH_TIMEOUT 30 /* seconds */
+
+typedef struct _Bench Bench;
+
+typedef struct {
+  const gchar *name;
+  void (* setup) (Bench *b);
+  void (* run)   (Bench *b);
+  guint size;
+  guint perf_size;
+} Workload;
+
+struct _Bench {
+  const Workload *workload;
+  guint n;
+  gboolean dry;         /* only record the syscalls */
+
+  gchar *dir;
+  GFile *root;
+  GMainLoop *loop;
+  GPtrArray *monitors;
+
+  GHashTable *issued;   /* relative path -> issue time */
+  guint n_issued;
+  guint n_seen;
+  gint64 start;
+  gint64 last;
+  GArray *latencies;    /* gint64, microseconds */
+
+  GString *ops;
+  GString *events;
+
+#ifdef HAVE_KQUEUE
+  int kq;               /* records the root directory if not 0 */
+  int kq_root;
+#endif
+};
+
+/* Workload primitives */
+
+/* Appends the notifications that the recording kqueue has for the root
+ * directory, the way the kqueue thread would pass them to the helper */
+static void
+bench_harvest (Bench *b)
+{
+#ifdef HAVE_KQUEUE
+  struct kevent events[64];
+  struct timespec zero = { 0, 0 };
+  int n, i;
+
+  if (b->kq == 0)
+    return;
+
+  while ((n = kevent (b->kq, NULL, 0, events, G_N_ELEMENTS (events), &zero)) > 0)
+    {
+      g_string_append (b->ops, "kn");
+      for (i = 0; i < n; i++)
+        g_string_append_printf (b->ops, " %u", (guint) (events[i].fflags & ~NOTE_REVOKE));
+      g_string_append_c (b->ops, '\n');
+    }
+#endif
+}
+
+#ifdef HAVE_KQUEUE
+/* Starts recording the notifications of the root directory */
+static void
+bench_kqueue_start (Bench *b)
+{
+  struct kevent change;
+
+  b->kq_root = open (b->dir, O_RDONLY);
+  g_assert_cmpint (b->kq_root, !=, -1);
+  b->kq = kqueue ();
+  g_assert_cmpint (b->kq, >, 0);
+
+  /* The filter that the kqueue thread sets */
+  EV_SET (&change, b->kq_root, EVFILT_VNODE, EV_ADD | EV_ENABLE | EV_CLEAR,
+          NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_RENAME,
+          0, 0);
+  g_assert_cmpint (kevent (b->kq, &change, 1, NULL, 0, NULL), ==, 0);
+}
+
+static void
+bench_kqueue_stop (Bench *b)
+{
+  if (b->kq == 0)
+    return;
+
+  close (b->kq);
+  close (b->kq_root);
+  b->kq = 0;
+}
+#endif
+
+static void
+bench_issue (Bench *b, const gchar *path)
+{
+  gint64 *now;
+
+  if (b->dry || b->loop == NULL)
+    return;
+
+  now = g_new (gint64, 1);
+  *now = g_get_monotonic_time ();
+  g_hash_table_insert (b->issued, g_strdup (path), now);
+  b->n_issued++;
+}
+
+static void
+bench_create (Bench *b, const gchar *path)
+{
+  gchar *full;
+  int fd;
+
+  g_string_append_printf (b->ops, "op create %s\n", path);
+  if (b->dry)
+    return;
+
+  full = g_build_filename (b->dir, path, NULL);
+  bench_issue (b, path);
+  fd = g_open (full, O_CREAT | O_WRONLY, 0644);
+  g_assert_cmpint (fd, !=, -1);
+  close (fd);
+  g_free (full);
+  bench_harvest (b);
+}
+
+static void
+bench_mkdir (Bench *b, const gchar *path)
+{
+  gchar *full;
+
+  g_string_append_printf (b->ops, "op mkdir %s\n", path);
+  if (b->dry)
+    return;
+
+  full = g_build_filename (b->dir, path, NULL);
+  bench_issue (b, path);
+  g_assert_cmpint (g_mkdir (full, 0755), ==, 0);
+  g_free (full);
+  bench_harvest (b);
+}
+
+static void
+bench_rename (Bench *b, const gchar *from, const gchar *to)
+{
+  gchar *full_from;
+  gchar *full_to;
+
+  g_string_append_printf (b->ops, "op rename %s %s\n", from, to);
+  if (b->dry)
+    return;
+
+  full_from = g_build_filename (b->dir, from, NULL);
+  full_to = g_build_filename (b->dir, to, NULL);
+  bench_issue (b, to);
+  g_assert_cmpint (g_rename (full_from, full_to), ==, 0);
+  g_free (full_from);
+  g_free (full_to);
+  bench_harvest (b);
+}
+
+/* Workloads */
+
+static void
+create_storm_run (Bench *b)
+{
+  guint i;
+
+  for (i = 0; i < b->n; i++)
+    {
+      gchar *name = g_strdup_printf ("file-%u", i);
+      bench_create (b, name);
+      g_free (name);
+    }
+}
+
+static void
+rename_chain_setup (Bench *b)
+{
+  bench_create (b, "link-0");
+}
+
+static void
+rename_chain_run (Bench *b)
+{
+  guint i;
+
+  for (i = 0; i < b->n; i++)
+    {
+      gchar *from = g_strdup_printf ("link-%u", i);
+      gchar *to = g_strdup_printf ("link-%u", i + 1);
+      bench_rename (b, from, to);
+      g_free (from);
+      g_free (to);
+    }
+}
+
+static void
+large_dir_setup (Bench *b)
+{
+  guint i;
+
+  for (i = 0; i < b->n; i++)
+    {
+      gchar *name = g_strdup_printf ("old-%u", i);
+      bench_create (b, name);
+      g_free (name);
+    }
+}
+
+static void
+large_dir_run (Bench *b)
+{
+  guint i;
+
+  for (i = 0; i < 10; i++)
+    {
+      gchar *name = g_strdup_printf ("new-%u", i);
+      bench_create (b, name);
+      g_free (name);
+    }
+}
+
+/* The deep tree is built one level at a time: the next directory is
+ * created as soon as the previous one is reported and watched, so the
+ * latency of setting up a watch is included. */
+static void
+deep_tree_next (Bench *b, const gchar *parent, guint level)
+{
+  gchar *path;
+
+  if (level == b->n)
+    return;
+
+  if (parent != NULL)
+    path = g_strdup_printf ("%s/d%u", parent, level);
+  else
+    path = g_strdup_printf ("d%u", level);
+  bench_mkdir (b, path);
+  g_free (path);
+}
+
+static void
+deep_tree_run (Bench *b)
+{
+  guint i;
+
+  if (b->loop != NULL)
+    {
+      deep_tree_next (b, NULL, 0);
+      return;
+    }
+
+  /* Without the monitors, the levels are just recorded in order */
+  for (i = 0; i < b->n; i++)
+    {
+      GString *path = g_string_new ("d0");
+      guint j;
+
+      for (j = 1; j <= i; j++)
+        g_string_append_printf (path, "/d%u", j);
+      bench_mkdir (b, path->str);
+      g_string_free (path, TRUE);
+    }
+}
+
+/* A storm is issued without returning to the main loop, so the perf
+ * sizes are kept below the default inotify queue limit (16384 events,
+ * at least two per syscall). */
+static const Workload workloads[] = {
+  { "create-storm", NULL,               create_storm_run, 100, 5000 },
+  { "rename-chain", rename_chain_setup, rename_chain_run, 100, 5000 },
+  { "large-dir",    large_dir_setup,    large_dir_run,    1000, 100000 },
+  { "deep-tree",    NULL,               deep_tree_run,    3,   100 },
+};
+
+/* Live runs */
+
+static void bench_watch (Bench *b, const gchar *path);
+
+static void
+bench_changed (GFileMonitor      *monitor,
+               GFile             *file,
+               GFile             *other_file,
+               GFileMonitorEvent  event_type,
+               gpointer           user_data)
+{
+  Bench *b = user_data;
+  gchar *path;
+  gchar *other = NULL;
+  gint64 now = g_get_monotonic_time ();
+  gint64 *issued;
+
+  path = g_file_get_relative_path (b->root, file);
+  if (other_file != NULL)
+    other = g_file_get_relative_path (b->root, other_file);
+
+  g_string_append_printf (b->events, "ev %" G_GINT64_FORMAT " %d %s %s\n",
+                          now - b->start, event_type,
+                          path ? path : "-", other ? other : "-");
+
+  if (event_type == G_FILE_MONITOR_EVENT_MOVED)
+    {
+      g_free (path);
+      path = other;
+      other = NULL;
+    }
+  else if (event_type != G_FILE_MONITOR_EVENT_CREATED)
+    {
+      g_free (path);
+      g_free (other);
+      return;
+    }
+
+  issued = path ? g_hash_table_lookup (b->issued, path) : NULL;
+  if (issued != NULL)
+    {
+      gint64 latency = now - *issued;
+
+      g_array_append_val (b->latencies, latency);
+      g_hash_table_remove (b->issued, path);
+      b->n_seen++;
+      b->last = now;
+
+      if (strcmp (b->workload->name, "deep-tree") == 0)
+        {
+          bench_watch (b, path);
+          deep_tree_next (b, path, b->n_seen);
+        }
+    }
+
+  if (b->n_seen == b->n_issued && g_hash_table_size (b->issued) == 0)
+    g_main_loop_quit (b->loop);
+
+  g_free (path);
+  g_free (other);
+}
+
+static void
+bench_watch (Bench *b, const gchar *path)
+{
+  GFile *file;
+  GFileMonitor *monitor;
+  GError *error = NULL;
+
+  file = path ? g_file_resolve_relative_path (b->root, path) : g_object_ref (b->root);
+  monitor = g_file_monitor_directory (file, G_FILE_MONITOR_SEND_MOVED, NULL, &error);
+  g_assert_no_error (error);
+  g_signal_connect (monitor, "changed", G_CALLBACK (bench_changed), b);
+  g_ptr_array_add (b->monitors, monitor);
+  g_object_unref (file);
+}
+
+static gboolean
+bench_start (gpointer user_data)
+{
+  Bench *b = user_data;
+
+  b->start = g_get_monotonic_time ();
+  b->workload->run (b);
+  return FALSE;
+}
+
+static gboolean
+bench_timeout (gpointer user_data)
+{
+  Bench *b = user_data;
+
+  g_main_loop_quit (b->loop);
+  return FALSE;
+}
+
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+remove_tree (const gchar *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const gchar *name;
+
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child = g_build_filename (path, name, NULL);
+          remove_tree (child);
+          g_free (child);
+        }
+      g_dir_close (dir);
+      g_rmdir (path);
+    }
+  else
+    g_remove (path);
+}
+
+static void
+bench_record (Bench *b)
+{
+  const gchar *record = g_getenv ("GIO_MONITOR_BENCH_RECORD");
+  FILE *out;
+
+  if (record == NULL)
+    return;
+
+  out = fopen (record, "a");
+  g_assert (out != NULL);
+  fprintf (out, "# %s %u\n%s%s", b->workload->name, b->n, b->ops->str, b->events->str);
+  fclose (out);
+}
+
+static void
+test_live (gconstpointer data)
+{
+  const Workload *workload = data;
+  Bench b;
+  guint timeout;
+  gint64 total = 0;
+  guint i;
+
+  memset (&b, 0, sizeof (Bench));
+  b.workload = workload;
+  b.n = g_test_perf () ? workload->perf_size : workload->size;
+  b.dir = g_strdup ("monitor-bench-XXXXXX");
+  g_assert (mkdtemp (b.dir) != NULL);
+  b.root = g_file_new_for_path (b.dir);
+  b.monitors = g_ptr_array_new_with_free_func (g_object_unref);
+  b.issued = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  b.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  b.ops = g_string_new (NULL);
+  b.events = g_string_new (NULL);
+
+  if (workload->setup)
+    workload->setup (&b);
+  g_string_append (b.ops, "op sync\n");
+
+#ifdef HAVE_KQUEUE
+  if (g_getenv ("GIO_MONITOR_BENCH_RECORD") != NULL)
+    bench_kqueue_start (&b);
+#endif
+
+  b.loop = g_main_loop_new (NULL, FALSE);
+  bench_watch (&b, NULL);
+  g_idle_add (bench_start, &b);
+  timeout = g_timeout_add_seconds (BENCH_TIMEOUT, bench_timeout, &b);
+  g_main_loop_run (b.loop);
+  g_source_remove (timeout);
+
+#ifdef HAVE_KQUEUE
+  bench_kqueue_stop (&b);
+#endif
+
+  g_assert_cmpuint (g_hash_table_size (b.issued), ==, 0);
+  g_assert_cmpuint (b.n_seen, ==, b.n_issued);
+  g_assert_cmpuint (b.latencies->len, >, 0);
+
+  g_array_sort (b.latencies, compare_latency);
+  for (i = 0; i < b.latencies->len; i++)
+    total += g_array_index (b.latencies, gint64, i);
+
+  g_test_message ("%s on %s: %u events, latency mean %.3f ms, "
+                  "median %.3f ms, max %.3f ms, %.0f events/s",
+                  workload->name,
+                  G_OBJECT_TYPE_NAME (g_ptr_array_index (b.monitors, 0)),
+                  b.latencies->len,
+                  total / 1000.0 / b.latencies->len,
+                  g_array_index (b.latencies, gint64, b.latencies->len / 2) / 1000.0,
+                  g_array_index (b.latencies, gint64, b.latencies->len - 1) / 1000.0,
+                  b.latencies->len * 1e6 / MAX (b.last - b.start, 1));
+  g_test_minimized_result (total / 1e6 / b.latencies->len,
+                           "%s: mean latency", workload->name);
+
+  bench_record (&b);
+
+  g_ptr_array_free (b.monitors, TRUE);
+  g_main_loop_unref (b.loop);
+  remove_tree (b.dir);
+  g_object_unref (b.root);
+  g_free (b.dir);
+  g_hash_table_destroy (b.issued);
+  g_array_free (b.latencies, TRUE);
+  g_string_free (b.ops, TRUE);
+  g_string_free (b.events, TRUE);
+}
+
+/* Replay */
+
+#ifdef HAVE_KQUEUE
+static gdouble kqueue_replay (const gchar *trace, guint window, kh_stats *stats);
+#endif
+
+typedef struct {
+  guint added;
+  guint removed;
+  guint moved;
+  guint other;
+} ReplayCounts;
+
+static void
+count_added (void *udata, const char *path, ino_t inode)
+{
+  ((ReplayCounts *) udata)->added++;
+}
+
+static void
+count_removed (void *udata, const char *path, ino_t inode)
+{
+  ((ReplayCounts *) udata)->removed++;
+}
+
+static void
+count_moved (void *udata,
+             const char *from_path, ino_t from_inode,
+             const char *to_path, ino_t to_inode)
+{
+  ((ReplayCounts *) udata)->moved++;
+}
+
+static void
+count_other (void *udata, const char *path, ino_t inode)
+{
+  ((ReplayCounts *) udata)->other++;
+}
+
+/* The same set of callbacks the kqueue helper installs */
+static const traverse_cbs replay_cbs = {
+  count_added,
+  count_removed,
+  count_moved,
+  count_other,
+  count_moved,
+  NULL, /* many added */
+  NULL, /* many removed */
+  NULL, /* names updated */
+  count_other,
+};
+
+static dep_list *
+replay_snapshot (GHashTable *entries)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  dep_list *head = NULL;
+
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      head = dl_append (head, key, GPOINTER_TO_UINT (value));
+      g_assert (head != NULL);
+    }
+  return head;
+}
+
+/**
+ * replay:
+ * @trace: "op" lines of a recorded workload
+ * @window: how many syscalls are merged into a single notification
+ * @counts: (out): the diff results
+ *
+ * Applies the recorded syscalls of a single directory to a simulated
+ * listing and diffs the listing after every @window of them, as the
+ * kqueue helper would do for a burst of coalesced NOTE_WRITE
+ * notifications. Entries in subdirectories are not visible in the
+ * listing. Everything before the "sync" line is a setup.
+ *
+ * Returns: the time spent in the diff, in seconds.
+ **/
+static gdouble
+replay (const gchar *trace, guint window, ReplayCounts *counts)
+{
+  GHashTable *entries;
+  gchar **lines;
+  dep_list *before = NULL;
+  guint next_inode = 1;
+  guint pending = 0;
+  gboolean synced = FALSE;
+  gdouble elapsed = 0;
+  GTimer *timer;
+  guint i;
+
+  memset (counts, 0, sizeof (ReplayCounts));
+  entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  timer = g_timer_new ();
+  lines = g_strsplit (trace, "\n", -1);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar **args = g_strsplit (lines[i], " ", -1);
+      gboolean visible = TRUE;
+
+      if (g_strv_length (args) >= 2 && strcmp (args[0], "op") == 0)
+        {
+          if (strcmp (args[1], "sync") == 0)
+            {
+              synced = TRUE;
+              pending = 0;
+              dl_free (before);
+              before = replay_snapshot (entries);
+            }
+          else if ((strcmp (args[1], "create") == 0 ||
+                    strcmp (args[1], "mkdir") == 0) && args[2] != NULL)
+            {
+              visible = strchr (args[2], '/') == NULL;
+              if (visible)
+                g_hash_table_insert (entries, g_strdup (args[2]),
+                                     GUINT_TO_POINTER (next_inode++));
+            }
+          else if (strcmp (args[1], "rename") == 0
+                   && args[2] != NULL && args[3] != NULL)
+            {
+              gpointer inode = g_hash_table_lookup (entries, args[2]);
+
+              visible = inode != NULL;
+              if (visible)
+                {
+                  g_hash_table_remove (entries, args[2]);
+                  g_hash_table_insert (entries, g_strdup (args[3]), inode);
+                }
+            }
+
+          if (synced && visible && strcmp (args[1], "sync") != 0
+              && ++pending == window)
+            {
+              dep_list *after = replay_snapshot (entries);
+
+              g_timer_start (timer);
+              dl_calculate (before, after, &replay_cbs, counts);
+              elapsed += g_timer_elapsed (timer, NULL);
+
+              dl_free (before);
+              before = after;
+              pending = 0;
+            }
+        }
+      g_strfreev (args);
+    }
+
+  if (pending > 0)
+    {
+      dep_list *after = replay_snapshot (entries);
+
+      g_timer_start (timer);
+      dl_calculate (before, after, &replay_cbs, counts);
+      elapsed += g_timer_elapsed (timer, NULL);
+
+      dl_free (before);
+      before = after;
+    }
+
+  dl_free (before);
+  g_strfreev (lines);
+  g_timer_destroy (timer);
+  g_hash_table_destroy (entries);
+  return elapsed;
+}
+
+static void
+test_replay (gconstpointer data)
+{
+  const Workload *workload = data;
+  static const guint windows[] = { 1, 16, 256 };
+  ReplayCounts counts;
+  Bench b;
+  guint i;
+
+  memset (&b, 0, sizeof (Bench));
+  b.workload = workload;
+  b.n = g_test_perf () ? workload->perf_size : workload->size;
+  b.dry = TRUE;
+  b.ops = g_string_new (NULL);
+
+  if (workload->setup)
+    workload->setup (&b);
+  g_string_append (b.ops, "op sync\n");
+  workload->run (&b);
+
+  for (i = 0; i < G_N_ELEMENTS (windows); i++)
+    {
+      gdouble elapsed = replay (b.ops->str, windows[i], &counts);
+
+      g_test_message ("%s, %u syscalls per notification: %.3f s, "
+                      "%u added, %u removed, %u moved",
+                      workload->name, windows[i], elapsed,
+                      counts.added, counts.removed, counts.moved);
+      g_test_minimized_result (elapsed, "%s: diff time, window %u",
+                               workload->name, windows[i]);
+
+      g_assert_cmpuint (counts.removed, ==, 0);
+      g_assert_cmpuint (counts.other, ==, 0);
+      if (windows[i] != 1)
+        continue;
+
+      /* Without coalescing every syscall is reported on its own */
+      if (workload->setup == rename_chain_setup)
+        g_assert_cmpuint (counts.moved, ==, b.n);
+      else if (workload->run == deep_tree_run)
+        g_assert_cmpuint (counts.added, ==, 1);
+      else if (workload->run == large_dir_run)
+        g_assert_cmpuint (counts.added, ==, 10);
+      else
+        g_assert_cmpuint (counts.added, ==, b.n);
+    }
+
+  g_string_free (b.ops, TRUE);
+}
+
+static void
+test_replay_file (void)
+{
+  const gchar *path = g_getenv ("GIO_MONITOR_BENCH_REPLAY");
+  GError *error = NULL;
+  gchar *contents;
+  gchar **traces;
+  guint i;
+
+  g_assert (g_file_get_contents (path, &contents, NULL, &error));
+  g_assert_no_error (error);
+
+  /* Every recorded workload starts with a "# name size" line */
+  traces = g_strsplit (contents, "# ", -1);
+  for (i = 0; traces[i] != NULL; i++)
+    {
+      ReplayCounts counts;
+      gdouble elapsed;
+
+      if (traces[i][0] == '\0')
+        continue;
+
+#ifdef HAVE_KQUEUE
+      if (strstr (traces[i], "\nkn ") != NULL)
+        {
+          kh_stats stats;
+
+          elapsed = kqueue_replay (traces[i], 1, &stats);
+          g_test_message ("%.*s: %.3f s, %" G_GUINT64_FORMAT " notifications, "
+                          "%" G_GUINT64_FORMAT " diffs",
+                          (int) strcspn (traces[i], "\n"), traces[i], elapsed,
+                          stats.n_notifications, stats.n_dir_diffs);
+          continue;
+        }
+#endif
+
+      elapsed = replay (traces[i], 1, &counts);
+      g_test_message ("%.*s: %.3f s, %u added, %u removed, %u moved",
+                      (int) strcspn (traces[i], "\n"), traces[i], elapsed,
+                      counts.added, counts.removed, counts.moved);
+    }
+
+  g_strfreev (traces);
+  g_free (contents);
+}
+
+/* Rate limiting of GFileMonitor itself, without any backend: a fake
+ * monitor reports a steady stream of changes to many files, like a
+ * directory of logs being written, and the CPU time the main loop
+ * spends on the rate limiting is measured.
+ */
+
+#define RATE_LIMIT_MSECS  100
+#define RATE_LIMIT_ROUNDS 3
+#define RATE_LIMIT_TICKS  200 /* per round, one per millisecond */
+
+typedef GFileMonitor      FakeMonitor;
+typedef GFileMonitorClass FakeMonitorClass;
+
+static GType fake_monitor_get_type (void);
+G_DEFINE_TYPE (FakeMonitor, fake_monitor, G_TYPE_FILE_MONITOR)
+
+static gboolean
+fake_monitor_cancel (GFileMonitor *monitor)
+{
+  return TRUE;
+}
+
+static void
+fake_monitor_class_init (FakeMonitorClass *klass)
+{
+  klass->cancel = fake_monitor_cancel;
+}
+
+static void
+fake_monitor_init (FakeMonitor *monitor)
+{
+}
+
+typedef struct {
+  GMainLoop *loop;
+  GFileMonitor *monitor;
+  GPtrArray *files;
+  guint tick;
+  guint n_changed;
+  guint n_done;
+} RateLimit;
+
+static void
+rate_limit_changed (GFileMonitor      *monitor,
+                    GFile             *file,
+                    GFile             *other_file,
+                    GFileMonitorEvent  event_type,
+                    gpointer           user_data)
+{
+  RateLimit *r = user_data;
+
+  if (event_type == G_FILE_MONITOR_EVENT_CHANGED)
+    r->n_changed++;
+  else if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+    r->n_done++;
+
+  if (r->n_changed == RATE_LIMIT_ROUNDS * r->files->len &&
+      r->n_done == r->files->len)
+    g_main_loop_quit (r->loop);
+}
+
+/* Every tick changes the next slice of the files, so that the timeouts
+ * of the files are spread over the whole round */
+static gboolean
+rate_limit_tick (gpointer user_data)
+{
+  RateLimit *r = user_data;
+  guint slice = r->tick % RATE_LIMIT_TICKS;
+  guint first = slice * r->files->len / RATE_LIMIT_TICKS;
+  guint last = (slice + 1) * r->files->len / RATE_LIMIT_TICKS;
+  guint i;
+
+  for (i = first; i < last; i++)
+    g_file_monitor_emit_event (r->monitor, r->files->pdata[i], NULL,
+                               G_FILE_MONITOR_EVENT_CHANGED);
+
+  return ++r->tick < RATE_LIMIT_ROUNDS * RATE_LIMIT_TICKS;
+}
+
+static gboolean
+rate_limit_timeout (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return FALSE;
+}
+
+static void
+test_rate_limit (void)
+{
+  RateLimit r = { NULL, };
+  guint n = g_test_perf () ? 100000 : 1000;
+  guint i, id;
+  gint64 start;
+  clock_t cpu;
+
+  r.monitor = g_object_new (fake_monitor_get_type (), NULL);
+  g_file_monitor_set_rate_limit (r.monitor, RATE_LIMIT_MSECS);
+  r.loop = g_main_loop_new (NULL, FALSE);
+  g_signal_connect (r.monitor, "changed", G_CALLBACK (rate_limit_changed), &r);
+
+  r.files = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = 0; i < n; i++)
+    {
+      gchar *path = g_strdup_printf ("/nonexistent/%u", i);
+
+      g_ptr_array_add (r.files, g_file_new_for_path (path));
+      g_free (path);
+    }
+
+  start = g_get_monotonic_time ();
+  cpu = clock ();
+
+  /* A file changes once per round, which is longer than the rate limit,
+   * so every change is sent right away. The virtual CHANGES_DONE_HINT
+   * is postponed until the last round is over. */
+  g_timeout_add (1, rate_limit_tick, &r);
+  id = g_timeout_add_seconds (BENCH_TIMEOUT, rate_limit_timeout, r.loop);
+  g_main_loop_run (r.loop);
+  g_source_remove (id);
+
+  cpu = clock () - cpu;
+  g_test_message ("%u files: %.3f s, %.3f s of CPU",
+                  n, (g_get_monotonic_time () - start) / 1e6,
+                  (gdouble) cpu / CLOCKS_PER_SEC);
+  g_test_minimized_result ((gdouble) cpu / CLOCKS_PER_SEC,
+                           "rate limiting %u files: CPU time", n);
+
+  g_assert_cmpuint (r.n_changed, ==, RATE_LIMIT_ROUNDS * n);
+  g_assert_cmpuint (r.n_done, ==, n);
+
+  g_file_monitor_cancel (r.monitor);
+  g_object_unref (r.monitor);
+  g_ptr_array_free (r.files, TRUE);
+  g_main_loop_unref (r.loop);
+}
+
+#ifdef HAVE_KQUEUE
+/* Replay through the kqueue helper: the notifications recorded from the
+ * kernel are processed by a copy of the helper built into the test, so
+ * that the merging of the notifications and the dispatch are measured
+ * along with the diff, without a second run of the workload.
+ */
+
+static void
+kqueue_replay_op (const gchar *dir, gchar **args)
+{
+  gchar *path, *other;
+  int fd;
+
+  if (args[2] == NULL)
+    return;
+
+  path = g_build_filename (dir, args[2], NULL);
+  if (strcmp (args[1], "create") == 0)
+    {
+      fd = g_open (path, O_CREAT | O_WRONLY, 0644);
+      g_assert_cmpint (fd, !=, -1);
+      close (fd);
+    }
+  else if (strcmp (args[1], "mkdir") == 0)
+    g_assert_cmpint (g_mkdir (path, 0755), ==, 0);
+  else if (strcmp (args[1], "rename") == 0 && args[3] != NULL)
+    {
+      other = g_build_filename (dir, args[3], NULL);
+      g_assert_cmpint (g_rename (path, other), ==, 0);
+      g_free (other);
+    }
+  g_free (path);
+}
+
+/**
+ * kqueue_replay:
+ * @trace: "op" and "kn" lines of a recorded workload
+ * @window: how many kevent() calls are read in a single dispatch
+ * @stats: (out): the helper counters of the replay
+ *
+ * Applies the recorded syscalls to a new directory, watched by
+ * a subscription of the kqueue helper, and passes the recorded
+ * notifications of the root to _kh_process_notifications() at the
+ * points where they were received, @window kevent() calls at a time.
+ * They are merged, dispatched and diffed against the directory as the
+ * helper does with the notifications of the kqueue thread. The
+ * coalescing window of GIO_KQUEUE_COALESCE_MSECS should not be set,
+ * as the main loop does not run during the replay.
+ *
+ * Returns: the time spent processing the notifications, in seconds.
+ **/
+static gdouble
+kqueue_replay (const gchar *trace, guint window, kh_stats *stats)
+{
+  GFileMonitor *monitor;
+  kqueue_sub *sub = NULL;
+  GArray *pending;
+  kh_stats before;
+  gchar *dir;
+  gchar **lines;
+  guint n_reads = 0;
+  gdouble elapsed = 0;
+  GTimer *timer;
+  guint i;
+
+  g_assert (_kh_startup ());
+  _kh_get_stats (&before);
+
+  dir = g_strdup ("monitor-bench-XXXXXX");
+  g_assert (mkdtemp (dir) != NULL);
+  monitor = g_object_new (fake_monitor_get_type (), NULL);
+  pending = g_array_new (FALSE, FALSE, sizeof (struct kqueue_notification));
+  timer = g_timer_new ();
+  lines = g_strsplit (trace, "\n", -1);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar **args = g_strsplit (lines[i], " ", -1);
+      guint j;
+
+      if (g_strv_length (args) >= 2 && strcmp (args[0], "op") == 0)
+        {
+          if (strcmp (args[1], "sync") == 0)
+            {
+              /* Set up the way a directory monitor does */
+              sub = _kh_sub_new (dir, TRUE, monitor);
+              sub->child_changes = g_getenv ("GIO_KQUEUE_CHILD_CHANGES") != NULL;
+              g_assert (_kh_start_watching (sub));
+            }
+          else
+            kqueue_replay_op (dir, args);
+        }
+      else if (sub != NULL && strcmp (args[0], "kn") == 0)
+        {
+          for (j = 1; args[j] != NULL; j++)
+            {
+              struct kqueue_notification n;
+
+              n.fd = sub->fd;
+              n.flags = strtoul (args[j], NULL, 10);
+              g_array_append_val (pending, n);
+            }
+
+          if (++n_reads == window)
+            {
+              g_timer_start (timer);
+              _kh_process_notifications ((struct kqueue_notification *) pending->data,
+                                         pending->len);
+              elapsed += g_timer_elapsed (timer, NULL);
+
+              g_array_set_size (pending, 0);
+              n_reads = 0;
+            }
+        }
+      g_strfreev (args);
+    }
+
+  if (pending->len > 0)
+    {
+      g_timer_start (timer);
+      _kh_process_notifications ((struct kqueue_notification *) pending->data,
+                                 pending->len);
+      elapsed += g_timer_elapsed (timer, NULL);
+    }
+
+  _kh_get_stats (stats);
+  stats->n_notifications -= before.n_notifications;
+  stats->n_coalesced -= before.n_coalesced;
+  stats->n_batches -= before.n_batches;
+  stats->n_dir_diffs -= before.n_dir_diffs;
+  stats->n_diffed_notifications -= before.n_diffed_notifications;
+  stats->dir_diff_time -= before.dir_diff_time;
+
+  if (sub != NULL)
+    {
+      _kh_cancel_sub (sub);
+      _kh_sub_free (sub);
+    }
+  g_object_unref (monitor);
+  g_strfreev (lines);
+  g_timer_destroy (timer);
+  g_array_free (pending, TRUE);
+  remove_tree (dir);
+  g_free (dir);
+  return elapsed;
+}
+
+static void
+test_kqueue_replay (gconstpointer data)
+{
+  const Workload *workload = data;
+  static const guint windows[] = { 1, 16, 256 };
+  kh_stats stats;
+  Bench b;
+  guint i;
+
+  /* Run the workload once, without monitors, to record it */
+  memset (&b, 0, sizeof (Bench));
+  b.workload = workload;
+  b.n = g_test_perf () ? workload->perf_size : workload->size;
+  b.dir = g_strdup ("monitor-bench-XXXXXX");
+  g_assert (mkdtemp (b.dir) != NULL);
+  b.ops = g_string_new (NULL);
+
+  if (workload->setup)
+    workload->setup (&b);
+  g_string_append (b.ops, "op sync\n");
+  bench_kqueue_start (&b);
+  workload->run (&b);
+  bench_kqueue_stop (&b);
+  remove_tree (b.dir);
+
+  for (i = 0; i < G_N_ELEMENTS (windows); i++)
+    {
+      gdouble elapsed = kqueue_replay (b.ops->str, windows[i], &stats);
+
+      g_test_message ("%s, %u reads per dispatch: %.3f s, "
+                      "%" G_GUINT64_FORMAT " notifications, "
+                      "%" G_GUINT64_FORMAT " coalesced, "
+                      "%" G_GUINT64_FORMAT " diffs, %.3f s diffing",
+                      workload->name, windows[i], elapsed,
+                      stats.n_notifications, stats.n_coalesced,
+                      stats.n_dir_diffs, stats.dir_diff_time / 1e6);
+      g_test_minimized_result (elapsed, "%s: kqueue processing time, window %u",
+                               workload->name, windows[i]);
+
+      g_assert_cmpuint (stats.n_notifications, >, 0);
+      g_assert_cmpuint (stats.n_dir_diffs, >, 0);
+      g_assert_cmpuint (stats.n_dir_diffs, <=, stats.n_batches);
+      g_assert_cmpuint (stats.n_diffed_notifications, <=, stats.n_notifications);
+    }
+
+  g_free (b.dir);
+  g_string_free (b.ops, TRUE);
+}
+#endif
+
+/* Delivery of the queued changes to the handlers, one "changed"
+ * emission per change or one "changes" emission per dispatch */
+
+typedef struct {
+  GFileMonitor *monitor;
+  GPtrArray *files;
+  guint n_seen;
+  gboolean in_order;
+} Delivery;
+
+static void
+delivery_changed (GFileMonitor      *monitor,
+                  GFile             *file,
+                  GFile             *other_file,
+                  GFileMonitorEvent  event_type,
+                  gpointer           user_data)
+{
+  Delivery *d = user_data;
+
+  if (file != d->files->pdata[d->n_seen % d->files->len])
+    d->in_order = FALSE;
+  d->n_seen++;
+}
+
+static void
+delivery_changes (GFileMonitor             *monitor,
+                  const GFileMonitorChange *changes,
+                  guint                     n_changes,
+                  gpointer                  user_data)
+{
+  Delivery *d = user_data;
+  guint i;
+
+  for (i = 0; i < n_changes; i++)
+    {
+      if (changes[i].file != d->files->pdata[d->n_seen % d->files->len] ||
+          changes[i].event_type != G_FILE_MONITOR_EVENT_CREATED)
+        d->in_order = FALSE;
+      d->n_seen++;
+    }
+}
+
+static void
+test_delivery (gconstpointer data)
+{
+  gboolean batched = GPOINTER_TO_INT (data);
+  Delivery d = { NULL, };
+  guint n = g_test_perf () ? 1000000 : 10000;
+  guint per_dispatch = 1000;
+  guint i, j;
+  gdouble elapsed;
+
+  d.monitor = g_object_new (fake_monitor_get_type (), NULL);
+  g_file_monitor_set_batched (d.monitor, batched);
+  d.in_order = TRUE;
+  if (batched)
+    g_signal_connect (d.monitor, "changes", G_CALLBACK (delivery_changes), &d);
+  else
+    g_signal_connect (d.monitor, "changed", G_CALLBACK (delivery_changed), &d);
+
+  d.files = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = 0; i < per_dispatch; i++)
+    {
+      gchar *path = g_strdup_printf ("/nonexistent/%u", i);
+
+      g_ptr_array_add (d.files, g_file_new_for_path (path));
+      g_free (path);
+    }
+
+  g_test_timer_start ();
+  for (i = 0; i < n / per_dispatch; i++)
+    {
+      for (j = 0; j < per_dispatch; j++)
+        g_file_monitor_emit_event (d.monitor, d.files->pdata[j], NULL,
+                                   G_FILE_MONITOR_EVENT_CREATED);
+      while (g_main_context_iteration (NULL, FALSE));
+    }
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_message ("%s: %u changes in %.3f s, %.0f per second",
+                  batched ? "batched" : "per change", n, elapsed, n / elapsed);
+  g_test_minimized_result (elapsed, "delivery of %u changes, %s",
+                           n, batched ? "batched" : "per change");
+
+  g_assert_cmpuint (d.n_seen, ==, n);
+  g_assert (d.in_order);
+
+  g_file_monitor_cancel (d.monitor);
+  g_object_unref (d.monitor);
+  g_ptr_array_free (d.files, TRUE);
+}
+
+/* The polling fallback, for filesystems without change notification.
+ *
+ * g_file_monitor_file() falls back to polling for a GFile that cannot
+ * monitor itself, so the local files are wrapped into one.
+ */
+
+typedef struct {
+  GObject parent_instance;
+  GFile *file;
+} PollFile;
+
+typedef GObjectClass PollFileClass;
+
+static GType poll_file_get_type (void);
+static void  poll_file_iface_init (GFileIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (PollFile, poll_file, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_FILE,
+                                                poll_file_iface_init))
+
+#define POLL_FILE(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), poll_file_get_type (), PollFile))
+#define IS_POLL_FILE(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), poll_file_get_type ()))
+
+static GFile *
+poll_file_new (GFile *file)
+{
+  PollFile *poll_file = g_object_new (poll_file_get_type (), NULL);
+
+  poll_file->file = g_object_ref (file);
+  return G_FILE (poll_file);
+}
+
+static void
+poll_file_finalize (GObject *object)
+{
+  g_object_unref (POLL_FILE (object)->file);
+
+  G_OBJECT_CLASS (poll_file_parent_class)->finalize (object);
+}
+
+static void
+poll_file_class_init (PollFileClass *klass)
+{
+  klass->finalize = poll_file_finalize;
+}
+
+static void
+poll_file_init (PollFile *poll_file)
+{
+}
+
+static GFile *
+poll_file_dup (GFile *file)
+{
+  return poll_file_new (POLL_FILE (file)->file);
+}
+
+static guint
+poll_file_hash (GFile *file)
+{
+  return g_file_hash (POLL_FILE (file)->file);
+}
+
+static gboolean
+poll_file_equal (GFile *file1,
+                 GFile *file2)
+{
+  return IS_POLL_FILE (file2) &&
+    g_file_equal (POLL_FILE (file1)->file, POLL_FILE (file2)->file);
+}
+
+static gboolean
+poll_file_is_native (GFile *file)
+{
+  return FALSE;
+}
+
+static char *
+poll_file_get_path (GFile *file)
+{
+  return g_file_get_path (POLL_FILE (file)->file);
+}
+
+static char *
+poll_file_get_uri (GFile *file)
+{
+  return g_file_get_uri (POLL_FILE (file)->file);
+}
+
+static char *
+poll_file_get_parse_name (GFile *file)
+{
+  return g_file_get_parse_name (POLL_FILE (file)->file);
+}
+
+static GFileInfo *
+poll_file_query_info (GFile                *file,
+                      const char           *attributes,
+                      GFileQueryInfoFlags   flags,
+                      GCancellable         *cancellable,
+                      GError              **error)
+{
+  return g_file_query_info (POLL_FILE (file)->file, attributes, flags,
+                            cancellable, error);
+}
+
+static void
+poll_file_iface_init (GFileIface *iface)
+{
+  iface->dup = poll_file_dup;
+  iface->hash = poll_file_hash;
+  iface->equal = poll_file_equal;
+  iface->is_native = poll_file_is_native;
+  iface->get_path = poll_file_get_path;
+  iface->get_uri = poll_file_get_uri;
+  iface->get_parse_name = poll_file_get_parse_name;
+  iface->query_info = poll_file_query_info;
+}
+
+typedef struct {
+  GMainLoop *loop;
+  guint n_changed;
+  guint n_expected;
+} Poll;
+
+static void
+poll_changed (GFileMonitor      *monitor,
+              GFile             *file,
+              GFile             *other_file,
+              GFileMonitorEvent  event_type,
+              gpointer           user_data)
+{
+  Poll *p = user_data;
+
+  if (event_type != G_FILE_MONITOR_EVENT_CHANGED)
+    return;
+
+  if (++p->n_changed == p->n_expected)
+    g_main_loop_quit (p->loop);
+}
+
+static gboolean
+poll_timeout (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return FALSE;
+}
+
+static void
+test_poll (void)
+{
+  Poll p = { NULL, };
+  GPtrArray *monitors;
+  gchar *dir;
+  guint n = g_test_perf () ? 5000 : 100;
+  guint interval = g_test_perf () ? 5 : 1;
+  guint i, id;
+  gint64 start;
+  clock_t cpu;
+
+  dir = g_strdup ("monitor-bench-XXXXXX");
+  g_assert (mkdtemp (dir) != NULL);
+
+  p.loop = g_main_loop_new (NULL, FALSE);
+  p.n_expected = n;
+  monitors = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (i = 0; i < n; i++)
+    {
+      gchar *name = g_strdup_printf ("%u", i);
+      gchar *path = g_build_filename (dir, name, NULL);
+      GFile *local = g_file_new_for_path (path);
+      GFile *file = poll_file_new (local);
+      GFileMonitor *monitor;
+
+      g_assert (g_file_set_contents (path, "x", 1, NULL));
+      monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+      g_assert_cmpstr (G_OBJECT_TYPE_NAME (monitor), ==, "GPollFileMonitor");
+      g_object_set (monitor, "poll-interval", interval, NULL);
+      g_signal_connect (monitor, "changed", G_CALLBACK (poll_changed), &p);
+      g_ptr_array_add (monitors, monitor);
+
+      g_object_unref (file);
+      g_object_unref (local);
+      g_free (path);
+      g_free (name);
+    }
+
+  /* Let the first polls fill the caches */
+  g_timeout_add_seconds (interval + 2, poll_timeout, p.loop);
+  g_main_loop_run (p.loop);
+
+  start = g_get_monotonic_time ();
+  cpu = clock ();
+
+  for (i = 0; i < n; i++)
+    {
+      gchar *name = g_strdup_printf ("%u", i);
+      gchar *path = g_build_filename (dir, name, NULL);
+
+      g_assert (g_file_set_contents (path, "xy", 2, NULL));
+      g_free (path);
+      g_free (name);
+    }
+
+  id = g_timeout_add_seconds (BENCH_TIMEOUT, poll_timeout, p.loop);
+  g_main_loop_run (p.loop);
+  g_source_remove (id);
+
+  cpu = clock () - cpu;
+  g_test_message ("%u files polled every %u s: all changes seen in %.3f s, %.3f s of CPU",
+                  n, interval, (g_get_monotonic_time () - start) / 1e6,
+                  (gdouble) cpu / CLOCKS_PER_SEC);
+  g_test_minimized_result ((gdouble) cpu / CLOCKS_PER_SEC,
+                           "polling %u files: CPU time", n);
+
+  g_assert_cmpuint (p.n_changed, ==, n);
+
+  for (i = 0; i < monitors->len; i++)
+    g_file_monitor_cancel (monitors->pdata[i]);
+  g_ptr_array_free (monitors, TRUE);
+  g_main_loop_unref (p.loop);
+  remove_tree (dir);
+  g_free (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  guint i;
+
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (workloads); i++)
+    {
+      gchar *path;
+
+      path = g_strdup_printf ("/monitor-bench/live/%s", workloads[i].name);
+      g_test_add_data_func (path, &workloads[i], test_live);
+      g_free (path);
+
+      path = g_strdup_printf ("/monitor-bench/replay/%s", workloads[i].name);
+      g_test_add_data_func (path, &workloads[i], test_replay);
+      g_free (path);
+
+#ifdef HAVE_KQUEUE
+      path = g_strdup_printf ("/monitor-bench/kqueue-replay/%s", workloads[i].name);
+      g_test_add_data_func (path, &workloads[i], test_kqueue_replay);
+      g_free (path);
+#endif
+    }
+
+  g_test_add_func ("/monitor-bench/rate-limit", test_rate_limit);
+  g_test_add_func ("/monitor-bench/poll", test_poll);
+  g_test_add_data_func ("/monitor-bench/delivery/changed", GINT_TO_POINTER (FALSE), test_delivery);
+  g_test_add_data_func ("/monitor-bench/delivery/changes", GINT_TO_POINTER (TRUE), test_delivery);
+
+  if (g_getenv ("GIO_MONITOR_BENCH_REPLAY") != NULL)
+    g_test_add_func ("/monitor-bench/replay/file", test_replay_file);
+
+  return g_test_run ();
+}
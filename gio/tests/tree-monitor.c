@@ -0,0 +1,558 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#define WAIT_TIMEOUT 10 /* seconds */
+
+typedef struct {
+  gchar *dir;
+  GFile *root;
+  GFileMonitor *monitor;
+  GMainLoop *loop;
+  GHashTable *events;   /* "event relative/path" -> 1 */
+  const gchar *expected;
+} Fixture;
+
+static const gchar *
+event_name (GFileMonitorEvent event_type)
+{
+  switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_CREATED:
+      return "created";
+    case G_FILE_MONITOR_EVENT_DELETED:
+      return "deleted";
+    case G_FILE_MONITOR_EVENT_CHANGED:
+      return "changed";
+    case G_FILE_MONITOR_EVENT_MOVED:
+      return "moved";
+    default:
+      return NULL;
+    }
+}
+
+static void
+changed_cb (GFileMonitor      *monitor,
+            GFile             *file,
+            GFile             *other_file,
+            GFileMonitorEvent  event_type,
+            gpointer           user_data)
+{
+  Fixture *f = user_data;
+  const gchar *name = event_name (event_type);
+  gchar *rel;
+
+  if (name == NULL)
+    return;
+
+  rel = g_file_get_relative_path (f->root, file);
+  if (rel == NULL)
+    rel = g_strdup (".");
+
+  g_hash_table_insert (f->events, g_strdup_printf ("%s %s", name, rel), GINT_TO_POINTER (1));
+  g_free (rel);
+
+  if (f->expected != NULL && g_hash_table_lookup (f->events, f->expected) != NULL)
+    g_main_loop_quit (f->loop);
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return FALSE;
+}
+
+/* Runs the main loop until the event has been seen, or times out */
+static gboolean
+wait_for (Fixture *f, const gchar *event)
+{
+  guint id;
+
+  if (g_hash_table_lookup (f->events, event) == NULL)
+    {
+      f->expected = event;
+      id = g_timeout_add_seconds (WAIT_TIMEOUT, timeout_cb, f->loop);
+      g_main_loop_run (f->loop);
+      g_source_remove (id);
+      f->expected = NULL;
+    }
+
+  if (g_hash_table_lookup (f->events, event) == NULL)
+    {
+      g_test_message ("event '%s' not seen", event);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gchar *
+make_path (Fixture *f, const gchar *rel)
+{
+  return g_build_filename (f->dir, rel, NULL);
+}
+
+static void
+do_mkdir (Fixture *f, const gchar *rel)
+{
+  gchar *path = make_path (f, rel);
+
+  g_assert_cmpint (g_mkdir (path, 0755), ==, 0);
+  g_free (path);
+}
+
+static void
+do_create (Fixture *f, const gchar *rel)
+{
+  gchar *path = make_path (f, rel);
+
+  g_assert (g_file_set_contents (path, "x", 1, NULL));
+  g_free (path);
+}
+
+static void
+fixture_setup (Fixture *f, gconstpointer data)
+{
+  GFileMonitorFlags flags = GPOINTER_TO_UINT (data);
+  GError *error = NULL;
+
+  f->dir = g_strdup ("tree-monitor-XXXXXX");
+  g_assert (mkdtemp (f->dir) != NULL);
+  f->root = g_file_new_for_path (f->dir);
+  f->loop = g_main_loop_new (NULL, FALSE);
+  f->events = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  do_mkdir (f, "a");
+  do_mkdir (f, "a/b");
+
+  f->monitor = g_file_monitor_tree (f->root, flags, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (f->monitor != NULL);
+  g_signal_connect (f->monitor, "changed", G_CALLBACK (changed_cb), f);
+}
+
+static void
+remove_tree (const gchar *path)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child = g_build_filename (path, name, NULL);
+          remove_tree (child);
+          g_free (child);
+        }
+      g_dir_close (dir);
+      g_rmdir (path);
+    }
+  else
+    g_remove (path);
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer data)
+{
+  g_file_monitor_cancel (f->monitor);
+  g_object_unref (f->monitor);
+  remove_tree (f->dir);
+  g_object_unref (f->root);
+  g_main_loop_unref (f->loop);
+  g_hash_table_destroy (f->events);
+  g_free (f->dir);
+}
+
+/* Changes anywhere below the root are reported */
+static void
+test_nested (Fixture *f, gconstpointer data)
+{
+  do_create (f, "top");
+  g_assert (wait_for (f, "created top"));
+
+  do_create (f, "a/b/deep");
+  g_assert (wait_for (f, "created a/b/deep"));
+}
+
+/* Directories created after the monitor are watched as well */
+static void
+test_new_dir (Fixture *f, gconstpointer data)
+{
+  do_mkdir (f, "c");
+  g_assert (wait_for (f, "created c"));
+
+  do_create (f, "c/file");
+  g_assert (wait_for (f, "created c/file"));
+}
+
+/* With G_FILE_MONITOR_SCAN_ON_ADD, the contents a new directory got
+ * before it was watched are reported */
+static void
+test_scan_on_add (Fixture *f, gconstpointer data)
+{
+  gchar *path = make_path (f, "d/e/f");
+
+  g_assert_cmpint (g_mkdir_with_parents (path, 0755), ==, 0);
+  do_create (f, "d/e/f/file");
+  g_free (path);
+
+  g_assert (wait_for (f, "created d"));
+  g_assert (wait_for (f, "created d/e"));
+  g_assert (wait_for (f, "created d/e/f"));
+  g_assert (wait_for (f, "created d/e/f/file"));
+
+  /* and the new directories are watched */
+  do_create (f, "d/e/f/later");
+  g_assert (wait_for (f, "created d/e/f/later"));
+}
+
+/* Removed directories are dropped, and the subdirectories do not
+ * report themselves */
+static void
+test_remove (Fixture *f, gconstpointer data)
+{
+  gchar *path = make_path (f, "a/b");
+
+  g_assert_cmpint (g_rmdir (path), ==, 0);
+  g_assert (wait_for (f, "deleted a/b"));
+  g_free (path);
+
+  do_mkdir (f, "a/b");
+  g_assert (wait_for (f, "created a/b"));
+  do_create (f, "a/b/again");
+  g_assert (wait_for (f, "created a/b/again"));
+}
+
+static guint32
+get_n_dirs (Fixture *f)
+{
+  GVariant *stats;
+  guint32 n_dirs;
+
+  stats = g_file_monitor_get_statistics (f->monitor);
+  g_assert (g_variant_lookup (stats, "tree-directories", "u", &n_dirs));
+  g_variant_unref (stats);
+
+  return n_dirs;
+}
+
+/* A directory moved within the tree is only watched at its new place,
+ * and a sibling sharing its name as a prefix is left alone */
+static void
+test_move_subtree (Fixture *f, gconstpointer data)
+{
+  gchar *from, *to;
+
+  do_mkdir (f, "ab");
+  g_assert (wait_for (f, "created ab"));
+  do_mkdir (f, "ab/c");
+  g_assert (wait_for (f, "created ab/c"));
+  do_create (f, "ab/c/file");
+  g_assert (wait_for (f, "created ab/c/file"));
+  g_assert_cmpuint (get_n_dirs (f), ==, 5);
+
+  from = make_path (f, "a");
+  to = make_path (f, "ab/a");
+  g_assert_cmpint (g_rename (from, to), ==, 0);
+  g_free (from);
+  g_free (to);
+  g_assert (wait_for (f, "created ab/a"));
+
+  do_create (f, "ab/a/b/file");
+  g_assert (wait_for (f, "created ab/a/b/file"));
+
+  /* the root, ab, ab/c, ab/a and ab/a/b */
+  g_assert_cmpuint (get_n_dirs (f), ==, 5);
+
+  do_create (f, "ab/c/again");
+  g_assert (wait_for (f, "created ab/c/again"));
+}
+
+static void
+changes_cb (GFileMonitor             *monitor,
+            const GFileMonitorChange *changes,
+            guint                     n_changes,
+            gpointer                  user_data)
+{
+  guint i;
+
+  for (i = 0; i < n_changes; i++)
+    changed_cb (monitor, changes[i].file, changes[i].other_file,
+                changes[i].event_type, user_data);
+}
+
+/* The directories are followed with batched delivery as well */
+static void
+test_batched (Fixture *f, gconstpointer data)
+{
+  g_signal_handlers_disconnect_by_func (f->monitor, changed_cb, f);
+  g_signal_connect (f->monitor, "changes", G_CALLBACK (changes_cb), f);
+  g_file_monitor_set_batched (f->monitor, TRUE);
+
+  do_mkdir (f, "c");
+  g_assert (wait_for (f, "created c"));
+
+  do_create (f, "c/file");
+  g_assert (wait_for (f, "created c/file"));
+}
+
+/* The statistics cover the monitor and its backend */
+static void
+test_statistics (Fixture *f, gconstpointer data)
+{
+  GVariant *stats, *histogram;
+  const gchar *backend;
+  guint64 delivered, deliveries, total;
+  guint32 n_dirs, n_watches, n_polled;
+  gsize i;
+
+  do_create (f, "a/b/file");
+  g_assert (wait_for (f, "created a/b/file"));
+
+  stats = g_file_monitor_get_statistics (f->monitor);
+  g_assert (g_variant_is_of_type (stats, G_VARIANT_TYPE ("a{sv}")));
+
+  g_assert (g_variant_lookup (stats, "events-delivered", "t", &delivered));
+  g_assert (g_variant_lookup (stats, "deliveries", "t", &deliveries));
+  g_assert_cmpuint (delivered, >=, 1);
+  g_assert_cmpuint (deliveries, >=, 1);
+  g_assert_cmpuint (deliveries, <=, delivered);
+
+  /* Every delivery shows up in the latency histogram */
+  histogram = g_variant_lookup_value (stats, "delivery-latency-histogram",
+                                      G_VARIANT_TYPE ("at"));
+  g_assert (histogram != NULL);
+  total = 0;
+  for (i = 0; i < g_variant_n_children (histogram); i++)
+    {
+      guint64 count;
+
+      g_variant_get_child (histogram, i, "t", &count);
+      total += count;
+    }
+  g_assert_cmpuint (total, ==, deliveries);
+  g_variant_unref (histogram);
+
+  g_assert (g_variant_lookup (stats, "tree-directories", "u", &n_dirs));
+  g_assert_cmpuint (n_dirs, ==, 3);
+
+  if (g_variant_lookup (stats, "backend", "&s", &backend) &&
+      strcmp (backend, "inotify") == 0)
+    {
+      /* Directories over the watch budget are polled */
+      g_assert (g_variant_lookup (stats, "watches", "u", &n_watches));
+      g_assert (g_variant_lookup (stats, "polled-directories", "u", &n_polled));
+      g_assert_cmpuint (n_watches + n_polled, >=, n_dirs);
+    }
+
+  g_variant_unref (stats);
+}
+
+/* Resource usage for a large tree */
+
+static gsize
+get_rss (void)
+{
+  gchar *contents;
+  gsize rss = 0;
+
+  if (g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    {
+      gulong size, resident;
+
+      if (sscanf (contents, "%lu %lu", &size, &resident) == 2)
+        rss = resident * sysconf (_SC_PAGESIZE);
+      g_free (contents);
+    }
+
+  return rss;
+}
+
+/* The number of inotify watches held by the process */
+static guint
+count_watches (void)
+{
+  GDir *dir;
+  const gchar *name;
+  guint n = 0;
+
+  dir = g_dir_open ("/proc/self/fdinfo", 0, NULL);
+  if (dir == NULL)
+    return 0;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *path = g_build_filename ("/proc/self/fdinfo", name, NULL);
+      gchar *contents;
+
+      if (g_file_get_contents (path, &contents, NULL, NULL))
+        {
+          const gchar *p = contents;
+
+          while ((p = strstr (p, "inotify wd:")) != NULL)
+            {
+              n++;
+              p++;
+            }
+          g_free (contents);
+        }
+      g_free (path);
+    }
+  g_dir_close (dir);
+
+  return n;
+}
+
+static guint
+get_max_watches (void)
+{
+  gchar *contents;
+  guint max = G_MAXUINT;
+
+  if (g_file_get_contents ("/proc/sys/fs/inotify/max_user_watches", &contents, NULL, NULL))
+    {
+      max = atoi (contents);
+      g_free (contents);
+    }
+
+  return max;
+}
+
+static void
+test_large_tree (void)
+{
+  Fixture f = { NULL, };
+  GError *error = NULL;
+  GPtrArray *monitors;
+  guint n_dirs = 100000;
+  guint max = get_max_watches ();
+  guint i, watches_before;
+  gsize rss_before;
+  gint64 start;
+  gdouble elapsed;
+
+  /* Leave room for the rest of the system */
+  if (max != G_MAXUINT && n_dirs > max - 1000)
+    n_dirs = max - 1000;
+
+  f.dir = g_strdup ("tree-monitor-XXXXXX");
+  g_assert (mkdtemp (f.dir) != NULL);
+  f.root = g_file_new_for_path (f.dir);
+
+  /* 100 subdirectories per directory */
+  for (i = 0; i < n_dirs; i++)
+    {
+      gchar *rel;
+      gchar *path;
+
+      if (i < 100)
+        rel = g_strdup_printf ("%u", i);
+      else
+        rel = g_strdup_printf ("%u/%u", i % 100, i);
+      path = make_path (&f, rel);
+      g_assert_cmpint (g_mkdir (path, 0755), ==, 0);
+      g_free (path);
+      g_free (rel);
+    }
+
+  watches_before = count_watches ();
+  rss_before = get_rss ();
+  start = g_get_monotonic_time ();
+
+  f.monitor = g_file_monitor_tree (f.root, G_FILE_MONITOR_NONE, NULL, &error);
+  g_assert_no_error (error);
+
+  elapsed = (g_get_monotonic_time () - start) / 1000000.0;
+  g_test_minimized_result (elapsed, "tree monitor: %u directories watched in %.2f s", n_dirs + 1, elapsed);
+  g_test_minimized_result (get_rss () - rss_before, "tree monitor: %lu bytes, %u watches",
+                           (gulong) (get_rss () - rss_before), count_watches () - watches_before);
+
+  /* The backend shares the watches of a path, so drop the tree first */
+  g_file_monitor_cancel (f.monitor);
+  g_object_unref (f.monitor);
+
+  /* The same tree with a directory monitor per directory */
+  monitors = g_ptr_array_new_with_free_func (g_object_unref);
+  watches_before = count_watches ();
+  rss_before = get_rss ();
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < n_dirs; i++)
+    {
+      gchar *rel;
+      GFile *file;
+
+      if (i < 100)
+        rel = g_strdup_printf ("%u", i);
+      else
+        rel = g_strdup_printf ("%u/%u", i % 100, i);
+      file = g_file_resolve_relative_path (f.root, rel);
+      g_ptr_array_add (monitors, g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL));
+      g_object_unref (file);
+      g_free (rel);
+    }
+  g_ptr_array_add (monitors, g_file_monitor_directory (f.root, G_FILE_MONITOR_NONE, NULL, NULL));
+
+  elapsed = (g_get_monotonic_time () - start) / 1000000.0;
+  g_test_minimized_result (elapsed, "directory monitors: %u directories watched in %.2f s", n_dirs + 1, elapsed);
+  g_test_minimized_result (get_rss () - rss_before, "directory monitors: %lu bytes, %u watches",
+                           (gulong) (get_rss () - rss_before), count_watches () - watches_before);
+
+  g_ptr_array_free (monitors, TRUE);
+  remove_tree (f.dir);
+  g_object_unref (f.root);
+  g_free (f.dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/tree-monitor/nested", Fixture, GUINT_TO_POINTER (G_FILE_MONITOR_NONE),
+              fixture_setup, test_nested, fixture_teardown);
+  g_test_add ("/tree-monitor/new-dir", Fixture, GUINT_TO_POINTER (G_FILE_MONITOR_NONE),
+              fixture_setup, test_new_dir, fixture_teardown);
+  g_test_add ("/tree-monitor/scan-on-add", Fixture, GUINT_TO_POINTER (G_FILE_MONITOR_SCAN_ON_ADD),
+              fixture_setup, test_scan_on_add, fixture_teardown);
+  g_test_add ("/tree-monitor/remove", Fixture, GUINT_TO_POINTER (G_FILE_MONITOR_NONE),
+              fixture_setup, test_remove, fixture_teardown);
+  g_test_add ("/tree-monitor/move-subtree", Fixture, GUINT_TO_POINTER (G_FILE_MONITOR_NONE),
+              fixture_setup, test_move_subtree, fixture_teardown);
+  g_test_add ("/tree-monitor/batched", Fixture, GUINT_TO_POINTER (G_FILE_MONITOR_NONE),
+              fixture_setup, test_batched, fixture_teardown);
+  g_test_add ("/tree-monitor/statistics", Fixture, GUINT_TO_POINTER (G_FILE_MONITOR_NONE),
+              fixture_setup, test_statistics, fixture_teardown);
+
+  if (g_test_perf ())
+    g_test_add_func ("/tree-monitor/large-tree", test_large_tree);
+
+  return g_test_run ();
+}